@@ -1,19 +1,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
 #include <sys/vmm.h>
 #include <const.h>
 
 int main(int argc, char **argv)
 {
-    if (argc > 1) {
-        fprintf(stderr,"free: no arguments support!\n");
+    int flags = 0;
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-c"))) {
+        fprintf(stderr,"usage: mem [-c]\n  -c  dump kernel memory cache statistics\n");
         return -1;
     }
+    if (argc == 2)
+        flags |= MSTATE_CACHES;
     mstate_t ms;
-    mstate(&ms);
+    xmstate(&ms, flags);
     printf("          TOTAL           USED           FREE\n");
     printf("%14xB%14xB%14xB\n", ms.ms_total, ms.ms_used, ms.ms_free);
     printf("%14dM%14dM%14dM\n", ms.ms_total / MB, ms.ms_used / MB, ms.ms_free / MB);
+    printf("largest free block: %dK, fragmentation: %d%%\n", ms.ms_largest / KB, ms.ms_frag);
     return 0;
 }
@@ -0,0 +1,131 @@
+#include "test.h"
+#include <sys/sys.h>
+
+#define DD_FILE_PATH    "/res/ddtest.bin"
+#define DD_FILE_SIZE    (1024 * 1024)
+#define DD_BUF_SIZE     (64 * 1024)
+
+static char dd_buf[DD_BUF_SIZE];
+
+/* 文件中每个字节的内容由它的偏移决定，每个扇区的内容都不同 */
+static char dd_pattern(int off)
+{
+    return (off ^ (off >> 9) ^ (off >> 15)) & 0xff;
+}
+
+static void dd_fill(char *buf, int off, int len)
+{
+    int i;
+    for (i = 0; i < len; i++)
+        buf[i] = dd_pattern(off + i);
+}
+
+/* 检查从off开始的len字节，返回第一个错误的偏移，没有错误返回-1 */
+static int dd_check(char *buf, int off, int len)
+{
+    int i;
+    for (i = 0; i < len; i++) {
+        if (buf[i] != dd_pattern(off + i))
+            return off + i;
+    }
+    return -1;
+}
+
+/* 以bs字节为块大小顺序读取整个文件，类似于dd if=file of=/dev/null bs=bs */
+static int dd_read(int bs)
+{
+    int fd = open(DD_FILE_PATH, O_RDONLY);
+    if (fd < 0) {
+        printf("dd: open %s failed!\n", DD_FILE_PATH);
+        return -1;
+    }
+    bstate_t bs0, bs1;
+    bstate(&bs0);
+    unsigned long start = test_msecond();
+    int total = 0, rd, bad = -1;
+    while ((rd = read(fd, dd_buf, bs)) > 0) {
+        if (bad < 0)
+            bad = dd_check(dd_buf, total, rd);
+        total += rd;
+    }
+    unsigned long ms = test_msecond() - start;
+    bstate(&bs1);
+    close(fd);
+    if (!ms)
+        ms = 1;
+    printf("dd: bs=%6d read %d bytes in %4d ms, %5d KB/s, cache hits %d misses %d\n",
+        bs, total, ms, (total / 1024) * 1000 / ms,
+        bs1.bs_hits - bs0.bs_hits, bs1.bs_misses - bs0.bs_misses);
+    if (bad >= 0) {
+        printf("dd: bs=%d data mismatch at offset %d!\n", bs, bad);
+        return -1;
+    }
+    return total == DD_FILE_SIZE ? 0 : -1;
+}
+
+/* 从跨越扇区、簇和预读窗口边界的位置读取，检查读到的数据 */
+static int dd_verify_seek()
+{
+    int fd = open(DD_FILE_PATH, O_RDONLY);
+    if (fd < 0) {
+        printf("dd: open %s failed!\n", DD_FILE_PATH);
+        return -1;
+    }
+    int off_table[] = {0, 511, 4000, 4095, 32767, 65535 - 700, 300000, DD_FILE_SIZE - 1000};
+    int i, off, bad;
+    for (i = 0; i < ARRAY_SIZE(off_table); i++) {
+        off = off_table[i];
+        if (lseek(fd, off, SEEK_SET) != off || read(fd, dd_buf, 1024) != 1024) {
+            printf("dd: read 1024 bytes at offset %d failed!\n", off);
+            close(fd);
+            return -1;
+        }
+        if ((bad = dd_check(dd_buf, off, 1024)) >= 0) {
+            printf("dd: data mismatch at offset %d!\n", bad);
+            close(fd);
+            return -1;
+        }
+    }
+    close(fd);
+    printf("dd: seek read check ok\n");
+    return 0;
+}
+
+int dd_test(int argc, char *argv[])
+{
+    int fd = open(DD_FILE_PATH, O_CREAT | O_RDWR);
+    if (fd < 0) {
+        printf("dd: create %s failed!\n", DD_FILE_PATH);
+        return -1;
+    }
+    int i;
+    unsigned long start = test_msecond();
+    for (i = 0; i < DD_FILE_SIZE / DD_BUF_SIZE; i++) {
+        dd_fill(dd_buf, i * DD_BUF_SIZE, DD_BUF_SIZE);
+        if (write(fd, dd_buf, DD_BUF_SIZE) != DD_BUF_SIZE) {
+            printf("dd: write failed!\n");
+            close(fd);
+            return -1;
+        }
+    }
+    fsync(fd);
+    close(fd);
+    unsigned long ms = test_msecond() - start;
+    printf("dd: write %d bytes in %d ms\n", DD_FILE_SIZE, ms ? ms : 1);
+
+    /* 不是扇区整数倍的块大小会让每次读取都跨越扇区边界 */
+    int bs_table[] = {512, 1000, 4096, 4097, 32 * 1024, DD_BUF_SIZE};
+    for (i = 0; i < ARRAY_SIZE(bs_table); i++) {
+        if (dd_read(bs_table[i]) < 0) {
+            printf("dd: read with bs=%d failed!\n", bs_table[i]);
+            break;
+        }
+    }
+    dd_verify_seek();
+    bstate_t bs;
+    if (!bstate(&bs))
+        printf("dd: block cache blocks %d used %d dirty %d writebacks %d\n",
+            bs.bs_blocks, bs.bs_used, bs.bs_dirty, bs.bs_writebacks);
+    unlink(DD_FILE_PATH);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "test.h"
+#include <sys/ioring.h>
+
+#define IORING_TEST_NR      32      /* 一批提交的请求数 */
+#define IORING_TEST_BATCH   8       /* 批次数 */
+#define IORING_TEST_SECTORS 8       /* 每个请求读取的扇区数 */
+#define IORING_TEST_BUFLEN  (IORING_TEST_SECTORS * 512)
+
+static char ioring_bufs[IORING_TEST_NR][IORING_TEST_BUFLEN];
+
+/* 一次提交多个读请求，再统一收割，磁盘设备的偏移是扇区号 */
+int ioring_test(int argc, char *argv[])
+{
+    char *devs[] = {"/dev/sda", "/dev/hda"};
+    int fd = -1, i, j;
+    for (i = 0; i < ARRAY_SIZE(devs); i++) {
+        fd = open(devs[i], O_RDONLY);
+        if (fd >= 0) {
+            printf("ioring: using %s\n", devs[i]);
+            break;
+        }
+    }
+    if (fd < 0) {
+        printf("ioring: no disk device!\n");
+        return -1;
+    }
+    iocb_t iocbs[IORING_TEST_NR];
+    ioevent_t events[IORING_TEST_NR];
+    unsigned long bytes = 0;
+    int errors = 0;
+    unsigned long start = test_msecond();
+    for (j = 0; j < IORING_TEST_BATCH; j++) {
+        for (i = 0; i < IORING_TEST_NR; i++) {
+            iocbs[i].fd = fd;
+            iocbs[i].opcode = IOCB_CMD_READ;
+            iocbs[i].buf = ioring_bufs[i];
+            iocbs[i].length = IORING_TEST_BUFLEN;
+            iocbs[i].offset = (j * IORING_TEST_NR + i) * IORING_TEST_SECTORS;
+            iocbs[i].user_data = i;
+        }
+        int submitted = io_submit(iocbs, IORING_TEST_NR);
+        if (submitted <= 0) {
+            printf("ioring: submit failed, errno=%d\n", errno);
+            close(fd);
+            return -1;
+        }
+        int reaped = 0;
+        while (reaped < submitted) {
+            int n = io_getevents(events, 1, IORING_TEST_NR);
+            if (n <= 0)
+                break;
+            for (i = 0; i < n; i++) {
+                if (events[i].result < 0)
+                    errors++;
+                else
+                    bytes += events[i].result;
+            }
+            reaped += n;
+        }
+    }
+    unsigned long ms = test_msecond() - start;
+    if (!ms)
+        ms = 1;
+    printf("ioring: %d requests, read %d bytes in %d ms, %d KB/s, %d errors\n",
+        IORING_TEST_NR * IORING_TEST_BATCH, bytes, ms, (bytes / 1024) * 1000 / ms, errors);
+    close(fd);
+    return errors ? -1 : 0;
+}
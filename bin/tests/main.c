@@ -17,13 +17,18 @@ testfunc_t test_table[] = {
     {"port_comm3", port_comm_test3},
     {"pipe", pipe_test},
     {"shm", shm_test},
+    {"mmap", mmap_test},
+    {"mmap_file", mmap_file_test},
     {"xlibc", xlibc_test},
     {"math", math_test},
     {"pyt", pty_test},
     {"sleep", sleep_test},
+    {"timer_bench", timer_bench},
+    {"clock_bench", clock_bench},
     {"exp", exp_test},
     {"fifo", fifo_test},
     {"sys", sys_test},
+    {"copy_bench", copy_bench},
     {"pthread", pthread_test},
     {"file", file_test},
     {"file2", file_test2},
@@ -36,7 +41,9 @@ testfunc_t test_table[] = {
     {"video", video_test},
     {"signal", signal_test},
     {"proc", proc_test},
+    {"fork_bench", fork_bench},
     {"port_comm", port_comm_test},
+    {"port_bench", port_comm_bench},
     {"file3", file_test3},
     {"fcntl", fcntl_test},
     {"tty", tty_test},
@@ -47,6 +54,13 @@ testfunc_t test_table[] = {
     {"sound", sound_test},
     {"file5", file_test5},
     {"file6", file_test6},
+    {"dd", dd_test},
+    {"ioring", ioring_test},
+    {"sched", sched_test},
+    {"netpps", netpps_test},
+    {"netrx", netrx_test},
+    {"netstat", netstat_test},
+    {"smp", smp_test},
 };
 
 int main(int argc, char *argv[])
@@ -57,7 +71,7 @@ int main(int argc, char *argv[])
     if (argc == 1) {
         retval = test_table[0].func(argc, argv);  
         printf("\ntest %s demo done.\n", test_table[0].name);
-    } else if (argc == 2) {
+    } else {    /* 测试名后面的参数由测试自己解析 */
         char *p = argv[1];
         int i;
         for (i = 0; i < ARRAY_SIZE(test_table); i++)
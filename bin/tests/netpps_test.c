@@ -0,0 +1,202 @@
+#include "test.h"
+
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+
+#define NETPPS_DEST_IP      "192.168.0.104"
+#define NETPPS_PORT         8081
+#define NETPPS_COUNT        10000
+#define NETPPS_PKT_MAX      1472    /* 以太网MTU减去IP和UDP头 */
+
+static char netpps_buf[NETPPS_PKT_MAX];
+
+/* 以固定大小的UDP包连续发送，统计每秒发送的包数和吞吐量 */
+static int netpps_send(int fd, struct sockaddr_in *addr, int size, int count)
+{
+    int i, sent = 0;
+    unsigned long start = test_msecond();
+    for (i = 0; i < count; i++) {
+        if (sendto(fd, netpps_buf, size, 0, (struct sockaddr *)addr,
+            sizeof(struct sockaddr_in)) == size)
+            sent++;
+    }
+    unsigned long ms = test_msecond() - start;
+    if (!ms)
+        ms = 1;
+    printf("netpps: size=%4d sent %d/%d in %5d ms, %6d pps, %6d KB/s\n",
+        size, sent, count, ms, sent * 1000 / ms, sent * size / 1024 * 1000 / ms);
+    return sent ? 0 : -1;
+}
+
+/**
+ * 网络发包测试：netpps [ip] [count]
+ * 分别用小包和大包测试网卡发送路径的包率
+ */
+int netpps_test(int argc, char *argv[])
+{
+    char *ip = test_arg_str(argc, argv, 1, NETPPS_DEST_IP);
+    int count = test_arg_int(argc, argv, 2, NETPPS_COUNT);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        printf("netpps: create socket failed!\n");
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_addr.s_addr = inet_addr(ip);
+    addr.sin_port = htons(NETPPS_PORT);
+    addr.sin_family = AF_INET;
+    addr.sin_len = sizeof(struct sockaddr_in);
+
+    memset(netpps_buf, 0x5a, NETPPS_PKT_MAX);
+    printf("netpps: send %d packets to %s:%d\n", count, ip, NETPPS_PORT);
+    int retval = 0;
+    if (netpps_send(fd, &addr, 18, count) < 0)    /* 最小以太网帧 */
+        retval = -1;
+    if (netpps_send(fd, &addr, 512, count) < 0)
+        retval = -1;
+    if (netpps_send(fd, &addr, NETPPS_PKT_MAX, count) < 0)
+        retval = -1;
+    close(fd);
+    return retval;
+}
+
+/**
+ * 网卡中断和轮询统计：netstat [dev]
+ * 在发包测试前后各看一次，数据包多时轮询次数应该明显多于中断次数
+ */
+int netstat_test(int argc, char *argv[])
+{
+    char *devs[] = {"e1000", "rtl8139", "pcnet32"};
+    char path[32];
+    netdev_stat_t stat;
+    char *dev = test_arg_str(argc, argv, 1, NULL);
+    int i, found = 0;
+    for (i = 0; i < sizeof(devs) / sizeof(devs[0]); i++) {
+        if (dev && strcmp(dev, devs[i]))
+            continue;
+        sprintf(path, "/dev/%s", devs[i]);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0)
+            continue;
+        if (ioctl(fd, NETIO_GETSTAT, &stat) < 0) {
+            printf("netstat: %s get stat failed!\n", devs[i]);
+            close(fd);
+            continue;
+        }
+        printf("%s: irqs %d polls %d packets %d drops %d squeezed %d\n", devs[i],
+            stat.irqs, stat.polls, stat.packets, stat.drops, stat.squeezed);
+        close(fd);
+        found++;
+    }
+    if (!found) {
+        printf("netstat: no netcard found!\n");
+        return -1;
+    }
+    return 0;
+}
+
+#define NETRX_ICMP_PROTO    1
+#define NETRX_ICMP_ECHOREPLY    0
+#define NETRX_ICMP_UNREACH      3
+#define NETRX_ICMP_ECHO         8
+#define NETRX_CLOSED_PORT   33434   /* traceroute使用的端口，一般没有程序监听 */
+#define NETRX_WAIT_SECOND   20
+
+static unsigned short netrx_cksum(unsigned char *data, int len)
+{
+    unsigned long sum = 0;
+    for (; len > 1; len -= 2, data += 2)
+        sum += *(unsigned short *)data;
+    if (len)
+        sum += *data;
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += sum >> 16;
+    return ~sum;
+}
+
+/* 在原始套接字上等待一个ICMP包，返回ICMP类型，超时返回-1 */
+static int netrx_recv_icmp(int fd, int ms)
+{
+    unsigned char buf[1500];
+    struct timeval tv;
+    fd_set rdfds;
+    FD_ZERO(&rdfds);
+    FD_SET(fd, &rdfds);
+    tv.tv_sec = ms / 1000;
+    tv.tv_usec = (ms % 1000) * 1000;
+    if (select(fd + 1, &rdfds, NULL, NULL, &tv) <= 0)
+        return -1;
+    int len = recv(fd, buf, sizeof(buf), 0);
+    if (len <= 0)
+        return -1;
+    int hlen = (buf[0] & 0x0f) * 4;     /* 原始套接字收到的包带有IP头部 */
+    if (len <= hlen)
+        return -1;
+    return buf[hlen];
+}
+
+/**
+ * 网卡接收路径测试：netrx [ip]
+ * 回显请求和发往关闭端口的UDP包都需要协议栈在网卡的接收缓冲区中把payload移回IP头部。
+ * 先向对端发送回显请求和发往关闭端口的UDP包，等待回显应答和端口不可达，
+ * 再等待对端ping本机并向本机关闭的UDP端口发包，期间系统应该正常响应。
+ */
+int netrx_test(int argc, char *argv[])
+{
+    char *ip = test_arg_str(argc, argv, 1, NETPPS_DEST_IP);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(struct sockaddr_in));
+    addr.sin_addr.s_addr = inet_addr(ip);
+    addr.sin_family = AF_INET;
+    addr.sin_len = sizeof(struct sockaddr_in);
+
+    int rawfd = socket(AF_INET, SOCK_RAW, NETRX_ICMP_PROTO);
+    if (rawfd < 0) {
+        printf("netrx: create raw socket failed!\n");
+        return -1;
+    }
+    int udpfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (udpfd < 0) {
+        printf("netrx: create udp socket failed!\n");
+        close(rawfd);
+        return -1;
+    }
+    int retval = 0, type;
+    unsigned char pkt[64];
+    memset(pkt, 0x5a, sizeof(pkt));
+    pkt[0] = NETRX_ICMP_ECHO;
+    pkt[1] = 0;
+    pkt[2] = pkt[3] = 0;
+    *(unsigned short *)&pkt[4] = htons(getpid());
+    *(unsigned short *)&pkt[6] = htons(1);
+    *(unsigned short *)&pkt[2] = netrx_cksum(pkt, sizeof(pkt));
+    sendto(rawfd, pkt, sizeof(pkt), 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+    while ((type = netrx_recv_icmp(rawfd, 2000)) >= 0 && type != NETRX_ICMP_ECHOREPLY);
+    printf("netrx: echo reply from %s %s\n", ip, type >= 0 ? "ok" : "timeout");
+    if (type < 0)
+        retval = -1;
+
+    addr.sin_port = htons(NETRX_CLOSED_PORT);
+    sendto(udpfd, pkt, sizeof(pkt), 0, (struct sockaddr *)&addr, sizeof(struct sockaddr_in));
+    while ((type = netrx_recv_icmp(rawfd, 2000)) >= 0 && type != NETRX_ICMP_UNREACH);
+    printf("netrx: port unreachable from %s %s\n", ip, type >= 0 ? "ok" : "timeout");
+    if (type < 0)
+        retval = -1;
+
+    printf("netrx: run 'ping <this host>' and 'nc -u <this host> %d' on %s in %d seconds\n",
+        NETRX_CLOSED_PORT, ip, NETRX_WAIT_SECOND);
+    int echos = 0;
+    unsigned long end = test_msecond() + NETRX_WAIT_SECOND * 1000;
+    while (test_msecond() < end) {
+        if (netrx_recv_icmp(rawfd, 1000) == NETRX_ICMP_ECHO)
+            echos++;
+    }
+    printf("netrx: received %d echo requests, system still alive\n", echos);
+    close(udpfd);
+    close(rawfd);
+    return retval;
+}
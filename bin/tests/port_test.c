@@ -185,4 +185,61 @@ int port_comm_test3(int argc, char *argv[])
     bind_server2();
     bind_client2();
     return 0;
-}
\ No newline at end of file
+}
+
+#define PORT_BENCH_COUNT    10000
+
+/* 客户端连续请求count次，统计一次请求和应答的往返延迟 */
+static void port_bench_client(int size, int count)
+{
+    port_msg_t msg;
+    int i, ok = 0;
+    unsigned long start = test_msecond();
+    for (i = 0; i < count; i++) {
+        msg.header.size = PORT_MSG_HEADER_SIZE + size;
+        if (!request_port(SERV_PORT, &msg))
+            ok++;
+    }
+    unsigned long ms = test_msecond() - start;
+    if (!ms)
+        ms = 1;
+    printf("port bench: size=%4d %d/%d round trips in %5d ms, %6d us/rtt, %6d rtt/s\n",
+        size, ok, count, ms, ms * 1000 / count, ok * 1000 / ms);
+}
+
+/**
+ * 端口通信的往返延迟测试：port_bench [count]
+ * 服务端收到请求后原样应答，分别测试小消息和整页消息
+ */
+int port_comm_bench(int argc, char *argv[])
+{
+    int count = test_arg_int(argc, argv, 1, PORT_BENCH_COUNT);
+    if (bind_port(SERV_PORT, 0) < 0) {
+        printf("port bench: bind port %d failed!\n", SERV_PORT);
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("fork failed!\n");
+        return -1;
+    }
+    port_msg_t msg;
+    if (pid > 0) {
+        int total = count * 2;
+        while (total > 0) {
+            if (receive_port(SERV_PORT, &msg) < 0)
+                continue;
+            reply_port(SERV_PORT, &msg);
+            total--;
+        }
+        waitpid(pid, NULL, 0);
+        unbind_port(SERV_PORT);
+    } else {
+        bind_port(CLIENT_PORT, 0);
+        memset(&msg, 0, sizeof(port_msg_t));
+        port_bench_client(16, count);
+        port_bench_client(PORT_MSG_SIZE, count);
+        exit(0);
+    }
+    return 0;
+}
@@ -32,3 +32,69 @@ int proc_test(int argc, char *argv[])
     
     return 0;
 }
+
+#define FORK_BENCH_ROUNDS   200
+#define FORK_BENCH_MAX      128
+
+/* 测一轮fork+exit+waitpid的平均微秒数 */
+static unsigned long fork_bench_round(int rounds)
+{
+    int i, status;
+    unsigned long start = test_usecond();
+    for (i = 0; i < rounds; i++) {
+        pid_t pid = fork();
+        if (pid < 0)
+            return 0;
+        if (!pid)
+            exit(0);
+        waitpid(pid, &status, 0);
+    }
+    return (test_usecond() - start) / rounds;
+}
+
+/**
+ * 进程创建和回收的延迟测试：fork_bench [max]
+ * 先创建一批阻塞在管道上的后台子进程增加任务数，再测fork+exit+waitpid的延迟，
+ * 查找pid和回收子进程不再遍历所有任务，延迟应该不随任务数增加
+ */
+int fork_bench(int argc, char *argv[])
+{
+    int max = test_arg_int(argc, argv, 1, FORK_BENCH_MAX);
+    int fd[2];
+    if (pipe(fd) < 0) {
+        printf("fork bench: create pipe failed\n");
+        return -1;
+    }
+    pid_t *idle = malloc(sizeof(pid_t) * max);
+    if (!idle) {
+        close(fd[0]);
+        close(fd[1]);
+        return -1;
+    }
+    int nr = 0, level;
+    char ch;
+    for (level = 0; level <= max; level = level ? level * 2 : 16) {
+        while (nr < level) {
+            pid_t pid = fork();
+            if (pid < 0)
+                break;
+            if (!pid) {
+                close(fd[1]);
+                read(fd[0], &ch, 1);    /* 父进程关闭管道后退出 */
+                exit(0);
+            }
+            idle[nr++] = pid;
+        }
+        printf("fork bench: %d idle tasks, %d us per fork/exit/wait\n",
+            nr, fork_bench_round(FORK_BENCH_ROUNDS));
+        if (nr < level)
+            break;
+    }
+    close(fd[0]);
+    close(fd[1]);
+    int i, status;
+    for (i = 0; i < nr; i++)
+        waitpid(idle[i], &status, 0);
+    free(idle);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "test.h"
+#include <sys/proc.h>
+#include <sys/wait.h>
+
+#define SCHED_YIELD_LOOPS   10000
+#define SCHED_PINGPONG_LOOPS    10000
+
+/* 平均每次的纳秒数，避免乘1000后溢出 */
+static unsigned long sched_ns_per(unsigned long us, unsigned long count)
+{
+    if (!count)
+        return 0;
+    return us / count * 1000 + us % count * 1000 / count;
+}
+
+/* 两个进程轮流让出cpu，每次让出都是一次上下文切换 */
+static int sched_yield_bench()
+{
+    int i;
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("sched: fork failed!\n");
+        return -1;
+    }
+    if (!pid) {
+        for (i = 0; i < SCHED_YIELD_LOOPS; i++)
+            sched_yield();
+        exit(0);
+    }
+    unsigned long start = test_usecond();
+    for (i = 0; i < SCHED_YIELD_LOOPS; i++)
+        sched_yield();
+    unsigned long us = test_usecond() - start;
+    waitpid(pid, NULL, 0);
+    printf("sched: yield %d loops in %d us, %d ns per switch\n",
+        SCHED_YIELD_LOOPS, us, sched_ns_per(us, SCHED_YIELD_LOOPS * 2));
+    return 0;
+}
+
+/* 通过两个管道传递一个字节，一次往返包含两次阻塞唤醒和两次上下文切换 */
+static int sched_pingpong_bench()
+{
+    int ping[2], pong[2];
+    char c = 0;
+    int i;
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        printf("sched: create pipe failed!\n");
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        printf("sched: fork failed!\n");
+        return -1;
+    }
+    if (!pid) {
+        close(ping[1]);
+        close(pong[0]);
+        for (i = 0; i < SCHED_PINGPONG_LOOPS; i++) {
+            if (read(ping[0], &c, 1) != 1)
+                break;
+            write(pong[1], &c, 1);
+        }
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+    unsigned long start = test_usecond();
+    for (i = 0; i < SCHED_PINGPONG_LOOPS; i++) {
+        write(ping[1], &c, 1);
+        if (read(pong[0], &c, 1) != 1) {
+            printf("sched: pingpong read failed!\n");
+            break;
+        }
+    }
+    unsigned long us = test_usecond() - start;
+    close(ping[1]);
+    close(pong[0]);
+    waitpid(pid, NULL, 0);
+    printf("sched: pingpong %d round trips in %d us, %d ns per switch\n",
+        i, us, sched_ns_per(us, i * 2));
+    return 0;
+}
+
+int sched_test(int argc, char *argv[])
+{
+    if (sched_yield_bench() < 0)
+        return -1;
+    return sched_pingpong_bench();
+}
@@ -1,6 +1,7 @@
 #include "test.h"
 
 #include <sys/ipc.h>
+#include <sys/mman.h>
 
 int shm_test(int argc, char *argv[])
 {
@@ -34,4 +35,152 @@ int shm_test(int argc, char *argv[])
         exit(1234);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+#define MMAP_TEST_SLACK (256 * 1024)    /* 页表和其它任务带来的内存用量波动 */
+
+/**
+ * 匿名映射的测试：映射一大片空间只占用地址，访问到的页才分配物理内存，并且是清零的，
+ * 页不是清零的或者没有访问的页也占用了内存时返回失败
+ */
+int mmap_test(int argc, char *argv[])
+{
+    printf("----mmap test----\n");
+    size_t len = 64 * 1024 * 1024;
+    size_t touch = 1024 * 1024;
+    mstate_t ms0, ms1, ms2;
+    mstate(&ms0);
+    unsigned char *addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (!addr) {
+        printf("mmap failed!\n");
+        return -1;
+    }
+    mstate(&ms1);
+    long used = (long) ms0.ms_free - (long) ms1.ms_free;
+    printf("map %d MB at %x, used %d KB\n", len / (1024 * 1024), addr, used / 1024);
+    if (used > MMAP_TEST_SLACK) {
+        printf("mapping without touch used memory!\n");
+        munmap(addr, len);
+        return -1;
+    }
+    size_t i;
+    for (i = 0; i < touch; i++) {
+        if (addr[i]) {
+            printf("page not zero at %x!\n", addr + i);
+            munmap(addr, len);
+            return -1;
+        }
+        addr[i] = i;
+    }
+    if (addr[len - 1]) {    /* 最后一页 */
+        printf("last page not zero!\n");
+        munmap(addr, len);
+        return -1;
+    }
+    addr[len - 1] = 1;
+    mstate(&ms2);
+    used = (long) ms0.ms_free - (long) ms2.ms_free;
+    printf("touch %d KB, used %d KB\n", touch / 1024 + 4, used / 1024);
+    munmap(addr, len);
+    /* 只有访问过的页占用内存 */
+    if (used > (long) touch + 4096 + MMAP_TEST_SLACK) {
+        printf("untouched pages used memory!\n");
+        return -1;
+    }
+    return 0;
+}
+
+#define MMAP_FILE_PATH  "/res/mmap.txt"
+#define MMAP_FILE_SIZE  (4096 * 2 + 100)
+
+/* 用read读出整个文件 */
+static int mmap_file_read(int fd, char *buf)
+{
+    memset(buf, 0, MMAP_FILE_SIZE);
+    lseek(fd, 0, SEEK_SET);
+    return read(fd, buf, MMAP_FILE_SIZE) == MMAP_FILE_SIZE ? 0 : -1;
+}
+
+/**
+ * 文件映射的测试：映射的内容和read读到的一致，共享映射的写入能写回文件，
+ * 私有映射的写入不影响文件，不一致时返回失败
+ */
+int mmap_file_test(int argc, char *argv[])
+{
+    printf("----mmap file test----\n");
+    static char buf[MMAP_FILE_SIZE];
+    int i, ret = -1;
+    for (i = 0; i < MMAP_FILE_SIZE; i++)
+        buf[i] = 'a' + i % 26;
+    int fd = open(MMAP_FILE_PATH, O_CREAT | O_RDWR | O_TRUNC);
+    if (fd < 0) {
+        printf("open %s failed!\n", MMAP_FILE_PATH);
+        return -1;
+    }
+    if (write(fd, buf, MMAP_FILE_SIZE) != MMAP_FILE_SIZE) {
+        printf("write %s failed!\n", MMAP_FILE_PATH);
+        close(fd);
+        return -1;
+    }
+    char *shared = mmap(NULL, MMAP_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    char *private = mmap(NULL, MMAP_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (!shared || !private) {
+        printf("mmap file failed!\n");
+        close(fd);
+        return -1;
+    }
+    if (mmap_file_read(fd, buf) < 0) {
+        printf("read %s failed!\n", MMAP_FILE_PATH);
+        goto out;
+    }
+    if (memcmp(shared, buf, MMAP_FILE_SIZE) || memcmp(private, buf, MMAP_FILE_SIZE)) {
+        printf("mapped data not same as file!\n");
+        goto out;
+    }
+    if (shared[MMAP_FILE_SIZE] != 0) {
+        printf("data after end of file not zero!\n");
+        goto out;
+    }
+    /* 私有映射写入时复制，不影响文件和共享映射 */
+    private[0] = 'P';
+    /* 子进程通过共享映射写入，父进程可以看到 */
+    int pid = fork();
+    if (pid == 0) {
+        shared[4096] = 'C';
+        exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    shared[1] = 'S';
+    if (msync(shared, MMAP_FILE_SIZE, MS_SYNC) < 0) {
+        printf("msync failed!\n");
+        goto out;
+    }
+    /* write写入的数据在映射中也能看到 */
+    lseek(fd, 2, SEEK_SET);
+    write(fd, "W", 1);
+    if (mmap_file_read(fd, buf) < 0) {
+        printf("read %s failed!\n", MMAP_FILE_PATH);
+        goto out;
+    }
+    printf("file: %c%c%c, shared: %c%c%c, private: %c%c%c, child: %c\n",
+        buf[0], buf[1], buf[2], shared[0], shared[1], shared[2],
+        private[0], private[1], private[2], shared[4096]);
+    if (buf[0] != 'a' || buf[1] != 'S' || buf[2] != 'W' || buf[4096] != 'C') {
+        printf("shared write not in file!\n");
+        goto out;
+    }
+    if (memcmp(shared, buf, MMAP_FILE_SIZE)) {
+        printf("shared mapping not same as file!\n");
+        goto out;
+    }
+    if (private[0] != 'P') {
+        printf("private write lost!\n");
+        goto out;
+    }
+    ret = 0;
+out:
+    munmap(private, MMAP_FILE_SIZE);
+    munmap(shared, MMAP_FILE_SIZE);
+    close(fd);
+    return ret;
+}
@@ -1,4 +1,7 @@
 #include "test.h"
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/syscall.h>
 
 int sleep_test(int argc, char *argv[])
 {
@@ -12,5 +15,100 @@ int sleep_test(int argc, char *argv[])
         perror("sleep err:");
 
     printf("usleep done.");
+
+    /* 不到一个节拍的休眠，统计平均的实际休眠时间 */
+    struct timespec req = {0, 200 * 1000};
+    int i;
+    unsigned long start = test_usecond();
+    for (i = 0; i < 100; i++)
+        nanosleep(&req, NULL);
+    unsigned long us = test_usecond() - start;
+    printf("nanosleep 200us: %d us on average.\n", us / 100);
     return 0;
-}
\ No newline at end of file
+}
+
+#define TIMER_BENCH_COUNT   10000
+#define TIMER_BENCH_EARLY   10      /* 闹钟最多提前的毫秒数，一个节拍以内 */
+#define TIMER_BENCH_LATE    100     /* 闹钟最多推迟的毫秒数 */
+
+static volatile unsigned long timer_bench_fired = 0;
+
+static void timer_bench_handler(int signo)
+{
+    timer_bench_fired = test_msecond();
+}
+
+/**
+ * 定时器的添加和取消测试：timer_bench [count]
+ * 用alarm添加count个不同超时的定时器后马上取消，超时值覆盖时间轮的每一层，
+ * 最后检查闹钟仍然会在1秒左右触发，剩余时间不对、闹钟丢失或者不准时返回失败
+ */
+int timer_bench(int argc, char *argv[])
+{
+    int count = test_arg_int(argc, argv, 1, TIMER_BENCH_COUNT);
+    int i, bad = 0;
+    unsigned long start = test_msecond();
+    for (i = 0; i < count; i++) {
+        unsigned long second = 1 + (i * 37) % 100000;
+        alarm(second);
+        if (alarm(0) != second)
+            bad++;
+    }
+    unsigned long ms = test_msecond() - start;
+    if (!ms)
+        ms = 1;
+    printf("timer bench: %d arm/cancel pairs in %d ms, %d us/pair, %d bad remain\n",
+        count, ms, ms * 1000 / count, bad);
+
+    signal(SIGALRM, timer_bench_handler);
+    start = test_msecond();
+    alarm(1);
+    while (!timer_bench_fired && test_msecond() - start < 3000)
+        usleep(10000);
+    signal(SIGALRM, SIG_DFL);
+    if (!timer_bench_fired) {
+        printf("timer bench: alarm lost after %d ms\n", test_msecond() - start);
+        return -1;
+    }
+    ms = timer_bench_fired - start;
+    printf("timer bench: alarm fired after %d ms\n", ms);
+    if (ms + TIMER_BENCH_EARLY < 1000 || ms > 1000 + TIMER_BENCH_LATE) {
+        printf("timer bench: alarm out of [%d, %d] ms!\n",
+            1000 - TIMER_BENCH_EARLY, 1000 + TIMER_BENCH_LATE);
+        return -1;
+    }
+    return bad ? -1 : 0;
+}
+
+#define CLOCK_BENCH_COUNT   1000000
+
+/**
+ * 读时间的开销测试：clock_bench [count]
+ * 连续调用count次clock_gettime，统计平均开销，检查单调时钟没有倒退，
+ * 再和系统调用读到的时间比较，时钟倒退时返回失败
+ */
+int clock_bench(int argc, char *argv[])
+{
+    int count = test_arg_int(argc, argv, 1, CLOCK_BENCH_COUNT);
+    struct timespec start, prev, now;
+    int i, back = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    prev = start;
+    for (i = 0; i < count; i++) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec < prev.tv_sec ||
+            (now.tv_sec == prev.tv_sec && now.tv_nsec < prev.tv_nsec))
+            back++;
+        prev = now;
+    }
+    long us = (now.tv_sec - start.tv_sec) * 1000000L + (now.tv_nsec - start.tv_nsec) / 1000;
+    printf("clock bench: %d calls in %d us, %d ns/call, %d went backwards\n",
+        count, us, (us / count) * 1000 + (us % count) * 1000 / count, back);
+
+    struct timespec sys;
+    clock_gettime(CLOCK_REALTIME, &now);
+    syscall2(int, SYS_CLOCK_GETTIME, CLOCK_REALTIME, &sys);
+    printf("clock bench: realtime %d.%d, syscall %d.%d\n",
+        now.tv_sec, now.tv_nsec, sys.tv_sec, sys.tv_nsec);
+    return back ? -1 : 0;
+}
@@ -0,0 +1,151 @@
+#include "test.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SMP_TEST_THREADS    4       /* 读页的线程数 */
+#define SMP_TEST_ROUNDS     2000    /* 映射和撤销的轮数 */
+#define SMP_TEST_LOAD       8       /* 计算进程数 */
+#define SMP_TEST_WORK       2000000 /* 每个计算进程的循环次数 */
+#define SMP_TEST_FORK_EVERY 16      /* 每隔多少轮fork一次，让后续写入触发写时复制 */
+
+#define SMP_PAGE_WORDS      (4096 / sizeof(unsigned long))
+
+static volatile unsigned long *smp_page;    /* 本轮映射的页 */
+static volatile unsigned long smp_round;    /* 本轮的序号，页中的每个字都是这个值 */
+static volatile int smp_seen;               /* 检查过本轮的线程数 */
+static volatile int smp_bad;
+static volatile int smp_stop;
+static pthread_mutex_t smp_mutex;
+
+/**
+ * 每轮检查一次主线程新映射的页。主线程撤销旧页后又在同一个地址映射新页，
+ * 如果这个cpu的TLB没有被刷新，就会读到旧页的内容
+ */
+static void *smp_reader(void *arg)
+{
+    unsigned long last = 0, round;
+    volatile unsigned long *page;
+    int i;
+    while (!smp_stop) {
+        round = smp_round;
+        if (round == last) {
+            sched_yield();
+            continue;
+        }
+        page = smp_page;
+        for (i = 0; i < SMP_PAGE_WORDS; i++) {
+            if (page[i] != round) {
+                pthread_mutex_lock(&smp_mutex);
+                smp_bad++;
+                pthread_mutex_unlock(&smp_mutex);
+                break;
+            }
+        }
+        last = round;
+        pthread_mutex_lock(&smp_mutex);
+        smp_seen++;
+        pthread_mutex_unlock(&smp_mutex);
+    }
+    return NULL;
+}
+
+/* 整数和浮点混合的计算，迁移时寄存器或者浮点状态出错会改变结果 */
+static unsigned long smp_work(int count)
+{
+    unsigned long sum = 0;
+    double f = 1.0;
+    int i;
+    for (i = 0; i < count; i++) {
+        sum = sum * 31 + i;
+        f = f * 1.000001 + 0.5;
+        if (f > 1000000.0)
+            f /= 3.0;
+    }
+    return sum ^ (unsigned long) f;
+}
+
+/* 主线程在同一个地址反复映射和撤销页，其它cpu上的线程同时读，撤销时需要刷新它们的TLB */
+static int smp_shootdown_test(int threads, int rounds)
+{
+    pthread_t tids[SMP_TEST_THREADS];
+    unsigned long r;
+    int i, nr = 0;
+    pthread_mutex_init(&smp_mutex, NULL);
+    for (i = 0; i < threads && i < SMP_TEST_THREADS; i++) {
+        if (pthread_create(&tids[nr], NULL, smp_reader, NULL) < 0) {
+            printf("smp: create thread failed!\n");
+            break;
+        }
+        nr++;
+    }
+    unsigned long start = test_msecond();
+    for (r = 1; r <= rounds && nr > 0; r++) {
+        if (!(r % SMP_TEST_FORK_EVERY)) {
+            pid_t pid = fork();
+            if (!pid)
+                exit(0);
+            if (pid > 0)
+                waitpid(pid, NULL, 0);
+        }
+        unsigned long *page = mmap(NULL, 4096, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (!page || page == (void *) -1) {
+            printf("smp: mmap failed!\n");
+            smp_bad++;
+            break;
+        }
+        for (i = 0; i < SMP_PAGE_WORDS; i++)
+            page[i] = r;
+        smp_page = page;
+        smp_seen = 0;
+        smp_round = r;
+        while (smp_seen < nr)
+            sched_yield();
+        smp_page = NULL;
+        munmap(page, 4096);
+    }
+    unsigned long ms = test_msecond() - start;
+    smp_stop = 1;
+    for (i = 0; i < nr; i++)
+        pthread_join(tids[i], NULL);
+    printf("smp: %d rounds with %d threads in %d ms, %d stale reads\n",
+        r - 1, nr, ms, smp_bad);
+    return (nr > 0 && !smp_bad) ? 0 : -1;
+}
+
+/**
+ * 多处理器测试：smp [threads] [rounds]
+ * 先创建一批计算进程让调度单元之间负载不均，各cpu做负载均衡时迁移它们，
+ * 同时测试TLB刷新，最后检查计算进程的结果都正确
+ */
+int smp_test(int argc, char *argv[])
+{
+    int threads = test_arg_int(argc, argv, 1, SMP_TEST_THREADS);
+    int rounds = test_arg_int(argc, argv, 2, SMP_TEST_ROUNDS);
+    unsigned long expect = smp_work(SMP_TEST_WORK);
+    pid_t pids[SMP_TEST_LOAD];
+    int i, nr = 0, failed = 0, status;
+    for (i = 0; i < SMP_TEST_LOAD; i++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            printf("smp: fork failed!\n");
+            failed++;
+            break;
+        }
+        if (!pid)
+            exit(smp_work(SMP_TEST_WORK) == expect ? 0 : 1);
+        pids[nr++] = pid;
+    }
+    if (smp_shootdown_test(threads, rounds) < 0)
+        failed++;
+    for (i = 0; i < nr; i++) {
+        status = -1;
+        if (waitpid(pids[i], &status, 0) < 0 || status) {
+            printf("smp: load process %d failed with %d!\n", pids[i], status);
+            failed++;
+        }
+    }
+    printf("smp: %d load processes done, %s\n", nr, failed ? "failed" : "ok");
+    return failed ? -1 : 0;
+}
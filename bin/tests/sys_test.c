@@ -23,5 +23,45 @@ int sys_test(int argc, char *argv[])
     clock_gettime(CLOCK_MONOTONIC, &ts);
     printf("nsecond: %d\n", ts.tv_sec * 1000000 + ts.tv_nsec);
 
+    return 0;
+}
+
+#define COPY_BENCH_COUNT    100000
+
+/**
+ * 系统调用复制用户数据的开销测试：copy_bench [count]
+ * tstate每次从用户读取序号，再把任务状态和序号写回用户，
+ * 最后检查传入无效地址时返回错误，进程不会收到信号，没有返回错误时测试失败。
+ */
+int copy_bench(int argc, char *argv[])
+{
+    int count = test_arg_int(argc, argv, 1, COPY_BENCH_COUNT);
+    tstate_t ts;
+    int i, idx;
+    unsigned long start = test_usecond();
+    for (i = 0; i < count; i++) {
+        idx = 0;
+        if (tstate(&ts, &idx) < 0) {
+            printf("copy bench: tstate failed!\n");
+            return -1;
+        }
+    }
+    unsigned long us = test_usecond() - start;
+    printf("copy bench: %d calls in %d us, %d ns/call, %d bytes copied per call\n",
+        count, us, (us / count) * 1000 + (us % count) * 1000 / count,
+        sizeof(tstate_t) + sizeof(int) * 2);
+
+    int bad, unmapped, badidx;
+    idx = 0;
+    bad = tstate((tstate_t *) 0x10, &idx);
+    idx = 0;
+    unmapped = tstate((tstate_t *) 0x90000000, &idx);
+    badidx = tstate(&ts, (int *) 0x90000000);
+    printf("copy bench: bad user address %d, unmapped address %d, unmapped index %d\n",
+        bad, unmapped, badidx);
+    if (bad >= 0 || unmapped >= 0 || badidx >= 0) {
+        printf("copy bench: bad pointer copy did not fail!\n");
+        return -1;
+    }
     return 0;
 }
\ No newline at end of file
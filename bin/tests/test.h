@@ -25,17 +25,57 @@ static inline void sys_err(char *str)
     printf("sys err: %s\n", str);
     exit(-1);
 }
+
+/* 单调时钟的毫秒数，用来统计测试的耗时 */
+static inline unsigned long test_msecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* 单调时钟的微秒数 */
+static inline unsigned long test_usecond(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * 取测试的第index个参数，从1开始。argv[1]是测试的名字，参数从argv[2]开始。
+ * 没有这个参数时返回def
+ */
+static inline char *test_arg_str(int argc, char *argv[], int index, char *def)
+{
+    if (index + 1 >= argc)
+        return def;
+    return argv[index + 1];
+}
+
+/* 取整数参数，没有这个参数或者不是正数时返回def */
+static inline int test_arg_int(int argc, char *argv[], int index, int def)
+{
+    char *arg = test_arg_str(argc, argv, index, NULL);
+    int val = arg ? atoi(arg) : 0;
+    return val > 0 ? val : def;
+}
 int file_test4(int argc, char *argv[]);
 int socket_ifconfig(int argc, char *argv[]);
 int chargen_test(int argc, char *argv[]);
 int select_test(int argc, char *argv[]);
 int pipe_test(int argc, char *argv[]);
 int shm_test(int argc, char *argv[]);
+int mmap_test(int argc, char *argv[]);
+int mmap_file_test(int argc, char *argv[]);
 int xlibc_test(int argc,char *argv[]);
 int math_test(int argc, char *argv[]);
 
 int pty_test(int argc, char *argv[]);
 int sleep_test(int argc, char *argv[]);
+int timer_bench(int argc, char *argv[]);
+int clock_bench(int argc, char *argv[]);
+int copy_bench(int argc, char *argv[]);
 int exp_test(int argc, char *argv[]);
 int fifo_test(int argc, char *argv[]);
 int sys_test(int argc, char *argv[]);
@@ -54,8 +94,10 @@ int backtrace_test(int argc, char *argv[]);
 int video_test(int argc, char *argv[]);
 int signal_test(int argc, char *argv[]);
 int proc_test(int argc, char *argv[]);
+int fork_bench(int argc, char *argv[]);
 
 int port_comm_test(int argc, char *argv[]);
+int port_comm_bench(int argc, char *argv[]);
 int gui_test(int argc, char *argv[]);
 int file_test3(int argc, char *argv[]);
 int fcntl_test(int argc, char *argv[]);
@@ -75,5 +117,12 @@ int sound_test(int argc, char *argv[]);
 
 int file_test5(int argc,char *argv[]);
 int file_test6(int argc, char *argv[]);
+int dd_test(int argc, char *argv[]);
+int ioring_test(int argc, char *argv[]);
+int sched_test(int argc, char *argv[]);
+int netpps_test(int argc, char *argv[]);
+int netstat_test(int argc, char *argv[]);
+int netrx_test(int argc, char *argv[]);
+int smp_test(int argc, char *argv[]);
 
 #endif // _TEST_H
@@ -13,10 +13,10 @@ void __pthread_entry();
 int pthread_make_default_attr(pthread_attr_t *attr)
 {
     attr->stacksize = PTHREAD_STACKSIZE_DEL;
-    attr->stackaddr = malloc(attr->stacksize); /* 分配空间 */
+    /* 栈不需要清零，没有用到的页就不会分配物理页 */
+    attr->stackaddr = malloc(attr->stacksize);
     if (attr->stackaddr == NULL)
         return -1;
-    memset(attr->stackaddr, 0, attr->stacksize);
     attr->detachstate = PTHREAD_CREATE_JOINABLE;
     return 0;
 }  
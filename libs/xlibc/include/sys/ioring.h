@@ -0,0 +1,37 @@
+#ifndef _SYS_IORING_H
+#define _SYS_IORING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* 每个线程最多同时存在的异步请求数 */
+#define IORING_ENTRY_NR     64
+/* 单个请求的最大长度 */
+#define IORING_BUF_MAX      (64 * 1024)
+
+/* 请求操作码 */
+enum {
+    IOCB_CMD_READ = 0,
+    IOCB_CMD_WRITE,
+};
+
+/* 提交的请求，只支持设备文件 */
+typedef struct {
+    int fd;
+    int opcode;
+    void *buf;
+    size_t length;
+    off_t offset;       /* 由设备解释，磁盘设备是扇区号 */
+    unsigned long user_data;
+} iocb_t;
+
+/* 完成事件 */
+typedef struct {
+    unsigned long user_data;
+    long result;        /* 成功返回传输的字节数，失败返回负的错误码 */
+} ioevent_t;
+
+int io_submit(iocb_t *iocbs, int nr);
+int io_getevents(ioevent_t *events, int min_nr, int nr);
+
+#endif   /* _SYS_IORING_H */
@@ -30,9 +30,19 @@ enum lpc_parcel_arg_type {
     LPC_PARCEL_ARG_FLOAT,   // not support
     LPC_PARCEL_ARG_DOUBLE,  // not support
     LPC_PARCEL_ARG_STRING,
-    LPC_PARCEL_ARG_SEQUENCE
+    LPC_PARCEL_ARG_SEQUENCE,
+    LPC_PARCEL_ARG_GRANT,   // 在授权缓冲区中的序列，读取时和SEQUENCE一样
 };
 
+/* 授权缓冲区：内核创建的共享内存，服务端映射后直接读写，大的序列不用复制到消息中 */
+#define LPC_GRANT_SIZE      (32 * 1024) /* 不能超过arglen的范围 */
+#define LPC_GRANT_NR        8
+
+/* 授权序列的参数值：高16位是共享内存id，低16位是在缓冲区中的偏移 */
+#define LPC_GRANT_ARG(shmid, offset)    (((shmid) << 16) | ((offset) & 0xffff))
+#define LPC_GRANT_SHMID(arg)            ((arg) >> 16)
+#define LPC_GRANT_OFFSET(arg)           ((arg) & 0xffff)
+
 typedef struct {
     uint32_t args[LPC_PARCEL_ARG_NR];   // 参数值
     uint16_t arglen[LPC_PARCEL_ARG_NR]; // 表明参数的长度
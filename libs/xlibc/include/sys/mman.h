@@ -8,9 +8,11 @@ extern "C" {
 #include <types.h>
 
 #define MAP_FIXED       0x10       /* 映射固定位置 */
-#define MAP_PRIVATE     0x00       /* 映射成私有，NOTE: 内核未实现该功能 */
+#define MAP_PRIVATE     0x00       /* 映射成私有，写入时复制，不会写回文件 */
 #define MAP_SHARED      0x80       /* 映射成共享内存 */
 #define MAP_REMAP       0x100      /* 强制重写映射 */
+#define MAP_ANONYMOUS   0x200      /* 匿名映射，第一次访问时才分配清零的物理页 */
+#define MAP_ANON        MAP_ANONYMOUS
 
 /* protect flags */
 #define PROT_NONE        0x0       /* page can not be accessed */
@@ -21,8 +23,14 @@ extern "C" {
 #define PROT_USER        0x10      /* page in user */
 #define PROT_REMAP       0x20      /* page remap */
 
+/* msync flags */
+#define MS_ASYNC         0x1       /* 回写到文件 */
+#define MS_INVALIDATE    0x2       /* 页缓存和文件始终一致，不需要处理 */
+#define MS_SYNC          0x4       /* 回写到文件，并且同步到磁盘 */
+
 void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset);
 int munmap(void *addr, size_t length);
+int msync(void *addr, size_t length, int flags);
 
 #ifdef __cplusplus
 }
@@ -9,12 +9,23 @@ extern "C" {
 
 #define SYS_VER_LEN     48
 
+/* 块缓存状态 */
+typedef struct {
+    unsigned long bs_blocks;    /* 缓存块总数 */
+    unsigned long bs_used;      /* 已经使用的缓存块数 */
+    unsigned long bs_dirty;     /* 脏块数 */
+    unsigned long bs_hits;      /* 命中次数 */
+    unsigned long bs_misses;    /* 未命中次数 */
+    unsigned long bs_writebacks;    /* 回写的扇区数 */
+} bstate_t;
+
 int login(const char *name, char *password);
 int logout(const char *name);
 int register_account(const char *name, char *password);
 int unregister_account(const char *name);
 int accountname(char *buf, size_t buflen);
 int accountverify(char *password);
+int bstate(bstate_t *bs);
 
 #ifdef __cplusplus
 }
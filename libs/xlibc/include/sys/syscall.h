@@ -118,6 +118,11 @@ enum syscall_num {
     SYS_REBOOT,
     SYS_SHUTDOWN,
     SYS_SELECT,
+    SYS_BSTATE,
+    SYS_IOSUBMIT,
+    SYS_IOGETEVENTS,
+    SYS_CLOCK_NANOSLEEP,
+    SYS_MSYNC,
     SYSCALL_NR,
 };
 
@@ -13,6 +13,8 @@ extern "C" {
 #define CLOCK_PROCESS_CPUTIME_ID  3 /* 本进程运行时间*/
 #define CLOCK_THREAD_CPUTIME_ID   4 /*本线程运行时间*/
 
+#define TIMER_ABSTIME             1 /* clock_nanosleep的时间是绝对时间 */
+
 #define CLOCKS_PER_SEC  (100 * 5)   /* 1秒的时钟数 */
 #define HZ_PER_CLOCKS   (CLOCKS_PER_SEC / 100)   /* 每个时钟的HZ数 */
 
@@ -45,6 +47,8 @@ struct timespec {
 
 int gettimeofday(struct timeval *tv, struct timezone *tz);
 int clock_gettime(clockid_t clockid, struct timespec *ts);
+int clock_nanosleep(clockid_t clockid, int flags, const struct timespec *req, struct timespec *rem);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 clock_t getticks();
 unsigned long alarm(unsigned long second);
 void mdelay(time_t msec);
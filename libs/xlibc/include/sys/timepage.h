@@ -0,0 +1,22 @@
+#ifndef _SYS_TIMEPAGE_H
+#define _SYS_TIMEPAGE_H
+
+/**
+ * 时间页：内核把一个只读页映射到每个进程的用户空间顶部，
+ * 里面是上一次时钟节拍时的TSC和时间，用户态读TSC就能算出当前时间，不需要系统调用。
+ * 内核更新前后各把seq加1，seq是奇数或者读的前后seq不同时要重新读。
+ */
+#define TIMEPAGE_TSC    0x01    /* TSC已经校准，可以用来计算时间 */
+
+typedef struct {
+    volatile unsigned long seq;
+    unsigned long flags;
+    unsigned long long cycles;  /* 上一次更新时的TSC */
+    unsigned long long snsec;   /* 上一次更新时秒内的纳秒数，左移了shift位 */
+    unsigned long mult;         /* 纳秒数 = (TSC的差值 * mult) >> shift */
+    unsigned long shift;
+    long mono_sec;              /* 上一次更新时开机后的秒数 */
+    long real_offset;           /* 墙上时间比开机后的时间多的秒数 */
+} timepage_t;
+
+#endif  /* _SYS_TIMEPAGE_H */
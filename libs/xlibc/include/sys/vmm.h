@@ -13,9 +13,15 @@ typedef struct {
     unsigned long ms_total;    /* 物理内存总大小 */
     unsigned long ms_free;     /* 物理内存空闲大小 */
     unsigned long ms_used;     /* 物理内存已使用大小 */
+    unsigned long ms_largest;  /* 最大的连续空闲物理内存 */
+    unsigned long ms_frag;     /* 碎片化的空闲内存百分比 */
 } mstate_t;
 
+/* 获取内存状态时的标志 */
+#define MSTATE_CACHES   0x01    /* 同时把内存缓存的统计打印到内核日志 */
+
 int mstate(mstate_t *ms);
+int xmstate(mstate_t *ms, int flags);
 
 typedef struct {
     void *addr;
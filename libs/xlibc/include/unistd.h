@@ -115,6 +115,7 @@ enum {
     _SC_TTY_NAME_MAX,
     _SC_TZNAME_MAX,
     _SC_VERSION,
+    _SC_TIMEPAGE,       /* 时间页的用户地址，没有时为0 */
 };
 
 long sysconf(int name);
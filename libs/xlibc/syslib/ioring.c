@@ -0,0 +1,23 @@
+#include <sys/ioring.h>
+#include <sys/syscall.h>
+#include <errno.h>
+
+int io_submit(iocb_t *iocbs, int nr)
+{
+    int ret = syscall2(int, SYS_IOSUBMIT, iocbs, nr);
+    if (ret < 0) {
+        _set_errno(-ret);
+        ret = -1;
+    }
+    return ret;
+}
+
+int io_getevents(ioevent_t *events, int min_nr, int nr)
+{
+    int ret = syscall3(int, SYS_IOGETEVENTS, events, min_nr, nr);
+    if (ret < 0) {
+        _set_errno(-ret);
+        ret = -1;
+    }
+    return ret;
+}
@@ -1,4 +1,5 @@
 #include <sys/lpc.h>
+#include <sys/ipc.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +22,50 @@ int lpc_parcel_put(lpc_parcel_t parcel)
     return -1;
 }
 
+/* 已经映射到本进程的授权缓冲区 */
+static struct {
+    int shmid;
+    uint8_t *addr;
+} lpc_grant_map_table[LPC_GRANT_NR];
+
+/* buf在已经映射的授权缓冲区中时返回0，并且生成授权序列的参数值 */
+static int lpc_grant_lookup(void *buf, size_t len, uint32_t *arg)
+{
+    uint8_t *p = buf;
+    int i;
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        uint8_t *addr = lpc_grant_map_table[i].addr;
+        if (addr && p >= addr && p + len <= addr + LPC_GRANT_SIZE) {
+            *arg = LPC_GRANT_ARG(lpc_grant_map_table[i].shmid, p - addr);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* 第一次访问授权缓冲区时映射共享内存，之后一直保留映射 */
+static void *lpc_grant_addr(uint32_t arg)
+{
+    int shmid = LPC_GRANT_SHMID(arg);
+    int i, slot = -1;
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        if (!lpc_grant_map_table[i].addr) {
+            if (slot < 0)
+                slot = i;
+        } else if (lpc_grant_map_table[i].shmid == shmid) {
+            return lpc_grant_map_table[i].addr + LPC_GRANT_OFFSET(arg);
+        }
+    }
+    if (slot < 0)
+        return NULL;
+    void *addr = shmmap(shmid, NULL, 0);
+    if (addr == (void *) -1)
+        return NULL;
+    lpc_grant_map_table[slot].shmid = shmid;
+    lpc_grant_map_table[slot].addr = addr;
+    return (uint8_t *) addr + LPC_GRANT_OFFSET(arg);
+}
+
 static uint16_t lpc_parcel_get_arg_type(lpc_parcel_t parcel, uint16_t index)
 {
     return parcel->header.argtype[index];
@@ -46,7 +91,10 @@ static int lpc_parcel_find_arg_solt(lpc_parcel_t parcel, uint16_t type)
         return -1;
     int i; for (i = 0; i < LPC_PARCEL_ARG_NR; i++) {
         if ((parcel->header.argused & (1 << i))) {
-            if (lpc_parcel_get_arg_type(parcel, i) == type && 
+            uint16_t argtype = lpc_parcel_get_arg_type(parcel, i);
+            /* 授权的序列也是序列，保持参数的顺序 */
+            if ((argtype == type || (type == LPC_PARCEL_ARG_SEQUENCE &&
+                argtype == LPC_PARCEL_ARG_GRANT)) && 
                 parcel->header.arglen[i] > 0) {
                 break;
             }
@@ -58,6 +106,14 @@ static int lpc_parcel_find_arg_solt(lpc_parcel_t parcel, uint16_t type)
     return i;
 }
 
+/* 序列参数的数据地址，授权的序列在共享内存中 */
+static void *lpc_parcel_arg_buf(lpc_parcel_t parcel, uint16_t index)
+{
+    if (lpc_parcel_get_arg_type(parcel, index) == LPC_PARCEL_ARG_GRANT)
+        return lpc_grant_addr(parcel->header.args[index]);
+    return (void *) &parcel->data[parcel->header.args[index]];
+}
+
 static void lpc_parcel_set_arg(lpc_parcel_t parcel, uint16_t index,
         uint32_t data, uint16_t len, uint16_t type)
 {
@@ -83,6 +139,9 @@ void lpc_parcel_dump_args(lpc_parcel_t parcel)
             printf("arg%d: ", i);
             switch (lpc_parcel_get_arg_type(parcel, i))
             {
+            case LPC_PARCEL_ARG_GRANT:
+                printf("grant[%d] %x\n", parcel->header.arglen[i], parcel->header.args[i]);
+                break;
             case LPC_PARCEL_ARG_SEQUENCE:
                 {
                     printf("seq[%d] ", parcel->header.arglen[i]);
@@ -128,6 +187,12 @@ int lpc_parcel_write_sequence(lpc_parcel_t parcel, void *buf, size_t len)
     int i = lpc_parcel_alloc_arg_solt(parcel);
     if (i < 0)
         return -1;
+    uint32_t grant;
+    /* 数据已经在授权缓冲区中，只传递位置，不复制 */
+    if (buf && !lpc_grant_lookup(buf, len, &grant)) {
+        lpc_parcel_set_arg(parcel, i, grant, len, LPC_PARCEL_ARG_GRANT);
+        return 0;
+    }
     int size = parcel->header.size + len + 1;
     if (size >= LPC_PARCEL_BUF_SIZE)
         return -1; // no free space
@@ -239,11 +304,14 @@ int lpc_parcel_read_sequence(lpc_parcel_t parcel, void *buf, size_t *len)
     int i = lpc_parcel_find_arg_solt(parcel, LPC_PARCEL_ARG_SEQUENCE);
     if (i < 0) 
         return -1;
+    void *src = lpc_parcel_arg_buf(parcel, i);
+    if (!src)
+        return -1;
     if (len) {
         *len = parcel->header.arglen[i];
     }
-    if (buf) {  
-        memcpy(buf, (void *) &parcel->data[parcel->header.args[i]], parcel->header.arglen[i]);
+    if (buf && buf != src) {    /* 服务端直接写到了授权缓冲区时不用复制 */
+        memcpy(buf, src, parcel->header.arglen[i]);
     }
     lpc_parcel_clear_arg(parcel, i);
     return 0;
@@ -254,8 +322,11 @@ int lpc_parcel_read_sequence_buf(lpc_parcel_t parcel, void **buf, size_t *len)
     int i = lpc_parcel_find_arg_solt(parcel, LPC_PARCEL_ARG_SEQUENCE);
     if (i < 0) 
         return -1;
+    void *src = lpc_parcel_arg_buf(parcel, i);
+    if (!src)
+        return -1;
     if (buf) {
-        *buf = (void *) &parcel->data[parcel->header.args[i]];
+        *buf = src;
     }
     if (len) {
         *len = parcel->header.arglen[i];
@@ -30,4 +30,15 @@ int accountname(char *buf, size_t buflen)
 int accountverify(char *password)
 {
     return syscall1(int, SYS_ACNTVERIFY, password);
-}
\ No newline at end of file
+}
+
+/**
+ * bstate() - get block cache state
+ * @bs: block cache state
+ * 
+ * @return: success is 0, failed is -1 
+ */
+int bstate(bstate_t *bs)
+{
+    return syscall1(int, SYS_BSTATE, bs);
+}
@@ -1,8 +1,10 @@
 #include <sys/time.h>
 #include <sys/syscall.h>
 #include <sys/proc.h>
+#include <sys/timepage.h>
 #include <time.h>
 #include <errno.h>
+#include <unistd.h>
 /**
  * alarm - 设置一个闹钟
  * @second: 闹钟产生的时间
@@ -28,6 +30,65 @@ clock_t getticks()
     return syscall0(clock_t, SYS_GETTICKS);
 }
 
+#define NSEC_PER_SEC    1000000000UL
+
+static timepage_t *__timepage = NULL;
+static int __timepage_checked = 0;
+
+static inline unsigned long long __rdtsc(void)
+{
+    unsigned long long tsc;
+    __asm__ __volatile__ ("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
+/* 第一次使用时向内核查询时间页的地址，内核没有校准TSC时为空 */
+static timepage_t *__timepage_get(void)
+{
+    if (!__timepage_checked) {
+        long addr = sysconf(_SC_TIMEPAGE);
+        if (addr && addr != -1)
+            __timepage = (timepage_t *) addr;
+        __timepage_checked = 1;
+    }
+    if (__timepage && (__timepage->flags & TIMEPAGE_TSC))
+        return __timepage;
+    return NULL;
+}
+
+/**
+ * 从时间页读取时间，不进入内核。内核正在更新时seq是奇数，读的过程中seq变化就重读。
+ * 距离上次更新太久（TSC的差值超过32位）时返回-1，改用系统调用。
+ */
+static int __timepage_gettime(clockid_t clockid, struct timespec *ts)
+{
+    timepage_t *tp = __timepage_get();
+    unsigned long seq;
+    unsigned long long delta, nsec;
+    long sec;
+    if (!tp)
+        return -1;
+    do {
+        seq = tp->seq;
+        __asm__ __volatile__ ("" : : : "memory");
+        delta = __rdtsc() - tp->cycles;
+        if (delta >> 32)
+            return -1;
+        nsec = (tp->snsec + delta * tp->mult) >> tp->shift;
+        sec = tp->mono_sec;
+        if (clockid == CLOCK_REALTIME)
+            sec += tp->real_offset;
+        __asm__ __volatile__ ("" : : : "memory");
+    } while ((seq & 1) || seq != tp->seq);
+    while (nsec >= NSEC_PER_SEC) {
+        nsec -= NSEC_PER_SEC;
+        sec++;
+    }
+    ts->tv_sec = sec;
+    ts->tv_nsec = (long) nsec;
+    return 0;
+}
+
 /**
  * gettimeofday - 获取当前的时间
  * @tv: 时间
@@ -37,6 +98,12 @@ clock_t getticks()
  */
 int gettimeofday(struct timeval *tv, struct timezone *tz)
 {
+    struct timespec ts;
+    if (tv && !tz && !__timepage_gettime(CLOCK_REALTIME, &ts)) {
+        tv->tv_sec = ts.tv_sec;
+        tv->tv_usec = ts.tv_nsec / 1000;
+        return 0;
+    }
     return syscall2(int, SYS_GETTIMEOFDAY, tv, tz);
 }
 /**
@@ -44,13 +111,47 @@ int gettimeofday(struct timeval *tv, struct timezone *tz)
  * @clockid: 获取的类型
  * @ts: 时间结构
  * 
+ * CLOCK_REALTIME和CLOCK_MONOTONIC从时间页读取，不进入内核
+ * 
  * 成功返回0，失败返回-1
  */
 int clock_gettime(clockid_t clockid, struct timespec *ts)
 {
+    if (ts && (clockid == CLOCK_REALTIME || clockid == CLOCK_MONOTONIC) &&
+        !__timepage_gettime(clockid, ts))
+        return 0;
     return syscall2(int, SYS_CLOCK_GETTIME, clockid, ts);
 }
 
+/**
+ * clock_nanosleep - 按照指定的时钟休眠
+ * @clockid: CLOCK_REALTIME或者CLOCK_MONOTONIC
+ * @flags: TIMER_ABSTIME表示req是绝对时间
+ * @req: 休眠时间
+ * @rem: 被打断时保存剩余的时间，只对相对时间有效
+ * 
+ * 成功返回0，失败返回错误码
+ */
+int clock_nanosleep(clockid_t clockid, int flags, const struct timespec *req, struct timespec *rem)
+{
+    int retv = syscall4(int, SYS_CLOCK_NANOSLEEP, clockid, flags, req, rem);
+    return retv < 0 ? -retv : 0;
+}
+
+/**
+ * nanosleep - 以纳秒为单位休眠，精度取决于内核的时钟事件设备
+ * 
+ * 成功返回0，失败返回-1
+ */
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+    int retv = syscall4(int, SYS_CLOCK_NANOSLEEP, CLOCK_MONOTONIC, 0, req, rem);
+    if (!retv)
+        return 0;
+    _set_errno(retv);
+    return -1;
+}
+
 int walltime_switch(walltime_t *wt, struct tm *tm)
 {
     if (!wt || !tm)
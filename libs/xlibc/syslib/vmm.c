@@ -48,6 +48,19 @@ int munmap(void *addr, size_t length)
     return syscall2(int , SYS_MUNMAP, addr, length);
 }
 
+/**
+ * msync() - write back the shared file mapping
+ * @addr: start addr, page aligned
+ * @length: memory length
+ * @flags: MS_ASYNC or MS_SYNC
+ * 
+ * @return: success is 0, failed is -1 
+ */
+int msync(void *addr, size_t length, int flags)
+{
+    return syscall3(int , SYS_MSYNC, addr, length, flags);
+}
+
 /**
  * xmunmap() - ummap memory range for xbook
  * @addr: start addr
@@ -69,5 +82,17 @@ int xmunmap(void *addr, size_t length)
  */
 int mstate(mstate_t *ms)
 {
-    return syscall1(int , SYS_MSTATE, ms);
+    return syscall2(int , SYS_MSTATE, ms, 0);
+}
+
+/**
+ * xmstate() - get memory state with flags
+ * @ms: memory state
+ * @flags: MSTATE_CACHES dumps the kernel memory cache statistics too
+ * 
+ * @return: success is 0, failed is -1 
+ */
+int xmstate(mstate_t *ms, int flags)
+{
+    return syscall2(int , SYS_MSTATE, ms, flags);
 }
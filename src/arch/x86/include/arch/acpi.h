@@ -1,6 +1,8 @@
 #ifndef _X86_ACPI_H
 #define _X86_ACPI_H
 
+#include <arch/cpu.h>
+
 typedef unsigned char byte;
 typedef unsigned short word;
 typedef unsigned int dword;
@@ -40,10 +42,80 @@ struct FACP {
     byte PM1_CNT_LEN;
 };
 
+/* 系统描述表的通用表头 */
+struct acpi_sdt_header {
+    byte Signature[4];
+    dword Length;
+    byte Revision;
+    byte CheckSum;
+    byte OemID[6];
+    byte OemTableID[8];
+    dword OemRevision;
+    dword CreatorID;
+    dword CreatorRevision;
+} __attribute__((packed));
+
+/* MADT(APIC)：描述系统中的本地APIC和IOAPIC */
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    dword LocalApicAddress;
+    dword Flags;
+} __attribute__((packed));
+
+/* MADT中的表项类型 */
+#define ACPI_MADT_LOCAL_APIC        0
+#define ACPI_MADT_IO_APIC           1
+#define ACPI_MADT_INT_OVERRIDE      2
+
+#define ACPI_MADT_LAPIC_ENABLED     0x01
+
+struct acpi_madt_entry {
+    byte Type;
+    byte Length;
+} __attribute__((packed));
+
+struct acpi_madt_lapic {
+    struct acpi_madt_entry entry;
+    byte ProcessorId;
+    byte ApicId;
+    dword Flags;
+} __attribute__((packed));
+
+struct acpi_madt_ioapic {
+    struct acpi_madt_entry entry;
+    byte IoApicId;
+    byte Reserved;
+    dword Address;
+    dword GsiBase;
+} __attribute__((packed));
+
+struct acpi_madt_override {
+    struct acpi_madt_entry entry;
+    byte Bus;
+    byte Source;
+    dword Gsi;
+    word Flags;
+} __attribute__((packed));
+
+#define ACPI_ISA_IRQ_NR     16
+
+/* 从MADT中解析出来的多处理器信息 */
+typedef struct {
+    unsigned long lapic_addr;               /* 本地APIC的物理地址 */
+    int cpu_nr;                             /* 可用的cpu数量 */
+    unsigned char apic_ids[CPU_NR_MAX];     /* 每个cpu的本地APIC ID */
+    unsigned long ioapic_addr;              /* IOAPIC的物理地址，为0表示没有 */
+    unsigned int ioapic_gsi_base;
+    unsigned int isa_irq_gsi[ACPI_ISA_IRQ_NR];  /* ISA中断重定向后的全局中断号 */
+} acpi_madt_info_t;
+
+extern acpi_madt_info_t acpi_madt_info;
+
 unsigned int *acpi_check_RSDPtr(unsigned int *ptr);
 unsigned int *acpi_get_RSDPtr(void);
-int acpi_checkHeader(unsigned int *ptr, char *sig);
+int acpi_checkHeader(void *ptr, char *sig);
 int acpi_enable(void);
 int acpi_init(void);
+int acpi_madt_init(void);
 
 #endif /* _X86_ACPI_H */
@@ -0,0 +1,61 @@
+#ifndef _X86_APIC_H
+#define _X86_APIC_H
+
+#include <types.h>
+
+/* 本地APIC寄存器偏移 */
+#define LAPIC_ID                0x020
+#define LAPIC_VERSION           0x030
+#define LAPIC_TPR               0x080
+#define LAPIC_EOI               0x0B0
+#define LAPIC_SVR               0x0F0
+#define LAPIC_ESR               0x280
+#define LAPIC_ICR_LOW           0x300
+#define LAPIC_ICR_HIGH          0x310
+#define LAPIC_LVT_TIMER         0x320
+#define LAPIC_LVT_LINT0         0x350
+#define LAPIC_LVT_LINT1         0x360
+#define LAPIC_LVT_ERROR         0x370
+#define LAPIC_TIMER_INIT        0x380
+#define LAPIC_TIMER_CUR         0x390
+#define LAPIC_TIMER_DIV         0x3E0
+
+#define LAPIC_SVR_ENABLE        0x100
+#define LAPIC_LVT_MASKED        0x10000
+#define LAPIC_LVT_NMI           0x400
+#define LAPIC_LVT_EXTINT        0x700
+#define LAPIC_TIMER_PERIODIC    0x20000
+#define LAPIC_TIMER_DIV_16      0x03
+
+#define LAPIC_ICR_INIT          0x500
+#define LAPIC_ICR_STARTUP       0x600
+#define LAPIC_ICR_PENDING       0x1000
+#define LAPIC_ICR_ASSERT        0x4000
+#define LAPIC_ICR_LEVEL         0x8000
+
+/* 校准本地APIC定时器时等待的时钟节拍数 */
+#define LAPIC_CALIBRATE_TICKS   4
+
+/* IOAPIC寄存器 */
+#define IOAPIC_REG_SELECT       0x00
+#define IOAPIC_REG_WINDOW       0x10
+#define IOAPIC_VERSION          0x01
+#define IOAPIC_REDTBL(n)        (0x10 + (n) * 2)
+
+/* 本地APIC使用的中断向量，位于外部中断之后，系统调用之前 */
+#define APIC_VECTOR_TIMER       0x30    /* 应用处理器的时钟中断 */
+#define APIC_VECTOR_RESCHED     0x31    /* 重新调度 */
+#define APIC_VECTOR_TLB         0x32    /* 刷新TLB */
+#define APIC_VECTOR_SPURIOUS    0x3f    /* 伪中断 */
+
+int apic_init(void);
+void lapic_init(int bsp);
+void lapic_eoi(void);
+unsigned int lapic_get_id(void);
+void lapic_send_ipi(unsigned int apic_id, unsigned int vector);
+void lapic_send_init(unsigned int apic_id);
+void lapic_send_startup(unsigned int apic_id, unsigned long addr);
+void lapic_timer_calibrate(void);
+void lapic_timer_start(void);
+
+#endif   /* _X86_APIC_H */
@@ -3,13 +3,39 @@
 
 #include <types.h>
 
-#define CPU_NR_MAX  1
+#define CPU_NR_MAX  8
 
 cpuid_t cpu_get_my_id();
 void cpu_get_attached_list(cpuid_t *cpu_list, unsigned int *count);
+void cpu_attach(cpuid_t cpu);
 void cpu_init();
 
+/* 每个cpu私有的数据区，内核态时gs段指向它，访问成员只需要一条指令 */
+typedef struct {
+    void *self;             /* 数据区自身的线性地址 */
+    void *current;          /* 当前cpu上运行的任务 */
+    void *sched_unit;       /* 当前cpu的调度单元 */
+    cpuid_t cpuid;
+} cpu_local_t;
+
+/* 成员在数据区中的偏移 */
+#define CPU_LOCAL_SELF      0
+#define CPU_LOCAL_CURRENT   4
+#define CPU_LOCAL_SCHED     8
+#define CPU_LOCAL_CPUID     12
+
+extern cpu_local_t cpu_local_table[CPU_NR_MAX];
+
+#define cpu_local_read(offset) ({ \
+    unsigned long __val; \
+    __asm__ __volatile__ ("movl %%gs:%c1, %0" : "=r" (__val) : "i" (offset) : "memory"); \
+    __val; })
+
+#define cpu_local_write(offset, val) \
+    __asm__ __volatile__ ("movl %0, %%gs:%c1" : : "r" ((unsigned long) (val)), "i" (offset) : "memory")
+
 void cpu_do_sleep();
+void cpu_do_safe_sleep();
 void cpu_do_nohing(void);
 void cpu_do_udelay(int usec);
 static inline void cpu_do_pause(void)
@@ -26,9 +52,48 @@ static inline void cpu_do_cpuid(unsigned int mop,unsigned int sop,unsigned int *
     );
 }
 
+/* cpuid 1号功能的edx特性位 */
+#define CPUID_FEATURE_PSE   (1 << 3)    /* 4MB大页 */
+#define CPUID_FEATURE_MSR   (1 << 5)    /* rdmsr/wrmsr指令 */
+#define CPUID_FEATURE_PAT   (1 << 16)   /* 页属性表 */
+
+/* 返回cpuid 1号功能的edx，不支持1号功能时返回0 */
+static inline unsigned int cpu_do_features(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    cpu_do_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 1)
+        return 0;
+    cpu_do_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return edx;
+}
+
+static inline unsigned long long cpu_do_rdmsr(unsigned int msr)
+{
+    unsigned long long value;
+	__asm__ __volatile__ ("rdmsr" : "=A"(value) : "c"(msr));
+    return value;
+}
+
+static inline void cpu_do_wrmsr(unsigned int msr, unsigned long long value)
+{
+	__asm__ __volatile__ ("wrmsr" : : "c"(msr), "A"(value) : "memory");
+}
+
+static inline unsigned long long cpu_do_rdtsc(void)
+{
+    unsigned long long tsc;
+	__asm__ __volatile__ ("rdtsc" : "=A"(tsc));
+    return tsc;
+}
+
 #define cpu_sleep       cpu_do_sleep
+#define cpu_safe_sleep  cpu_do_safe_sleep
 #define cpu_idle        cpu_do_nohing
 #define cpu_pause       cpu_do_pause
+#define cpu_rdtsc       cpu_do_rdtsc
+#define cpu_rdmsr       cpu_do_rdmsr
+#define cpu_wrmsr       cpu_do_wrmsr
 #define udelay          cpu_do_udelay
 
 #endif  /* _X86_CPU_H */
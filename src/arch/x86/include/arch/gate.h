@@ -78,6 +78,11 @@ extern void irq_entry0x2d();
 extern void irq_entry0x2e();
 extern void irq_entry0x2f();
 
+extern void apic_entry0x30();
+extern void apic_entry0x31();
+extern void apic_entry0x32();
+extern void apic_entry0x3f();
+
 extern void syscall_handler();
 
 #endif	/* _X86_GATE_H */
\ No newline at end of file
@@ -20,10 +20,19 @@ enum {
 #define MEM_SECTION_MAX_NR      12
 #define MEM_SECTION_MAX_SIZE    2048    // (2 ^ 11) : 8 MB
 
+/* 统计碎片时，小于这个阶（16页，64KB）的空闲块算作碎片 */
+#define MEM_FRAG_ORDER          4
+
+/* 空闲页低于总页数的1/64时唤醒回收线程，回收到1/32以上 */
+#define MEM_WATERMARK_LOW_DIV   64
+#define MEM_WATERMARK_HIGH_DIV  32
+
+/* 节就是伙伴算法中的一阶，管理大小为section_size页的空闲块 */
 typedef struct {
     list_t free_list_head;
     size_t node_count;
     size_t section_size;
+    unsigned long *free_map;    /* 空闲位图，每一位对应一个按本阶对齐的块 */
 } mem_section_t;
 
 typedef struct _mem_node {
@@ -40,6 +49,9 @@ typedef struct {
     unsigned int start;
     unsigned int end;
     size_t pages;
+    size_t free_pages;
+    size_t low_pages;           /* 低水位 */
+    size_t high_pages;          /* 高水位 */
     mem_section_t sections[MEM_SECTION_MAX_NR];
     mem_node_t *node_table;
 } mem_range_t;
@@ -77,6 +89,8 @@ unsigned int mem_node_to_phy_addr(mem_node_t *node);
 
 unsigned long mem_node_alloc_pages(unsigned long count, unsigned long flags);
 int mem_node_free_pages(unsigned long page);
+int mem_node_ref_pages(unsigned long addr);
+int mem_node_page_reference(unsigned long addr);
 
 void mem_range_init(unsigned int idx, unsigned int start, size_t len);
 
@@ -30,6 +30,11 @@ typedef unsigned int pte_t; /* page table entry */
 #define	PAGE_ATTR_WRITE  	    2	// 0010 R/W read/write/execute
 #define	PAGE_ATTR_SYSTEM  	    0	// 0000 U/S system level, cpl0,1,2
 #define	PAGE_ATTR_USER  	    4   // 0100 U/S user level, cpl3
+#define	PAGE_ATTR_PWT  	        0x08    // PWT bit: PAT index bit 0
+#define	PAGE_ATTR_PCD  	        0x10    // PCD bit: PAT index bit 1
+#define	PAGE_ATTR_DIRTY  	    0x40    // D bit: page had been written
+#define	PAGE_ATTR_LARGE  	    0x80    // PS bit in pde: 4MB page
+#define	PAGE_ATTR_COW  	        0x200   // AVL bit 9: copy on write page
 
 #define KERN_PAGE_ATTR  (PAGE_ATTR_PRESENT | PAGE_ATTR_WRITE | PAGE_ATTR_SYSTEM)
 
@@ -42,6 +47,15 @@ typedef unsigned int pte_t; /* page table entry */
 
 #define PAGE_TABLE_ENTRY_NR 1024  
 
+/* 一个页目录项直接映射的大页 */
+#define PAGE_LARGE_SIZE     (PAGE_SIZE * PAGE_TABLE_ENTRY_NR)
+#define PAGE_LARGE_MASK     (~(PAGE_LARGE_SIZE - 1))
+
+/* 页属性表的第1项改成写合并，PWT=1、PCD=0的页使用这一项 */
+#define PAGE_PAT_MSR        0x277
+#define PAGE_PAT_WC         0x01
+#define PAGE_ATTR_WC        PAGE_ATTR_PWT
+
 #if CONFIG_KERN_LOWMEM == 1
 #define KERN_PAGE_DIR_ENTRY_OFF 0
 #else
@@ -91,6 +105,10 @@ int page_map_addr_fixed(unsigned long start, unsigned long addr,
 #define kern_phy_addr2vir_addr(x) ((void *)((unsigned long)(x) + KERN_BASE_VIR_ADDR)) 
 
 unsigned long addr_vir2phy(unsigned long vaddr);
+unsigned long page_attr_wc(void);
+void page_features_init(void);
+int page_clear_dirty(unsigned long vaddr);
+void page_copy_to_phy(unsigned long paddr, void *src);
 
 void kern_page_map_early(unsigned int start, unsigned int end);
 unsigned long *kern_page_dir_copy_to();
@@ -110,6 +128,8 @@ int page_do_fault(trap_frame_t *frame);
 #define page_alloc_user(count)              mem_node_alloc_pages(count, MEM_NODE_TYPE_USER)
 #define page_alloc_dma(count)               mem_node_alloc_pages(count, MEM_NODE_TYPE_DMA)
 #define page_free(addr)                     mem_node_free_pages(addr)
+#define page_ref(addr)                      mem_node_ref_pages(addr)
+#define page_ref_count(addr)                mem_node_page_reference(addr)
 
 #define kern_page_copy_storge               kern_page_dir_copy_to
 
@@ -49,6 +49,8 @@
 int physic_memory_init();
 
 unsigned long mem_get_free_page_nr();
+unsigned long mem_get_reclaim_page_nr();
 unsigned long mem_get_total_page_nr();
+unsigned long mem_get_fragment(unsigned long *largest);
 
 #endif   /*_X86_PHYMEM_H */
@@ -12,6 +12,10 @@ void eflags_restore_from(unsigned int eflags);
 
 /* cr0的最高位是分页模式位，1则启动，0则关闭 */
 #define REG_CR0_PG  (1 << 31)
+/* cr0的写保护位，置1后内核写只读的用户页也会触发页故障（写时复制需要） */
+#define REG_CR0_WP  (1 << 16)
+/* cr4的页大小扩展位，置1后页目录项可以直接映射4MB的大页 */
+#define REG_CR4_PSE (1 << 4)
 
 unsigned int cpu_cr0_read(void );
 unsigned int cpu_cr2_read(void );
@@ -20,4 +24,7 @@ unsigned int cpu_cr3_read(void );
 void cpu_cr0_write(unsigned int address);
 void cpu_cr3_write(unsigned int address);
 
+unsigned int cpu_cr4_read(void );
+void cpu_cr4_write(unsigned int value);
+
 #endif  /* _X86_REGISTERS_H */
@@ -2,6 +2,7 @@
 #define _X86_SEGMENT_H
 
 #include <xbook/kernel.h>
+#include <types.h>
 
 /*
  * 段的相关信息会出现在这个文件中
@@ -43,6 +44,7 @@
 #define	INDEX_TSS 3
 #define	INDEX_USER_CODE 4
 #define	INDEX_USER_DATA 5
+#define	INDEX_KERNEL_PERCPU 6
 
 #define KERNEL_CODE_SEL ((INDEX_KERNEL_CODE << 3) + (SA_TIG << 2) + SA_RPL0)
 #define KERNEL_DATA_SEL ((INDEX_KERNEL_DATA << 3) + (SA_TIG << 2) + SA_RPL0)
@@ -54,6 +56,9 @@
 
 #define KERNEL_TSS_SEL ((INDEX_TSS << 3) + (SA_TIG << 2) + SA_RPL0)
 
+/* 内核态时gs使用的选择子，段基址是当前cpu的私有数据区 */
+#define KERNEL_PERCPU_SEL ((INDEX_KERNEL_PERCPU << 3) + (SA_TIG << 2) + SA_RPL0)
+
 /* GDT 的虚拟地址 */
 #define GDT_VADDR			(KERN_BASE_VIR_ADDR + 0x003F0000)
 #define GDT_LIMIT		    0x000007ff
@@ -68,6 +73,7 @@
 #define GDT_USER_CODE_ATTR          (DA_CR | DA_DPL3 | DA_32 | DA_G)
 #define GDT_USER_DATA_ATTR          (DA_DRW | DA_DPL3 | DA_32 | DA_G)
 #define GDT_TSS_ATTR                (DA_386TSS)
+#define GDT_KERNEL_PERCPU_ATTR      (DA_DRW | DA_DPL0 | DA_32)
 
 struct segment_descriptor {
 	unsigned short limit_low, base_low;
@@ -76,5 +82,6 @@ struct segment_descriptor {
 };
 
 void segment_descriptor_init();
+struct segment_descriptor *segment_descriptor_init_cpu(cpuid_t cpu);
 
 #endif	/*_X86_SEGMENT_H*/
\ No newline at end of file
@@ -0,0 +1,10 @@
+#ifndef _X86_SMP_H
+#define _X86_SMP_H
+
+/* 应用处理器启动代码的物理地址，必须4KB对齐并且在1MB以下 */
+#define AP_TRAMPOLINE_ADDR      0x8000
+
+/* 等待应用处理器启动的时间(ms) */
+#define AP_BOOT_TIMEOUT         100
+
+#endif   /* _X86_SMP_H */
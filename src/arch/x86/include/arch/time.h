@@ -10,6 +10,20 @@ void pit_clock_init();
 
 #define clock_hardware_init pit_clock_init
 
+/* 时间戳计数器（TSC），cpuid 1号功能的edx第4位表示支持rdtsc */
+static inline int tsc_probe(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    cpu_do_cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+    if (eax < 1)
+        return 0;
+    cpu_do_cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+    return (edx >> 4) & 1;
+}
+
+#define clock_cycles_probe  tsc_probe
+#define clock_cycles_read   cpu_rdtsc
+
 #define time_get_hour       cmos_get_hour_hex
 #define time_get_minute     cmos_get_min_hex
 #define time_get_second     cmos_get_sec_hex
@@ -2,6 +2,7 @@
 #define _X86_TSS_H
 
 #include <stdint.h>
+#include <types.h>
 
 typedef struct {
 	uint32_t backlink;
@@ -35,6 +36,8 @@ typedef struct {
 
 void tss_init();
 tss_t *tss_get_from_cpu0();
+tss_t *tss_get_from_cpu(cpuid_t cpu);
+void tss_init_cpu(cpuid_t cpu, unsigned long esp0);
 void tss_update_info(unsigned long task_addr);
 
 #endif	/*_X86_CPU_H*/
\ No newline at end of file
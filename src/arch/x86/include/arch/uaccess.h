@@ -0,0 +1,20 @@
+#ifndef _X86_UACCESS_H
+#define _X86_UACCESS_H
+
+#include "interrupt.h"
+
+/**
+ * 异常表：访问用户地址的指令和出错时跳转的修复代码，
+ * 由链接脚本收集到__ex_table段中
+ */
+typedef struct exception_table_entry {
+    unsigned long insn;
+    unsigned long fixup;
+} exception_table_entry_t;
+
+int exception_table_fixup(trap_frame_t *frame);
+
+unsigned long __copy_user(void *to, const void *from, unsigned long n);
+long __strncpy_from_user(char *dst, const char *src, long count);
+
+#endif   /* _X86_UACCESS_H */
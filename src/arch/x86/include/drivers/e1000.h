@@ -70,6 +70,7 @@
 #include <xbook/timer.h>
 #include <xbook/spinlock.h>
 #include <xbook/driver.h>
+#include <xbook/netbuf.h>
 #include <arch/pci.h>
 #include <stddef.h>
 
@@ -172,6 +173,8 @@ struct e1000_adapter;
 struct e1000_buffer {
 	//struct sk_buff *skb;
 	uint8_t* buffer;
+	netbuf_t *netbuf;	/* 接收缓冲区，或者发送时复制用的缓冲区 */
+	netbuf_sg_t *sg;	/* 发送请求，只记录在最后一个描述符上 */
 	uint64_t dma;
 	unsigned long time_stamp;
 	uint16_t length;
@@ -1,17 +1,27 @@
 #include <arch/cpu.h>
 
 cpuid_t cpu_attached_list[CPU_NR_MAX];
+cpu_local_t cpu_local_table[CPU_NR_MAX];
+unsigned int cpu_attached_nr;
 
+/* 逻辑cpu号，启动cpu是0，其它cpu按启动顺序编号 */
 cpuid_t cpu_get_my_id()
 {
-    // TODO: calc cpuid 
-    return cpu_attached_list[0];
+    return (cpuid_t) cpu_local_read(CPU_LOCAL_CPUID);
 }
 
 void cpu_get_attached_list(cpuid_t *cpu_list, unsigned int *count)
 {
-    cpu_list[0] = cpu_get_my_id();
-    *count = 1;
+    int i;
+    for (i = 0; i < cpu_attached_nr; i++)
+        cpu_list[i] = cpu_attached_list[i];
+    *count = cpu_attached_nr;
+}
+
+/* 应用处理器启动后加入到cpu列表中 */
+void cpu_attach(cpuid_t cpu)
+{
+    cpu_attached_list[cpu_attached_nr++] = cpu;
 }
 
 void cpu_init()
@@ -19,6 +29,8 @@ void cpu_init()
     int i;
     for (i = 0; i < CPU_NR_MAX; i++) {
         cpu_attached_list[i] = 0;
+        cpu_local_table[i].cpuid = i;
     }
-    cpu_attached_list[0] = 0x80386;
+    cpu_attached_nr = 0;
+    cpu_attach(0);
 }
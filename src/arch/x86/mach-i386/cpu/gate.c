@@ -84,6 +84,12 @@ static void interrupt_descriptor_init()
 	gate_descriptor_set(IDT_OFF2PTR(idt0, 0x2e), irq_entry0x2e, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL0); 
 	gate_descriptor_set(IDT_OFF2PTR(idt0, 0x2f), irq_entry0x2f, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL0); 
 	
+	/* 本地APIC中断 */
+	gate_descriptor_set(IDT_OFF2PTR(idt0, 0x30), apic_entry0x30, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL0); 
+	gate_descriptor_set(IDT_OFF2PTR(idt0, 0x31), apic_entry0x31, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL0); 
+	gate_descriptor_set(IDT_OFF2PTR(idt0, 0x32), apic_entry0x32, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL0); 
+	gate_descriptor_set(IDT_OFF2PTR(idt0, 0x3f), apic_entry0x3f, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL0); 
+	
 	/* 系统调用处理中断 */
 	gate_descriptor_set(IDT_OFF2PTR(idt0, KERN_SYSCALL_NR), syscall_handler, KERNEL_CODE_SEL, DA_386IGate, DA_GATE_DPL3);
 
@@ -1,6 +1,9 @@
 #include <arch/registers.h>
 #include <arch/segment.h>
 #include <arch/tss.h>
+#include <arch/cpu.h>
+#include <xbook/memalloc.h>
+#include <string.h>
 
 /* 
  * Global descriptor table
@@ -34,5 +37,33 @@ void segment_descriptor_init()
 	segment_descriptor_set(GDT_OFF2PTR(gdt0, INDEX_USER_CODE), GDT_BOUND_TOP, GDT_BOUND_BOTTOM, DA_CR | DA_DPL3 | DA_32 | DA_G);
 	segment_descriptor_set(GDT_OFF2PTR(gdt0, INDEX_USER_DATA), GDT_BOUND_TOP, GDT_BOUND_BOTTOM, DA_DRW | DA_DPL3 | DA_32 | DA_G);
 
+	cpu_local_t *local = &cpu_local_table[0];
+	local->self = local;
+	segment_descriptor_set(GDT_OFF2PTR(gdt0, INDEX_KERNEL_PERCPU), sizeof(cpu_local_t) - 1,
+		(uint32_t) local, GDT_KERNEL_PERCPU_ATTR);
+
 	gdt_register_set(GDT_LIMIT, GDT_VADDR);
+
+	/* 内核态下gs始终指向cpu私有数据区 */
+	__asm__ __volatile__ ("movw %w0, %%gs" : : "r" (KERNEL_PERCPU_SEL));
+}
+
+/**
+ * 为应用处理器复制一份GDT，只有TSS和私有数据区的段基址不同，
+ * 这样所有cpu都使用相同的选择子。
+ */
+struct segment_descriptor *segment_descriptor_init_cpu(cpuid_t cpu)
+{
+	struct segment_descriptor *gdt = mem_alloc(GDT_LIMIT + 1);
+	if (!gdt)
+		return NULL;
+	memcpy(gdt, gdt0, GDT_LIMIT + 1);
+	tss_t *tss = tss_get_from_cpu(cpu);
+	segment_descriptor_set(GDT_OFF2PTR(gdt, INDEX_TSS), sizeof(tss_t) - 1, (uint32_t )tss, GDT_TSS_ATTR);
+
+	cpu_local_t *local = &cpu_local_table[cpu];
+	local->self = local;
+	segment_descriptor_set(GDT_OFF2PTR(gdt, INDEX_KERNEL_PERCPU), sizeof(cpu_local_t) - 1,
+		(uint32_t) local, GDT_KERNEL_PERCPU_ATTR);
+	return gdt;
 }
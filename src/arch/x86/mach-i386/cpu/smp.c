@@ -0,0 +1,168 @@
+#include <arch/smp.h>
+#include <arch/apic.h>
+#include <arch/acpi.h>
+#include <arch/cpu.h>
+#include <arch/segment.h>
+#include <arch/gate.h>
+#include <arch/tss.h>
+#include <arch/page.h>
+#include <arch/registers.h>
+#include <arch/interrupt.h>
+#include <arch/memory.h>
+#include <xbook/smp.h>
+#include <xbook/task.h>
+#include <xbook/schedule.h>
+#include <xbook/clock.h>
+#include <xbook/memalloc.h>
+#include <xbook/debug.h>
+#include <string.h>
+
+extern char ap_trampoline_start[];
+extern char ap_trampoline_end[];
+extern char ap_boot_pgdir[];
+extern char ap_boot_cr4[];
+extern char ap_boot_stack[];
+extern char ap_boot_entry[];
+
+/* 启动代码中的参数在复制后的位置 */
+#define TRAMPOLINE_ARG(base, arg) \
+        ((unsigned long *) ((base) + ((arg) - ap_trampoline_start)))
+
+/* 逻辑cpu号对应的本地APIC ID */
+static unsigned int cpu_apic_ids[CPU_NR_MAX];
+/* 应用处理器各自的GDT */
+static struct segment_descriptor *cpu_gdt_table[CPU_NR_MAX];
+
+static volatile cpuid_t ap_boot_cpu;
+static volatile int ap_boot_done;
+
+void smp_send_ipi(cpuid_t cpu, int ipi)
+{
+    if (ipi == IPI_RESCHED)
+        lapic_send_ipi(cpu_apic_ids[cpu], APIC_VECTOR_RESCHED);
+    else if (ipi == IPI_TLB)
+        lapic_send_ipi(cpu_apic_ids[cpu], APIC_VECTOR_TLB);
+}
+
+static void apic_timer_handler(unsigned int esp)
+{
+    lapic_eoi();
+    sched_tick();
+}
+
+static void apic_resched_handler(unsigned int esp)
+{
+    lapic_eoi();
+    smp_reschedule_interrupt();
+}
+
+/* 刷新TLB的中断不获取内核锁，发起者持有内核锁等待所有cpu刷新完成 */
+static void apic_tlb_handler(unsigned int esp)
+{
+    smp_tlb_interrupt();
+    lapic_eoi();
+}
+
+/* 伪中断不需要应答 */
+static void apic_spurious_handler(unsigned int esp)
+{
+}
+
+/**
+ * 应用处理器进入内核后执行的第一个函数，此时已经在自己的idle任务栈上，
+ * 加载自己的GDT、TSS和本地APIC后就进入idle循环。
+ */
+static void smp_ap_entry(void)
+{
+    cpuid_t cpu = ap_boot_cpu;
+    gdt_register_set(GDT_LIMIT, (unsigned int) cpu_gdt_table[cpu]);
+    idt_register_set(IDT_LIMIT, IDT_VADDR);
+    __asm__ __volatile__ ("movw %w0, %%gs" : : "r" (KERNEL_PERCPU_SEL));
+    task_register_set(KERNEL_TSS_SEL);
+    __asm__ __volatile__ ("fninit");
+    page_features_init();
+    lapic_init(0);
+    lapic_timer_start();
+    ap_boot_done = 1;
+    smp_ap_start(cpu);
+}
+
+static int smp_boot_ap(cpuid_t cpu, unsigned int apic_id, unsigned char *trampoline)
+{
+    task_t *idle = task_create_idle(cpu);
+    if (!idle)
+        return -1;
+    cpu_gdt_table[cpu] = segment_descriptor_init_cpu(cpu);
+    if (!cpu_gdt_table[cpu]) {
+        task_free(idle);
+        return -1;
+    }
+    unsigned long stack_top = (unsigned long) idle + TASK_KERN_STACK_SIZE;
+    tss_init_cpu(cpu, stack_top);
+    cpu_local_table[cpu].current = idle;
+    cpu_local_table[cpu].sched_unit = sched_get_unit(cpu);
+    cpu_apic_ids[cpu] = apic_id;
+
+    *TRAMPOLINE_ARG(trampoline, ap_boot_stack) = stack_top;
+    ap_boot_cpu = cpu;
+    ap_boot_done = 0;
+    /* INIT-SIPI-SIPI */
+    lapic_send_init(apic_id);
+    mdelay(10);
+    lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR);
+    udelay(200);
+    if (!ap_boot_done)
+        lapic_send_startup(apic_id, AP_TRAMPOLINE_ADDR);
+    int timeout = AP_BOOT_TIMEOUT;
+    while (!ap_boot_done && timeout-- > 0)
+        mdelay(1);
+    return ap_boot_done ? 0 : -1;
+}
+
+/**
+ * 根据MADT启动所有的应用处理器，返回启动后的cpu数量
+ * 需要在时钟初始化并且打开中断后调用，校准本地APIC定时器需要时钟节拍
+ */
+int smp_boot_cpus()
+{
+    if (acpi_madt_init() < 0 || apic_init() < 0)
+        return 1;
+    interrupt_register_handler(APIC_VECTOR_TIMER, apic_timer_handler);
+    interrupt_register_handler(APIC_VECTOR_RESCHED, apic_resched_handler);
+    interrupt_register_handler(APIC_VECTOR_TLB, apic_tlb_handler);
+    interrupt_register_handler(APIC_VECTOR_SPURIOUS, apic_spurious_handler);
+    if (acpi_madt_info.cpu_nr <= 1)
+        return 1;
+    lapic_timer_calibrate();
+
+    unsigned int bsp_id = lapic_get_id();
+    cpu_apic_ids[0] = bsp_id;
+    unsigned char *trampoline = kern_phy_addr2vir_addr(AP_TRAMPOLINE_ADDR);
+    memcpy(trampoline, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    *TRAMPOLINE_ARG(trampoline, ap_boot_pgdir) = KERN_PAGE_DIR_PHY_ADDR;
+    *TRAMPOLINE_ARG(trampoline, ap_boot_cr4) = cpu_cr4_read();
+    *TRAMPOLINE_ARG(trampoline, ap_boot_entry) = (unsigned long) smp_ap_entry;
+
+    /* 应用处理器开启分页时还在低端地址执行，临时把低端内存映射到相同的地址 */
+    pde_t *pgdir = (pde_t *) KERN_PAGE_DIR_VIR_ADDR;
+    pde_t old_pde = pgdir[0];
+    pgdir[0] = pgdir[KERN_PAGE_DIR_ENTRY_OFF];
+    tlb_flush();
+
+    cpuid_t cpu = 1;
+    int i;
+    for (i = 0; i < acpi_madt_info.cpu_nr && cpu < CPU_NR_MAX; i++) {
+        if (acpi_madt_info.apic_ids[i] == bsp_id)
+            continue;
+        if (smp_boot_ap(cpu, acpi_madt_info.apic_ids[i], trampoline) < 0) {
+            /* 超时的cpu可能稍后才启动，不能再复用启动代码，所以停止启动剩下的cpu */
+            keprint(PRINT_WARING "[smp] cpu with apic id %d not respond!\n",
+                acpi_madt_info.apic_ids[i]);
+            break;
+        }
+        cpu++;
+    }
+    pgdir[0] = old_pde;
+    tlb_flush();
+    return cpu;
+}
@@ -0,0 +1,73 @@
+; 应用处理器的启动代码
+; 启动cpu把这段代码复制到AP_TRAMPOLINE_ADDR，然后发送STARTUP IPI，
+; 应用处理器从实模式开始执行，进入保护模式并开启分页后跳转到内核中。
+
+AP_TRAMPOLINE_ADDR  EQU 0x8000      ; 和smp.h中的AP_TRAMPOLINE_ADDR保持一致
+
+; 标号复制后的物理地址
+%define TRAMPOLINE_ADDR(label)  (AP_TRAMPOLINE_ADDR + (label) - ap_trampoline_start)
+
+[section .data]
+[bits 16]
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_boot_pgdir
+global ap_boot_cr4
+global ap_boot_stack
+global ap_boot_entry
+
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    lgdt [TRAMPOLINE_ADDR(ap_gdt_ptr)]
+
+    mov eax, cr0
+    or eax, 1
+    mov cr0, eax
+    jmp dword 0x08:TRAMPOLINE_ADDR(ap_protect_mode)
+
+[bits 32]
+ap_protect_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; 和启动cpu一样开启大页，内核线性映射可能使用了4MB的页
+    mov eax, [TRAMPOLINE_ADDR(ap_boot_cr4)]
+    test eax, eax
+    jz .no_cr4
+    mov cr4, eax
+.no_cr4:
+    ; 使用内核页目录，启动cpu已经临时映射了低端内存
+    mov eax, [TRAMPOLINE_ADDR(ap_boot_pgdir)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, 0x80010000      ; PG | WP
+    mov cr0, eax
+
+    ; 切换到idle任务的内核栈，跳转到内核虚拟地址
+    mov esp, [TRAMPOLINE_ADDR(ap_boot_stack)]
+    mov eax, [TRAMPOLINE_ADDR(ap_boot_entry)]
+    jmp eax
+
+align 8
+ap_gdt:
+    dq 0x0000000000000000
+    dq 0x00cf9a000000ffff   ; 内核代码段
+    dq 0x00cf92000000ffff   ; 内核数据段
+ap_gdt_ptr:
+    dw 3 * 8 - 1
+    dd TRAMPOLINE_ADDR(ap_gdt)
+
+; 由启动cpu在复制后填写
+ap_boot_pgdir:  dd 0
+ap_boot_cr4:    dd 0
+ap_boot_stack:  dd 0
+ap_boot_entry:  dd 0
+
+ap_trampoline_end:
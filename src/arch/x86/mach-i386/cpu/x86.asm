@@ -100,6 +100,17 @@ cpu_cr0_write:
 	mov eax,[esp+4]
 	mov cr0,eax
 	ret	
+
+global cpu_cr4_read
+cpu_cr4_read:
+	mov eax,cr4
+	ret
+
+global cpu_cr4_write
+cpu_cr4_write:
+	mov eax,[esp+4]
+	mov cr4,eax
+	ret
 	
 global gdt_register_get 
 gdt_register_get:
@@ -176,6 +187,14 @@ cpu_do_sleep: ;void cpu_do_sleep();
 	hlt
 	ret
 
+;关中断检查完睡眠条件后调用，sti的下一条指令执行完才响应中断，
+;所以检查之后到的中断一定会唤醒hlt
+global cpu_do_safe_sleep
+cpu_do_safe_sleep: ;void cpu_do_safe_sleep();
+	sti
+	hlt
+	ret
+
 global mem_xchg8
 ; char mem_xchg8(char *ptr, char value);
 mem_xchg8:
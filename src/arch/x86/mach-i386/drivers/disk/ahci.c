@@ -18,6 +18,10 @@
 #include <xbook/bitops.h>
 #include <xbook/dma.h>
 #include <xbook/task.h>
+#include <xbook/schedule.h>
+#include <xbook/waitqueue.h>
+#include <xbook/timer.h>
+#include <arch/interrupt.h>
 #include <xbook/virmem.h>
 #include <assert.h>
 #include <sys/ioctl.h>
@@ -355,6 +359,24 @@ struct ata_identify {
 #define HBA_GHC_INTERRUPT_ENABLE (1 << 1)
 #define HBA_GHC_RESET (1 << 0)
 
+#define HBA_CAP_SNCQ (1 << 30)      /* 支持NCQ */
+#define HBA_CAP_NCS(cap) ((((cap) >> 8) & 0x1f) + 1)   /* 命令槽数量 */
+
+/* 端口中断状态 */
+#define HBA_PxIS_DHRS (1 << 0)      /* D2H寄存器FIS */
+#define HBA_PxIS_PSS  (1 << 1)      /* PIO Setup FIS */
+#define HBA_PxIS_DSS  (1 << 2)      /* DMA Setup FIS */
+#define HBA_PxIS_SDBS (1 << 3)      /* Set Device Bits FIS，NCQ命令完成 */
+#define HBA_PxIS_DPS  (1 << 5)      /* PRD处理完成 */
+#define HBA_PxIS_IFS  (1 << 27)     /* 接口致命错误 */
+#define HBA_PxIS_HBDS (1 << 28)     /* 主机总线数据错误 */
+#define HBA_PxIS_HBFS (1 << 29)     /* 主机总线致命错误 */
+#define HBA_PxIS_TFES (1 << 30)     /* 任务文件错误 */
+
+#define HBA_PxIS_DONE (HBA_PxIS_DHRS | HBA_PxIS_PSS | HBA_PxIS_DSS | \
+        HBA_PxIS_SDBS | HBA_PxIS_DPS)
+#define HBA_PxIS_ERROR (HBA_PxIS_IFS | HBA_PxIS_HBDS | HBA_PxIS_HBFS | HBA_PxIS_TFES)
+
 #define ATA_CMD_IDENTIFY 0xEC
 
 #define ATA_DEV_BUSY 0x80
@@ -363,17 +385,40 @@ struct ata_identify {
 
 #define ATA_CMD_READ_DMA_EX 0x25
 #define ATA_CMD_WRITE_DMA_EX 0x35
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+
+/* identify数据中的字 */
+#define ATA_IDENT_QUEUE_DEPTH 75
+#define ATA_IDENT_SATA_CAP 76
+#define ATA_SATA_CAP_NCQ (1 << 8)
 
 #define PRDT_MAX_COUNT 0x1000
 
 #define PRDT_MAX_ENTRIES 65535
 
+/* 每个命令表占一页，除去128字节的头，最多可以容纳的PRD项 */
+#define AHCI_SLOT_PRDT_ENTRIES ((0x1000 - 0x80) / sizeof(struct hba_prdt_entry))
+/* 单个命令最多传输的扇区数 */
+#define AHCI_MAX_SECTORS_PER_CMD ((AHCI_SLOT_PRDT_ENTRIES * PRDT_MAX_COUNT) / ATA_SECTOR_SIZE)
+
 #define ATA_TFD_TIMEOUT  1000000
 #define AHCI_CMD_TIMEOUT 1000000
 
 #define ATA_SECTOR_SIZE 512
 
-#define AHCI_DEFAULT_INT 0
+#define AHCI_DEFAULT_INT (HBA_PxIS_DONE | HBA_PxIS_ERROR)
+
+/* 异步请求使用每个命令槽自己的DMA缓冲区，超过的请求走同步路径 */
+#define AHCI_ASYNC_BUF_SIZE (64 * 1024)
+
+/* 命令槽的完成状态 */
+#define AHCI_SLOT_BUSY  0
+#define AHCI_SLOT_DONE  1
+#define AHCI_SLOT_ERROR -1
+
+/* 命令发出后等待完成中断的最长时间，超时后端口上所有的命令都失败，由复位清除 */
+#define AHCI_SLOT_TIMEOUT MSEC_TO_TICKS(5000)
 
 #define	SATA_SIG_ATA	0x00000101	// SATA drive
 #define	SATA_SIG_ATAPI	0xEB140101	// SATAPI drive
@@ -407,7 +452,17 @@ typedef struct _device_extension {
 	void *ch[HBA_COMMAND_HEADER_NUM];
 	struct dma_region ch_dmas[HBA_COMMAND_HEADER_NUM];
 	struct ata_identify identify;
-	uint32_t slots;
+	uint32_t slots;         /* 已经分配的命令槽 */
+	uint32_t issued;        /* 已经发送给设备，还没有完成的命令槽 */
+	int ncq;                /* 是否使用NCQ */
+	int queue_depth;        /* 可以同时使用的命令槽数量 */
+	int error;              /* 发生错误，需要复位端口 */
+	volatile int slot_status[HBA_COMMAND_HEADER_NUM];   /* 命令槽的完成状态 */
+	wait_queue_t slot_waiters;  /* 等待空闲命令槽的任务 */
+	wait_queue_t done_waiters[HBA_COMMAND_HEADER_NUM];  /* 等待命令完成的任务 */
+	timer_t slot_timers[HBA_COMMAND_HEADER_NUM];    /* 命令的超时定时器 */
+	io_request_t *slot_ioreq[HBA_COMMAND_HEADER_NUM];   /* 命令槽上的异步请求 */
+	struct dma_region async_dmas[HBA_COMMAND_HEADER_NUM];   /* 异步请求的DMA缓冲区 */
 	int created;
 } device_extension_t;
 
@@ -592,11 +647,103 @@ void ahci_reset_device(struct hba_memory *abar, struct hba_port *port, device_ex
 	port->interrupt_status = ~0; /* clear pending interrupts */
 	port->interrupt_enable = AHCI_DEFAULT_INT; /* we want some interrupts */
 	ahci_start_port_command_engine(port);
-	dev->slots=0;
+	/* 命令槽由各自的请求者释放，这里只清除已经发送的命令 */
+	dev->issued = 0;
 	port->sata_error = ~0;
 }
 
-int ahci_port_dma_data_transfer(struct hba_memory *abar, struct hba_port *port, device_extension_t *dev, int slot, int write, addr_t virt_buffer, int sectors, uint64_t lba)
+static void ahci_port_release_slot_locked(device_extension_t *dev, int slot);
+
+/**
+ * 完成命令槽上的异步请求，在中断中调用
+ */
+static void ahci_port_complete_async(device_extension_t *dev, int slot, int status)
+{
+	io_request_t *ioreq = dev->slot_ioreq[slot];
+	dev->slot_ioreq[slot] = NULL;
+	if (status == AHCI_SLOT_DONE) {
+		if (ioreq->flags & IOREQ_READ_OPERATION) {
+			memcpy(ioreq->system_buffer, (void *)dev->async_dmas[slot].v,
+				ioreq->parame.read.length);
+			ioreq->io_status.infomation = ioreq->parame.read.length;
+		} else {
+			ioreq->io_status.infomation = ioreq->parame.write.length;
+		}
+		ioreq->io_status.status = IO_SUCCESS;
+	} else {
+		keprint(PRINT_ERR "[ahci]: device %d: slot %d async command failed\n", dev->idx, slot);
+		ioreq->io_status.status = IO_FAILED;
+	}
+	ahci_port_release_slot_locked(dev, slot);
+	io_complete_request(ioreq);
+}
+
+/**
+ * 完成端口上已经结束的命令，唤醒等待的请求者，在中断中调用
+ */
+static void ahci_port_complete(struct hba_port *port, device_extension_t *dev, uint32_t int_status)
+{
+	uint32_t done;
+	int status = AHCI_SLOT_DONE;
+	if (int_status & HBA_PxIS_ERROR) {
+		/* 出错后端口会停止处理命令，所有未完成的命令都失败 */
+		done = dev->issued;
+		status = AHCI_SLOT_ERROR;
+		dev->error = 1;
+	} else {
+		done = dev->issued & ~(port->sata_active | port->command_issue);
+		if (done && !dev->ncq && (port->task_file_data & ATA_DEV_ERR)) {
+			status = AHCI_SLOT_ERROR;
+			dev->error = 1;
+		}
+	}
+	int slot;
+	for (slot = 0; done; slot++, done >>= 1) {
+		if (!(done & 1))
+			continue;
+		dev->issued &= ~(1 << slot);
+		timer_cancel(&dev->slot_timers[slot]);
+		dev->slot_status[slot] = status;
+		if (dev->slot_ioreq[slot])
+			ahci_port_complete_async(dev, slot, status);
+		else
+			wait_queue_wakeup(&dev->done_waiters[slot]);
+	}
+}
+
+/**
+ * 命令超时，在定时器软中断中执行。按端口出错处理，所有发出的命令都失败，
+ * 请求者或者下一次提交时复位端口，复位会清除PxCI和PxSACT中的命令
+ */
+static void ahci_port_timeout(timer_t *timer, void *arg)
+{
+	device_extension_t *dev = (device_extension_t *)arg;
+	int slot = timer - dev->slot_timers;
+	unsigned long flags;
+	interrupt_save_and_disable(flags);
+	if (dev->issued & (1 << slot)) {
+		keprint(PRINT_ERR "[ahci]: device %d: slot %d command timeout\n", dev->idx, slot);
+		ahci_port_complete((struct hba_port *)&hba_mem->ports[dev->idx], dev, HBA_PxIS_ERROR);
+	}
+	interrupt_restore_state(flags);
+}
+
+/* 端口出错后复位，多个请求同时失败时只复位一次 */
+static void ahci_port_recover(struct hba_memory *abar, struct hba_port *port, device_extension_t *dev)
+{
+	mutex_lock(&dev->lock);
+	if (dev->error) {
+		ahci_reset_device(abar, port, dev);
+		dev->error = 0;
+	}
+	mutex_unlock(&dev->lock);
+}
+
+/**
+ * 构建命令并发送给设备，需要关闭中断调用
+ * @return: 成功返回0，端口挂起返回-1
+ */
+static int ahci_port_issue(struct hba_memory *abar, struct hba_port *port, device_extension_t *dev, int slot, int write, addr_t virt_buffer, int sectors, uint64_t lba)
 {
 	int timeout;
 	int fis_len = sizeof(struct fis_reg_host_to_device) / 4;
@@ -604,66 +751,79 @@ int ahci_port_dma_data_transfer(struct hba_memory *abar, struct hba_port *port,
 			slot, 0, ATA_SECTOR_SIZE * sectors, virt_buffer);
 	ahci_initialize_command_header(abar,
 			port, dev, slot, write, 0, ne, fis_len);
-	struct fis_reg_host_to_device *fis = ahci_initialize_fis_host_to_device(abar,
-			port, dev, slot, 1, write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX);
+	struct fis_reg_host_to_device *fis;
+	if (dev->ncq) {
+		fis = ahci_initialize_fis_host_to_device(abar, port, dev, slot, 1,
+				write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED);
+		/* NCQ命令的扇区数放在feature中，count中放的是标签 */
+		fis->feature_l = sectors & 0xFF;
+		fis->feature_h = (sectors >> 8) & 0xFF;
+		fis->count_l = slot << 3;
+		fis->count_h = 0;
+	} else {
+		fis = ahci_initialize_fis_host_to_device(abar, port, dev, slot, 1,
+				write ? ATA_CMD_WRITE_DMA_EX : ATA_CMD_READ_DMA_EX);
+		fis->count_l = sectors & 0xFF;
+		fis->count_h = (sectors >> 8) & 0xFF;
+	}
 	fis->device = 1<<6;
 	/* WARNING: assumes little-endian */
-	fis->count_l = sectors & 0xFF;
-	fis->count_h = (sectors >> 8) & 0xFF;
-	
 	fis->lba0 = (unsigned char)( lba        & 0xFF);
 	fis->lba1 = (unsigned char)((lba >> 8)  & 0xFF);
 	fis->lba2 = (unsigned char)((lba >> 16) & 0xFF);
 	fis->lba3 = (unsigned char)((lba >> 24) & 0xFF);
 	fis->lba4 = (unsigned char)((lba >> 32) & 0xFF);
 	fis->lba5 = (unsigned char)((lba >> 40) & 0xFF);
-	port->sata_error = ~0;
-	timeout = ATA_TFD_TIMEOUT;
-	while ((port->task_file_data & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && --timeout)
-	{
-		//tm_schedule();
-        // cpu yield
-        cpu_pause();
-        //task_yield();
-	}
-	if(!timeout) goto port_hung;
-	
-	port->sata_error = ~0;
-	ahci_send_command(port, slot);
-	timeout = ATA_TFD_TIMEOUT;
-	while ((port->task_file_data & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && --timeout)
-	{
-		cpu_pause();
-        //task_yield();
-	}
-	if(!timeout) goto port_hung;
-	
-	timeout = AHCI_CMD_TIMEOUT;
-	while(--timeout)
-	{
-		if(!((port->sata_active | port->command_issue) & (1 << slot)))
-			break;
-		cpu_pause();
-        //task_yield();
+
+	if (!dev->issued) {
+		/* 端口空闲时需要等待设备就绪，NCQ命令在队列中时设备会很快清除BSY */
+		timeout = ATA_TFD_TIMEOUT;
+		while ((port->task_file_data & (ATA_DEV_BUSY | ATA_DEV_DRQ)) && --timeout)
+			cpu_pause();
+		if(!timeout)
+			return -1;
+		port->sata_error = ~0;
 	}
-	if(!timeout) goto port_hung;
-	if(port->sata_error)
-	{
-		keprint(PRINT_ERR "[ahci]: device %d: ahci error\n", dev->idx);
-		goto error;
+	dev->slot_status[slot] = AHCI_SLOT_BUSY;
+	dev->issued |= (1 << slot);
+	if (dev->ncq)
+		port->sata_active = (1 << slot);
+	port->command_issue = (1 << slot);
+	ahci_flush_commands(port);
+	timer_cancel(&dev->slot_timers[slot]);
+	timer_modify(&dev->slot_timers[slot], AHCI_SLOT_TIMEOUT);
+	timer_add(&dev->slot_timers[slot]);
+	return 0;
+}
+
+int ahci_port_dma_data_transfer(struct hba_memory *abar, struct hba_port *port, device_extension_t *dev, int slot, int write, addr_t virt_buffer, int sectors, uint64_t lba)
+{
+	unsigned long flags;
+	if (dev->error)
+		ahci_port_recover(abar, port, dev);
+	interrupt_save_and_disable(flags);
+	if (ahci_port_issue(abar, port, dev, slot, write, virt_buffer, sectors, lba) < 0) {
+		interrupt_restore_state(flags);
+		goto port_hung;
 	}
-	if(port->task_file_data & ATA_DEV_ERR)
-	{
-		keprint(PRINT_ERR "[ahci]: device %d: task file data error\n", dev->idx);
-		goto error;
+	/* 休眠等待中断处理函数完成命令，超时由ahci_port_timeout让命令失败 */
+	while (dev->slot_status[slot] == AHCI_SLOT_BUSY) {
+		wait_queue_add(&dev->done_waiters[slot], task_current);
+		task_block(TASK_BLOCKED);
 	}
-	return 1;
+	interrupt_restore_state(flags);
+
+	if (dev->slot_status[slot] == AHCI_SLOT_DONE)
+		return 1;
+	keprint(PRINT_ERR "[ahci]: device %d: slot %d command failed\n", dev->idx, slot);
+	goto error;
 	port_hung:
 	keprint(PRINT_ERR "[ahci]: device %d: port hung\n", dev->idx);
+	dev->error = 1;
 	error:
 	keprint(PRINT_ERR "[ahci]: device %d: tfd=%x, serr=%x\n",
 			dev->idx, port->task_file_data, port->sata_error);
-	ahci_reset_device(abar, port, dev);
+	ahci_port_recover(abar, port, dev);
 	return 0;
 }
 
@@ -851,7 +1011,26 @@ int ahci_initialize_device(struct hba_memory *abar, device_extension_t *dev)
     #ifdef DEBUG_AHCI
     dbgprint("[AHCI]: map command list dma addr and fis dma addr done.\n");
     #endif
-	return ahci_device_identify_ahci(abar, port, dev);
+	dev->issued = 0;
+	dev->error = 0;
+	wait_queue_init(&dev->slot_waiters);
+	for(i=0;i<HBA_COMMAND_HEADER_NUM;i++) {
+		wait_queue_init(&dev->done_waiters[i]);
+		timer_init(&dev->slot_timers[i], AHCI_SLOT_TIMEOUT, dev, ahci_port_timeout);
+	}
+	if (!ahci_device_identify_ahci(abar, port, dev))
+		return 0;
+	/* 控制器和磁盘都支持NCQ时使用所有的命令槽，否则一次只能有一个命令 */
+	uint16_t *ident = (uint16_t *)&dev->identify;
+	dev->ncq = 0;
+	dev->queue_depth = 1;
+	if ((abar->capability & HBA_CAP_SNCQ) && (ident[ATA_IDENT_SATA_CAP] & ATA_SATA_CAP_NCQ)) {
+		dev->ncq = 1;
+		dev->queue_depth = min((ident[ATA_IDENT_QUEUE_DEPTH] & 0x1f) + 1, HBA_CAP_NCS(abar->capability));
+	}
+    keprint(PRINT_INFO "[ahci]: device %d: ncq %s, queue depth %d\n", dev->idx,
+        dev->ncq ? "on" : "off", dev->queue_depth);
+	return 1;
 }
 
 iostatus_t ahci_create_device(driver_object_t *driver, device_extension_t *dev)
@@ -868,8 +1047,8 @@ iostatus_t ahci_create_device(driver_object_t *driver, device_extension_t *dev)
         keprint(PRINT_ERR "[ahci]: create device on port %d failed!\n", dev->idx);
         return status;
     }
-    /* buffered io mode */
-    devobj->flags = DO_BUFFERED_IO;
+    /* buffered io mode，命令槽自己处理并发，不需要框架串行化请求 */
+    devobj->flags = DO_BUFFERED_IO | DO_ASYNC_IO;
     devobj->device_extension = dev;
     dev->device_object = devobj;
 	dev->created = 1;
@@ -895,6 +1074,7 @@ int ahci_probe_ports(driver_object_t *driver, struct hba_memory *abar)
                 #endif
                 /* 创建设备扩展 */
 				ports[i] = mem_alloc(sizeof(device_extension_t));
+				memset(ports[i], 0, sizeof(device_extension_t));
 				ports[i]->type = type;
 				ports[i]->idx = i;
                 mutexlock_init(&(ports[i]->lock));
@@ -930,29 +1110,75 @@ int ahci_probe_ports(driver_object_t *driver, struct hba_memory *abar)
 
 int ahci_port_acquire_slot(device_extension_t *dev)
 {
+	unsigned long flags;
+	int i;
+	interrupt_save_and_disable(flags);
 	while(1) {
-		int i;
-		mutex_lock(&dev->lock);
-		for(i=0;i<32;i++)
+		for(i=0;i<dev->queue_depth;i++)
 		{
 			if(!(dev->slots & (1 << i))) {
 				dev->slots |= (1 << i);
-				mutex_unlock(&dev->lock);
+				interrupt_restore_state(flags);
 				return i;
 			}
 		}
-		mutex_unlock(&dev->lock);
-		// yield
-        cpu_pause();
-        //task_yield();
+		/* 没有空闲的命令槽，休眠等待其它请求释放 */
+		wait_queue_add(&dev->slot_waiters, task_current);
+		task_block(TASK_BLOCKED);
 	}
 }
 
-void ahci_port_release_slot(device_extension_t *dev, int slot)
+static void ahci_port_release_slot_locked(device_extension_t *dev, int slot)
 {
-	mutex_lock(&dev->lock);
 	dev->slots &= ~(1 << slot);
-	mutex_unlock(&dev->lock);
+	wait_queue_wakeup(&dev->slot_waiters);
+}
+
+void ahci_port_release_slot(device_extension_t *dev, int slot)
+{
+	unsigned long flags;
+	interrupt_save_and_disable(flags);
+	ahci_port_release_slot_locked(dev, slot);
+	interrupt_restore_state(flags);
+}
+
+/**
+ * 提交异步请求，命令完成后在中断中完成请求
+ * @return: 成功返回0，失败返回-1
+ */
+static int ahci_port_submit_async(device_extension_t *dev, io_request_t *ioreq, int write, uint64_t lba, int sectors)
+{
+	struct hba_port *port = (struct hba_port *)&hba_mem->ports[dev->idx];
+	unsigned long flags;
+	int slot = ahci_port_acquire_slot(dev);
+	struct dma_region *dma = &dev->async_dmas[slot];
+	if (!dma->v) {  /* 第一次使用时分配，之后一直保留 */
+		dma->p.size = AHCI_ASYNC_BUF_SIZE;
+		dma->p.alignment = 0x1000;
+		dma->flags = DMA_REGION_SPECIAL;
+		if (dma_alloc_buffer(dma) < 0) {
+			dma->v = 0;
+			ahci_port_release_slot(dev, slot);
+			return -1;
+		}
+	}
+	if (write)
+		memcpy((void *)dma->v, ioreq->system_buffer, ioreq->parame.write.length);
+	if (dev->error)
+		ahci_port_recover(hba_mem, port, dev);
+	interrupt_save_and_disable(flags);
+	dev->slot_ioreq[slot] = ioreq;
+	if (ahci_port_issue(hba_mem, port, dev, slot, write, dma->v, sectors, lba) < 0) {
+		dev->slot_ioreq[slot] = NULL;
+		interrupt_restore_state(flags);
+		keprint(PRINT_ERR "[ahci]: device %d: port hung\n", dev->idx);
+		dev->error = 1;
+		ahci_port_release_slot(dev, slot);
+		ahci_port_recover(hba_mem, port, dev);
+		return -1;
+	}
+	interrupt_restore_state(flags);
+	return 0;
 }
 
 /* since a DMA transfer must write to contiguous physical RAM, we need to allocate
@@ -1011,9 +1237,9 @@ int ahci_rw_multiple(int rw, int min, uint64_t blk, unsigned char *out_buffer, i
 	int i=0;
 	int ret=0;
 	int c = count;
-	for(i=0;i<count;i+=(PRDT_MAX_ENTRIES * PRDT_MAX_COUNT) / ATA_SECTOR_SIZE)
+	for(i=0;i<count;i+=AHCI_MAX_SECTORS_PER_CMD)
 	{
-		int n = (PRDT_MAX_ENTRIES * PRDT_MAX_COUNT) / ATA_SECTOR_SIZE;
+		int n = AHCI_MAX_SECTORS_PER_CMD;
 		if(n > c)
 			n=c;
 		ret += ahci_rw_multiple_do(rw, min, blk+i, out_buffer + ret, n);
@@ -1092,6 +1318,15 @@ iostatus_t ahci_read(device_object_t *device, io_request_t *ioreq)
     } else {
         off = ioreq->parame.read.offset;
     }
+    /* 异步请求不等待命令完成，由中断完成请求 */
+    if ((ioreq->flags & IOREQ_ASYNC) && sectors * SECTOR_SIZE <= AHCI_ASYNC_BUF_SIZE &&
+        off + sectors <= ext->size) {
+        if (!ahci_port_submit_async(ext, ioreq, 0, off, sectors))
+            return IO_PENDING;
+        ioreq->io_status.status = IO_FAILED;
+        io_complete_request(ioreq);
+        return IO_FAILED;
+    }
     len = ahci_read_sector(device->device_extension, off,
         ioreq->system_buffer, sectors);
     if (!len) { /* 执行失败 */
@@ -1124,6 +1359,14 @@ iostatus_t ahci_write(device_object_t *device, io_request_t *ioreq)
     } else {
         off = ioreq->parame.write.offset;
     }
+    if ((ioreq->flags & IOREQ_ASYNC) && sectors * SECTOR_SIZE <= AHCI_ASYNC_BUF_SIZE &&
+        off + sectors <= ext->size) {
+        if (!ahci_port_submit_async(ext, ioreq, 1, off, sectors))
+            return IO_PENDING;
+        ioreq->io_status.status = IO_FAILED;
+        io_complete_request(ioreq);
+        return IO_FAILED;
+    }
     len = ahci_write_sector(device->device_extension, off,
         ioreq->system_buffer, sectors);
     
@@ -1149,12 +1392,16 @@ static int ahci_handler(irqno_t irq, void *data)
 {
     int intrhandled = IRQ_NEXTONE;
     int i;
+    uint32_t int_status;
 	for(i=0;i<32;i++) {
 		if(hba_mem->interrupt_status & (1 << i)) {
-            dbgprint("ahci: interrupt %d occur!\n", i);
-			hba_mem->ports[i].interrupt_status = ~0;
+            struct hba_port *port = (struct hba_port *)&hba_mem->ports[i];
+            int_status = port->interrupt_status;
+			port->interrupt_status = int_status;
 			hba_mem->interrupt_status = (1 << i);
-			ahci_flush_commands((struct hba_port *)&hba_mem->ports[i]);
+            if (ports[i] && ports[i]->created)
+                ahci_port_complete(port, ports[i], int_status);
+			ahci_flush_commands(port);
             intrhandled = IRQ_HANDLED;
 		}
 	}
@@ -1205,8 +1452,11 @@ static iostatus_t ahci_exit(driver_object_t *driver)
         dma_free_buffer(&(ext->dma_clb));
         dma_free_buffer(&(ext->dma_fis));
         int j;
-        for(j = 0; j < HBA_COMMAND_HEADER_NUM; j++)
+        for(j = 0; j < HBA_COMMAND_HEADER_NUM; j++) {
             dma_free_buffer(&(ext->ch_dmas[j]));
+            if (ext->async_dmas[j].v)
+                dma_free_buffer(&(ext->async_dmas[j]));
+        }
 
         mem_free(ext);
         io_delete_device(devobj);   /* 删除每一个设备 */
@@ -7,10 +7,17 @@
 #include <xbook/driver.h>
 #include <string.h>
 #include <xbook/clock.h>
+#include <xbook/timer.h>
 #include <arch/io.h>
 #include <xbook/hardirq.h>
 #include <arch/cpu.h>
 #include <xbook/memalloc.h>
+#include <xbook/mutexlock.h>
+#include <xbook/waitqueue.h>
+#include <xbook/schedule.h>
+#include <xbook/dma.h>
+#include <arch/interrupt.h>
+#include <arch/pci.h>
 #include <sys/ioctl.h>
 #include <stdio.h>
 
@@ -104,6 +111,28 @@
 #define ATA_REG_ALT_STATUS(channel) 	(channel->base + 0x206)
 #define ATA_REG_CTL(channel) 			ATA_REG_ALT_STATUS(channel)
 
+/* 总线主控IDE（PCI IDE控制器的BAR4），从通道的寄存器在主通道后8字节 */
+#define ATA_REG_BM_CMD(channel) 		(channel->bmide + 0)
+#define ATA_REG_BM_STATUS(channel) 		(channel->bmide + 2)
+#define ATA_REG_BM_PRDT(channel) 		(channel->bmide + 4)
+
+#define BM_CMD_START		0x01	// 启动总线主控传输
+#define BM_CMD_READ			0x08	// 传输方向：从磁盘写入内存
+
+#define BM_STATUS_ACTIVE	0x01	// 正在传输
+#define BM_STATUS_ERR		0x02	// 传输出错，写1清除
+#define BM_STATUS_IRQ		0x04	// 磁盘产生了中断，写1清除
+
+#define PRD_FLAGS_EOT		0x8000	// 最后一个描述符
+#define PRD_BOUNDARY		0x10000	// 一个描述符的缓冲区不能跨越64KB边界
+
+/* DMA缓冲区能容纳的扇区数，正好是LBA28一条命令的最大扇区数 */
+#define IDE_DMA_SECTORS		256
+#define IDE_DMA_BUF_SIZE	(IDE_DMA_SECTORS * SECTOR_SIZE)
+
+/* 等待DMA完成中断的最长时间，超时后认为中断丢失 */
+#define IDE_DMA_TIMEOUT		MSEC_TO_TICKS(5000)
+
 /* 设备寄存器的位 */
 #define BIT_DEV_MBS		0xA0	//bit 7 and 5 are 1
 
@@ -113,13 +142,35 @@
 		(slave << 4) | \
 		head)
 
+/* 物理区域描述符，描述一段DMA缓冲区 */
+struct ide_prd {
+	unsigned int addr;		/* 缓冲区物理地址 */
+	unsigned short count;	/* 字节数，0表示64KB */
+	unsigned short flags;	/* 最后一个描述符需要置EOT位 */
+} __attribute__((packed));
+
 /* IDE通道结构体 */
 struct ide_channel {
    	unsigned short base;    // I/O Base.
 	char irqno;		 	// 本通道所用的中断号
-   	struct _device_extension *ext;	// 通道上面的设备
+   	struct _device_extension *ext[2];	// 通道上面的主从设备
 	char who;		    /* 通道上主磁盘在活动还是从磁盘在活动 */
 	char what;		    /* 执行的是什么操作 */
+	unsigned short bmide;	/* 总线主控寄存器基址，为0表示不支持DMA */
+	struct dma_region prdt;		/* PRD表 */
+	struct dma_region dma_buf;	/* DMA缓冲区，物理上连续 */
+	mutexlock_t lock;		/* 主从磁盘共用一个通道，传输时需要互斥 */
+	wait_queue_t wait_queue;	/* 等待DMA传输完成的任务 */
+	volatile char dma_active;	/* 正在进行DMA传输 */
+	volatile unsigned char dma_status;	/* 中断中读取的总线主控状态 */
+	volatile unsigned char ata_status;	/* 中断中读取的磁盘状态 */
+	volatile char dma_timeout;	/* DMA传输超时，中断没有到来 */
+	timer_t dma_timer;		/* DMA传输超时定时器 */
+	io_request_t *async_cur;	/* 正在传输的异步请求 */
+	io_request_t *async_next;	/* 排队的异步请求，每个通道只排一个 */
+	unsigned char async_mode;	/* 异步请求的寻址模式，刷新写缓冲区时选择命令 */
+	char async_flush;		/* 异步写的数据已经传输，正在刷新写缓冲区 */
+	char sync_busy;			/* 同步传输占用通道，异步请求需要排队 */
 } channels[2];
 
 typedef struct _device_extension {
@@ -135,6 +186,7 @@ typedef struct _device_extension {
 	unsigned int capabilities;// Features.
 	unsigned int command_sets; // Command Sets Supported.
 	unsigned int size;		// Size in Sectors.
+	unsigned char dma;		// 是否使用总线主控DMA传输
 
     unsigned long rwoffset; // 读写偏移位置
 	/* 状态信息 */
@@ -756,8 +808,8 @@ static void select_sector(device_extension_t *ext,
 	if (mode == 2) {
 		out8(ATA_REG_FEATURE(channel), 0); // PIO mode.
 
-		/* 写入要读写的扇区数*/
-		out8(ATA_REG_SECTOR_CNT(channel), 0);
+		/* 写入要读写的扇区数的高8位 */
+		out8(ATA_REG_SECTOR_CNT(channel), (count >> 8) & 0xff);
 
 		/* 写入lba地址24~47位(即扇区号) */
 		out8(ATA_REG_SECTOR_LOW(channel), lbaIO[3]);
@@ -915,6 +967,376 @@ static int pio_data_transfer(device_extension_t *ext,
 	return 0;
 }
 
+/**
+ * dma_prepare - 准备总线主控DMA传输
+ * @ext: 设备
+ * @rw: 传输方向（读，写）
+ * @buf: 扇区缓冲
+ * @count: 扇区数，不超过IDE_DMA_SECTORS
+ * 
+ * 填写PRD表，设置传输方向，需要在发送命令前调用
+ */
+static void dma_prepare(device_extension_t *ext,
+	unsigned char rw,
+	unsigned char *buf,
+	unsigned int count)
+{
+	struct ide_channel *channel = ext->channel;
+	struct ide_prd *prd = (struct ide_prd *) channel->prdt.v;
+	addr_t addr = channel->dma_buf.p.address;
+	unsigned int left = count * SECTOR_SIZE;
+	unsigned int len;
+
+	if (rw == IDE_WRITE)
+		memcpy((void *) channel->dma_buf.v, buf, left);
+
+	/* 按64KB边界拆分缓冲区 */
+	while (left > 0) {
+		len = PRD_BOUNDARY - (addr & (PRD_BOUNDARY - 1));
+		if (len > left)
+			len = left;
+		prd->addr = addr;
+		prd->count = len & 0xffff;
+		prd->flags = 0;
+		addr += len;
+		left -= len;
+		if (!left)
+			prd->flags = PRD_FLAGS_EOT;
+		prd++;
+	}
+
+	/* 停止上一次传输，清除状态，写入PRD表地址和方向 */
+	out8(ATA_REG_BM_CMD(channel), 0);
+	out8(ATA_REG_BM_STATUS(channel), in8(ATA_REG_BM_STATUS(channel)) |
+		BM_STATUS_ERR | BM_STATUS_IRQ);
+	out32(ATA_REG_BM_PRDT(channel), channel->prdt.p.address);
+	out8(ATA_REG_BM_CMD(channel), rw == IDE_READ ? BM_CMD_READ : 0);
+}
+
+static void ide_async_end(struct ide_channel *channel, iostatus_t status);
+
+/**
+ * ide_dma_timeout - DMA传输超时
+ * 
+ * 在定时器软中断中执行，中断丢失时停止总线主控，唤醒等待的任务。
+ * 同步传输由等待的任务来复位通道，异步请求没有等待的任务，在这里复位并让请求失败
+ */
+static void ide_dma_timeout(timer_t *timer, void *arg)
+{
+	struct ide_channel *channel = (struct ide_channel *) arg;
+	unsigned long flags;
+
+	interrupt_save_and_disable(flags);
+	if (channel->dma_active) {
+		out8(ATA_REG_BM_CMD(channel), 0);
+		channel->dma_status = in8(ATA_REG_BM_STATUS(channel));
+		out8(ATA_REG_BM_STATUS(channel), channel->dma_status | BM_STATUS_ERR | BM_STATUS_IRQ);
+		channel->ata_status = in8(ATA_REG_STATUS(channel));
+		channel->dma_timeout = 1;
+		channel->dma_active = 0;
+		if (!channel->async_cur)
+			wait_queue_wakeup_all(&channel->wait_queue);
+	}
+	if (channel->async_cur) {
+		keprint(PRINT_ERR "async dma transfer timeout! bm status %x ata status %x\n",
+			channel->dma_status, channel->ata_status);
+		driver_soft_rest(channel);
+		ide_async_end(channel, IO_FAILED);
+	}
+	interrupt_restore_state(flags);
+}
+
+/* 启动DMA超时定时器，定时器可能还在时间轮上，需要先取消 */
+static void ide_dma_timer_start(struct ide_channel *channel)
+{
+	timer_cancel(&channel->dma_timer);
+	timer_modify(&channel->dma_timer, IDE_DMA_TIMEOUT);
+	timer_add(&channel->dma_timer);
+}
+
+/**
+ * dma_data_transfer - 总线主控DMA数据传输
+ * @ext: 设备
+ * @rw: 传输方向（读，写）
+ * @mode: 传输模式（CHS和LBA模式）
+ * @buf: 扇区缓冲
+ * @count: 扇区数
+ * 
+ * 命令发送后启动传输，任务阻塞到通道中断到来，中断超过IDE_DMA_TIMEOUT
+ * 没有到来时复位通道。
+ * 传输成功返回0，失败返回非0
+ */
+static int dma_data_transfer(device_extension_t *ext,
+	unsigned char rw,
+	unsigned char mode,
+	unsigned char *buf,
+	unsigned int count)
+{
+	struct ide_channel *channel = ext->channel;
+	unsigned long flags;
+
+	interrupt_save_and_disable(flags);
+	channel->dma_active = 1;
+	channel->dma_timeout = 0;
+	out8(ATA_REG_BM_CMD(channel), (rw == IDE_READ ? BM_CMD_READ : 0) | BM_CMD_START);
+	ide_dma_timer_start(channel);
+	while (channel->dma_active) {
+		wait_queue_add(&channel->wait_queue, task_current);
+		task_block(TASK_BLOCKED);
+	}
+	timer_cancel(&channel->dma_timer);
+	interrupt_restore_state(flags);
+
+	if (channel->dma_timeout) {
+		keprint(PRINT_ERR "dma transfer timeout! bm status %x ata status %x\n",
+			channel->dma_status, channel->ata_status);
+		rest_driver(ext);
+		return 5;
+	}
+
+	if (channel->ata_status & ATA_STATUS_DF) {
+		rest_driver(ext);
+		return 1;
+	}
+	if ((channel->ata_status & ATA_STATUS_ERR) || (channel->dma_status & BM_STATUS_ERR)) {
+		keprint(PRINT_ERR "dma transfer failed! bm status %x ata status %x\n",
+			channel->dma_status, channel->ata_status);
+		rest_driver(ext);
+		return 2;
+	}
+
+	if (rw == IDE_READ) {
+		memcpy(buf, (void *) channel->dma_buf.v, count * SECTOR_SIZE);
+		ext->read_sectors += count;
+	} else {
+		/* 刷新写缓冲区 */
+		out8(ATA_REG_CMD(channel), mode > 1 ?
+			ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+		ide_polling(channel, 0);
+		ext->write_sectors += count;
+	}
+	return 0;
+}
+
+/**
+ * ide_wait_ready - 有限时间内等待磁盘不忙并且就绪
+ * @channel: 通道
+ * 
+ * 可以在中断中使用，就绪返回0，超时返回5
+ */
+static int ide_wait_ready(struct ide_channel *channel)
+{
+	unsigned char state;
+	int i;
+	for (i = 0; i < 0x10000; i++) {
+		state = in8(ATA_REG_STATUS(channel));
+		if (!(state & ATA_STATUS_BUSY) && (state & ATA_STATUS_READY))
+			return 0;
+		cpu_pause();
+	}
+	return 5;
+}
+
+/**
+ * ide_async_issue - 发出异步请求的DMA命令
+ * @channel: 通道
+ * @ioreq: 异步请求，提交时已经检查过扇区范围，偏移也换成了扇区号
+ * 
+ * 关中断调用，可以在中断中使用，命令发出后由ide_handler完成请求。
+ * 成功返回0，失败返回非0
+ */
+static int ide_async_issue(struct ide_channel *channel, io_request_t *ioreq)
+{
+	device_extension_t *ext = ioreq->devobj->device_extension;
+	unsigned char rw, mode, head, cmd = 0;
+	unsigned char lbaIO[6];
+	unsigned long lba, count;
+
+	if (ioreq->flags & IOREQ_WRITE_OPERATION) {
+		rw = IDE_WRITE;
+		lba = ioreq->parame.write.offset;
+		count = ioreq->parame.write.length / SECTOR_SIZE;
+	} else {
+		rw = IDE_READ;
+		lba = ioreq->parame.read.offset;
+		count = ioreq->parame.read.length / SECTOR_SIZE;
+	}
+	select_addr_mode(ext, lba, &mode, &head, lbaIO);
+	if (ide_wait_ready(channel))
+		return 5;
+	select_disk(ext, mode, head);
+	select_sector(ext, mode, lbaIO, count);
+	if (ide_wait_ready(channel))
+		return 5;
+	select_cmd(rw, mode, 1, &cmd);
+	dma_prepare(ext, rw, ioreq->system_buffer, count);
+
+	channel->what = rw;
+	channel->async_cur = ioreq;
+	channel->async_mode = mode;
+	channel->async_flush = 0;
+	channel->dma_active = 1;
+	send_cmd(channel, cmd);
+	out8(ATA_REG_BM_CMD(channel), (rw == IDE_READ ? BM_CMD_READ : 0) | BM_CMD_START);
+	ide_dma_timer_start(channel);
+	return 0;
+}
+
+/**
+ * ide_async_next - 通道空闲时发出排队的异步请求
+ * @channel: 通道
+ * 
+ * 关中断调用，唤醒等待通道和等待队列空位的任务
+ */
+static void ide_async_next(struct ide_channel *channel)
+{
+	io_request_t *ioreq;
+	while (!channel->sync_busy && !channel->async_cur && channel->async_next) {
+		ioreq = channel->async_next;
+		channel->async_next = NULL;
+		if (ide_async_issue(channel, ioreq)) {
+			ioreq->io_status.status = IO_FAILED;
+			io_complete_request(ioreq);
+		}
+	}
+	wait_queue_wakeup_all(&channel->wait_queue);
+}
+
+/**
+ * ide_async_end - 结束当前的异步请求
+ * @channel: 通道
+ * @status: 请求的状态
+ * 
+ * 关中断调用。先发出排队的请求再完成当前的请求，
+ * 完成回调中提交新请求时队列已经空出来了
+ */
+static void ide_async_end(struct ide_channel *channel, iostatus_t status)
+{
+	io_request_t *ioreq = channel->async_cur;
+
+	timer_cancel(&channel->dma_timer);
+	channel->async_cur = NULL;
+	channel->async_flush = 0;
+	ide_async_next(channel);
+
+	ioreq->io_status.status = status;
+	if (ioreq->flags & IOREQ_WRITE_OPERATION)
+		ioreq->io_status.infomation = ioreq->parame.write.length;
+	else
+		ioreq->io_status.infomation = ioreq->parame.read.length;
+	io_complete_request(ioreq);
+}
+
+/**
+ * ide_async_dma_done - 异步请求的DMA传输结束
+ * @channel: 通道
+ * 
+ * 在中断中调用。读请求复制数据后完成，写请求还要等刷新写缓冲区的中断
+ */
+static void ide_async_dma_done(struct ide_channel *channel)
+{
+	io_request_t *ioreq = channel->async_cur;
+	device_extension_t *ext = ioreq->devobj->device_extension;
+
+	if ((channel->ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF)) ||
+		(channel->dma_status & BM_STATUS_ERR)) {
+		keprint(PRINT_ERR "async dma transfer failed! bm status %x ata status %x\n",
+			channel->dma_status, channel->ata_status);
+		driver_soft_rest(channel);
+		ide_async_end(channel, IO_FAILED);
+		return;
+	}
+	if (channel->what == IDE_READ) {
+		memcpy(ioreq->system_buffer, (void *) channel->dma_buf.v, ioreq->parame.read.length);
+		ext->read_sectors += ioreq->parame.read.length / SECTOR_SIZE;
+		ide_async_end(channel, IO_SUCCESS);
+		return;
+	}
+	ext->write_sectors += ioreq->parame.write.length / SECTOR_SIZE;
+	channel->async_flush = 1;
+	out8(ATA_REG_CMD(channel), channel->async_mode > 1 ?
+		ATA_CMD_CACHE_FLUSH_EXT : ATA_CMD_CACHE_FLUSH);
+	ide_dma_timer_start(channel);
+}
+
+/**
+ * ide_async_submit - 提交异步请求
+ * @ext: 设备
+ * @ioreq: 异步请求
+ * 
+ * 通道空闲时马上发出命令，否则排到通道的队列，队列满了就等待。
+ * 成功返回0，请求由中断完成
+ */
+static int ide_async_submit(device_extension_t *ext, io_request_t *ioreq)
+{
+	struct ide_channel *channel = ext->channel;
+	unsigned long flags;
+	int err = 0;
+
+	interrupt_save_and_disable(flags);
+	while (channel->async_next) {
+		wait_queue_add(&channel->wait_queue, task_current);
+		task_block(TASK_BLOCKED);
+	}
+	if (channel->sync_busy || channel->async_cur)
+		channel->async_next = ioreq;
+	else
+		err = ide_async_issue(channel, ioreq);
+	interrupt_restore_state(flags);
+	return err;
+}
+
+/**
+ * ide_async_able - 请求能否走异步路径
+ * 
+ * 只有支持DMA的LBA磁盘，并且请求是整扇区、不超过DMA缓冲区时才异步传输
+ */
+static int ide_async_able(device_extension_t *ext, unsigned long off, unsigned long length)
+{
+	if (!ext->dma || ext->type != IDE_ATA || !(ext->capabilities & 0x200))
+		return 0;
+	if (!length || length % SECTOR_SIZE || length > IDE_DMA_BUF_SIZE)
+		return 0;
+	return off + length / SECTOR_SIZE <= ext->size;
+}
+
+/**
+ * ide_sync_begin - 同步传输占用通道
+ * @channel: 通道
+ * 
+ * 先占住通道让新的异步请求排队，再等待正在传输的异步请求结束
+ */
+static void ide_sync_begin(struct ide_channel *channel)
+{
+	unsigned long flags;
+
+	mutex_lock(&channel->lock);
+	interrupt_save_and_disable(flags);
+	channel->sync_busy = 1;
+	while (channel->async_cur) {
+		wait_queue_add(&channel->wait_queue, task_current);
+		task_block(TASK_BLOCKED);
+	}
+	interrupt_restore_state(flags);
+}
+
+/**
+ * ide_sync_end - 同步传输释放通道
+ * @channel: 通道
+ * 
+ * 发出同步传输期间排队的异步请求
+ */
+static void ide_sync_end(struct ide_channel *channel)
+{
+	unsigned long flags;
+
+	interrupt_save_and_disable(flags);
+	channel->sync_busy = 0;
+	ide_async_next(channel);
+	interrupt_restore_state(flags);
+	mutex_unlock(&channel->lock);
+}
+
 /**
  * ata_type_transfer - ATA类型数据传输
  * @dev: 设备
@@ -947,8 +1369,8 @@ static int ata_type_transfer(device_extension_t *ext,
 	/* 已经完成的扇区数 */
 	unsigned int done = 0;
 	
-    /* 同步锁加锁 */
-	//SyncLock(&channel->lock);
+    /* 同步锁加锁，等待通道上的异步请求 */
+	ide_sync_begin(channel);
 
 	/* 保存读写操作 */
 	channel->what = rw;
@@ -963,13 +1385,13 @@ static int ata_type_transfer(device_extension_t *ext,
 			todo = count - done;
 		}
 
-		/* 选择传输模式（PIO或DMA） */
-		dma = 0; // We don't support DMA
-
 		/* 选择寻址模式 */
 		// (I) Select one from LBA28, LBA48 or CHS;
 		select_addr_mode(ext, lba + done, &mode, &head, lbaIO);
 
+		/* 选择传输模式（PIO或DMA），CHS寻址的老磁盘使用PIO */
+		dma = (ext->dma && mode) ? 1 : 0;
+
 		/* 等待驱动不繁忙 */
 		// (III) Wait if the drive is busy;
 		while (in8(ATA_REG_STATUS(channel)) & ATA_STATUS_BUSY) cpu_idle();// Wait if busy.
@@ -977,7 +1399,7 @@ static int ata_type_transfer(device_extension_t *ext,
 		select_disk(ext, mode, head);
 
 		/* 填写参数，扇区和扇区数 */
-		select_sector(ext, mode, lbaIO, count);
+		select_sector(ext, mode, lbaIO, todo);
 
 		/* 等待磁盘控制器处于准备状态 */
 		while (!(in8(ATA_REG_STATUS(channel)) & ATA_STATUS_READY)) cpu_idle();
@@ -994,27 +1416,28 @@ static int ata_type_transfer(device_extension_t *ext,
 		/* 等待磁盘控制器处于准备状态 */
 		while (!(in8(ATA_REG_STATUS(channel)) & ATA_STATUS_READY)) cpu_idle();
 
+		if (dma)
+			dma_prepare(ext, rw, _buf, todo);
+
 		/* 发送命令 */
 		send_cmd(channel, cmd);
 
 		/* 根据不同的模式传输数据 */
 		if (dma) {	/* DMA模式 */
-			if (rw == IDE_READ) {
-				// DMA Read.
-			} else {
-				// DMA Write.
-			}
+			err = dma_data_transfer(ext, rw, mode, _buf, todo);
 		} else {
 			/* PIO模式数据传输 */
-			if ((err = pio_data_transfer(ext, rw, mode, _buf, todo))) {
-				return err;
-			}
-			_buf += todo * SECTOR_SIZE;
-			done += todo;
+			err = pio_data_transfer(ext, rw, mode, _buf, todo);
 		}
+		if (err) {
+			ide_sync_end(channel);
+			return err;
+		}
+		_buf += todo * SECTOR_SIZE;
+		done += todo;
 	}
 
-	//SyncUnlock(&channel->lock);
+	ide_sync_end(channel);
 	return 0;
 }
 
@@ -1038,15 +1461,12 @@ static int ide_read_sector(device_extension_t *ext,
         errprint(PRINT_ERR "ide_read_sector: out of range!\n");
 		return -1;
 	} else {
-		unsigned char *_buf = (unsigned char *)buf;
-		int i;
-		for (i = 0; i < count; i++) {
-			error = ata_type_transfer(ext, IDE_READ, lba + i, 1, _buf + i * SECTOR_SIZE);
-			/* 打印驱动错误信息 */
-			if(ide_print_error(ext, error)) {
-				keprint(PRINT_ERR "ide_read_sector: ide read error!\n");
-				return -1;
-			}
+		/* 多个扇区一次传输，由ata_type_transfer按命令的最大扇区数拆分 */
+		error = ata_type_transfer(ext, IDE_READ, lba, count, buf);
+		/* 打印驱动错误信息 */
+		if(ide_print_error(ext, error)) {
+			keprint(PRINT_ERR "ide_read_sector: ide read error!\n");
+			return -1;
 		}
 	}
 	return 0;
@@ -1072,15 +1492,11 @@ static int ide_write_sector(
 		errprint(PRINT_ERR "ide_write_sector: out of range!\n");
 		return -1;
 	} else {
-		unsigned char *_buf = (unsigned char *)buf;
-		int i;
-		for (i = 0; i < count; i++) {
-			error = ata_type_transfer(ext, IDE_WRITE, lba + i, 1, _buf + i * SECTOR_SIZE);
-			/* 打印驱动错误信息 */
-			if(ide_print_error(ext, error)) {
-				keprint(PRINT_ERR "ide_write_sector: ide write error!\n");
-				return -1;
-			}
+		error = ata_type_transfer(ext, IDE_WRITE, lba, count, buf);
+		/* 打印驱动错误信息 */
+		if(ide_print_error(ext, error)) {
+			keprint(PRINT_ERR "ide_write_sector: ide write error!\n");
+			return -1;
 		}
 	}
 	return 0;
@@ -1177,6 +1593,15 @@ iostatus_t ide_read(device_object_t *device, io_request_t *ioreq)
     } else {
         off = ioreq->parame.read.offset;
     }
+    /* 异步请求不等待传输完成，由中断完成请求 */
+    if ((ioreq->flags & IOREQ_ASYNC) && ide_async_able(ext, off, ioreq->parame.read.length)) {
+        ioreq->parame.read.offset = off;
+        if (!ide_async_submit(ext, ioreq))
+            return IO_PENDING;
+        ioreq->io_status.status = IO_FAILED;
+        io_complete_request(ioreq);
+        return IO_FAILED;
+    }
     len = ide_read_sector(device->device_extension, off,
         ioreq->system_buffer, sectors);
     if (!len) { /* 执行成功 */
@@ -1210,6 +1635,14 @@ iostatus_t ide_write(device_object_t *device, io_request_t *ioreq)
     } else {
         off = ioreq->parame.write.offset;
     }
+    if ((ioreq->flags & IOREQ_ASYNC) && ide_async_able(ext, off, ioreq->parame.write.length)) {
+        ioreq->parame.write.offset = off;
+        if (!ide_async_submit(ext, ioreq))
+            return IO_PENDING;
+        ioreq->io_status.status = IO_FAILED;
+        io_complete_request(ioreq);
+        return IO_FAILED;
+    }
     len = ide_write_sector(device->device_extension, off,
         ioreq->system_buffer, sectors);
     if (!len) { /* 执行成功 */
@@ -1228,9 +1661,37 @@ iostatus_t ide_write(device_object_t *device, io_request_t *ioreq)
 static int ide_handler(irqno_t irq, void *data)
 {
     struct ide_channel *channel = (struct ide_channel *)data;
-	device_extension_t *ext = channel->ext + channel->who;
+	device_extension_t *ext = channel->ext[(int) channel->who];
+
+	/* DMA传输结束，停止总线主控并唤醒等待的任务 */
+	if (channel->dma_active) {
+		unsigned char status = in8(ATA_REG_BM_STATUS(channel));
+		if (!(status & BM_STATUS_IRQ))
+			return 0;
+		out8(ATA_REG_BM_CMD(channel), 0);
+		out8(ATA_REG_BM_STATUS(channel), status | BM_STATUS_ERR | BM_STATUS_IRQ);
+		channel->dma_status = status;
+		channel->ata_status = in8(ATA_REG_STATUS(channel));	/* 读取状态同时应答中断 */
+		channel->dma_active = 0;
+		if (channel->async_cur) {
+			ide_async_dma_done(channel);
+			return 0;
+		}
+		wait_queue_wakeup_all(&channel->wait_queue);
+		return 0;
+	}
+	/* 异步写刷新写缓冲区结束 */
+	if (channel->async_flush) {
+		unsigned char status = in8(ATA_REG_STATUS(channel));
+		if (status & ATA_STATUS_BUSY)
+			return 0;
+		ide_async_end(channel, (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) ?
+			IO_FAILED : IO_SUCCESS);
+		return 0;
+	}
+	if (!ext)
+		return 0;
 
-    
 	/* 获取状态，做出错判断 */
 	if (in8(ATA_REG_STATUS(channel)) & ATA_STATUS_ERR) {
 		/* 尝试重置驱动 */
@@ -1280,7 +1741,7 @@ static int ide_probe(device_extension_t *ext, int id)
     dump_ide_channel(channel);
 #endif
 
-    channel->ext = ext;
+    channel->ext[diskno] = ext;
 
     /* 填写设备信息 */
     ext->channel = channel;
@@ -1339,6 +1800,8 @@ static int ide_probe(device_extension_t *ext, int id)
     }
 
     ext->capabilities = ext->info->Capabilities0;
+    /* 控制器支持总线主控并且磁盘支持DMA时才使用DMA */
+    ext->dma = (channel->bmide && (ext->capabilities & 0x100)) ? 1 : 0;
     ext->signature = ext->info->General_Config;
     ext->reserved = 1;	/* 设备存在 */
     ext->rwoffset = 0;
@@ -1350,6 +1813,76 @@ static int ide_probe(device_extension_t *ext, int id)
     return 0;
 }
 
+/**
+ * ide_channel_dma_init - 初始化通道的总线主控DMA
+ * @channel: 通道
+ * @bmide: 总线主控寄存器基址
+ * 
+ * 分配PRD表和DMA缓冲区，失败时通道退回PIO模式
+ */
+static void ide_channel_dma_init(struct ide_channel *channel, unsigned short bmide)
+{
+	channel->prdt.p.size = PAGE_SIZE;
+	channel->prdt.p.alignment = PAGE_SIZE;
+	channel->prdt.flags = DMA_REGION_SPECIAL;
+	if (dma_alloc_buffer(&channel->prdt) < 0) {
+		keprint(PRINT_WARING "ide: alloc prd table failed, use pio mode.\n");
+		return;
+	}
+	channel->dma_buf.p.size = IDE_DMA_BUF_SIZE;
+	channel->dma_buf.p.alignment = PAGE_SIZE;
+	channel->dma_buf.flags = DMA_REGION_SPECIAL;
+	if (dma_alloc_buffer(&channel->dma_buf) < 0) {
+		keprint(PRINT_WARING "ide: alloc dma buffer failed, use pio mode.\n");
+		dma_free_buffer(&channel->prdt);
+		return;
+	}
+	memset((void *) channel->prdt.v, 0, PAGE_SIZE);
+	channel->bmide = bmide;
+}
+
+static void ide_channel_dma_exit(struct ide_channel *channel)
+{
+	if (!channel->bmide)
+		return;
+	out8(ATA_REG_BM_CMD(channel), 0);
+	dma_free_buffer(&channel->dma_buf);
+	dma_free_buffer(&channel->prdt);
+	channel->bmide = 0;
+}
+
+/**
+ * ide_channels_init - 初始化IDE通道
+ * 
+ * 在PCI总线上查找IDE控制器，支持总线主控时为通道准备DMA
+ */
+static void ide_channels_init(void)
+{
+	unsigned short bmide = 0;
+	int i;
+	/* 大容量存储控制器(0x01)，IDE控制器(0x01) */
+	pci_device_t *pcidev = pci_get_device_by_class_code(0x01, 0x01);
+	if (pcidev && pcidev->bar[4].type == PCI_BAR_TYPE_IO && pcidev->bar[4].base_addr) {
+		bmide = pcidev->bar[4].base_addr;
+		pci_enable_bus_mastering(pcidev);
+		keprint(PRINT_INFO "ide: bus master ide at %x\n", bmide);
+	}
+	for (i = 0; i < 2; i++) {
+		mutexlock_init(&channels[i].lock);
+		wait_queue_init(&channels[i].wait_queue);
+		channels[i].ext[0] = channels[i].ext[1] = NULL;
+		channels[i].dma_active = 0;
+		channels[i].dma_timeout = 0;
+		channels[i].async_cur = channels[i].async_next = NULL;
+		channels[i].async_flush = 0;
+		channels[i].sync_busy = 0;
+		timer_init(&channels[i].dma_timer, IDE_DMA_TIMEOUT, &channels[i], ide_dma_timeout);
+		channels[i].bmide = 0;
+		if (bmide)
+			ide_channel_dma_init(&channels[i], bmide + i * 8);
+	}
+}
+
 static iostatus_t ide_enter(driver_object_t *driver)
 {
     iostatus_t status = IO_FAILED;
@@ -1369,6 +1902,7 @@ static iostatus_t ide_enter(driver_object_t *driver)
 
 	/* 有磁盘才初始化磁盘 */
 	if (disk_foud > 0) {    
+        ide_channels_init();
         for (id = 0; id < disk_foud; id++) {
             sprintf(devname, "%s%c", DEV_NAME, 'a' + id);
             /* 初始化一些其它内容 */
@@ -1378,8 +1912,8 @@ static iostatus_t ide_enter(driver_object_t *driver)
                 keprint(PRINT_ERR "ide_enter: create device failed!\n");
                 return status;
             }
-            /* buffered io mode */
-            devobj->flags = DO_BUFFERED_IO;
+            /* buffered io mode，通道自己处理并发，可以异步传输 */
+            devobj->flags = DO_BUFFERED_IO | DO_ASYNC_IO;
 
             devext = (device_extension_t *)devobj->device_extension;
             string_new(&devext->device_name, devname, DEVICE_NAME_LEN);
@@ -1421,6 +1955,8 @@ static iostatus_t ide_exit(driver_object_t *driver)
         io_delete_device(devobj);   /* 删除每一个设备 */
     }
 
+    ide_channel_dma_exit(&channels[0]);
+    ide_channel_dma_exit(&channels[1]);
     string_del(&driver->name); /* 删除驱动名 */
     return IO_SUCCESS;
 }
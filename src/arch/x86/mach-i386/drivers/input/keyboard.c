@@ -971,37 +971,27 @@ iostatus_t keyboard_read(device_object_t *device, io_request_t *ioreq)
     device_extension_t *ext = device->device_extension;
     iostatus_t status = IO_SUCCESS;
     
-    /* 直接返回读取的数据 */
-    ioreq->io_status.infomation = ioreq->parame.read.length;
     input_event_t *even = (input_event_t *) ioreq->user_buffer;
-    /* 参数正确 */
-    if (even && ioreq->parame.read.length == sizeof(input_event_t)) {
-        
-        if (ext->flags & DEV_NOWAIT) {
-            // 解析
-            if (input_even_get(&ext->evbuf, even) < 0) {
-                status = IO_FAILED;
-            } else {
-                #ifdef DEBUG_DRV
-                keprint(PRINT_DEBUG "key even get: type=%d code=%x value=%d\n", even->type, even->code, even->value);
-                keprint(PRINT_DEBUG "key even buf: head=%d tail=%d\n", ext->evbuf.head, ext->evbuf.tail);
-                #endif        
-            }
+    int nr = ioreq->parame.read.length / sizeof(input_event_t);
+    int count = 0;
+    /* 参数正确，长度是事件大小的整数倍，一次可以读取多个事件 */
+    if (even && nr > 0 && ioreq->parame.read.length % sizeof(input_event_t) == 0) {
+        /* 阻塞时在等待队列上睡眠，有按键事件时被唤醒 */
+        count = input_even_read(&ext->evbuf, even, nr, (ext->flags & DEV_NOWAIT) ? IO_NOWAIT : 0);
+        if (count < 0) {
+            count = 0;
+            status = IO_FAILED;
         } else {
-            while (1) {
-                // 解析
-                if (!input_even_get(&ext->evbuf, even))
-                    break;
-                task_yield();
-            }
+            #ifdef DEBUG_DRV
+            keprint(PRINT_DEBUG "key even get: type=%d code=%x value=%d\n", even->type, even->code, even->value);
+            keprint(PRINT_DEBUG "key even buf: in=%d out=%d\n", ext->evbuf.queue.ring.in, ext->evbuf.queue.ring.out);
+            #endif        
         }
     } else {
         status = IO_FAILED;
     }
-    #ifdef DEBUG_DRV
-    keprint(PRINT_DEBUG "key even get: type=%d code=%x value=%d\n", even->type, even->code, even->value);
-    keprint(PRINT_DEBUG "key even buf: head=%d tail=%d\n", ext->evbuf.head, ext->evbuf.tail);
-    #endif     
+    /* 直接返回读取的数据 */
+    ioreq->io_status.infomation = count * sizeof(input_event_t);
     ioreq->io_status.status = status;
     /* 调用完成请求 */
     io_complete_request(ioreq);
@@ -1061,7 +1051,7 @@ void kbd_thread(void *arg) {
             input_even_put(&ext->evbuf, &e);
 #ifdef DEBUG_DRV
             keprint(PRINT_DEBUG "key even set: type=%d code=%x value=%d\n", e.type, e.code, e.value);
-            keprint(PRINT_DEBUG "key even buf: head=%d tail=%d\n", ext->evbuf.head, ext->evbuf.tail);
+            keprint(PRINT_DEBUG "key even buf: in=%d out=%d\n", ext->evbuf.queue.ring.in, ext->evbuf.queue.ring.out);
 #endif
 #ifdef DEBUG_DRV
         keprint(PRINT_DEBUG "kbd_thread: key:%c\n", key);
@@ -360,25 +360,29 @@ iostatus_t mouse_read(device_object_t *device, io_request_t *ioreq)
     device_extension_t *ext = device->device_extension;
 
     iostatus_t status = IO_SUCCESS;
-    /* 直接返回读取的数据 */
-    ioreq->io_status.infomation = ioreq->parame.read.length;
-    /* 参数正确 */
-    if (ioreq->user_buffer && ioreq->parame.read.length == sizeof(input_event_t)) {
+    int nr = ioreq->parame.read.length / sizeof(input_event_t);
+    int count = 0;
+    /* 参数正确，长度是事件大小的整数倍，一次可以读取多个事件 */
+    if (ioreq->user_buffer && nr > 0 && ioreq->parame.read.length % sizeof(input_event_t) == 0) {
         input_event_t *even = (input_event_t *) ioreq->user_buffer;
         
-        if (input_even_get(&ext->evbuf, even)) {
+        count = input_even_read(&ext->evbuf, even, nr, IO_NOWAIT);
+        if (count < 0) {
+            count = 0;
             status = IO_FAILED;
         } else {
 #ifdef DEBUG_DRV
     #ifdef DEBUG_INFO
             keprint(PRINT_DEBUG "mouse even get: type=%d code=%x value=%d\n", even->type, even->code, even->value);
-            keprint(PRINT_DEBUG "mouse even buf: head=%d tail=%d\n", ext->evbuf.head, ext->evbuf.tail);
+            keprint(PRINT_DEBUG "mouse even buf: in=%d out=%d\n", ext->evbuf.queue.ring.in, ext->evbuf.queue.ring.out);
     #endif
 #endif        
         }
     } else {
         status = IO_FAILED;
     }
+    /* 直接返回读取的数据 */
+    ioreq->io_status.infomation = count * sizeof(input_event_t);
     ioreq->io_status.status = status;
     /* 调用完成请求 */
     io_complete_request(ioreq);
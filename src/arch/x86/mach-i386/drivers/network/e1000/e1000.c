@@ -1,6 +1,7 @@
 #include <xbook/debug.h>
 #include <xbook/bitops.h>
 #include <string.h>
+#include <errno.h>
 
 #include <xbook/driver.h>
 #include <assert.h>
@@ -17,6 +18,7 @@
 #include <sys/ioctl.h>
 #include <stddef.h>
 #include <xbook/virmem.h>
+#include <xbook/netpoll.h>
 
 #include <drivers/e1000_hw.h>
 #include <drivers/e1000_osdep.h>
@@ -136,9 +138,11 @@ typedef struct _e1000_extension {
     // dma_addr_t rx_ring_dma;   //dma物理地址
 
     spinlock_t lock;   //普通锁
-    spinlock_t rx_lock;   //接收锁
+    spinlock_t rx_lock;   //接收锁，保护挂起的异步读请求
 
-    device_queue_t rx_queue;   //接收队列
+    netbuf_queue_t rx_queue;   //接收队列，缓冲区直接来自接收环
+    list_t pending_reads;   //等待数据包的异步读请求
+    netpoll_t netpoll;   //接收轮询，中断只负责调度
 }e1000_extension_t;
 
 iostatus_t e1000_driver_func(driver_object_t* driver);
@@ -147,6 +151,7 @@ iostatus_t e1000_up(e1000_extension_t* ext);
 void e1000_down(e1000_extension_t* ext);
 int e1000_reset(e1000_extension_t* ext);
 int e1000_transmit(e1000_extension_t* ext, uint8_t* buf, uint32_t len);
+int e1000_transmit_sg(e1000_extension_t* ext, netbuf_sg_t* sg, netbuf_t* nb);
 iostatus_t e1000_setup_tx_resources(e1000_extension_t* ext);
 iostatus_t e1000_setup_rx_resources(e1000_extension_t* ext);
 
@@ -174,16 +179,12 @@ static void e1000_enter_82542_rst(e1000_extension_t* ext);
 static void e1000_leave_82542_rst(e1000_extension_t* ext);
 static void e1000_clean_tx_ring(e1000_extension_t* ext);
 static void e1000_clean_rx_ring(e1000_extension_t* ext);
-static void e1000_alloc_rx_buffers(e1000_extension_t* ext);
+static int e1000_alloc_rx_buffers(e1000_extension_t* ext);
 static int e1000_intr(irqno_t irq, void *data);
 static boolean_t e1000_clean_tx_irq(e1000_extension_t* ext);
-#ifdef CONFIG_E1000_NAPI
-static int e1000_clean(struct net_device *netdev, int *budget);
+static int e1000_poll(netpoll_t* np, int budget);
 static boolean_t e1000_clean_rx_irq(e1000_extension_t* ext,
                                     int *work_done, int work_to_do);
-#else
-static boolean_t e1000_clean_rx_irq(e1000_extension_t* ext);
-#endif
 
 static inline void e1000_irq_disable(e1000_extension_t* ext);
 
@@ -316,6 +317,7 @@ static int e1000_sw_init(e1000_extension_t* ext)
     spinlock_init(&ext->stats_lock);
     spinlock_init(&ext->tx_lock);
     spinlock_init(&ext->lock);
+    netpoll_init(&ext->netpoll, e1000_poll, NETPOLL_WEIGHT, ext);
 
     return 0;
 }
@@ -350,6 +352,7 @@ static int e1000_init_board(e1000_extension_t* ext)
 void e1000_down(e1000_extension_t* ext)
 {
     e1000_irq_disable(ext);
+    netpoll_disable(&ext->netpoll);
     irq_unregister(ext->irq, ext);
     timer_del(&ext->tx_fifo_stall_timer);
     timer_del(&ext->watchdog_timer);
@@ -508,13 +511,8 @@ static int e1000_init(e1000_extension_t* ext)
  **/
 
 static inline void
-e1000_free_tx_resource(struct e1000_buffer* buffer_info)
-{
-    if(buffer_info->buffer) {
-        mem_free(buffer_info->buffer);
-        buffer_info->buffer = NULL;
-    }
-}
+e1000_unmap_and_free_tx_resource(e1000_extension_t* ext, 
+            struct e1000_buffer* buffer_info);
 
 /**
  * e1000_clean_tx_ring - Free Tx Buffers
@@ -531,7 +529,7 @@ static void e1000_clean_tx_ring(e1000_extension_t* ext)
     /* free all the tx ring buffers*/
     for(i=0; i<tx_ring->count; i++) {
         buffer_info = &tx_ring->buffer_info[i];
-        e1000_free_tx_resource(buffer_info);
+        e1000_unmap_and_free_tx_resource(ext, buffer_info);
     }
 
     size = sizeof(struct e1000_buffer) * tx_ring->count;
@@ -581,9 +579,10 @@ static void e1000_clean_rx_ring(e1000_extension_t* ext)
 
     /* free all the rx ring buffers */
     for(i=0; i<rx_ring->count; i++) {
-        buffer_info = rx_ring->buffer_info;
-        if(buffer_info->buffer) {
-            mem_free(buffer_info->buffer);
+        buffer_info = &rx_ring->buffer_info[i];
+        if(buffer_info->netbuf) {
+            netbuf_free(buffer_info->netbuf);
+            buffer_info->netbuf = NULL;
             buffer_info->buffer = NULL;
         }
     }
@@ -761,13 +760,16 @@ iostatus_t e1000_up(e1000_extension_t* ext)
     e1000_configure_tx(ext);
     e1000_setup_rctl(ext);
     e1000_configure_rx(ext);
-    e1000_alloc_rx_buffers(ext);
+    if(!e1000_alloc_rx_buffers(ext)) {
+        return IO_FAILED;
+    }
 
     if((err = irq_register(ext->irq, e1000_intr, IRQF_SHARED, "IRQ-Network", DEV_NAME, (void *) ext))) {
         return err;
     }
 
     timer_modify(&ext->watchdog_timer, systicks);
+    netpoll_enable(&ext->netpoll);
     e1000_irq_enable(ext);
 
     return IO_SUCCESS;
@@ -793,6 +795,9 @@ static iostatus_t e1000_open(device_object_t* device, io_request_t* ioreq)
     e1000_extension_t* ext = device->device_extension;
     iostatus_t err;
 
+    /* 设备是DO_ASYNC_IO，打开和关闭需要自己串行化 */
+    mutex_lock(&device->lock.mutexlock);
+
     /* allocate transmit descriptors */
     /* 分配传输描述符 */
     if((err = e1000_setup_tx_resources(ext))) {
@@ -809,6 +814,7 @@ static iostatus_t e1000_open(device_object_t* device, io_request_t* ioreq)
         goto err_up;
     }
     ext->flags = 0;
+    mutex_unlock(&device->lock.mutexlock);
     ioreq->io_status.status = IO_SUCCESS;
     ioreq->io_status.infomation = 0;
     io_complete_request(ioreq);
@@ -823,6 +829,7 @@ err_setup_rx:
     e1000_free_tx_resources(ext);
 err_setup_tx:
     e1000_reset(ext);
+    mutex_unlock(&device->lock.mutexlock);
 
     return err;
 }
@@ -844,10 +851,16 @@ static iostatus_t e1000_close(device_object_t* device, io_request_t* ioreq)
 {
     e1000_extension_t* ext = device->device_extension;
 
+    /* 取消还在等待数据包的异步读请求 */
+    io_cancel_device_requests(device);
+
+    mutex_lock(&device->lock.mutexlock);
     e1000_down(ext);
 
     e1000_free_tx_resources(ext);
     e1000_free_rx_resources(ext);
+    netbuf_queue_flush(&ext->rx_queue);
+    mutex_unlock(&device->lock.mutexlock);
 
     ioreq->io_status.status = IO_SUCCESS;
     ioreq->io_status.infomation = 0;
@@ -856,6 +869,63 @@ static iostatus_t e1000_close(device_object_t* device, io_request_t* ioreq)
     return IO_SUCCESS;
 }
 
+static void e1000_cancel_read(device_object_t* device, io_request_t* ioreq)
+{
+    e1000_extension_t* ext = device->device_extension;
+    unsigned long flags;
+
+    spin_lock_irqsave(&ext->rx_lock, flags);
+    list_del_init(&ioreq->list);
+    spin_unlock_irqrestore(&ext->rx_lock, flags);
+
+    ioreq->io_status.status = IO_CANCELED;
+    ioreq->io_status.infomation = 0;
+    io_complete_request(ioreq);
+}
+
+/**
+ * e1000_complete_pending_reads - 把接收队列中的数据包交给挂起的异步读请求
+ * @ext: board private structure
+ *
+ * 在接收中断中或者挂起请求后调用
+ **/
+static void e1000_complete_pending_reads(e1000_extension_t* ext)
+{
+    io_request_t* ioreq;
+    unsigned long flags;
+    int len;
+
+    spin_lock_irqsave(&ext->rx_lock, flags);
+    while(!list_empty(&ext->pending_reads) && netbuf_queue_count(&ext->rx_queue) > 0) {
+        ioreq = list_first_owner(&ext->pending_reads, io_request_t, list);
+        list_del_init(&ioreq->list);
+        /* 清除取消例程，请求已经被取消时由取消例程完成 */
+        if(io_set_cancel_routine(ioreq, NULL) < 0) {
+            continue;
+        }
+        len = netbuf_queue_read(&ext->rx_queue, ioreq->user_buffer,
+                                ioreq->parame.read.length, IO_NOWAIT);
+        if(len < 0) {
+            /* 数据包被同步读者取走了，重新挂起 */
+            if(io_set_cancel_routine(ioreq, e1000_cancel_read) < 0) {
+                spin_unlock_irqrestore(&ext->rx_lock, flags);
+                ioreq->io_status.status = IO_CANCELED;
+                ioreq->io_status.infomation = 0;
+                io_complete_request(ioreq);
+                return;
+            }
+            list_add(&ioreq->list, &ext->pending_reads);
+            break;
+        }
+        spin_unlock_irqrestore(&ext->rx_lock, flags);
+        ioreq->io_status.status = IO_SUCCESS;
+        ioreq->io_status.infomation = len;
+        io_complete_request(ioreq);
+        spin_lock_irqsave(&ext->rx_lock, flags);
+    }
+    spin_unlock_irqrestore(&ext->rx_lock, flags);
+}
+
 static iostatus_t e1000_read(device_object_t* device, io_request_t* ioreq)
 {
     unsigned long len;
@@ -871,9 +941,32 @@ static iostatus_t e1000_read(device_object_t* device, io_request_t* ioreq)
         flags |= IO_NOWAIT;
     }
 
+    /* 异步读没有数据包时挂起请求，由接收中断完成 */
+    if(ioreq->flags & IOREQ_ASYNC) {
+        int ret = netbuf_queue_read(&ext->rx_queue, buf, len, IO_NOWAIT);
+        if(ret >= 0) {
+            ioreq->io_status.status = IO_SUCCESS;
+            ioreq->io_status.infomation = ret;
+            io_complete_request(ioreq);
+            return IO_SUCCESS;
+        }
+        unsigned long irqflags;
+        spin_lock_irqsave(&ext->rx_lock, irqflags);
+        if(io_set_cancel_routine(ioreq, e1000_cancel_read) < 0) {
+            spin_unlock_irqrestore(&ext->rx_lock, irqflags);
+            ioreq->io_status.status = IO_CANCELED;
+            io_complete_request(ioreq);
+            return IO_CANCELED;
+        }
+        list_add_tail(&ioreq->list, &ext->pending_reads);
+        spin_unlock_irqrestore(&ext->rx_lock, irqflags);
+        /* 挂起前可能已经有数据包到达 */
+        e1000_complete_pending_reads(ext);
+        return IO_PENDING;
+    }
+
     /* 从网络接收队列中获取一个包 */
-    //len = io_device_queue_pickup(&ext->rx_ring.buffer_info->buffer, buf, len, flags);
-    len = io_device_queue_pickup(&ext->rx_queue, buf, len, flags);
+    len = netbuf_queue_read(&ext->rx_queue, buf, len, flags);
     if(len < 0) {
         status = IO_FAILED;
     }
@@ -920,6 +1013,7 @@ static iostatus_t e1000_devctl(device_object_t* device, io_request_t* ioreq)
     e1000_extension_t* ext = (e1000_extension_t*)device->device_extension;
     iostatus_t status = IO_SUCCESS;;
     unsigned char* mac;
+    netbuf_t* nb;
     int i;
 
     switch(ctlcode) {
@@ -935,6 +1029,23 @@ static iostatus_t e1000_devctl(device_object_t* device, io_request_t* ioreq)
         case NETIO_GETFLGS:
             *((unsigned long *) arg) = ext->flags;
             break;
+        case NETIO_GETSTAT:
+            *((netdev_stat_t *) arg) = ext->netpoll.stat;
+            break;
+        case NETIO_RECVBUF:
+            /* 把接收环中的缓冲区直接交给调用者，由调用者释放 */
+            nb = netbuf_queue_get(&ext->rx_queue, (ext->flags & DEV_NOWAIT) ? IO_NOWAIT : 0);
+            if(!nb) {
+                status = IO_FAILED | IO_ERRNO(EAGAIN);   /* 没有数据包 */
+                break;
+            }
+            *((netbuf_t **) arg) = nb;
+            break;
+        case NETIO_SENDSG:
+            if(e1000_transmit_sg(ext, (netbuf_sg_t *) arg, NULL)) {
+                status = IO_FAILED;
+            }
+            break;
         default:
             status = IO_FAILED;
             break;
@@ -960,15 +1071,17 @@ static iostatus_t e1000_enter(driver_object_t* driver)
         return status;
     }
 
-    /* neither io mode*/
-    devobj->flags = 0;
+    /* neither io mode，接收和发送各自加锁，读请求阻塞时不影响发送 */
+    devobj->flags = DO_ASYNC_IO;
 
     devext = (e1000_extension_t*)devobj->device_extension;   //设备扩展部分位于devobj的尾部
     devext->device_object = devobj;
     devext->hw.back = devext;
     devext->flags = 0;
-    /*初始化接收队列，用内核队列结构保存，等待被读取*/
-    io_device_queue_init(&devext->rx_queue);
+    /*初始化接收队列，接收到的缓冲区在队列中等待被读取*/
+    netbuf_queue_init(&devext->rx_queue);
+    spinlock_init(&devext->rx_lock);
+    list_init(&devext->pending_reads);
 
     /* 申请并初始化pci_device_t，io_addr、中断号*/
     if(e1000_get_pci_info(devext)) {
@@ -1207,52 +1320,57 @@ static void e1000_configure_rx(e1000_extension_t* ext)
     E1000_WRITE_REG(&ext->hw, RCTL, rctl);
 }
 
+static inline void
+e1000_map_rx_netbuf(struct e1000_buffer* buffer_info, netbuf_t* nb)
+{
+    /* 接收缓冲区大小设置的是2048，但是没有打开长帧接收(LPE)，
+       写入的帧不超过1522字节，不会越过数据区 */
+    buffer_info->netbuf = nb;
+    buffer_info->buffer = nb->data;
+    buffer_info->length = NETBUF_DATA_SIZE;
+    buffer_info->dma = kern_vir_addr2phy_addr(nb->data);
+}
+
 /**
- * e1000_alloc_rx_buffers - Replace used receive buffers
+ * e1000_alloc_rx_buffers - Fill the receive ring from the netbuf pool
  * @ext: address of board private structure
+ *
+ * 接收环始终是满的：收到数据包时先换上新的缓冲区再把旧的交出去，
+ * 这里只在启动网卡时填充一次。返回可用的描述符数量。
  **/
 
-static void e1000_alloc_rx_buffers(e1000_extension_t* ext)
+static int e1000_alloc_rx_buffers(e1000_extension_t* ext)
 {
     struct e1000_desc_ring* rx_ring = &ext->rx_ring;
     struct e1000_rx_desc* rx_desc;
     struct e1000_buffer* buffer_info;
-    uint8_t* buffer;
+    netbuf_t* nb;
     unsigned int i;
 
-    i = rx_ring->next_to_use;
-    buffer_info = &rx_ring->buffer_info[i];   //i=0
-
-    while(!buffer_info->buffer) {
-        buffer = mem_alloc(ext->rx_buffer_len + NET_IP_ALIGN);
-
-        if(unlikely(!buffer)) {
-            break;
+    for(i = 0; i < rx_ring->count; i++) {
+        buffer_info = &rx_ring->buffer_info[i];
+        if(!buffer_info->netbuf) {
+            nb = netbuf_alloc();
+            if(unlikely(!nb)) {
+                break;
+            }
+            e1000_map_rx_netbuf(buffer_info, nb);
         }
-
-        /* make buffer alignment 2 beyond a 16 byte boundary
-         * this will result in a 16 byte alinged IP header after
-         * the 14 byte MAC header is removed
-         */
-
-        buffer_info->buffer = buffer;
-        buffer_info->length = ext->rx_buffer_len;
-        buffer_info->dma = kern_vir_addr2phy_addr(buffer);
-
         rx_desc = E1000_RX_DESC(*rx_ring, i);
-        rx_desc->buffer_addr_low = byte_cpu_to_little_endian32(buffer_info->dma); //------
+        rx_desc->buffer_addr_low = byte_cpu_to_little_endian32(buffer_info->dma);
         rx_desc->buffer_addr_high = 0;
-
-        if(unlikely((i & ~(E1000_RX_BUFFER_WRITE - 1)) == i)) {
-            wmb();
-            E1000_WRITE_REG(&ext->hw, RDT, i);
-        }
-
-        if(unlikely(++i == rx_ring->count)) i = 0;
-        buffer_info = &rx_ring->buffer_info[i];
+        rx_desc->status = 0;
+    }
+    if(unlikely(i < 2)) {
+        return 0;
     }
 
+    /* 最后一个描述符留作间隔，RDH等于RDT时接收环为空 */
+    wmb();
+    E1000_WRITE_REG(&ext->hw, RDT, i - 1);
     rx_ring->next_to_use = i;
+    rx_ring->next_to_clean = 0;
+    return i;
 }
 
 /**
@@ -1389,6 +1507,8 @@ static void e1000_setup_rctl(e1000_extension_t* ext)
  * e1000_intr - Interrupt Handler
  * @irq: interrupt number
  * @data: pointer to a network interface device structure
+ *
+ * 读ICR应答中断后关闭网卡中断，收发的处理都交给轮询
  **/
 
 static int e1000_intr(irqno_t irq, void *data)
@@ -1397,29 +1517,51 @@ static int e1000_intr(irqno_t irq, void *data)
 
     struct e1000_hw* hw = &ext->hw;
     uint32_t icr = E1000_READ_REG(hw, ICR);
-#ifndef CONFIG_E1000_NAPI
-    unsigned int i;
-#endif
 
     if(unlikely(!icr)) {
         return IRQ_NEXTONE;
     }
+    netpoll_stat_irq(&ext->netpoll);
 
     if(unlikely(icr & (E1000_ICR_RXSEQ | E1000_ICR_LSC))) {
         hw->get_link_status = 1;
         timer_modify(&ext->watchdog_timer, systicks);
     }
 
-    for(i=0; i<E1000_MAX_INTR; i++) {
-        if(unlikely(!e1000_clean_rx_irq(ext) & 
-           !e1000_clean_tx_irq(ext))) {
-            break;
-        }
-    }
+    e1000_irq_disable(ext);
+    netpoll_schedule(&ext->netpoll);
 
     return IRQ_HANDLED;
 }
 
+/**
+ * e1000_poll - NET_RX软中断中的轮询函数
+ * @np: 网卡的轮询结构
+ * @budget: 这次最多处理的数据包数
+ *
+ * 接收环处理完后才重新打开网卡中断，关闭期间到达的数据包会在ICR中
+ * 留下中断原因，打开后立即产生中断，不会丢失。
+ **/
+
+static int e1000_poll(netpoll_t* np, int budget)
+{
+    e1000_extension_t* ext = (e1000_extension_t*)np->data;
+    unsigned long flags;
+    int work_done = 0;
+
+    spin_lock_irqsave(&ext->tx_lock, flags);
+    e1000_clean_tx_irq(ext);
+    spin_unlock_irqrestore(&ext->tx_lock, flags);
+
+    e1000_clean_rx_irq(ext, &work_done, budget);
+
+    if(work_done < budget) {
+        netpoll_complete(np);
+        e1000_irq_enable(ext);
+    }
+    return work_done;
+}
+
 /**
  * e1000_rx_checksum - Receive Checksum Offload for 82543
  * @ext: board private structure
@@ -1453,23 +1595,20 @@ e1000_rx_checksum(e1000_extension_t* ext,
  **/
 
 static boolean_t
-#ifdef CONFIG_E1000_NAPI
 e1000_clean_rx_irq(e1000_extension_t* ext, int* work_done,
                    int work_to_do)
-#else
-e1000_clean_rx_irq(e1000_extension_t* ext)
-#endif
 {
     struct e1000_desc_ring* rx_ring = &ext->rx_ring;
     device_object_t* netdev = ext->device_object;
     // pci_device_t* pci_dev = ext->pci_device;
     struct e1000_rx_desc* rx_desc;
     struct e1000_buffer* buffer_info;
+    netbuf_t* nb;
     uint8_t* buffer;
     unsigned long flags;
     uint32_t length;
     uint8_t last_byte;
-    unsigned int i;
+    unsigned int i, last = 0;
     boolean_t cleaned = FALSE;
 
     i = rx_ring->next_to_clean;
@@ -1481,12 +1620,10 @@ e1000_clean_rx_irq(e1000_extension_t* ext)
     while(rx_desc->status & E1000_RXD_STAT_DD) {
         // keprint(PRINT_DEBUG "i = %d\n", i);
         buffer_info = &rx_ring->buffer_info[i];
-#ifdef CONFIG_E1000_NAPI
         if(*work_done >= work_to_do) {
             break;
         }
         (*work_done)++;
-#endif
         cleaned = TRUE;
 
         buffer = buffer_info->buffer;
@@ -1496,7 +1633,6 @@ e1000_clean_rx_irq(e1000_extension_t* ext)
         if(unlikely(!(rx_desc->status & E1000_RXD_STAT_EOP))) {
             /* all receives must fit into a single buffer */
             keprint(PRINT_DEBUG "%s: receive packet consumed multiple buffers", netdev->name);
-            mem_free(buffer);
             goto next_desc;
         }
 
@@ -1512,7 +1648,6 @@ e1000_clean_rx_irq(e1000_extension_t* ext)
                 spin_unlock_irqrestore(&ext->stats_lock, flags);
                 length--;
             } else {
-                mem_free(buffer);
                 goto next_desc;
             }
         }
@@ -1527,23 +1662,38 @@ e1000_clean_rx_irq(e1000_extension_t* ext)
         //     }
         // }
 
-    	/* 网络接口发送数据包 */
-        // keprint(PRINT_DEBUG "len = %d\n\n", length - 4);
-        io_device_queue_append(&ext->rx_queue, buffer, length - ETHERNET_FCS_SIZE);
-        // io_device_queue_append(&ext->rx_queue, buffer, length);
+        /* 先从缓冲池换上新的缓冲区，缓冲池用完时丢弃数据包，旧的缓冲区留在接收环中 */
+        nb = netbuf_alloc();
+        if(unlikely(!nb)) {
+            netpoll_drop(&ext->netpoll);
+            goto next_desc;
+        }
+        /* 把DMA缓冲区直接放入接收队列，不复制数据 */
+        buffer_info->netbuf->length = length - ETHERNET_FCS_SIZE;
+        if(netbuf_queue_put(&ext->rx_queue, buffer_info->netbuf) < 0) {
+            netpoll_drop(&ext->netpoll);
+            netbuf_free(buffer_info->netbuf);
+        }
+        e1000_map_rx_netbuf(buffer_info, nb);
 
 next_desc:
+        rx_desc->buffer_addr_low = byte_cpu_to_little_endian32(buffer_info->dma);
+        rx_desc->buffer_addr_high = 0;
         rx_desc->status = 0;
-        buffer_info->buffer = NULL;
+        last = i;
         if(unlikely(++i == rx_ring->count)) {
             i = 0;
         }
         rx_desc = E1000_RX_DESC(*rx_ring, i);
     }
 
-    rx_ring->next_to_clean = i;
-
-    e1000_alloc_rx_buffers(ext);
+    if(cleaned) {
+        rx_ring->next_to_clean = i;
+        /* 处理完的描述符还给网卡 */
+        wmb();
+        E1000_WRITE_REG(&ext->hw, RDT, last);
+        e1000_complete_pending_reads(ext);
+    }
 
     return cleaned;
 }
@@ -1555,9 +1705,15 @@ e1000_unmap_and_free_tx_resource(e1000_extension_t* ext,
     if(buffer_info->dma) {
         buffer_info->dma = 0;
     }
-    if(buffer_info->buffer) {
-        //mem_free(buffer_info->buffer);
-        buffer_info->buffer = NULL;
+    buffer_info->buffer = NULL;
+    if(buffer_info->netbuf) {
+        netbuf_free(buffer_info->netbuf);
+        buffer_info->netbuf = NULL;
+    }
+    /* 发送完成，把请求还给调用者 */
+    if(buffer_info->sg) {
+        netbuf_sg_complete(buffer_info->sg);
+        buffer_info->sg = NULL;
     }
 }
 
@@ -1619,47 +1775,61 @@ static boolean_t e1000_clean_tx_irq(e1000_extension_t* ext)
 #define E1000_TX_FLAGS_VLAN_MASK	0xffff0000
 #define E1000_TX_FLAGS_VLAN_SHIFT	16
 
+/**
+ * e1000_tx_map - 把发送请求的每个分段映射到发送描述符上
+ *
+ * 分段直接由网卡DMA，请求和复制用的缓冲区记录在最后一个描述符上，发送完成后释放
+ **/
 static inline int
 e1000_tx_map(e1000_extension_t* ext, 
-             uint8_t* buffer, 
+             netbuf_sg_t* sg, 
+             netbuf_t* nb, 
              unsigned int first, 
-             unsigned int max_per_txd, 
-             int length)
+             unsigned int max_per_txd)
 {
     struct e1000_desc_ring* tx_ring = &ext->tx_ring;
     struct e1000_buffer* buffer_info;
-    unsigned int len = length;
-    unsigned int offset = 0, size, count = 0, i;
+    uint8_t* buffer = NULL;
+    unsigned int len, offset, size, count = 0, i;
+    int seg;
 
     i = tx_ring->next_to_use;
 
-    while(len) {
-        buffer_info = &tx_ring->buffer_info[i];
-        size = min(len, max_per_txd);
-        if(unlikely(ext->pcix_82544 && 
-           !((unsigned long)(buffer + offset + size -1) & 4) &&
-           size > 4)) {
-            size -= 4;
-        }
+    for(seg = 0; seg < sg->count; seg++) {
+        buffer = sg->seg[seg].addr;
+        len = sg->seg[seg].len;
+        offset = 0;
+        while(len) {
+            buffer_info = &tx_ring->buffer_info[i];
+            size = min(len, max_per_txd);
+            if(unlikely(ext->pcix_82544 && 
+               !((unsigned long)(buffer + offset + size -1) & 4) &&
+               size > 4)) {
+                size -= 4;
+            }
 
-        buffer_info->length = size;
-        buffer_info->dma = kern_vir_addr2phy_addr(buffer + offset);
-        // keprint(PRINT_DEBUG "tx_buffer_info->dma = %d\n", buffer_info->dma);
-        buffer_info->time_stamp = systicks;
+            buffer_info->length = size;
+            buffer_info->dma = kern_vir_addr2phy_addr(buffer + offset);
+            buffer_info->time_stamp = systicks;
 
-        len -= size;
-        offset += size;
-        count++;
-        if(unlikely(++i == tx_ring->count)) {
-            i = 0;
+            len -= size;
+            offset += size;
+            count++;
+            if(unlikely(++i == tx_ring->count)) {
+                i = 0;
+            }
         }
     }
 
     i = (i == 0) ? tx_ring->count - 1 : i - 1;
     tx_ring->buffer_info[i].buffer = buffer;
+    if(nb) {
+        tx_ring->buffer_info[i].netbuf = nb;
+    } else {
+        tx_ring->buffer_info[i].sg = sg;
+    }
     tx_ring->buffer_info[first].next_to_watch = i;
 
-
     return count;
 }
 
@@ -1716,52 +1886,87 @@ e1000_tx_queue(e1000_extension_t* ext, int count, int tx_flags)
     E1000_WRITE_REG(&ext->hw, TDT, i);
 }
 
-int e1000_transmit(e1000_extension_t* ext, uint8_t* buf, uint32_t len)
+/**
+ * e1000_transmit_sg - 分散/聚集发送
+ * @sg: 发送请求，发送完成后在中断中调用sg->done
+ * @nb: 不为NULL时表示数据在nb中，发送完成后释放nb，不调用sg->done
+ *
+ * 描述符不够时返回-1，请求仍然由调用者持有
+ **/
+int e1000_transmit_sg(e1000_extension_t* ext, netbuf_sg_t* sg, netbuf_t* nb)
 {
     unsigned int first, max_per_txd = E1000_MAX_DATA_PER_TXD;
     unsigned int max_txd_pwr = E1000_MAX_TXD_PWR;
     unsigned int tx_flags = 0;
-    unsigned int length = len;
     unsigned long flags;
-    unsigned long intr_flags;
     int count = 0;
+    int i;
 
-    interrupt_save_and_disable(intr_flags);
-
-    if(unlikely(len <= 0)) {
-        mem_free(buf);
-        interrupt_restore_state(intr_flags);
-        return 0;
+    if(unlikely(!sg->count || sg->count > NETBUF_SG_MAX || !sg->total)) {
+        return -1;
     }
 
-    count += TXD_USE_COUNT(len, max_txd_pwr);
-
-    if(ext->pcix_82544) {
-        count++;
+    for(i = 0; i < sg->count; i++) {
+        count += TXD_USE_COUNT(sg->seg[i].len, max_txd_pwr);
+        if(ext->pcix_82544) {
+            count++;
+        }
     }
 
     spin_lock_irqsave(&ext->tx_lock, flags);
 
     if(unlikely(E1000_DESC_UNUSED(&ext->tx_ring) < count + 2)) {
-        spin_unlock_irqrestore(&ext->tx_lock, flags);
-        return -1;
+        /* 回收已经发送完的描述符再试一次 */
+        e1000_clean_tx_irq(ext);
+        if(unlikely(E1000_DESC_UNUSED(&ext->tx_ring) < count + 2)) {
+            spin_unlock_irqrestore(&ext->tx_lock, flags);
+            return -1;
+        }
     }
 
-    spin_unlock_irqrestore(&ext->tx_lock, flags);
-
     first = ext->tx_ring.next_to_use;
 
-    //int count_ = e1000_tx_map(ext, buf, first, max_per_txd, length);
-    // keprint(PRINT_DEBUG "transmit---tx_length=%d\n", length);
     e1000_tx_queue(ext, 
-        e1000_tx_map(ext, buf, first, max_per_txd, length), 
+        e1000_tx_map(ext, sg, nb, first, max_per_txd), 
         tx_flags);
     
-    interrupt_restore_state(intr_flags);
+    spin_unlock_irqrestore(&ext->tx_lock, flags);
 
     return 0;
 }
 
+/**
+ * e1000_transmit - 发送一个连续的数据包
+ *
+ * 调用者的缓冲区在返回后就可能被重用，所以先复制到缓冲池中再发送
+ **/
+int e1000_transmit(e1000_extension_t* ext, uint8_t* buf, uint32_t len)
+{
+    netbuf_sg_t sg;
+    netbuf_t* nb;
+
+    if(unlikely(!len || len > NETBUF_DATA_SIZE)) {
+        return -1;
+    }
+    nb = netbuf_alloc();
+    if(unlikely(!nb)) {
+        return -1;
+    }
+    memcpy(nb->data, buf, len);
+    nb->length = len;
+
+    sg.count = 1;
+    sg.total = len;
+    sg.seg[0].addr = nb->data;
+    sg.seg[0].len = len;
+    sg.done = NULL;
+    if(e1000_transmit_sg(ext, &sg, nb)) {
+        netbuf_free(nb);
+        return -1;
+    }
+    return 0;
+}
+
 static __init void e1000_driver_entry(void)
 {
     if (driver_object_create(e1000_driver_func) < 0) {
@@ -1,6 +1,7 @@
 #include <xbook/debug.h>
 #include <xbook/bitops.h>
 #include <string.h>
+#include <errno.h>
 #include <stdint.h>
 
 #include <xbook/driver.h>
@@ -10,6 +11,8 @@
 #include <math.h>
 #include <xbook/waitqueue.h>
 #include <xbook/memalloc.h>
+#include <xbook/netbuf.h>
+#include <xbook/netpoll.h>
 #include <arch/io.h>
 #include <xbook/hardirq.h>
 #include <arch/pci.h>
@@ -79,6 +82,7 @@
 #define CSR2        2
 #define CSR3        3   /*  Interrupt Masks and Deferral Control */
 #define CSR3_IDONM  (1 << 8)   /* Initialization Done Mask. */
+#define CSR3_RINTM  (1 << 10)  /* Receive Interrupt Mask. */
 #define CSR4        4   /* Test and Features Control */
 #define CSR4_ASTRP_RCV  (1 << 10)   /* Auto Strip Receive */
 #define CSR4_APAD_XMT   (1 << 11)   /* Auto Pad Transmit */
@@ -211,10 +215,15 @@ typedef struct _device_extension {
     struct pcnet32_rx_desc *rdes;   /* pointer to ring buffer of receive des */
     struct pcnet32_tx_desc *tdes;   /* pointer to ring buffer of transmit des */
 
-    uint32_t rx_buffers; /* physical address of actual receive buffers (< 4 GiB) */
+    netbuf_t *rx_netbuf[PCNET32_RX_BUFFERS];  /* 接收缓冲区来自缓冲池，收到后直接交给读者 */
     uint32_t tx_buffers; /* physical address of actual transmit buffers (< 4 GiB) */
 
-    device_queue_t rx_queue;    /* 接收队列 */
+    netbuf_sg_t *tx_sg[PCNET32_TX_BUFFERS];   /* 分散/聚集发送的请求，记录在最后一个描述符上 */
+    uint32_t tx_clean_ptr;   /* 下一个待回收的发送描述符 */
+    uint32_t tx_pending;     /* 已经交给网卡还没有回收的发送描述符数量 */
+
+    netbuf_queue_t rx_queue;    /* 接收队列 */
+    netpoll_t netpoll;          /* 接收轮询 */
 } device_extension_t;
 
 /**
@@ -239,7 +248,7 @@ static void pcnet32_init_rx_desc_entry(device_extension_t *dev, uint32_t idx)
     struct pcnet32_rx_desc *des = dev->rdes + idx;
     memset(des, 0, dev->de_size);
 
-    des->base = kern_vir_addr2phy_addr(dev->rx_buffers + idx * dev->buffer_size);
+    des->base = kern_vir_addr2phy_addr(dev->rx_netbuf[idx]->data);
 
     /* next 2 bytes are 0xf000 OR'd with the first 12 bits of the 2s complement of the length */
     uint16_t bcnt = (uint16_t)(-dev->buffer_size);
@@ -337,57 +346,135 @@ static int pcnet32_get_pci(device_extension_t *dev)
     return 0;
 }
 
-static int pcnet32_transmit(device_extension_t *dev, uint8_t *buf, size_t len)
+/**
+ * 回收网卡已经发送完的描述符，归还分散/聚集发送的请求，需要关闭中断
+ */
+static void pcnet32_tx_reclaim(device_extension_t *dev)
 {
-    if(len > ETH_FRAME_LEN)
+    while (dev->tx_pending > 0 && pcnet32_is_driver_own(dev, TRUE, dev->tx_clean_ptr))
     {
-        len = ETH_FRAME_LEN;
+        netbuf_sg_t *sg = dev->tx_sg[dev->tx_clean_ptr];
+        if (sg)
+        {
+            dev->tx_sg[dev->tx_clean_ptr] = NULL;
+            netbuf_sg_complete(sg);
+        }
+        dev->tx_pending--;
+        dev->tx_clean_ptr = pcnet32_get_next_desc(dev, dev->tx_clean_ptr, dev->tx_buffer_count);
     }
+}
 
+/**
+ * 等待count个空闲的发送描述符，需要关闭中断
+ */
+static int pcnet32_tx_wait_desc(device_extension_t *dev, uint32_t count)
+{
     uint32_t tx_retry = PCNET32_TX_RETRY;
 
     while (tx_retry > 0)
     {
-        /* the next available descriptor entry index is in tx_buffer_ptr */
-        if(!pcnet32_is_driver_own(dev, TRUE, dev->tx_buffer_ptr))
-        {
-            /* try encourage the card to send all buffers. */
-            pcnet32_wio_write_csr(dev->iobase, CSR0, pcnet32_wio_read_csr(dev->iobase, CSR0) | CSR0_TXPOLL);
-        }
-        else
-        {
-            break;
-        }
+        pcnet32_tx_reclaim(dev);
+        if (dev->tx_buffer_count - dev->tx_pending >= count)
+            return 0;
+        /* try encourage the card to send all buffers. */
+        pcnet32_wio_write_csr(dev->iobase, CSR0, pcnet32_wio_read_csr(dev->iobase, CSR0) | CSR0_TXPOLL);
         --tx_retry;
     }
+    /* retry end, no entry available */
+    return -1;
+}
+
+static void pcnet32_fill_tx_desc(struct pcnet32_tx_desc *tdes, dma_addr_t base, size_t len, uint16_t status)
+{
+    tdes->base = base;
+    uint16_t bcnt = (uint16_t)(-len);
+    bcnt &= 0xfff;
+    bcnt |= 0xf000; /* high 4 bits fixed 1 */
+    tdes->buf_length = bcnt;
+    tdes->misc = 0;
+    tdes->status = status;
+}
+
+static int pcnet32_transmit(device_extension_t *dev, uint8_t *buf, size_t len)
+{
+    if(len > ETH_FRAME_LEN)
+    {
+        len = ETH_FRAME_LEN;
+    }
 
-    if (!tx_retry)  /* retry end, no entry available */
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (pcnet32_tx_wait_desc(dev, 1) < 0)
     {
+        interrupt_restore_state(flags);
         errprint("transmit no available descriptor entry\n");
         return -1;
     }
 
-    memcpy((void *)(dev->tx_buffers + dev->tx_buffer_ptr * dev->buffer_size), buf, len);
+    uint8_t *txbuf = (uint8_t *)(dev->tx_buffers + dev->tx_buffer_ptr * dev->buffer_size);
+    memcpy(txbuf, buf, len);
 
     struct pcnet32_tx_desc *tdes = dev->tdes + dev->tx_buffer_ptr;
     /**
      * set the STP bit in the descriptor entry (signals this is the first
-     * frame in a split packet - we only support single frames)
+     * frame in a split packet) and the ENP bit to state this is also the
+     * end of a packet, finally, flip the ownership bit back to the card.
+     * 描述符可能被分散/聚集发送用过，需要重新设置缓冲区地址。
      */
-    tdes->status |= PCNET32_DESC_STATUS_STP;
+    pcnet32_fill_tx_desc(tdes, kern_vir_addr2phy_addr(txbuf), len,
+        PCNET32_DESC_STATUS_STP | PCNET32_DESC_STATUS_ENP | PCNET32_DESC_STATUS_OWN);
 
-    /* similarly, set the ENP bit to state this is also the end of a packet */
-    tdes->status |= PCNET32_DESC_STATUS_ENP;
+    dev->tx_pending++;
+    dev->tx_buffer_ptr = pcnet32_get_next_desc(dev, dev->tx_buffer_ptr, dev->tx_buffer_count);
+    interrupt_restore_state(flags);
+    return 0;
+}
 
-    uint16_t bcnt = (uint16_t)(-len);
-    bcnt &= 0xfff;
-    bcnt |= 0xf000; /* high 4 bits fixed 1 */
-    tdes->buf_length = bcnt;
+/**
+ * 分散/聚集发送：每个分段占用一个描述符，网卡直接DMA分段，不复制数据。
+ * 发送完成后在回收描述符时调用sg->done。
+ */
+static int pcnet32_transmit_sg(device_extension_t *dev, netbuf_sg_t *sg)
+{
+    if (!sg->count || sg->count > dev->tx_buffer_count || sg->total > ETH_FRAME_LEN)
+        return -1;
 
-    /* finally, flip the ownership bit back to the card */
-    tdes->status |= PCNET32_DESC_STATUS_OWN;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (pcnet32_tx_wait_desc(dev, sg->count) < 0)
+    {
+        interrupt_restore_state(flags);
+        return -1;
+    }
 
-    dev->tx_buffer_ptr = pcnet32_get_next_desc(dev, dev->tx_buffer_ptr, dev->tx_buffer_count);
+    uint32_t first = dev->tx_buffer_ptr;
+    uint32_t idx = first;
+    uint16_t status;
+    int i;
+    for (i = 0; i < sg->count; i++)
+    {
+        status = 0;
+        if (i == 0)
+            status |= PCNET32_DESC_STATUS_STP;
+        else    /* 第一个描述符最后再交给网卡，避免网卡提前开始发送 */
+            status |= PCNET32_DESC_STATUS_OWN;
+        if (i == sg->count - 1)
+        {
+            status |= PCNET32_DESC_STATUS_ENP;
+            dev->tx_sg[idx] = sg;
+        }
+        pcnet32_fill_tx_desc(dev->tdes + idx, kern_vir_addr2phy_addr(sg->seg[i].addr),
+            sg->seg[i].len, status);
+        idx = pcnet32_get_next_desc(dev, idx, dev->tx_buffer_count);
+    }
+    wmb();
+    dev->tdes[first].status |= PCNET32_DESC_STATUS_OWN;
+
+    dev->tx_pending += sg->count;
+    dev->tx_buffer_ptr = idx;
+    /* 通知网卡立即检查发送环 */
+    pcnet32_wio_write_csr(dev->iobase, CSR0, CSR0_TXPOLL | CSR0_INTEN);
+    interrupt_restore_state(flags);
     return 0;
 }
 
@@ -410,7 +497,7 @@ static iostatus_t pcnet32_read(device_object_t *device, io_request_t *ioreq)
         flags |= IO_NOWAIT;
     }
     /* 从网络接收队列中获取一个包 */
-    len = io_device_queue_pickup(&ext->rx_queue, buf, len, flags);
+    len = netbuf_queue_read(&ext->rx_queue, buf, len, flags);
     if (len < 0)
         status = IO_FAILED;
 
@@ -456,6 +543,7 @@ static iostatus_t pcnet32_devctl(device_object_t *device, io_request_t *ioreq)
     device_extension_t *extension = (device_extension_t *) device->device_extension;
     iostatus_t status = IO_SUCCESS;
     unsigned char *mac;
+    netbuf_t *nb;
 
     switch (ctlcode)
     {
@@ -477,6 +565,21 @@ static iostatus_t pcnet32_devctl(device_object_t *device, io_request_t *ioreq)
     case NETIO_GETFLGS:
         *((unsigned long *) arg) = extension->flags;
         break;
+    case NETIO_GETSTAT:
+        *((netdev_stat_t *) arg) = extension->netpoll.stat;
+        break;
+    case NETIO_RECVBUF:
+        nb = netbuf_queue_get(&extension->rx_queue, (extension->flags & DEV_NOWAIT) ? IO_NOWAIT : 0);
+        if (nb == NULL) {
+            status = IO_FAILED | IO_ERRNO(EAGAIN);   /* 没有数据包 */
+            break;
+        }
+        *((netbuf_t **) arg) = nb;
+        break;
+    case NETIO_SENDSG:
+        if (pcnet32_transmit_sg(extension, (netbuf_sg_t *) arg) < 0)
+            status = IO_FAILED;
+        break;
     default:
         status = IO_FAILED;
         break;
@@ -487,23 +590,65 @@ static iostatus_t pcnet32_devctl(device_object_t *device, io_request_t *ioreq)
     return status;
 }
 
-static void pcnet32_rx_packet(device_extension_t *dev)
+/**
+ * 处理接收环中收到的数据包，最多处理budget个，返回处理的个数
+ */
+static int pcnet32_rx_packet(device_extension_t *dev, int budget)
 {
-    while (pcnet32_is_driver_own(dev, FALSE, dev->rx_buffer_ptr))
+    int received = 0;
+    while (received < budget && pcnet32_is_driver_own(dev, FALSE, dev->rx_buffer_ptr))
     {
         struct pcnet32_rx_desc *rdes = dev->rdes + dev->rx_buffer_ptr;
         uint32_t plen = rdes->msg_length; /* msg len no need to negate it unlike BCNT above */
 
-        void *pbuf = (void *)(dev->rx_buffers + dev->rx_buffer_ptr * dev->buffer_size);
-        // log_print("recv packet on ring %d: buf=%p, len=%d\n", dev->rx_buffer_ptr, pbuf, plen);
-        /* merge size and data into receive pkg */
-        io_device_queue_append(&dev->rx_queue, pbuf, plen);
+        /* 换上缓冲池中新的缓冲区，把收到数据的缓冲区直接放入接收队列。
+        缓冲池用完时丢弃数据包，继续使用原来的缓冲区 */
+        netbuf_t *nb = netbuf_alloc();
+        if (nb != NULL)
+        {
+            netbuf_t *rxnb = dev->rx_netbuf[dev->rx_buffer_ptr];
+            rxnb->length = plen;
+            if (netbuf_queue_put(&dev->rx_queue, rxnb) < 0)
+            {
+                netbuf_free(rxnb);
+                netpoll_drop(&dev->netpoll);
+            }
+            dev->rx_netbuf[dev->rx_buffer_ptr] = nb;
+            rdes->base = kern_vir_addr2phy_addr(nb->data);
+        }
+        else
+        {
+            netpoll_drop(&dev->netpoll);
+        }
 
         /* hand the buffer back to the card */
         rdes->status = PCNET32_DESC_STATUS_OWN;
 
         dev->rx_buffer_ptr = pcnet32_get_next_desc(dev, dev->rx_buffer_ptr, dev->rx_buffer_count);
+        received++;
     }
+    return received;
+}
+
+/**
+ * NET_RX软中断中的轮询函数，接收环空了才取消接收中断的屏蔽。
+ * 屏蔽期间收到数据包仍然会设置CSR0的RINT，取消屏蔽后立即产生中断。
+ */
+static int pcnet32_poll(netpoll_t *np, int budget)
+{
+    device_extension_t *dev = (device_extension_t *) np->data;
+    int work_done = pcnet32_rx_packet(dev, budget);
+    if (work_done < budget)
+    {
+        /* 通过RAP/RDP访问寄存器不是原子的，需要关闭中断 */
+        unsigned long flags;
+        interrupt_save_and_disable(flags);
+        netpoll_complete(np);
+        pcnet32_wio_write_csr(dev->iobase, CSR3,
+            pcnet32_wio_read_csr(dev->iobase, CSR3) & ~CSR3_RINTM);
+        interrupt_restore_state(flags);
+    }
+    return work_done;
 }
 
 static int pcnet32_handler(irqno_t irq, void *data)
@@ -514,10 +659,17 @@ static int pcnet32_handler(irqno_t irq, void *data)
     uint32_t iobase = dev->iobase;
     uint32_t csr0 = pcnet32_wio_read_csr(iobase, 0);
 
+    netpoll_stat_irq(&dev->netpoll);
+    /* 回收发送完的描述符 */
+    if (csr0 & CSR0_TINT)
+        pcnet32_tx_reclaim(dev);
+
     if (csr0 & CSR0_RINT) /* recv packet */
     {
         log_print("RX intr occur!\n");
-        pcnet32_rx_packet(dev);
+        /* 屏蔽接收中断，接收交给轮询处理 */
+        pcnet32_wio_write_csr(iobase, CSR3, pcnet32_wio_read_csr(iobase, CSR3) | CSR3_RINTM);
+        netpoll_schedule(&dev->netpoll);
     }
     else if ((csr0 & CSR0_TINT))    /* packet transmitted */
     {
@@ -569,27 +721,33 @@ static int pcnet32_alloc_ring_buffer(device_extension_t *dev)
         return -1;
     }
 
-    dev->rx_buffers = (uint32_t)mem_alloc_align(dev->rx_buffer_count * dev->buffer_size, 16);
-    if (dev->rx_buffers == 0)
+    int i = 0;
+    for (i = 0; i < dev->rx_buffer_count; i++)
     {
-        errprint("alloc memory for rx ring buffer failed!");
-        mem_free_align(dev->rdes);
-        mem_free_align(dev->tdes);
-        return -1;
+        dev->rx_netbuf[i] = netbuf_alloc();
+        if (dev->rx_netbuf[i] == NULL)
+        {
+            errprint("alloc netbuf for rx ring failed!");
+            while (--i >= 0)
+                netbuf_free(dev->rx_netbuf[i]);
+            mem_free_align(dev->rdes);
+            mem_free_align(dev->tdes);
+            return -1;
+        }
     }
 
     dev->tx_buffers = (uint32_t)mem_alloc_align(dev->tx_buffer_count * dev->buffer_size, 16);
     if (dev->tx_buffers == 0)
     {
         errprint("alloc memory for tx ring buffer failed!");
+        for (i = 0; i < dev->rx_buffer_count; i++)
+            netbuf_free(dev->rx_netbuf[i]);
         mem_free_align(dev->rdes);
         mem_free_align(dev->tdes);
-        mem_free_align((void *)dev->rx_buffers);
         return -1;
     }
-    log_print("rdes:%p tdes:%p rbuf:%p tbuf:%p\n", dev->rdes, dev->tdes, dev->rx_buffers, dev->tx_buffers);
+    log_print("rdes:%p tdes:%p tbuf:%p\n", dev->rdes, dev->tdes, dev->tx_buffers);
 
-    int i = 0;
     for (i = 0; i < dev->rx_buffer_count; i++)
     {
         pcnet32_init_rx_desc_entry(dev, i);
@@ -603,9 +761,11 @@ static int pcnet32_alloc_ring_buffer(device_extension_t *dev)
 
 static void pcnet32_free_ring_buffer(device_extension_t *dev)
 {
+    int i;
+    for (i = 0; i < dev->rx_buffer_count; i++)
+        netbuf_free(dev->rx_netbuf[i]);
     mem_free_align(dev->rdes);
     mem_free_align(dev->tdes);
-    mem_free_align((void *)dev->rx_buffers);
     mem_free_align((void *)dev->tx_buffers);
 }
 
@@ -645,6 +805,8 @@ static int pcnet32_init(device_extension_t *dev)
     /* init buffer info */
     dev->rx_buffer_ptr = 0;
     dev->tx_buffer_ptr = 0;
+    dev->tx_clean_ptr = 0;
+    dev->tx_pending = 0;
 
     dev->rx_buffer_count = PCNET32_RX_BUFFERS;
     dev->tx_buffer_count = PCNET32_TX_BUFFERS;
@@ -661,7 +823,9 @@ static int pcnet32_init(device_extension_t *dev)
     dev->tx_ring_dma_addr = (uint32_t)kern_vir_addr2phy_addr(dev->tdes);
 
     /* 初始化接收队列，用内核队列结构保存，等待被读取 */
-    io_device_queue_init(&dev->rx_queue);
+    netbuf_queue_init(&dev->rx_queue);
+    netpoll_init(&dev->netpoll, pcnet32_poll, NETPOLL_WEIGHT, dev);
+    netpoll_enable(&dev->netpoll);
 
     /* alloc init block, must 16 bit align */
     dev->init_block = mem_alloc_align(sizeof(struct pcnet32_init_block), 16);
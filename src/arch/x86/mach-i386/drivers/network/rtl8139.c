@@ -107,6 +107,7 @@
 #include <xbook/debug.h>
 #include <xbook/bitops.h>
 #include <string.h>
+#include <errno.h>
 
 #include <xbook/driver.h>
 #include <assert.h>
@@ -115,6 +116,8 @@
 #include <math.h>
 #include <xbook/waitqueue.h>
 #include <xbook/memalloc.h>
+#include <xbook/netbuf.h>
+#include <xbook/netpoll.h>
 #include <arch/io.h>
 #include <xbook/hardirq.h>
 #include <arch/pci.h>
@@ -563,7 +566,8 @@ typedef struct _device_extension {
 
     uint32_t rx_config;      /* 接收配置 */
 
-    device_queue_t rx_queue;    /* 接收队列 */
+    netbuf_queue_t rx_queue;    /* 接收队列 */
+    netpoll_t netpoll;          /* 接收轮询 */
 } device_extension_t;
 
 struct rx_packet_header {
@@ -605,12 +609,10 @@ static const unsigned int rtl8139_tx_config =
 static const u16 rtl8139_intr_mask =
 	PCI_ERR | PCS_TIMEOUT | RX_UNDERRUN | RX_OVERFLOW | RX_FIFO_OVER |
 	TX_ERR | TX_OK | RX_ERR | RX_OK;
-#if 0
-/* 没有接收的中断屏蔽 */
+/* 没有接收的中断屏蔽，轮询接收时使用 */
 static const u16 rtl8139_no_rx_intr_mask =
 	PCI_ERR | PCS_TIMEOUT | RX_UNDERRUN |
 	TX_ERR | TX_OK | RX_ERR ;
-#endif
 
 static int rtl8139_get_pci_info(device_extension_t *ext)
 {
@@ -661,10 +663,17 @@ static int rtl8139_next_desc(int current_desc)
     return (current_desc == NUM_TX_DESC - 1) ? 0 : (current_desc + 1);
 }
 
-int rtl8139_transmit(device_extension_t *ext, uint8_t *buf, uint32 len)
+/**
+ * rtl8139_transmit_sg - 分散/聚集发送
+ * @sg: 发送请求
+ * 
+ * 网卡只有4个固定的发送缓冲区，不能直接DMA分段，所以把所有分段聚集复制到发送缓冲区中，
+ * 复制完成后立即归还请求。
+ */
+int rtl8139_transmit_sg(device_extension_t *ext, netbuf_sg_t *sg)
 {
     uint32_t entry;
-    uint32_t length = len;
+    uint32_t length = sg->total;
 
     /* 获取当前传输项 */
     entry = ext->current_tx;
@@ -696,13 +705,15 @@ int rtl8139_transmit(device_extension_t *ext, uint8_t *buf, uint32 len)
             if (length < ETH_ZLEN)
                 memset(ext->tx_buffer[entry], 0, ETH_ZLEN);  /* 前面的部分置0 */
 
-            /* 复制数据 */
-            memcpy(ext->tx_buffer[entry], buf, length);
+            /* 聚集复制数据 */
+            netbuf_sg_copy(sg, ext->tx_buffer[entry], TX_BUF_SIZE);
 
         } else {    /* 长度过长 */
             /* 丢掉数据包 */
             ext->stats.tx_dropped++; 
             keprint(PRINT_DEBUG "dropped a packed!\n");
+            interrupt_restore_state(flags);
+            netbuf_sg_complete(sg);
             return 0;
         }
 
@@ -738,6 +749,8 @@ int rtl8139_transmit(device_extension_t *ext, uint8_t *buf, uint32 len)
         return -1;
     }
     interrupt_restore_state(flags);
+    /* 数据已经复制走了 */
+    netbuf_sg_complete(sg);
 
 #ifdef DEBUG_DRV 
     keprint(PRINT_DEBUG "Queued Tx packet size %d to slot %d\n",
@@ -746,6 +759,17 @@ int rtl8139_transmit(device_extension_t *ext, uint8_t *buf, uint32 len)
     return 0;
 }
 
+int rtl8139_transmit(device_extension_t *ext, uint8_t *buf, uint32 len)
+{
+    netbuf_sg_t sg;
+    sg.count = 1;
+    sg.total = len;
+    sg.seg[0].addr = buf;
+    sg.seg[0].len = len;
+    sg.done = NULL;
+    return rtl8139_transmit_sg(ext, &sg);
+}
+
 static int rtl8139_tx_interrupt(device_extension_t *ext)
 {
 #ifdef DEBUG_DRV
@@ -952,13 +976,14 @@ static void rtl8139_isr_ack(device_extension_t *ext)
     }
 }
 
-static int rtl8139_rx_interrupt(device_extension_t *ext)
+static int rtl8139_rx_interrupt(device_extension_t *ext, int budget)
 {
 #ifdef DEBUG_DRV
     keprint(PRINT_DEBUG "RX\n");
 #endif
     int received = 0;
     unsigned char *rx_ring = ext->rx_ring;
+    netbuf_t *nb;
     unsigned int current_rx = ext->current_rx;
     unsigned int rx_size = 0;
 #ifdef DEBUG_DRV
@@ -968,8 +993,9 @@ static int rtl8139_rx_interrupt(device_extension_t *ext)
             in16(ext->io_addr + RX_BUF_PTR),
             in8(ext->io_addr + CHIP_CMD));
 #endif
-    /* 当队列在运行中，并且接收缓冲区不是空 */
-    while (!(in8(ext->io_addr + CHIP_CMD) & RX_BUFFER_EMPTY)) {
+    /* 当队列在运行中，并且接收缓冲区不是空，最多处理budget个包 */
+    while (received < budget &&
+        !(in8(ext->io_addr + CHIP_CMD) & RX_BUFFER_EMPTY)) {
         /* 获取数据的偏移 */
         u32 ring_offset = current_rx % RX_BUF_LEN;
         u32 rx_status;
@@ -1082,8 +1108,20 @@ keep_pkt:
         keprint(PRINT_DEBUG "RX: upload packet.\n");
 #endif    
         /* 接受数据包 */
-        //rtl8139_packet_receive(ext, &rx_ring[ring_offset + 4], pkt_size);
-        io_device_queue_append(&ext->rx_queue, &rx_ring[ring_offset + 4], pkt_size);
+        /* 接收环是一整块连续内存，只能复制一次到缓冲池中，再交给读者 */
+        nb = netbuf_alloc();
+        if (nb) {
+            memcpy(nb->data, &rx_ring[ring_offset + 4], pkt_size);
+            nb->length = pkt_size;
+            if (netbuf_queue_put(&ext->rx_queue, nb) < 0) {
+                netbuf_free(nb);
+                ext->stats.rx_dropped++;
+                netpoll_drop(&ext->netpoll);
+            }
+        } else {
+            ext->stats.rx_dropped++;
+            netpoll_drop(&ext->netpoll);
+        }
 
         //NlltReceive(&rx_ring[ring_offset + 4], pkt_size);
         /* 创建接收缓冲区，并把数据复制进去 */
@@ -1123,6 +1161,33 @@ out:
     return received;
 }
 
+/**
+ * rtl8139_poll - NET_RX软中断中的轮询函数
+ * 
+ * 接收缓冲区空了才重新打开接收中断，关闭期间到达的数据包会在中断状态
+ * 寄存器中留下接收位，打开后立即产生中断。
+ */
+static int rtl8139_poll(netpoll_t *np, int budget)
+{
+    device_extension_t *ext = (device_extension_t *) np->data;
+    unsigned long flags;
+    int work_done;
+
+    spin_lock_irqsave(&ext->rx_lock, flags);
+    work_done = rtl8139_rx_interrupt(ext, budget);
+    spin_unlock_irqrestore(&ext->rx_lock, flags);
+    if (work_done < 0)  /* 接收出错，接收单元已经复位 */
+        work_done = 0;
+
+    if (work_done < budget) {
+        spin_lock_irqsave(&ext->lock, flags);
+        netpoll_complete(np);
+        out16(ext->io_addr + INTR_MASK, rtl8139_intr_mask);
+        spin_unlock_irqrestore(&ext->lock, flags);
+    }
+    return work_done;
+}
+
 /**
  * KeyboardHandler - 时钟中断处理函数
  * @irq: 中断号
@@ -1152,6 +1217,7 @@ static int rtl8139_handler(irqno_t irq, void *data)
         spin_unlock(&ext->lock);
         return IRQ_NEXTONE;
     }
+    netpoll_stat_irq(&ext->netpoll);
     //keprint(PRINT_DEBUG "[rtl8139]: int status:%x\n", status);
 
     /* 如果网络没有运行的时候发生中断，那么就退出 */
@@ -1176,13 +1242,11 @@ static int rtl8139_handler(irqno_t irq, void *data)
 	/* 
     处理接收中断
     */
-    spin_lock(&ext->rx_lock);
-	/* 如果有接收状态，那么就处理接收包 */
+	/* 如果有接收状态，就关闭接收中断，交给轮询处理接收包，接收状态在轮询中应答 */
     if (status & RX_ACK_BITS){
-        /* 调用接收处理函数 */
-        rtl8139_rx_interrupt(ext);
+        out16(ext->io_addr + INTR_MASK, rtl8139_no_rx_intr_mask);
+        netpoll_schedule(&ext->netpoll);
 	}
-    spin_unlock(&ext->rx_lock);
     
 	/* Check uncommon events with one test. */
 	if (unlikely(status & (PCI_ERR | PCS_TIMEOUT | RX_UNDERRUN | RX_ERR)))
@@ -1497,6 +1561,7 @@ static int rtl8139_init(device_extension_t *ext)
     /* 初始化自旋锁 */
     spinlock_init(&ext->lock);
     spinlock_init(&ext->rx_lock);
+    netpoll_init(&ext->netpoll, rtl8139_poll, NETPOLL_WEIGHT, ext);
 
     /* Put the chip into low-power mode.
     把芯片设置成低耗模式
@@ -1536,6 +1601,7 @@ static iostatus_t rtl8139_open(device_object_t *device, io_request_t *ioreq)
 
     /* 初始化传输和接收缓冲区环 */
     rtl8139_init_ring(ext);
+    netpoll_enable(&ext->netpoll);
     /* 设置硬件信息 */
     rtl8139_hardware_start(ext);
 
@@ -1566,6 +1632,7 @@ static iostatus_t rtl8139_close(device_object_t *device, io_request_t *ioreq)
 
     /* 屏蔽网卡可以触发的所有中断 */
     out16(ext->io_addr + INTR_MASK, 0);
+    netpoll_disable(&ext->netpoll);
 
     /* 更新错误计数，丢失的数量，并把寄存器中丢失归零 */
     ext->stats.rx_missed_errors += in32(ext->io_addr + RX_MISSED);
@@ -1577,6 +1644,7 @@ static iostatus_t rtl8139_close(device_object_t *device, io_request_t *ioreq)
 
     /* 清除传输的项 */
     rtl8139_tx_clear(ext);
+    netbuf_queue_flush(&ext->rx_queue);
 
     /* 释放缓冲区 */
     mem_free(ext->rx_ring);
@@ -1615,7 +1683,7 @@ static iostatus_t rtl8139_read(device_object_t *device, io_request_t *ioreq)
         flags |= IO_NOWAIT;
     }
     /* 从网络接收队列中获取一个包 */
-    len = io_device_queue_pickup(&ext->rx_queue, buf, len, flags);
+    len = netbuf_queue_read(&ext->rx_queue, buf, len, flags);
     if (len < 0)
         status = IO_FAILED;
 
@@ -1660,6 +1728,7 @@ static iostatus_t rtl8139_devctl(device_object_t *device, io_request_t *ioreq)
     device_extension_t *extension = (device_extension_t *) device->device_extension;
     iostatus_t status = IO_SUCCESS;
     unsigned char *mac;
+    netbuf_t *nb;
 
     switch (ctlcode)
     {
@@ -1681,6 +1750,21 @@ static iostatus_t rtl8139_devctl(device_object_t *device, io_request_t *ioreq)
     case NETIO_GETFLGS:
         *((unsigned long *) arg) = extension->flags;
         break;
+    case NETIO_GETSTAT:
+        *((netdev_stat_t *) arg) = extension->netpoll.stat;
+        break;
+    case NETIO_RECVBUF:
+        nb = netbuf_queue_get(&extension->rx_queue, (extension->flags & DEV_NOWAIT) ? IO_NOWAIT : 0);
+        if (nb == NULL) {
+            status = IO_FAILED | IO_ERRNO(EAGAIN);   /* 没有数据包 */
+            break;
+        }
+        *((netbuf_t **) arg) = nb;
+        break;
+    case NETIO_SENDSG:
+        if (rtl8139_transmit_sg(extension, (netbuf_sg_t *) arg) < 0)
+            status = IO_FAILED;
+        break;
     default:
         status = IO_FAILED;
         break;
@@ -1711,7 +1795,7 @@ static iostatus_t rtl8139_enter(driver_object_t *driver)
     devext = (device_extension_t *)devobj->device_extension;
     devext->device_object = devobj;
     /* 初始化接收队列，用内核队列结构保存，等待被读取 */
-    io_device_queue_init(&devext->rx_queue);
+    netbuf_queue_init(&devext->rx_queue);
 
     if (rtl8139_get_pci_info(devext)) {
         status = IO_FAILED;
@@ -184,9 +184,9 @@ static iostatus_t vbe_enter(driver_object_t *driver)
 
     extension->vir_base_addr = NULL;
 #if MAP_VRAM_TO_KERN == 1
-    /* 将显存映射到内核 */
+    /* 将显存以写合并的方式映射到内核 */
     int video_ram_size = extension->mode_info->bytesPerScanLine * extension->mode_info->yResolution;
-    extension->vir_base_addr = memio_remap(extension->mode_info->phyBasePtr, video_ram_size);
+    extension->vir_base_addr = memio_remap_wc(extension->mode_info->phyBasePtr, video_ram_size);
     if (extension->vir_base_addr == NULL) {
         status = IO_FAILED;
         keprint(PRINT_ERR "%s: %s: memio_remap for vbe ram failed!\n", 
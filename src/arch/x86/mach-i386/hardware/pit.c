@@ -2,6 +2,7 @@
 #include <arch/cmos.h>
 #include <arch/time.h>
 #include <xbook/debug.h>
+#include <xbook/clockevent.h>
 
 /* PIT （Programmable Interval Timer）8253/8254 可编程中断计时器 */
 
@@ -120,10 +121,62 @@ enum CtrlModeBits {
 #define TIMER_FREQ     1193180 	/* 时钟的频率 */
 #define COUNTER0_VALUE  (TIMER_FREQ / HZ)	    /* pit count0 数值 */
 
-void pit_clock_init()
+/* 读回命令：锁存计数器0的状态和计数值 */
+#define PIT_READ_BACK_COUNTER0  (PIT_MODE_READ_BACK | (1 << 1))
+#define PIT_STATUS_OUT          0x80
+
+static unsigned long pit_oneshot_counts;    /* 单次模式下编程的计数值 */
+
+static void pit_set_count(unsigned char mode, unsigned long counts)
 {
-	ioport_out8(PIT_CTRL, PIT_MODE_2 | PIT_MODE_MSB_LSB | 
+	ioport_out8(PIT_CTRL, mode | PIT_MODE_MSB_LSB | 
             PIT_MODE_COUNTER_0 | PIT_MODE_BINARY);
-	ioport_out8(PIT_COUNTER0, (unsigned char) (COUNTER0_VALUE & 0xff));
-	ioport_out8(PIT_COUNTER0, (unsigned char) (COUNTER0_VALUE >> 8) & 0xff);   
+	ioport_out8(PIT_COUNTER0, (unsigned char) (counts & 0xff));
+	ioport_out8(PIT_COUNTER0, (unsigned char) (counts >> 8) & 0xff);   
+}
+
+static void pit_set_periodic(clock_event_device_t *dev)
+{
+    pit_oneshot_counts = 0;
+    pit_set_count(PIT_MODE_2, COUNTER0_VALUE);
+}
+
+/* 模式0：计数到0时产生中断，然后从0xffff继续往下计数 */
+static void pit_set_oneshot(clock_event_device_t *dev, unsigned long counts)
+{
+    pit_oneshot_counts = counts;
+    pit_set_count(PIT_MODE_0, counts);
+}
+
+static unsigned long pit_elapsed(clock_event_device_t *dev)
+{
+    unsigned char status;
+    unsigned long cur;
+    ioport_out8(PIT_CTRL, PIT_READ_BACK_COUNTER0);
+    status = ioport_in8(PIT_COUNTER0);
+    cur = ioport_in8(PIT_COUNTER0);
+    cur |= ioport_in8(PIT_COUNTER0) << 8;
+    if (!pit_oneshot_counts)    /* 周期模式从COUNTER0_VALUE计数到1 */
+        return cur <= COUNTER0_VALUE ? COUNTER0_VALUE - cur : 0;
+    if (status & PIT_STATUS_OUT)   /* 已经超时，加上超时后多走的计数 */
+        return pit_oneshot_counts + ((0x10000 - cur) & 0xffff);
+    return cur <= pit_oneshot_counts ? pit_oneshot_counts - cur : 0;
+}
+
+static clock_event_device_t pit_clock_event = {
+    .name = "pit",
+    .features = CLOCK_EVT_FEAT_PERIODIC | CLOCK_EVT_FEAT_ONESHOT,
+    .rating = 100,
+    .counts_per_tick = COUNTER0_VALUE,
+    .min_counts = 16,
+    .max_counts = 0xffff,
+    .set_periodic = pit_set_periodic,
+    .set_oneshot = pit_set_oneshot,
+    .elapsed = pit_elapsed,
+};
+
+void pit_clock_init()
+{
+    if (clock_event_register(&pit_clock_event) < 0)
+        pit_set_periodic(&pit_clock_event);
 }
@@ -0,0 +1,159 @@
+#include <arch/apic.h>
+#include <arch/acpi.h>
+#include <arch/page.h>
+#include <arch/cpu.h>
+#include <xbook/virmem.h>
+#include <xbook/clock.h>
+#include <xbook/debug.h>
+
+/*
+ * 本地APIC用来在cpu之间发送中断，以及给应用处理器提供时钟中断。
+ * 外部设备的中断仍然由8259A通过启动cpu的LINT0(虚拟线模式)送达，
+ * 所以IOAPIC只做探测，所有引脚都保持屏蔽。
+ */
+static volatile unsigned char *lapic_base;
+static volatile unsigned char *ioapic_base;
+
+/* 本地APIC定时器每个时钟节拍的计数值 */
+static unsigned long lapic_timer_count;
+
+static inline unsigned int lapic_read(unsigned int reg)
+{
+    return *(volatile unsigned int *) (lapic_base + reg);
+}
+
+static inline void lapic_write(unsigned int reg, unsigned int value)
+{
+    *(volatile unsigned int *) (lapic_base + reg) = value;
+}
+
+static inline unsigned int ioapic_read(unsigned int reg)
+{
+    *(volatile unsigned int *) (ioapic_base + IOAPIC_REG_SELECT) = reg;
+    return *(volatile unsigned int *) (ioapic_base + IOAPIC_REG_WINDOW);
+}
+
+static inline void ioapic_write(unsigned int reg, unsigned int value)
+{
+    *(volatile unsigned int *) (ioapic_base + IOAPIC_REG_SELECT) = reg;
+    *(volatile unsigned int *) (ioapic_base + IOAPIC_REG_WINDOW) = value;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_EOI, 0);
+}
+
+unsigned int lapic_get_id(void)
+{
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+static void lapic_send_icr(unsigned int apic_id, unsigned int low)
+{
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, low);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING)
+        cpu_pause();
+}
+
+void lapic_send_ipi(unsigned int apic_id, unsigned int vector)
+{
+    lapic_send_icr(apic_id, vector);
+}
+
+void lapic_send_init(unsigned int apic_id)
+{
+    lapic_send_icr(apic_id, LAPIC_ICR_INIT | LAPIC_ICR_ASSERT | LAPIC_ICR_LEVEL);
+}
+
+/* 应用处理器从addr(必须4KB对齐并且在1MB以下)处开始以实模式执行 */
+void lapic_send_startup(unsigned int apic_id, unsigned long addr)
+{
+    lapic_send_icr(apic_id, LAPIC_ICR_STARTUP | ((addr >> 12) & 0xff));
+}
+
+/**
+ * 初始化当前cpu的本地APIC
+ * 启动cpu的LINT0设置成ExtINT，8259A的中断才能继续送达
+ */
+void lapic_init(int bsp)
+{
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    if (bsp) {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_EXTINT);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    } else {
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_MASKED);
+    }
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    /* 写两次清除错误状态 */
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_VECTOR_SPURIOUS);
+    lapic_eoi();
+}
+
+/**
+ * 用PIT的时钟节拍校准本地APIC定时器，需要在开中断后调用
+ */
+void lapic_timer_calibrate(void)
+{
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    clock_t start = systicks;
+    while (systicks == start)   /* 从节拍的边界开始计数 */
+        cpu_pause();
+    lapic_write(LAPIC_TIMER_INIT, 0xffffffff);
+    start = systicks;
+    while (systicks - start < LAPIC_CALIBRATE_TICKS)
+        cpu_pause();
+    unsigned long count = 0xffffffff - lapic_read(LAPIC_TIMER_CUR);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+    lapic_timer_count = count / LAPIC_CALIBRATE_TICKS;
+    keprint(PRINT_INFO "[apic] timer %d counts per tick\n", lapic_timer_count);
+}
+
+/* 以HZ的频率产生周期性的时钟中断 */
+void lapic_timer_start(void)
+{
+    lapic_write(LAPIC_TIMER_DIV, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, APIC_VECTOR_TIMER | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INIT, lapic_timer_count);
+}
+
+static void ioapic_init(unsigned long paddr)
+{
+    ioapic_base = memio_remap(paddr & PAGE_MASK, PAGE_SIZE);
+    if (!ioapic_base) {
+        keprint(PRINT_WARING "[apic] remap ioapic %x failed!\n", paddr);
+        return;
+    }
+    ioapic_base += paddr & ~PAGE_MASK;
+    int i, pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xff) + 1;
+    for (i = 0; i < pins; i++) {
+        ioapic_write(IOAPIC_REDTBL(i), LAPIC_LVT_MASKED);
+        ioapic_write(IOAPIC_REDTBL(i) + 1, 0);
+    }
+    keprint(PRINT_INFO "[apic] ioapic %x with %d pins masked\n", paddr, pins);
+}
+
+/**
+ * 映射本地APIC和IOAPIC并初始化启动cpu的本地APIC，需要先解析MADT
+ */
+int apic_init(void)
+{
+    unsigned long paddr = acpi_madt_info.lapic_addr;
+    lapic_base = memio_remap(paddr & PAGE_MASK, PAGE_SIZE);
+    if (!lapic_base) {
+        keprint(PRINT_ERR "[apic] remap local apic %x failed!\n", paddr);
+        return -1;
+    }
+    lapic_base += paddr & ~PAGE_MASK;
+    if (acpi_madt_info.ioapic_addr)
+        ioapic_init(acpi_madt_info.ioapic_addr);
+    lapic_init(1);
+    return 0;
+}
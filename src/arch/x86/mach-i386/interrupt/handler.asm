@@ -7,6 +7,8 @@ extern syscalls
 extern exception_check
 extern syscall_check
 extern syscall_dispatch
+extern kernel_lock
+extern kernel_unlock
 
 [bits 32]
 [section .text]
@@ -59,6 +61,11 @@ INTERRUPT_ENTRY 0x2d,NO_ERROR_CODE	;fpu浮点单元异常
 INTERRUPT_ENTRY 0x2e,NO_ERROR_CODE	;硬盘
 INTERRUPT_ENTRY 0x2f,NO_ERROR_CODE	;保留
 
+APIC_ENTRY 0x30,1	;本地APIC定时器
+APIC_ENTRY 0x31,1	;重新调度的核间中断
+APIC_ENTRY 0x32,0	;刷新TLB的核间中断
+APIC_ENTRY 0x3f,0	;本地APIC伪中断
+
 ;系统调用中断
 [bits 32]
 [section .text]
@@ -79,11 +86,15 @@ syscall_handler:
 	mov ds, ax
 	mov es, ax
     mov fs, ax
+    mov ax, KERNEL_PERCPU_SEL
 	mov gs, ax
     pop eax
     
    	push 0x40			; 此位置压入0x40也是为了保持统一的栈格式
     
+    push eax
+    call kernel_lock
+    pop eax
     sti
 
     ; check syscall num
@@ -110,7 +121,10 @@ syscall_handler:
     jmp .check_exception
 
 global interrupt_exit
+global interrupt_exit_nolock
 interrupt_exit:
+    call kernel_unlock
+interrupt_exit_nolock:
     add esp, 4			   ; 跳过中断号
     popad
     pop gs
@@ -7,8 +7,10 @@
 #include <string.h>
 #include <arch/acpi.h>
 #include <arch/io.h>
+#include <arch/page.h>
 #include <xbook/debug.h>
 #include <xbook/process.h>
+#include <xbook/virmem.h>
 
 dword *SMI_CMD;
 byte ACPI_ENABLE;
@@ -21,6 +23,11 @@ word SLP_EN;
 word SCI_EN;
 byte PM1_CNT_LEN;
 
+acpi_madt_info_t acpi_madt_info;
+
+/* 1MB以下的物理内存已经线性映射到内核空间 */
+#define ACPI_LOWMEM_LIMIT   0x100000
+
 // check if the given address has a valid header
 unsigned int *acpi_check_RSDPtr(unsigned int *ptr) {
     char *sig = "RSD PTR ";
@@ -79,11 +86,11 @@ unsigned int *acpi_get_RSDPtr(void) {
 }
 
 // checks for a given header and validates checksum
-int acpi_checkHeader(unsigned int *ptr, char *sig) {
+int acpi_checkHeader(void *ptr, char *sig) {
     if (memcmp(ptr, sig, 4) == 0)
     {
         char *checkPtr = (char*) ptr;
-        int len = *(ptr + 1);
+        int len = *((unsigned int *) ptr + 1);
         char check = 0;
         while (0 < len--)
         {
@@ -244,3 +251,150 @@ int acpi_init(void) {
 
     return -1;
 }
+
+/* 映射ACPI表所在的物理内存，表可能跨页，所以按页对齐后映射 */
+static void *acpi_map_table(unsigned long paddr, unsigned long size)
+{
+    if (paddr + size <= ACPI_LOWMEM_LIMIT)
+        return kern_phy_addr2vir_addr(paddr);
+    unsigned long base = paddr & PAGE_MASK;
+    unsigned char *vaddr = memio_remap(base, PAGE_ALIGN(paddr + size) - base);
+    if (!vaddr)
+        return NULL;
+    return vaddr + (paddr - base);
+}
+
+static void acpi_unmap_table(void *vaddr)
+{
+    if ((unsigned long) vaddr < (unsigned long) kern_phy_addr2vir_addr(ACPI_LOWMEM_LIMIT))
+        return;
+    memio_unmap((void *) ((unsigned long) vaddr & PAGE_MASK));
+}
+
+/* 和acpi_get_RSDPtr一样查找RSDP，不过通过内核的线性映射访问，返回RSDT的物理地址 */
+static unsigned long acpi_find_rsdt(void)
+{
+    unsigned char *addr, *end;
+    unsigned int *rsdt;
+    addr = kern_phy_addr2vir_addr(0x000E0000);
+    end = kern_phy_addr2vir_addr(0x00100000);
+    for (; addr < end; addr += 0x10) {
+        if ((rsdt = acpi_check_RSDPtr((unsigned int *) addr)) != NULL)
+            return (unsigned long) rsdt;
+    }
+    unsigned long ebda = *((unsigned short *) kern_phy_addr2vir_addr(0x40E));
+    ebda = ebda * 0x10 & 0x000FFFFF;
+    addr = kern_phy_addr2vir_addr(ebda);
+    end = addr + 1024;
+    for (; addr < end; addr += 0x10) {
+        if ((rsdt = acpi_check_RSDPtr((unsigned int *) addr)) != NULL)
+            return (unsigned long) rsdt;
+    }
+    return 0;
+}
+
+/* 在RSDT中查找指定签名的表，返回映射后的整张表 */
+static struct acpi_sdt_header *acpi_find_table(unsigned long rsdt_addr, char *sig)
+{
+    struct acpi_sdt_header *rsdt, *header, *table = NULL;
+    rsdt = acpi_map_table(rsdt_addr, sizeof(struct acpi_sdt_header));
+    if (!rsdt)
+        return NULL;
+    unsigned long length = rsdt->Length;
+    acpi_unmap_table(rsdt);
+    rsdt = acpi_map_table(rsdt_addr, length);
+    if (!rsdt)
+        return NULL;
+    if (acpi_checkHeader(rsdt, "RSDT") < 0) {
+        acpi_unmap_table(rsdt);
+        return NULL;
+    }
+    dword *entrys = (dword *) (rsdt + 1);
+    int i, count = (length - sizeof(struct acpi_sdt_header)) / 4;
+    for (i = 0; i < count && !table; i++) {
+        header = acpi_map_table(entrys[i], sizeof(struct acpi_sdt_header));
+        if (!header)
+            continue;
+        if (!memcmp(header->Signature, sig, 4)) {
+            length = header->Length;
+            table = acpi_map_table(entrys[i], length);
+            if (table && acpi_checkHeader(table, sig) < 0) {
+                acpi_unmap_table(table);
+                table = NULL;
+            }
+        }
+        acpi_unmap_table(header);
+    }
+    acpi_unmap_table(rsdt);
+    return table;
+}
+
+static void acpi_madt_parse(struct acpi_madt *madt)
+{
+    acpi_madt_info_t *info = &acpi_madt_info;
+    info->lapic_addr = madt->LocalApicAddress;
+    unsigned char *p = (unsigned char *) (madt + 1);
+    unsigned char *end = (unsigned char *) madt + madt->header.Length;
+    struct acpi_madt_entry *entry;
+    while (p + sizeof(struct acpi_madt_entry) <= end) {
+        entry = (struct acpi_madt_entry *) p;
+        if (entry->Length < sizeof(struct acpi_madt_entry))
+            break;
+        switch (entry->Type) {
+        case ACPI_MADT_LOCAL_APIC:
+            {
+                struct acpi_madt_lapic *lapic = (struct acpi_madt_lapic *) entry;
+                /* 没有启用的cpu不能被唤醒 */
+                if ((lapic->Flags & ACPI_MADT_LAPIC_ENABLED) && info->cpu_nr < CPU_NR_MAX)
+                    info->apic_ids[info->cpu_nr++] = lapic->ApicId;
+            }
+            break;
+        case ACPI_MADT_IO_APIC:
+            {
+                struct acpi_madt_ioapic *ioapic = (struct acpi_madt_ioapic *) entry;
+                if (!info->ioapic_addr) {   /* 只使用第一个IOAPIC */
+                    info->ioapic_addr = ioapic->Address;
+                    info->ioapic_gsi_base = ioapic->GsiBase;
+                }
+            }
+            break;
+        case ACPI_MADT_INT_OVERRIDE:
+            {
+                struct acpi_madt_override *override = (struct acpi_madt_override *) entry;
+                if (override->Bus == 0 && override->Source < ACPI_ISA_IRQ_NR)
+                    info->isa_irq_gsi[override->Source] = override->Gsi;
+            }
+            break;
+        default:
+            break;
+        }
+        p += entry->Length;
+    }
+}
+
+/**
+ * 解析MADT，得到本地APIC地址、所有可用cpu的APIC ID以及IOAPIC的信息
+ */
+int acpi_madt_init(void)
+{
+    int i;
+    memset(&acpi_madt_info, 0, sizeof(acpi_madt_info_t));
+    for (i = 0; i < ACPI_ISA_IRQ_NR; i++)
+        acpi_madt_info.isa_irq_gsi[i] = i;
+    unsigned long rsdt_addr = acpi_find_rsdt();
+    if (!rsdt_addr) {
+        keprint(PRINT_WARING "[acpi] no RSDP present.\n");
+        return -1;
+    }
+    struct acpi_madt *madt = (struct acpi_madt *) acpi_find_table(rsdt_addr, "APIC");
+    if (!madt) {
+        keprint(PRINT_WARING "[acpi] no MADT present.\n");
+        return -1;
+    }
+    acpi_madt_parse(madt);
+    acpi_unmap_table(madt);
+    keprint(PRINT_INFO "[acpi] madt: cpus %d lapic %x ioapic %x gsi base %d\n",
+        acpi_madt_info.cpu_nr, acpi_madt_info.lapic_addr,
+        acpi_madt_info.ioapic_addr, acpi_madt_info.ioapic_gsi_base);
+    return acpi_madt_info.cpu_nr > 0 ? 0 : -1;
+}
@@ -2,6 +2,7 @@
 #include <arch/acpi.h>
 #include <arch/io.h>
 #include <xbook/debug.h>
+#include <xbook/bcache.h>
 
 static void acpi_poweroff() {
     // SCI_EN is set to 1 if acpi poweroff is possible
@@ -22,6 +23,9 @@ static void acpi_poweroff() {
 void sys_shutdown(void) {
     // TODO: Send 'Exit' signal in OS
 
+    // Write back block cache
+    bcache_sync(-1);
+
     // TODO: Check if Halt OK
 
     // Halt
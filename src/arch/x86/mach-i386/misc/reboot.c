@@ -1,9 +1,13 @@
 #include <arch/misc.h>
 #include <xbook/debug.h>
+#include <xbook/bcache.h>
 
 void sys_reboot(void) {
     // TODO: Send 'Exit' signal in OS
 
+    // Write back block cache
+    bcache_sync(-1);
+
     // TODO: Check if Reboot OK
 
     // Reboot
@@ -6,15 +6,31 @@
  * 因为memio是直接映射一个物理地址，因此不需要分配物理页，直接使用指定的页地址即可，释放同理
  */
 
-int hal_memio_remap(unsigned long paddr, unsigned long vaddr, size_t size)
+static void memio_link(unsigned long paddr, unsigned long vaddr, size_t size, unsigned long attr)
 {
     unsigned long end = vaddr + size;
     while (vaddr < end) {
-        /* 添加页面 */
+        /* 添加页面，缓存属性只加在页表项上，页目录项会使用相同的属性 */
         page_link_addr(vaddr, paddr, PAGE_ATTR_WRITE | PAGE_ATTR_SYSTEM);
+        *vir_addr_to_table_entry(vaddr) |= attr;
         vaddr += PAGE_SIZE;
         paddr += PAGE_SIZE;
     }
+}
+
+int hal_memio_remap(unsigned long paddr, unsigned long vaddr, size_t size)
+{
+    memio_link(paddr, vaddr, size, 0);
+    return 0;
+}
+
+/**
+ * 以写合并的方式映射，用于显存这类只写、按顺序访问的内存。
+ * 连续的写入在cpu中合并后一次写到总线上，不支持PAT时和普通映射相同。
+ */
+int hal_memio_remap_wc(unsigned long paddr, unsigned long vaddr, size_t size)
+{
+    memio_link(paddr, vaddr, size, page_attr_wc());
     return 0;
 }
 
@@ -2,9 +2,11 @@
 #include <arch/page.h>
 #include <arch/bootmem.h>
 #include <xbook/debug.h>
+#include <xbook/reclaim.h>
 #include <assert.h>
 #include <math.h>
 #include <stdint.h>
+#include <string.h>
 
 // #define MEMPOOL_DEBUG
 
@@ -20,25 +22,14 @@ void mem_node_init(mem_node_t *node, int ref, uint32_t size)
     list_init(&node->list);
 }
 
-void mem_section_init(mem_section_t *mem_section, size_t section_size)  
+void mem_section_init(mem_section_t *mem_section, size_t section_size, unsigned long *free_map)  
 {   
     mem_section->node_count = 0;
     mem_section->section_size = section_size;
+    mem_section->free_map = free_map;
     list_init(&mem_section->free_list_head);
 }
 
-void mem_section_setup(mem_section_t *mem_section, mem_node_t *node_base, size_t section_count)  
-{    
-    mem_section->node_count = section_count;
-    int i;
-    for (i = 0; i < section_count; i++) {
-        mem_node_t *next = node_base + i * mem_section->section_size;
-        mem_node_init(next, 0, 0);
-        list_add_tail(&next->list, &mem_section->free_list_head);
-        MEM_NODE_MARK_SECTION(next, mem_section);
-    }
-}
-
 mem_range_t *mem_range_get_by_mem_node(mem_node_t *node)
 {
     if (!node)
@@ -73,6 +64,45 @@ mem_range_t *mem_range_get_by_phy_addr(unsigned int addr)
     return NULL;
 }
 
+/* 
+伙伴算法：第i个节管理大小为2^i页的空闲块，块的起始节点下标按块大小对齐，
+下标只有第i位不同的两个块互为伙伴。每个节有一个空闲位图，第n位表示下标为n*2^i的块
+空闲并且在这个节的空闲链表上，用来在释放时O(1)查找伙伴和检测重复释放。
+只有空闲块和已分配块的第一个节点会标记所属的节，块内其它节点的节为NULL。
+*/
+static inline int mem_section_order(mem_range_t *mem_range, mem_section_t *mem_section)
+{
+    return mem_section - mem_range->sections;
+}
+
+static inline int mem_section_test_free(mem_section_t *mem_section, unsigned long block)
+{
+    return (mem_section->free_map[block / 32] & (1UL << (block % 32))) != 0;
+}
+
+static void mem_section_add_free(mem_range_t *mem_range, int order, mem_node_t *node)
+{
+    mem_section_t *mem_section = &mem_range->sections[order];
+    unsigned long block = (node - mem_range->node_table) >> order;
+    mem_node_init(node, 0, 0);
+    MEM_NODE_MARK_SECTION(node, mem_section);
+    list_add(&node->list, &mem_section->free_list_head);
+    MEM_SECTION_INC_COUNT(mem_section);
+    mem_range->free_pages += 1UL << order;
+    mem_section->free_map[block / 32] |= (1UL << (block % 32));
+}
+
+static void mem_section_del_free(mem_range_t *mem_range, int order, mem_node_t *node)
+{
+    mem_section_t *mem_section = &mem_range->sections[order];
+    unsigned long block = (node - mem_range->node_table) >> order;
+    list_del_init(&node->list);
+    MEM_SECTION_DES_COUNT(mem_section);
+    mem_range->free_pages -= 1UL << order;
+    MEM_NODE_CLEAR_SECTION(node);
+    mem_section->free_map[block / 32] &= ~(1UL << (block % 32));
+}
+
 void mem_range_init(unsigned int idx, unsigned int start, size_t len)
 {
     if (idx >= MEM_RANGE_NR)
@@ -81,45 +111,46 @@ void mem_range_init(unsigned int idx, unsigned int start, size_t len)
     mem_range->start = start;
     mem_range->end = start + len;
     mem_range->pages = len / PAGE_SIZE;
+    mem_range->free_pages = 0;
+    mem_range->low_pages = mem_range->pages / MEM_WATERMARK_LOW_DIV;
+    mem_range->high_pages = mem_range->pages / MEM_WATERMARK_HIGH_DIV;
     mem_range->node_table = boot_mem_alloc(mem_range->pages * sizeof(mem_node_t));
     if (mem_range->node_table == NULL) {
         panic("mem range %d: start=%x len=%x node table alloc null!\n",
             idx, start, len);  
     }
+    /* 所有阶的空闲位图放在一起分配 */
+    size_t map_words[MEM_SECTION_MAX_NR];
+    size_t map_total = 0;
     int i;
+    for (i = 0; i < MEM_SECTION_MAX_NR; i++) {
+        map_words[i] = DIV_ROUND_UP((mem_range->pages >> i) + 1, 32);
+        map_total += map_words[i];
+    }
+    unsigned long *free_map = boot_mem_alloc(map_total * sizeof(unsigned long));
+    if (free_map == NULL) {
+        panic("mem range %d: free map alloc null!\n", idx);  
+    }
+    memset(free_map, 0, map_total * sizeof(unsigned long));
     for (i = 0; i < MEM_SECTION_MAX_NR; i++) {    
-        mem_section_init(&mem_range->sections[i], powi(2, i));
+        mem_section_init(&mem_range->sections[i], powi(2, i), free_map);
+        free_map += map_words[i];
     }
     
-    int section_off = MEM_SECTION_MAX_NR - 1;     
-    size_t section_size = powi(2, section_off);
-    mem_section_t *mem_section;
-    size_t big_sections;
-    size_t small_sections;
-    
-    mem_node_t *node_base = mem_range->node_table;
-    ssize_t pages = mem_range->pages;
-
-    while (pages > 0) {
-        assert(0 <= section_off && section_off < MEM_SECTION_MAX_NR);
+    unsigned long node_idx;
+    for (node_idx = 0; node_idx < mem_range->pages; node_idx++)
+        mem_node_init(mem_range->node_table + node_idx, 0, 0);
 
-        big_sections = pages / section_size;
-        small_sections = pages % section_size;
-        mem_section = &mem_range->sections[section_off];
-        
-        if (big_sections > 0) {
-            mem_section_setup(mem_section, node_base, big_sections);
-            pages -= big_sections * section_size;
-            node_base += big_sections * section_size;
-        } else if (small_sections > 0) {
-            /* 把剩下的所有小的节都放到大小为1的节中。 */
-            mem_section = &mem_range->sections[0];
-            mem_section_setup(mem_section, node_base, small_sections);
-            break;
-        }
-        
-        section_size >>= 1;
-        --section_off;
+    /* 从前往后切成尽可能大的对齐块 */
+    int order;
+    node_idx = 0;
+    while (node_idx < mem_range->pages) {
+        order = MEM_SECTION_MAX_NR - 1;
+        while (order > 0 && ((node_idx & ((1UL << order) - 1)) || 
+            node_idx + (1UL << order) > mem_range->pages))
+            order--;
+        mem_section_add_free(mem_range, order, mem_range->node_table + node_idx);
+        node_idx += 1UL << order;
     }
 }
 
@@ -148,46 +179,84 @@ unsigned int mem_node_to_phy_addr(mem_node_t *node)
     return local_addr + mem_range->start; 
 }
 
-int mem_range_split_section(mem_range_t *mem_range, mem_section_t *mem_section)
+/**
+ * 空闲页距离水位还差的页数。缓存都在普通区域中，DMA区域不回收；
+ * 用户区域可以借用普通区域的页，普通区域在水位以上的空闲页也算用户区域的
+ */
+static unsigned long mem_pages_below_watermark(int high)
 {
-    if (!mem_range || !mem_section)
-        return 0;
-    /* 已经有节有空闲的节点，成功返回！ */
-    if (!list_empty(&mem_section->free_list_head))
-        return 0;
+    mem_range_t *normal = &mem_ranges[MEM_RANGE_NORMAL];
+    mem_range_t *user = &mem_ranges[MEM_RANGE_USER];
+    size_t normal_mark = high ? normal->high_pages : normal->low_pages;
+    size_t user_mark = high ? user->high_pages : user->low_pages;
+    size_t spare = 0;
+    unsigned long count = 0;
+    if (normal->free_pages < normal_mark)
+        count += normal_mark - normal->free_pages;
+    else
+        spare = normal->free_pages - normal_mark;
+    if (user->free_pages + spare < user_mark)
+        count += user_mark - user->free_pages - spare;
+    return count;
+}
 
-    mem_section_t *tmp_section = mem_section + 1;
-    mem_section_t *top_section = &mem_range->sections[MEM_SECTION_MAX_NR - 1];
-    while (tmp_section <= top_section) {
-        if (!list_empty(&tmp_section->free_list_head))
+/* 从区域中分配连续的页，没有足够大的空闲块时返回0 */
+static unsigned long mem_range_alloc_pages(mem_range_t *mem_range, unsigned long count)
+{
+    int order;
+    for (order = 0; order < MEM_SECTION_MAX_NR; order++) {
+        if (mem_range->sections[order].section_size >= count) {
             break;
-        tmp_section++;
+        }
     }
-    
-    if (tmp_section > top_section) {
-        // TODO: 收缩内存
-        keprint(PRINT_ERR "mempool: no free section left!\n");
-        return -1;
+    unsigned long intr_flags;
+    interrupt_save_and_disable(intr_flags);
+    /* 找到有空闲块的最小的节 */
+    int i = order;
+    while (i < MEM_SECTION_MAX_NR && list_empty(&mem_range->sections[i].free_list_head))
+        i++;
+    if (i >= MEM_SECTION_MAX_NR) {
+        interrupt_restore_state(intr_flags);
+        return 0;
     }
+    mem_node_t *node = list_first_owner(&mem_range->sections[i].free_list_head, mem_node_t, list);
+    mem_section_del_free(mem_range, i, node);
+    /* 大块对半分裂，后一半放回低一阶的节 */
+    while (i > order) {
+        i--;
+        mem_section_add_free(mem_range, i, node + (1UL << i));
+    }
+    mem_node_init(node, 1, count);
+    MEM_NODE_MARK_SECTION(node, &mem_range->sections[order]);
+    interrupt_restore_state(intr_flags);
+    return mem_node_to_phy_addr(node);
+}
 
-    mem_node_t *node = list_first_owner(&tmp_section->free_list_head, mem_node_t, list);
-    list_del(&node->list);
-    MEM_SECTION_DES_COUNT(tmp_section);
-
-    mem_node_init(node, 1, tmp_section->section_size / 2);
-    
-    mem_node_t *node_half = node + node->count;
-    mem_node_init(node_half, 1, node->count);
-
-    --tmp_section; // 下降一个节高度
-    list_add(&node->list, &tmp_section->free_list_head);
-    list_add(&node_half->list, &tmp_section->free_list_head);
-    MEM_NODE_MARK_SECTION(node, tmp_section);
-    MEM_NODE_MARK_SECTION(node_half, tmp_section);
-    MEM_SECTION_INC_COUNT(tmp_section);
-    MEM_SECTION_INC_COUNT(tmp_section);
+/* 用户页借用普通区域中低水位以上的部分，低水位以下留给内核 */
+static unsigned long mem_range_borrow_pages(mem_range_t *mem_range, unsigned long count)
+{
+    mem_range_t *normal = &mem_ranges[MEM_RANGE_NORMAL];
+    if (mem_range != &mem_ranges[MEM_RANGE_USER] ||
+        normal->free_pages < normal->low_pages + count)
+        return 0;
+    return mem_range_alloc_pages(normal, count);
+}
 
-    return mem_range_split_section(mem_range, mem_section);
+/**
+ * 区域中没有足够的空闲块时，用户页先从普通区域借用，
+ * 还是不够就直接回收缓存，然后再试一次
+ */
+static unsigned long mem_node_alloc_slow(mem_range_t *mem_range, unsigned long count)
+{
+    unsigned long addr = mem_range_borrow_pages(mem_range, count);
+    if (addr)
+        return addr;
+    if (mem_reclaim_direct(count) <= 0)
+        return 0;
+    addr = mem_range_alloc_pages(mem_range, count);
+    if (!addr)
+        addr = mem_range_borrow_pages(mem_range, count);
+    return addr;
 }
 
 unsigned long mem_node_alloc_pages(unsigned long count, unsigned long flags)
@@ -208,39 +277,15 @@ unsigned long mem_node_alloc_pages(unsigned long count, unsigned long flags)
         mem_range = &mem_ranges[MEM_RANGE_USER];
     else
         panic("phymem: get range null!");
-    
-    mem_section_t *mem_section;
-    int i;
-    for (i = 0; i < MEM_SECTION_MAX_NR; i++) {
-        mem_section = &mem_range->sections[i];
-        if (mem_section->section_size >= count) {
-            break;
-        }
-    }
-    unsigned long intr_flags;
-    interrupt_save_and_disable(intr_flags);
-    if (list_empty(&mem_section->free_list_head)) {
-        if (mem_section->section_size == MEM_SECTION_MAX_SIZE) {    // 没有更大的节
-            // TODO: 收缩内存，合并没有使用的小节为大节
-            keprint(PRINT_ERR "mempool: no free section!\n");
-            interrupt_restore_state(flags);
-            return 0;
-        } else {
-            if (mem_range_split_section(mem_range, mem_section) < 0) {
-                keprint(PRINT_ERR "mempool: split section failed!\n");
-                interrupt_restore_state(intr_flags);
-                return 0;
-            }
-        }
-    }
-    mem_node_t *node = list_first_owner(&mem_section->free_list_head, mem_node_t, list);
-    list_del_init(&node->list);
-    MEM_SECTION_DES_COUNT(mem_section);
 
-    mem_node_init(node, 1, count);
-    MEM_NODE_MARK_SECTION(node, mem_section);
-    interrupt_restore_state(intr_flags);
-    return mem_node_to_phy_addr(node);
+    unsigned long addr = mem_range_alloc_pages(mem_range, count);
+    if (!addr)
+        addr = mem_node_alloc_slow(mem_range, count);
+    if (mem_pages_below_watermark(0))
+        mem_reclaim_wakeup();
+    if (!addr)
+        keprint(PRINT_ERR "mempool: no free section!\n");
+    return addr;
 }
 
 int mem_node_free_pages(unsigned long addr)
@@ -251,26 +296,95 @@ int mem_node_free_pages(unsigned long addr)
     if (!node)
         return -1;
     
-    // 放回节点所属的节中去
     mem_section_t *section = MEM_NODE_GET_SECTION(node);
     if (!section) {
         // keprint(PRINT_WARING "node %x addr %x no section!\n", node, addr);
         return -1;
     }
+    mem_range_t *mem_range = mem_range_get_by_mem_node(node);
     unsigned long intr_flags;
     interrupt_save_and_disable(intr_flags);
-    if (list_find(&node->list, &section->free_list_head)) {
+    int order = mem_section_order(mem_range, section);
+    unsigned long node_idx = node - mem_range->node_table;
+    if (mem_section_test_free(section, node_idx >> order)) {
         // keprint(PRINT_WARING "addr %x don't need free again!\n", addr);
         interrupt_restore_state(intr_flags); 
         return -1;
     }
-    mem_node_init(node, 0, 0);
-    list_add(&node->list, &section->free_list_head);
-    MEM_SECTION_INC_COUNT(section);
+    /* 页被多个映射共享（写时复制），只减少引用，最后一个引用释放时才归还 */
+    if (node->reference > 1) {
+        node->reference--;
+        interrupt_restore_state(intr_flags);
+        return 0;
+    }
+    /* 伙伴空闲就合并，直到伙伴不空闲或者到达最大的节 */
+    unsigned long buddy_idx;
+    while (order < MEM_SECTION_MAX_NR - 1) {
+        buddy_idx = node_idx ^ (1UL << order);
+        if (buddy_idx + (1UL << order) > mem_range->pages ||
+            !mem_section_test_free(&mem_range->sections[order], buddy_idx >> order))
+            break;
+        mem_section_del_free(mem_range, order, mem_range->node_table + buddy_idx);
+        node_idx &= ~(1UL << order);
+        order++;
+    }
+    /* 合并后不是块的第一个节点时，不再属于任何节 */
+    MEM_NODE_CLEAR_SECTION(node);
+    mem_section_add_free(mem_range, order, mem_range->node_table + node_idx);
     interrupt_restore_state(intr_flags);
     return 0;
 }
 
+static mem_range_t *mem_range_find_by_phy_addr(unsigned int addr)
+{
+    int i;
+    for (i = 0; i < MEM_RANGE_NR; i++) {
+        if (mem_ranges[i].start <= addr && addr < mem_ranges[i].end)
+            return &mem_ranges[i];
+    }
+    return NULL;
+}
+
+/**
+ * mem_node_ref_pages - 增加物理页的引用计数
+ * @addr: 物理地址
+ * 
+ * 用于写时复制，多个页表项映射同一个物理页。
+ * 不在内存池中的地址（设备内存）不计数，返回-1
+ */
+int mem_node_ref_pages(unsigned long addr)
+{
+    if (!addr || !mem_range_find_by_phy_addr(addr))
+        return -1;
+    mem_node_t *node = phy_addr_to_mem_node(addr);
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    int ref = ++node->reference;
+    interrupt_restore_state(flags);
+    return ref;
+}
+
+/**
+ * mem_node_page_reference - 获取物理页的引用计数
+ * @addr: 物理地址
+ */
+int mem_node_page_reference(unsigned long addr)
+{
+    if (!addr || !mem_range_find_by_phy_addr(addr))
+        return -1;
+    return phy_addr_to_mem_node(addr)->reference;
+}
+
+/**
+ * mem_get_reclaim_page_nr - 回收线程需要回收的页数
+ *
+ * 空闲页低于低水位时唤醒回收线程，回收线程一直回收到高水位以上
+ */
+unsigned long mem_get_reclaim_page_nr()
+{
+    return mem_pages_below_watermark(1);
+}
+
 unsigned long mem_get_free_page_nr()
 {
     unsigned long flags;
@@ -288,6 +402,38 @@ unsigned long mem_get_free_page_nr()
     return page_count;
 }
 
+/**
+ * mem_get_fragment - 统计空闲内存的碎片程度
+ * @largest: 返回最大空闲块的页数，可以为NULL
+ * 
+ * 返回小于MEM_FRAG_ORDER阶的空闲块占全部空闲页的百分比，
+ * 这部分内存不能满足大于等于该阶的连续分配
+ */
+unsigned long mem_get_fragment(unsigned long *largest)
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    unsigned long free_pages = 0, frag_pages = 0, max_block = 0;
+    int i, j;
+    for (j = 0; j < MEM_RANGE_NR; j++) {
+        mem_range_t *range = &mem_ranges[j];
+        for (i = 0; i < MEM_SECTION_MAX_NR; i++) {
+            mem_section_t *section = &range->sections[i];
+            if (!section->node_count)
+                continue;
+            free_pages += section->node_count * section->section_size;
+            if (i < MEM_FRAG_ORDER)
+                frag_pages += section->node_count * section->section_size;
+            if (section->section_size > max_block)
+                max_block = section->section_size;
+        }
+    }
+    interrupt_restore_state(flags);
+    if (largest)
+        *largest = max_block;
+    return free_pages ? frag_pages * 100 / free_pages : 0;
+}
+
 void mem_pool_test()
 {
     uint32_t addr = 64 * MB;
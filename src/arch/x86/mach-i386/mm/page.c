@@ -2,28 +2,53 @@
 #include <arch/phymem.h>
 #include <arch/mempool.h>
 #include <arch/registers.h>
+#include <arch/cpu.h>
 #include <arch/tss.h>
 #include <arch/memory.h>
+#include <arch/uaccess.h>
 #include <xbook/debug.h>
 #include <math.h>
 #include <string.h>
 #include <assert.h>
 #include <xbook/schedule.h>
 #include <xbook/memspace.h>
+#include <xbook/pagecache.h>
 #include <xbook/exception.h>
 #include <xbook/vmm.h>
+#include <xbook/smp.h>
+
+static int page_populate(unsigned long addr);
+
+/* 修改页表项后通知其它cpu，内核地址空间所有cpu共享，用户地址空间只通知使用当前vmm的cpu */
+static void page_tlb_shootdown(unsigned long vaddr, unsigned long flush_addr)
+{
+    smp_tlb_shootdown(vaddr >= KERN_BASE_VIR_ADDR ? NULL : task_current->vmm, flush_addr);
+}
+
+/* 内核线性映射使用4MB大页时没有页表，页目录项就是最后一级 */
+static inline pte_t *page_last_entry(unsigned long addr)
+{
+    pde_t *pde = vir_addr_to_dir_entry(addr);
+    if (*pde & PAGE_ATTR_LARGE)
+        return pde;
+    return vir_addr_to_table_entry(addr);
+}
+
+static inline bool page_present(unsigned long addr)
+{
+    return (*vir_addr_to_dir_entry(addr) & PAGE_ATTR_PRESENT) && 
+        (*page_last_entry(addr) & PAGE_ATTR_PRESENT);
+}
 
 bool page_readable(unsigned long vaddr, unsigned long nbytes)
 {
     unsigned long addr = vaddr & PAGE_MASK;
-    unsigned long count = PAGE_ALIGN(nbytes);
-    while (count > 0) {
-        pte_t *pte = vir_addr_to_table_entry(addr);
-        if (!(*pte & PAGE_ATTR_PRESENT)) {
+    unsigned long end = vaddr + nbytes;
+    while (addr < end) {
+        if (!page_present(addr) && page_populate(addr) < 0) {
             return false;
         }
         addr += PAGE_SIZE;
-        count -= PAGE_SIZE;
     }
     return true;
 }
@@ -31,17 +56,17 @@ bool page_readable(unsigned long vaddr, unsigned long nbytes)
 bool page_writable(unsigned long vaddr, unsigned long nbytes)
 {
     unsigned long addr = vaddr & PAGE_MASK;
-    unsigned long count = PAGE_ALIGN(nbytes);
-    while (count > 0) {
-        pte_t *pte = vir_addr_to_table_entry(addr);
-        if (!(*pte & PAGE_ATTR_PRESENT)) {
+    unsigned long end = vaddr + nbytes;
+    while (addr < end) {
+        if (!page_present(addr) && page_populate(addr) < 0) {
             return false;
         }
-        if (!(*pte & PAGE_ATTR_WRITE)) {
+        pte_t *pte = page_last_entry(addr);
+        /* 写时复制的页在写入时才会分离，可以认为是可写的 */
+        if (!(*pte & (PAGE_ATTR_WRITE | PAGE_ATTR_COW))) {
             return false;
         }
         addr += PAGE_SIZE;
-        count -= PAGE_SIZE;
     }
     return true;
 }
@@ -126,6 +151,7 @@ void page_unlink_addr(unsigned long vaddr)
 	if (*pte & PAGE_ATTR_PRESENT) {
 		*pte &= ~PAGE_ATTR_PRESENT;
         tlb_flush_one(vaddr);
+        page_tlb_shootdown(vaddr, vaddr);
     } else {
         //warnprint("page_unlink_addr: addr %x phy addr not present!\n", vaddr);
     }
@@ -209,6 +235,9 @@ int page_map_addr_fixed(unsigned long start, unsigned long addr, unsigned long l
  */
 unsigned long addr_vir2phy(unsigned long vaddr)
 {
+	pde_t *pde = vir_addr_to_dir_entry(vaddr);
+	if (*pde & PAGE_ATTR_LARGE)
+		return (*pde & PAGE_LARGE_MASK) + (vaddr & ~PAGE_LARGE_MASK);
 	pte_t* pte = vir_addr_to_table_entry(vaddr);
 	return ((*pte & 0xfffff000) + (vaddr & 0x00000fff));
 }
@@ -342,6 +371,7 @@ int page_unmap_addr_safe(unsigned long start, unsigned long len, char fixed)
         }
     }
 end_unmap:
+    page_tlb_shootdown(start, TLB_SHOOTDOWN_ALL);
     interrupt_restore_state(flags);
     return 0;
 }
@@ -375,10 +405,48 @@ unsigned long *kern_page_dir_copy_to()
     return (unsigned long *)vaddr;
 }
 
+static char page_large_enabled = 0;     /* 线性映射可以使用4MB大页 */
+static char page_pat_enabled = 0;       /* 页属性表中有写合并类型 */
+
+/**
+ * page_features_init - 开启分页相关的cpu特性
+ *
+ * 支持PSE时打开页大小扩展，内核线性映射使用4MB大页，减少TLB的占用。
+ * 支持PAT时把页属性表的第1项从WT改成WC，内核没有使用PWT的页，不影响已有的映射。
+ * 每个cpu的页属性表必须一致，应用处理器启动后也要调用。
+ */
+void page_features_init(void)
+{
+    unsigned int features = cpu_do_features();
+    if (features & CPUID_FEATURE_PSE) {
+        cpu_cr4_write(cpu_cr4_read() | REG_CR4_PSE);
+        page_large_enabled = 1;
+    }
+    if ((features & CPUID_FEATURE_PAT) && (features & CPUID_FEATURE_MSR)) {
+        unsigned long long pat = cpu_rdmsr(PAGE_PAT_MSR);
+        pat &= ~(0xffULL << 8);
+        pat |= (unsigned long long) PAGE_PAT_WC << 8;
+        cpu_wrmsr(PAGE_PAT_MSR, pat);
+        tlb_flush();
+        page_pat_enabled = 1;
+    }
+}
+
+/**
+ * page_attr_wc - 写合并映射需要的页属性
+ *
+ * 不支持PAT时返回0，由MTRR决定缓存类型
+ */
+unsigned long page_attr_wc(void)
+{
+    return page_pat_enabled ? PAGE_ATTR_WC : 0;
+}
+
 /**
  * 将物理地址[start, end]区间映射到高端地址
  * [HIGH+start, HIGH+end]
  * 并且只能通过高端地址来访问这段地址
+ * 支持PSE时完整的4MB直接用大页映射，剩下的部分才使用页表
  */
 void kern_page_map_early(unsigned int start, unsigned int end)
 {
@@ -396,8 +464,14 @@ void kern_page_map_early(unsigned int start, unsigned int end)
 
     uint32_t pde_off = KERN_PAGE_DIR_ENTRY_OFF + PAGE_TABLE_HAD_USED;
 
+	int large = page_large_enabled && !(start & ~PAGE_LARGE_MASK);
 	int i, j;
 	for (i = 0; i < pde_nr; i++) {
+		if (large) {
+			pdt[pde_off + i] = start | KERN_PAGE_ATTR | PAGE_ATTR_LARGE;
+			start += PAGE_LARGE_SIZE;
+			continue;
+		}
 		pdt[pde_off + i] = (unsigned int)pte_addr | KERN_PAGE_ATTR;
 		for (j = 0; j < PAGE_TABLE_ENTRY_NR; j++) {
 			pte_addr[j] = start | KERN_PAGE_ATTR;
@@ -412,13 +486,138 @@ void kern_page_map_early(unsigned int start, unsigned int end)
 			start += PAGE_SIZE;
 		}
 	}
-    dbgprint("map early: pde end: %x, phy end: %x\n", pte_addr, start);
+	/* 引导时用页表映射过的部分换成了大页 */
+	if (large)
+		tlb_flush();
+    dbgprint("map early: pde end: %x, phy end: %x, large page: %d\n", pte_addr, start, large);
+}
+
+/* 去掉页的写权限，用于先写入数据再变成只读的页 */
+static void page_clear_write(unsigned long addr)
+{
+    pte_t *pte = vir_addr_to_table_entry(addr);
+    *pte &= ~PAGE_ATTR_WRITE;
+    tlb_flush_one(addr);
 }
 
+/**
+ * do_handle_no_page - 匿名映射的空间缺页
+ * 
+ * 匿名映射只保留了地址空间，第一次访问时才分配物理页，并且清零，
+ * 不会把其它进程用过的数据暴露出来。
+ */
 static int do_handle_no_page(unsigned long addr, unsigned long prot)
 {
-    /* 映射一个物理页 */
-	return page_map_addr(addr, PAGE_SIZE, prot);
+    addr &= PAGE_MASK;
+	if (page_map_addr(addr, PAGE_SIZE, prot | PROT_WRITE) < 0)
+        return -1;
+    memset((void *)addr, 0, PAGE_SIZE);
+    if (!(prot & PROT_WRITE))
+        page_clear_write(addr);
+    return 0;
+}
+
+/**
+ * page_clear_dirty - 清除页的脏标志
+ * 
+ * 返回清除前页是否被写过，页没有映射时返回0
+ */
+int page_clear_dirty(unsigned long vaddr)
+{
+    vaddr &= PAGE_MASK;
+    if (!page_present(vaddr))
+        return 0;
+    pte_t *pte = vir_addr_to_table_entry(vaddr);
+    if (!(*pte & PAGE_ATTR_DIRTY))
+        return 0;
+    *pte &= ~PAGE_ATTR_DIRTY;
+    tlb_flush_one(vaddr);
+    page_tlb_shootdown(vaddr, vaddr);
+    return 1;
+}
+
+/**
+ * do_handle_cache_page - 从文件的页缓存映射一页
+ * 
+ * 共享的文件映射直接映射缓存中的页，写入的数据由msync或者munmap回写。
+ * 私有映射只读映射缓存中的页，可写的空间打上COW标志，第一次写入时才复制。
+ */
+static int do_handle_cache_page(mem_space_t *space, unsigned long addr, unsigned long index)
+{
+    unsigned long paddr = page_cache_find_page(space->pcache, space->file, index);
+    if (!paddr)
+        return -1;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (page_present(addr)) {   /* 读取文件期间其它线程已经映射了这一页 */
+        interrupt_restore_state(flags);
+        page_free(paddr);
+        return 0;
+    }
+    /* 先按可写映射，页表不存在时新建的页目录项才有写权限 */
+    page_link_addr(addr, paddr, PAGE_ATTR_USER | PAGE_ATTR_WRITE);
+    if (!((space->flags & MEM_SPACE_MAP_FILE_SHARED) && (space->page_prot & PROT_WRITE))) {
+        pte_t *pte = vir_addr_to_table_entry(addr);
+        *pte &= ~PAGE_ATTR_WRITE;
+        if (space->page_prot & PROT_WRITE)
+            *pte |= PAGE_ATTR_COW;
+        tlb_flush_one(addr);
+    }
+    interrupt_restore_state(flags);
+    return 0;
+}
+
+/**
+ * do_handle_file_page - 文件映射的空间缺页
+ * 
+ * 整页都是文件数据并且和文件的页对齐时使用页缓存，
+ * 不然先映射一个可写的物理页，再从文件中读取数据，
+ * 如果空间不可写，那么读取完后去掉写权限。
+ */
+static int do_handle_file_page(mem_space_t *space, unsigned long addr)
+{
+    addr &= PAGE_MASK;
+    if (space->pcache && addr >= space->file_vaddr &&
+        addr - space->file_vaddr + PAGE_SIZE <= space->file_size) {
+        unsigned long offset = space->file_offset + (addr - space->file_vaddr);
+        if (!(offset & ~PAGE_MASK))
+            return do_handle_cache_page(space, addr, offset >> PAGE_SHIFT);
+    }
+    if (page_map_addr(addr, PAGE_SIZE, space->page_prot | PROT_WRITE) < 0)
+        return -1;
+    if (mem_space_fill_page(space, addr) < 0) {
+        keprint(PRINT_ERR "page: %s: fill page %x from file failed!\n", __func__, addr);
+        page_unmap_addr(addr, PAGE_SIZE);
+        return -1;
+    }
+    if (!(space->page_prot & PROT_WRITE))
+        page_clear_write(addr);
+    return 0;
+}
+
+/**
+ * 处理空间中没有映射的页，文件映射从文件读取，匿名映射分配物理页
+ */
+static int do_handle_space_no_page(mem_space_t *space, unsigned long addr)
+{
+    if (space->file >= 0)
+        return do_handle_file_page(space, addr);
+    return do_handle_no_page(addr, space->page_prot);
+}
+
+/**
+ * 内核访问用户缓冲区之前，把空间中还没有映射的页映射上。
+ * 这样文件映射的页不会在文件系统读写用户缓冲区的过程中缺页，避免文件系统重入。
+ */
+static int page_populate(unsigned long addr)
+{
+    task_t *cur = task_current;
+    if (!cur->vmm || addr < USER_VMM_BASE_ADDR + PAGE_SIZE || addr >= USER_VMM_TOP_ADDR)
+        return -1;
+    mem_space_t *space = mem_space_find(cur->vmm, addr);
+    if (space == NULL || addr < space->start)
+        return -1;
+    return do_handle_space_no_page(space, addr);
 }
 
 /**
@@ -455,28 +654,113 @@ static void do_expand_stack(mem_space_t *space, unsigned long addr)
 	space->start = addr;
 }
 
-static int do_protection_fault(mem_space_t *space, unsigned long addr, int write)
+/* 复制窗口在内核映像中，低端8MB始终使用页表映射，有页表项可以借用 */
+static unsigned char page_copy_window[PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+/**
+ * page_copy_to_phy - 复制一个页的数据到物理页中
+ * @paddr: 目的物理页（可能没有映射到内核中）
+ * @src: 源数据虚拟地址
+ * 
+ * 借用复制窗口的页表项作为临时窗口，把目的物理页映射进来后复制。
+ * 内核页表在所有页目录中共享，所以不需要切换页目录。
+ */
+void page_copy_to_phy(unsigned long paddr, void *src)
+{
+    unsigned long copy_window = (unsigned long) page_copy_window;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    pte_t *pte = vir_addr_to_table_entry(copy_window);
+    pte_t old = *pte;
+    *pte = (paddr & PAGE_MASK) | KERN_PAGE_ATTR;
+    tlb_flush_one(copy_window);
+    memcpy((void *)copy_window, src, PAGE_SIZE);
+    *pte = old;
+    tlb_flush_one(copy_window);
+    interrupt_restore_state(flags);
+}
+
+/**
+ * do_copy_on_write - 处理写时复制
+ * @addr: 故障虚拟地址
+ * 
+ * 如果物理页只剩下当前的引用，那么直接恢复写权限，
+ * 不然就分配一个新页，复制数据后替换映射，并减少原物理页的引用。
+ */
+static int do_copy_on_write(unsigned long addr)
+{
+    addr &= PAGE_MASK;
+    pte_t *pte = vir_addr_to_table_entry(addr);
+    unsigned long paddr = *pte & PAGE_MASK;
+    unsigned long attr = (*pte & ~PAGE_MASK & ~PAGE_ATTR_COW) | PAGE_ATTR_WRITE;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (page_ref_count(paddr) <= 1) {
+        *pte = paddr | attr;
+        tlb_flush_one(addr);
+        interrupt_restore_state(flags);
+        return 0;
+    }
+    unsigned long new_page = page_alloc_user(1);
+    if (!new_page) {
+        keprint(PRINT_ERR "page: %s: alloc page for addr %x failed!\n", __func__, addr);
+        interrupt_restore_state(flags);
+        return -1;
+    }
+    page_copy_to_phy(new_page, (void *)addr);
+    *pte = new_page | attr;
+    tlb_flush_one(addr);
+    page_tlb_shootdown(addr, addr);
+    page_free(paddr);   /* 减少原物理页的引用 */
+    interrupt_restore_state(flags);
+    return 0;
+}
+
+/**
+ * 内核访问用户地址时出现了无法处理的页故障，如果出错的指令在异常表中，
+ * 就跳转到修复代码，由复制函数返回错误，不向进程发送信号
+ */
+static inline int page_fault_fixup(trap_frame_t *frame)
+{
+    return !(frame->error_code & PAGE_ERR_USER) && exception_table_fixup(frame);
+}
+
+static int do_protection_fault(trap_frame_t *frame, mem_space_t *space, unsigned long addr, int write)
 {
 	/* 没有写标志，说明该段内存不支持内存写入，就直接返回吧 */
 	if (write) {
-		keprint(PRINT_DEBUG "page: %s: addr %x have write protection.\n", __func__);
-		int ret = do_page_no_write(addr);
-		if (ret) {
-            keprint(PRINT_EMERG "page: %s: page not writable!", __func__);
+        if (!(space->page_prot & PROT_WRITE)) {
+            if (page_fault_fixup(frame))
+                return 0;
+            keprint(PRINT_EMERG "page: %s: addr %x space not writable!\n", __func__, addr);
             exception_force_self(EXP_CODE_SEGV);
             return -1;
         }
-
-		/* 虽然写入的写标志，但是还是会出现缺页故障，在此则处理一下缺页 */
-		if (do_handle_no_page(addr, space->page_prot)) {
-            keprint(PRINT_EMERG "page: %s: hand no page failed!", __func__);
+        pte_t *pte = vir_addr_to_table_entry(addr);
+        if (*pte & PAGE_ATTR_COW) {
+            if (do_copy_on_write(addr) < 0) {
+                if (page_fault_fixup(frame))
+                    return 0;
+                exception_force_self(EXP_CODE_SEGV);
+                return -1;
+            }
+            return 0;
+        }
+		keprint(PRINT_DEBUG "page: %s: addr %x have write protection.\n", __func__, addr);
+		if (do_page_no_write(addr)) {
+            if (page_fault_fixup(frame))
+                return 0;
+            keprint(PRINT_EMERG "page: %s: page not writable!", __func__);
             exception_force_self(EXP_CODE_SEGV);
-			return -1;
+            return -1;
         }
+        tlb_flush_one(addr);
 		return 0;
 	} else {
-		keprint(PRINT_DEBUG "page: %s: addr %x no write protection\n", addr, __func__);
+		keprint(PRINT_DEBUG "page: %s: addr %x no write protection\n", __func__, addr);
 	}
+    if (page_fault_fixup(frame))
+        return 0;
     keprint(PRINT_EMERG "page: %s: page protection!", __func__);
     exception_force_self(EXP_CODE_SEGV);
     return -1;
@@ -492,6 +776,7 @@ static int do_protection_fault(mem_space_t *space, unsigned long addr, int write
  *
  * 如果是来自内核的页故障，就会打印信息并停机。
  * 如果是来自用户的页故障，就会根据地址来做处理。
+ * 内核访问用户地址的故障和用户的一样处理，无法处理时通过异常表修复。
  */
 int page_do_fault(trap_frame_t *frame)
 {
@@ -520,6 +805,8 @@ int page_do_fault(trap_frame_t *frame)
 
     /* 检测在故障区域 */
     if (addr < PAGE_SIZE) {
+        if (page_fault_fixup(frame))
+            return 0;
         keprint(PRINT_ERR "page fauilt: user pid=%d name=%s access no permission space.\n", cur->pid, cur->name);
         keprint(PRINT_EMERG "page fault at %x.\n", addr);
         trap_frame_dump(frame);
@@ -528,8 +815,10 @@ int page_do_fault(trap_frame_t *frame)
     }
 
     /* 故障地址在用户空间 */
-    mem_space_t *space = mem_space_find(cur->vmm, addr);
+    mem_space_t *space = cur->vmm ? mem_space_find(cur->vmm, addr) : NULL;
     if (space == NULL) {
+        if (page_fault_fixup(frame))
+            return 0;
         keprint(PRINT_ERR "page fauilt: user pid=%d name=%s user access user unknown space.\n", cur->pid, cur->name);
         keprint(PRINT_EMERG "page fault at %x.\n", addr);
         trap_frame_dump(frame);
@@ -537,19 +826,20 @@ int page_do_fault(trap_frame_t *frame)
         return -1;
     }
     if (space->start > addr) { /* 故障地址在空间前，说明是栈向下拓展，那么尝试拓展栈。 */
-        if (frame->error_code & PAGE_ERR_USER) {
-            /* 可拓展栈：有栈标志，在可拓展限定内， */
-            if ((space->flags & MEM_SPACE_MAP_STACK) &&
-                ((space->end - space->start) < MAX_MEM_SPACE_STACK_SIZE) &&
-                (addr + 32 >= frame->esp)) {
-                do_expand_stack(space, addr);
-            } else {
-                errprint("page addr %x\n", addr);
-                keprint(PRINT_ERR "page fauilt: user pid=%d name=%s user task stack out of range!\n", cur->pid, cur->name);
-                trap_frame_dump(frame);
-                exception_force_self(EXP_CODE_SEGV);
-                return -1;
-            }
+        /* 可拓展栈：有栈标志，在可拓展限定内，
+        内核访问的用户缓冲区可能在用户还没有访问过的栈上，这时没有用户的栈指针可以比较 */
+        if ((space->flags & MEM_SPACE_MAP_STACK) &&
+            ((space->end - space->start) < MAX_MEM_SPACE_STACK_SIZE) &&
+            (!(frame->error_code & PAGE_ERR_USER) || addr + 32 >= frame->esp)) {
+            do_expand_stack(space, addr);
+        } else {
+            if (page_fault_fixup(frame))
+                return 0;
+            errprint("page addr %x\n", addr);
+            keprint(PRINT_ERR "page fauilt: user pid=%d name=%s user task stack out of range!\n", cur->pid, cur->name);
+            trap_frame_dump(frame);
+            exception_force_self(EXP_CODE_SEGV);
+            return -1;
         }
     }
     /* 故障地址在空间里面，情况如下：
@@ -557,9 +847,29 @@ int page_do_fault(trap_frame_t *frame)
     2.缺少物理页和虚拟地址的映射。（堆的向上拓展或者栈的向下拓展）
      */
     if (frame->error_code & PAGE_ERR_PROTECT) {
-        return do_protection_fault(space, addr, frame->error_code & PAGE_ERR_WRITE);
+        return do_protection_fault(frame, space, addr, frame->error_code & PAGE_ERR_WRITE);
+    }
+    if (space->file >= 0) {
+        /* 从文件读取数据可能需要等待磁盘，如果故障前是开中断的，就打开中断 */
+        if (frame->eflags & EFLAGS_IF_1)
+            interrupt_enable();
+        int ret = do_handle_file_page(space, addr);
+        interrupt_disable();
+        if (ret < 0) {
+            if (page_fault_fixup(frame))
+                return 0;
+            exception_force_self(EXP_CODE_BUS);
+            return -1;
+        }
+        return 0;
+    }
+    if (do_handle_no_page(addr, space->page_prot) < 0) {
+        if (page_fault_fixup(frame))
+            return 0;
+        keprint(PRINT_ERR "page fauilt: user pid=%d name=%s no memory for addr %x!\n", cur->pid, cur->name, addr);
+        exception_force_self(EXP_CODE_BUS);
+        return -1;
     }
-    do_handle_no_page(addr, space->page_prot);
     return 0;
 }
 
@@ -598,7 +908,7 @@ void setup_paging()
     pgdir[1023] = (unsigned int) pgdir |KERN_PAGE_ATTR;    /* record pgdir self */
     /* 打开分页模式 */
     cpu_cr3_write((unsigned int) pgdir);
-    cpu_cr0_write(cpu_cr0_read() | REG_CR0_PG);
+    cpu_cr0_write(cpu_cr0_read() | REG_CR0_PG | REG_CR0_WP);
     /* 0-8M物理内存是内核可以直接访问的地址，即使开启分页模式后，内核也可能会访问该地址的数据，
     不过不用担心，用户不能访问，因为页权限的问题所致 */
 }
@@ -53,7 +53,8 @@ int physic_memory_init()
     noteprint("user size:%x %d MB\n", user_size, user_size / MB);
     noteprint("unused size:%x %d MB\n", unused_size, unused_size / MB);
     
-    /* 由于引导中只映射了0~8MB，所以这里从DMA开始 */
+    /* 由于引导中只映射了0~8MB，所以这里从DMA开始，映射前先开启大页支持 */
+    page_features_init();
     kern_page_map_early(DMA_MEM_ADDR, NORMAL_MEM_ADDR + normal_size);
 
     /* normal size前面是boot mem，后面是normal mem */
@@ -0,0 +1,89 @@
+#include <arch/uaccess.h>
+#include <errno.h>
+
+/* 链接脚本提供的异常表的范围 */
+extern exception_table_entry_t __ex_table_start[];
+extern exception_table_entry_t __ex_table_end[];
+
+/**
+ * exception_table_fixup - 在异常表中查找出错的指令
+ *
+ * 找到后把返回地址改成修复代码，返回1，没有找到返回0。
+ * 访问用户地址的函数只有几个，表项很少，顺序查找就可以了。
+ */
+int exception_table_fixup(trap_frame_t *frame)
+{
+    exception_table_entry_t *entry;
+    for (entry = __ex_table_start; entry < __ex_table_end; entry++) {
+        if (entry->insn == frame->eip) {
+            frame->eip = entry->fixup;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * __copy_user - 复制用户数据，不检查地址
+ *
+ * 先按4字节复制，再复制剩下的字节。出错时从修复代码返回，
+ * 按4字节复制时剩下的字节数是ecx * 4加上不满4字节的部分。
+ * 返回没有复制的字节数。
+ */
+unsigned long __copy_user(void *to, const void *from, unsigned long n)
+{
+    int d0, d1, d2;
+    __asm__ __volatile__(
+        "1: rep; movsl\n"
+        "   movl %3, %0\n"
+        "2: rep; movsb\n"
+        "3:\n"
+        ".section .fixup, \"ax\"\n"
+        "4: leal 0(%3, %0, 4), %0\n"
+        "   jmp 3b\n"
+        ".previous\n"
+        ".section __ex_table, \"a\"\n"
+        "   .align 4\n"
+        "   .long 1b, 4b\n"
+        "   .long 2b, 3b\n"
+        ".previous"
+        : "=&c" (n), "=&D" (d0), "=&S" (d1), "=&r" (d2)
+        : "0" (n / 4), "1" (to), "2" (from), "3" (n & 3)
+        : "memory");
+    return n;
+}
+
+/**
+ * __strncpy_from_user - 从用户空间复制字符串，不检查地址
+ *
+ * 最多复制count个字节，复制到结束符为止，结束符也会复制。
+ * 返回字符串的长度，没有遇到结束符时返回count，出错返回-EFAULT。
+ */
+long __strncpy_from_user(char *dst, const char *src, long count)
+{
+    long res;
+    int d0, d1, d2;
+    __asm__ __volatile__(
+        "   testl %1, %1\n"
+        "   jz 2f\n"
+        "0: lodsb\n"
+        "   stosb\n"
+        "   testb %%al, %%al\n"
+        "   jz 1f\n"
+        "   decl %1\n"
+        "   jnz 0b\n"
+        "1: subl %1, %0\n"
+        "2:\n"
+        ".section .fixup, \"ax\"\n"
+        "3: movl %5, %0\n"
+        "   jmp 2b\n"
+        ".previous\n"
+        ".section __ex_table, \"a\"\n"
+        "   .align 4\n"
+        "   .long 0b, 3b\n"
+        ".previous"
+        : "=&d" (res), "=&c" (count), "=&a" (d0), "=&S" (d1), "=&D" (d2)
+        : "i" (-EFAULT), "0" (count), "1" (count), "3" (src), "4" (dst)
+        : "memory");
+    return res;
+}
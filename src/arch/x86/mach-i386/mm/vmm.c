@@ -6,66 +6,70 @@
 #include <xbook/vmm.h>
 #include <xbook/schedule.h>
 #include <arch/tss.h>
+#include <arch/memory.h>
+#include <xbook/smp.h>
 #include <string.h>
 
-#define DEBUG_VMM
 
-static int do_copy_share_page(addr_t vaddr, vmm_t *child, vmm_t *parent)
+/**
+ * 获取子进程中虚拟地址对应的页表，没有就创建一个。
+ * 子进程的页表从内核线性映射区分配，可以直接填写，不需要切换页目录。
+ */
+static pte_t *vmm_child_page_table(vmm_t *child, unsigned long vaddr, pde_t parent_pde)
 {
-    addr_t paddr = addr_vir2phy(vaddr);
-    dbgprint("[vmm]: copy share page at vaddr %x phy addr %x\n", vaddr, paddr);   
-    vmm_active(child);
-    page_link_addr(vaddr, paddr, PAGE_ATTR_WRITE | PAGE_ATTR_USER);
-    vmm_active(parent);
-    return 0;
-}
-
-static int do_copy_normal_page(addr_t vaddr, void *buf, vmm_t *child, vmm_t *parent)
-{
-    addr_t paddr;
-    memcpy(buf, (void *)vaddr, PAGE_SIZE);
-    vmm_active(child);
-    paddr = page_alloc_user(1);
-    if (!paddr) {
-        keprint(PRINT_ERR "vmm_copy_mapping: page_alloc_one for vaddr failed!\n");
-        vmm_active(parent);
-        return -1;
+    pde_t *pde = (pde_t *)child->page_storage + PAGE_DIR_ENTRY_IDX(vaddr);
+    if (!(*pde & PAGE_ATTR_PRESENT)) {
+        unsigned long page_table = page_alloc_normal(1);
+        if (!page_table)
+            return NULL;
+        memset(kern_phy_addr2vir_addr(page_table), 0, PAGE_SIZE);
+        *pde = page_table | (parent_pde & ~PAGE_MASK);
     }
-    page_link_addr(vaddr, paddr, PAGE_ATTR_WRITE | PAGE_ATTR_USER);
-    memcpy((void *)vaddr, buf, PAGE_SIZE);
-    vmm_active(parent);
-    return 0;
+    return (pte_t *)kern_phy_addr2vir_addr(*pde & PAGE_MASK);
 }
 
+/**
+ * vmm_copy_mapping - 复制父进程的页映射到子进程
+ * 
+ * 写时复制：私有页在父子进程之间共享，去掉写权限并打上COW标志，
+ * 同时增加物理页的引用计数，等到第一次写入时才在页故障中分离。
+ * 共享内存直接共享映射。共享的文件映射增加引用后共享映射，不需要写时复制。
+ * 没有映射的页不复制，由子进程按需缺页。
+ */
 int vmm_copy_mapping(task_t *child, task_t *parent)
 {
-    void *buf = mem_alloc(PAGE_SIZE);
-    if (buf == NULL) {
-        keprint(PRINT_ERR "vmm_copy_mapping: mem_alloc buf for data transform failed!\n");
-        return -1;
-    }
     mem_space_t *space = parent->vmm->mem_space_head;
-    addr_t prog_vaddr = 0;
+    unsigned long vaddr;
+    pde_t *pde;
+    pte_t *pte, *child_table;
     while (space != NULL) {
-        prog_vaddr = space->start;
-        while (prog_vaddr < space->end) {
-            /* 如果是共享内存，就只复制页映射，而不创建新的页 */
-            if (space->flags & MEM_SPACE_MAP_SHARED) {
-                if (do_copy_share_page(prog_vaddr, child->vmm, parent->vmm) < 0) {
-                    mem_free(buf);
+        vaddr = space->start;
+        while (vaddr < space->end) {
+            pde = vir_addr_to_dir_entry(vaddr);
+            if (!(*pde & PAGE_ATTR_PRESENT)) {  /* 跳过整个页表 */
+                vaddr = (vaddr & 0xffc00000) + PAGE_TABLE_ENTRY_NR * PAGE_SIZE;
+                continue;
+            }
+            pte = vir_addr_to_table_entry(vaddr);
+            if (*pte & PAGE_ATTR_PRESENT) {
+                child_table = vmm_child_page_table(child->vmm, vaddr, *pde);
+                if (child_table == NULL) {
+                    keprint(PRINT_ERR "vmm_copy_mapping: alloc page table for vaddr %x failed!\n", vaddr);
+                    tlb_flush();
                     return -1;
                 }
-            } else {
-                if (do_copy_normal_page(prog_vaddr, buf, child->vmm, parent->vmm) < 0) {
-                    mem_free(buf);
-                    return -1;
+                if (!(space->flags & MEM_SPACE_MAP_SHARED) && page_ref(*pte & PAGE_MASK) > 0 &&
+                    !(space->flags & MEM_SPACE_MAP_FILE_SHARED)) {
+                    *pte = (*pte & ~PAGE_ATTR_WRITE) | PAGE_ATTR_COW;
                 }
+                child_table[PAGE_TABLE_ENTRY_IDX(vaddr)] = *pte;
             }
-            prog_vaddr += PAGE_SIZE;
+            vaddr += PAGE_SIZE;
         }
         space = space->next;
     }
-    mem_free(buf);
+    tlb_flush();    /* 父进程的页权限已经修改 */
+    smp_tlb_shootdown(parent->vmm, TLB_SHOOTDOWN_ALL);
     return 0; 
 }
 
@@ -1,3 +1,5 @@
+extern kernel_unlock
+
 [section .text]
 [bits 32]
 
@@ -23,6 +25,7 @@ thread_switch_to_next:
 global kernel_switch_to_user
 kernel_switch_to_user:
     mov esp, [esp + 4]
+    call kernel_unlock     ; 返回用户态前释放内核锁
     add esp, 4			   ; 跳过中断号
     popad
     pop gs
@@ -25,8 +25,8 @@ void user_frame_init(trap_frame_t *frame)
 
 void kernel_frame_init(trap_frame_t *frame)
 {
-    frame->ds = frame->es = \
-    frame->fs = frame->gs = KERNEL_DATA_SEL; 
+    frame->ds = frame->es = frame->fs = KERNEL_DATA_SEL;
+    frame->gs = KERNEL_PERCPU_SEL;
     frame->cs = KERNEL_CODE_SEL;
     frame->ss = KERNEL_STACK_SEL;
 
@@ -102,7 +102,6 @@ int process_frame_init(task_t *task, trap_frame_t *frame, char **argv, char **en
         MEM_SPACE_MAP_FIXED | MEM_SPACE_MAP_STACK) == ((void *)-1)) {
         return -1;
     }
-    memset((void *) vmm->stack_start, 0, vmm->stack_end - vmm->stack_start);
     
     int argc = 0;
     char **new_envp = NULL;
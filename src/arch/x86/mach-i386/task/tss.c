@@ -2,27 +2,40 @@
 #include <arch/segment.h>
 #include <arch/registers.h>
 #include <arch/phymem.h>
+#include <arch/cpu.h>
 #include <string.h>
 #include <xbook/task.h>
 
-tss_t tss0;
+/* 每个cpu都有自己的tss，用来保存切换到内核态时的栈 */
+tss_t tss_table[CPU_NR_MAX];
 
 tss_t *tss_get_from_cpu0()
 {
-	return &tss0;
+	return &tss_table[0];
+}
+
+tss_t *tss_get_from_cpu(cpuid_t cpu)
+{
+	return &tss_table[cpu];
 }
 
 void tss_update_info(unsigned long task_addr)
 {
 	// 更新tss.esp0的值为任务的内核栈顶
-	tss0.esp0 = (unsigned long)(task_addr + TASK_KERN_STACK_SIZE);
+	tss_table[cpu_get_my_id()].esp0 = (unsigned long)(task_addr + TASK_KERN_STACK_SIZE);
+}
+
+void tss_init_cpu(cpuid_t cpu, unsigned long esp0)
+{
+	tss_t *tss = &tss_table[cpu];
+	memset(tss, 0, sizeof(tss_t));
+	tss->esp0 = esp0;
+	tss->ss0 = KERNEL_DATA_SEL;
+	tss->iobase = sizeof(tss_t);
 }
 
 void tss_init()
 {
-	memset(&tss0, 0, sizeof(tss_t));
-	tss0.esp0 = KERNEL_STATCK_TOP;
-	tss0.ss0 = KERNEL_DATA_SEL;
-	tss0.iobase = sizeof(tss_t);
+	tss_init_cpu(0, KERNEL_STATCK_TOP);
 	task_register_set(KERNEL_TSS_SEL);
 }
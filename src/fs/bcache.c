@@ -0,0 +1,657 @@
+#include <xbook/bcache.h>
+#include <xbook/driver.h>
+#include <xbook/memalloc.h>
+#include <xbook/mutexlock.h>
+#include <xbook/schedule.h>
+#include <xbook/waitqueue.h>
+#include <xbook/task.h>
+#include <xbook/clock.h>
+#include <xbook/debug.h>
+#include <xbook/safety.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+
+/* 哈希表，以(插槽，扇区)为键 */
+static list_t bcache_hash_table[BCACHE_HASH_NR];
+static LIST_HEAD(bcache_lru_list);
+static LIST_HEAD(bcache_dirty_list);
+static LIST_HEAD(bcache_free_list);
+
+static bcache_block_t *bcache_blocks;
+static int bcache_busy_nr;      /* 正在进行磁盘I/O的块数 */
+static bstate_t bcache_state;
+
+/* 异步预读请求，由预读线程处理 */
+typedef struct {
+    int solt;
+    int handle;
+    sector_t sector;
+    unsigned long count;
+} bcache_ra_req_t;
+
+static bcache_ra_req_t bcache_ra_queue[BCACHE_RA_QUEUE_NR];
+static int bcache_ra_head;
+static int bcache_ra_tail;
+static wait_queue_t bcache_ra_wait = WAIT_QUEUE_INIT(bcache_ra_wait);
+
+/**
+ * bcache_mutex只保护查找、插入和LRU等缓存结构，进行磁盘I/O时释放。
+ * I/O期间块标记为忙，访问忙块的任务在bcache_wait上等待。
+ */
+DEFINE_MUTEX_LOCK(bcache_mutex);
+static wait_queue_t bcache_wait = WAIT_QUEUE_INIT(bcache_wait);
+
+#define BCACHE_HASH(solt, sector) \
+        (((sector) ^ ((sector) >> 8) ^ ((solt) << 4)) & (BCACHE_HASH_NR - 1))
+
+static bcache_block_t *bcache_lookup(int solt, sector_t sector)
+{
+    bcache_block_t *blk;
+    list_for_each_owner (blk, &bcache_hash_table[BCACHE_HASH(solt, sector)], hash_list) {
+        if (blk->solt == solt && blk->sector == sector)
+            return blk;
+    }
+    return NULL;
+}
+
+static void bcache_mark_dirty(bcache_block_t *blk)
+{
+    if (!blk->dirty) {
+        blk->dirty = 1;
+        list_add_tail(&blk->dirty_list, &bcache_dirty_list);
+        bcache_state.bs_dirty++;
+    }
+}
+
+static void bcache_mark_clean(bcache_block_t *blk)
+{
+    if (blk->dirty) {
+        blk->dirty = 0;
+        list_del_init(&blk->dirty_list);
+        bcache_state.bs_dirty--;
+    }
+}
+
+static void bcache_set_busy(bcache_block_t *blk)
+{
+    blk->busy = 1;
+    bcache_busy_nr++;
+}
+
+static void bcache_clear_busy(bcache_block_t *blk)
+{
+    blk->busy = 0;
+    bcache_busy_nr--;
+}
+
+/* 等待其它任务的块I/O完成，等待期间释放bcache_mutex，返回后需要重新查找 */
+static void bcache_wait_io()
+{
+    wait_queue_add(&bcache_wait, task_current);
+    mutex_unlock(&bcache_mutex);
+    task_block(TASK_BLOCKED);
+    mutex_lock(&bcache_mutex);
+}
+
+/**
+ * 回写脏块，会把前后连续的脏扇区合并成一次磁盘写入。
+ * 写入期间释放bcache_mutex，块标记为忙，不会被回收也不会被修改
+ */
+static int bcache_flush_block(bcache_block_t *blk)
+{
+    bcache_block_t *run[BCACHE_FLUSH_MAX];
+    bcache_block_t *tmp;
+    unsigned char *buf = NULL;
+    int n = 0, i, retval;
+    /* 向前找到连续脏块的起始位置 */
+    while (blk->sector > 0) {
+        tmp = bcache_lookup(blk->solt, blk->sector - 1);
+        if (!tmp || !tmp->dirty || tmp->busy)
+            break;
+        blk = tmp;
+    }
+    run[n++] = blk;
+    while (n < BCACHE_FLUSH_MAX) {
+        tmp = bcache_lookup(blk->solt, blk->sector + n);
+        if (!tmp || !tmp->dirty || tmp->busy)
+            break;
+        run[n++] = tmp;
+    }
+    /* 合并回写需要缓冲区，分配失败时只回写一个块 */
+    if (n > 1 && !(buf = mem_alloc(n * BCACHE_BLOCK_SIZE)))
+        n = 1;
+    int solt = blk->solt;
+    int handle = blk->handle;
+    sector_t sector = blk->sector;
+    for (i = 0; i < n; i++) {
+        bcache_set_busy(run[i]);
+        bcache_mark_clean(run[i]);
+    }
+    mutex_unlock(&bcache_mutex);
+    if (buf) {
+        for (i = 0; i < n; i++)
+            memcpy(buf + i * BCACHE_BLOCK_SIZE, run[i]->data, BCACHE_BLOCK_SIZE);
+        retval = device_write(handle, buf, n * BCACHE_BLOCK_SIZE, sector);
+        mem_free(buf);
+    } else {
+        retval = device_write(handle, blk->data, BCACHE_BLOCK_SIZE, sector);
+    }
+    mutex_lock(&bcache_mutex);
+    for (i = 0; i < n; i++) {
+        bcache_clear_busy(run[i]);
+        if (retval < 0)
+            bcache_mark_dirty(run[i]);
+    }
+    wait_queue_wakeup_all(&bcache_wait);
+    if (retval < 0) {
+        errprint("[bcache]: write back solt %d sector %x failed!\n", solt, sector);
+        return -1;
+    }
+    bcache_state.bs_writebacks += n;
+    return 0;
+}
+
+/**
+ * 获取一个空闲的缓存块，没有空闲块时回收最久未使用的块，
+ * 脏块需要先回写，回写时会释放锁，调用者拿到块后需要重新查找。
+ * 所有块都在进行I/O或者回写失败时返回NULL
+ */
+static bcache_block_t *bcache_alloc()
+{
+    bcache_block_t *blk, *victim;
+    while (1) {
+        if (!list_empty(&bcache_free_list)) {
+            blk = list_first_owner(&bcache_free_list, bcache_block_t, lru_list);
+            list_del(&blk->lru_list);
+            bcache_state.bs_used++;
+            return blk;
+        }
+        victim = NULL;
+        list_for_each_owner_reverse (blk, &bcache_lru_list, lru_list) {
+            if (!blk->busy) {
+                victim = blk;
+                break;
+            }
+        }
+        if (!victim)
+            return NULL;
+        if (!victim->dirty) {
+            list_del(&victim->lru_list);
+            list_del(&victim->hash_list);
+            victim->valid = 0;
+            return victim;
+        }
+        if (bcache_flush_block(victim) < 0)
+            return NULL;
+    }
+}
+
+static void bcache_insert(bcache_block_t *blk, int solt, int handle, sector_t sector)
+{
+    blk->solt = solt;
+    blk->handle = handle;
+    blk->sector = sector;
+    blk->valid = 1;
+    blk->dirty = 0;
+    list_add(&blk->hash_list, &bcache_hash_table[BCACHE_HASH(solt, sector)]);
+    list_add(&blk->lru_list, &bcache_lru_list);
+}
+
+/* 把不在哈希表和LRU链表上的块放回空闲链表 */
+static void bcache_free(bcache_block_t *blk)
+{
+    blk->valid = 0;
+    list_add(&blk->lru_list, &bcache_free_list);
+    bcache_state.bs_used--;
+}
+
+static void bcache_release(bcache_block_t *blk)
+{
+    bcache_mark_clean(blk);
+    list_del(&blk->hash_list);
+    list_del(&blk->lru_list);
+    bcache_free(blk);
+}
+
+/**
+ * 为连续未缓存的扇区预留缓存块，预留的块在哈希表中，标记为忙并且没有数据，
+ * 其它任务查找到时会等待读入完成。分配时可能释放过锁，
+ * 遇到已经被其它任务缓存的扇区就停止，返回预留的块数
+ */
+static unsigned long bcache_reserve(int solt, int handle, sector_t sector, unsigned long count)
+{
+    bcache_block_t *blk;
+    unsigned long i;
+    for (i = 0; i < count; i++) {
+        blk = bcache_alloc();
+        if (!blk)
+            break;
+        if (bcache_lookup(solt, sector + i)) {
+            bcache_free(blk);
+            break;
+        }
+        bcache_insert(blk, solt, handle, sector + i);
+        blk->valid = 0;
+        bcache_set_busy(blk);
+    }
+    return i;
+}
+
+/* 预留块的数据读入完成，失败时释放预留的块 */
+static void bcache_fill(int solt, sector_t sector, unsigned long count, unsigned char *data, int ok)
+{
+    bcache_block_t *blk;
+    unsigned long i;
+    for (i = 0; i < count; i++) {
+        blk = bcache_lookup(solt, sector + i);
+        bcache_clear_busy(blk);
+        if (ok) {
+            memcpy(blk->data, data + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+            blk->valid = 1;
+        } else {
+            bcache_release(blk);
+        }
+    }
+    wait_queue_wakeup_all(&bcache_wait);
+}
+
+/* 是否有正在回写的块，正在读入的块没有数据，不算在内 */
+static int bcache_writing(int solt)
+{
+    bcache_block_t *blk;
+    int i;
+    for (i = 0; i < BCACHE_BLOCK_NR; i++) {
+        blk = &bcache_blocks[i];
+        if (blk->busy && blk->valid && (solt < 0 || blk->solt == solt))
+            return 1;
+    }
+    return 0;
+}
+
+static int __bcache_sync(int solt)
+{
+    bcache_block_t *blk;
+repeat:
+    list_for_each_owner (blk, &bcache_dirty_list, dirty_list) {
+        if (solt >= 0 && blk->solt != solt)
+            continue;
+        /* 回写会释放锁并从脏链表中删除多个节点，因此每次都从头开始遍历 */
+        if (bcache_flush_block(blk) < 0)
+            return -1;
+        goto repeat;
+    }
+    /* 其它任务正在回写的块也要等它写完 */
+    if (bcache_writing(solt)) {
+        bcache_wait_io();
+        goto repeat;
+    }
+    return 0;
+}
+
+/* 丢弃某个范围内的缓存块，用于不经过缓存的直接读写 */
+static void bcache_drop_range(int solt, sector_t sector, unsigned long count)
+{
+    bcache_block_t *blk;
+    while (count > 0) {
+        blk = bcache_lookup(solt, sector);
+        if (blk && blk->busy) {
+            bcache_wait_io();
+            continue;
+        }
+        if (blk)
+            bcache_release(blk);
+        sector++;
+        count--;
+    }
+}
+
+/**
+ * bcache_read - 通过块缓存读取磁盘
+ * @solt: 磁盘插槽
+ * @handle: 设备句柄
+ * @sector: 起始扇区
+ * @buffer: 缓冲区
+ * @size: 字节数
+ *
+ * 连续未命中的扇区会合并成一次磁盘读取，大块读取不进入缓存，
+ * 避免冲刷掉缓存中的其它数据。读磁盘时不持有锁，其它磁盘的I/O可以同时进行
+ * @return: 成功返回0，失败返回-1
+ */
+int bcache_read(int solt, int handle, sector_t sector, void *buffer, size_t size)
+{
+    unsigned char *buf = buffer;
+    bcache_block_t *blk;
+    unsigned long count = size / BCACHE_BLOCK_SIZE;
+    unsigned long i, n, reserved;
+    int retval;
+    mutex_lock(&bcache_mutex);
+    if (size % BCACHE_BLOCK_SIZE) {
+        /* 不是整扇区的读取直接访问磁盘，先回写以保证读到最新数据 */
+        retval = __bcache_sync(solt);
+        mutex_unlock(&bcache_mutex);
+        if (retval < 0 || device_read(handle, buffer, size, sector) < 0)
+            return -1;
+        return 0;
+    }
+    i = 0;
+    while (i < count) {
+        blk = bcache_lookup(solt, sector + i);
+        if (blk) {
+            if (!blk->valid) {  /* 其它任务正在读入这个块 */
+                bcache_wait_io();
+                continue;
+            }
+            memcpy(buf + i * BCACHE_BLOCK_SIZE, blk->data, BCACHE_BLOCK_SIZE);
+            list_move(&blk->lru_list, &bcache_lru_list);
+            bcache_state.bs_hits++;
+            i++;
+            continue;
+        }
+        /* 找出连续未命中的扇区 */
+        n = 1;
+        while (i + n < count && !bcache_lookup(solt, sector + i + n))
+            n++;
+        reserved = 0;
+        if (count < BCACHE_STREAM_MIN) {
+            reserved = bcache_reserve(solt, handle, sector + i, n);
+            if (reserved > 0)
+                n = reserved;
+            else if (bcache_lookup(solt, sector + i))
+                continue;
+        }
+        mutex_unlock(&bcache_mutex);
+        retval = device_read(handle, buf + i * BCACHE_BLOCK_SIZE, n * BCACHE_BLOCK_SIZE, sector + i);
+        mutex_lock(&bcache_mutex);
+        if (reserved > 0)
+            bcache_fill(solt, sector + i, reserved, buf + i * BCACHE_BLOCK_SIZE, retval >= 0);
+        if (retval < 0) {
+            mutex_unlock(&bcache_mutex);
+            return -1;
+        }
+        bcache_state.bs_misses += n;
+        i += n;
+    }
+    mutex_unlock(&bcache_mutex);
+    return 0;
+}
+
+/**
+ * bcache_write - 通过块缓存写入磁盘
+ * @solt: 磁盘插槽
+ * @handle: 设备句柄
+ * @sector: 起始扇区
+ * @buffer: 缓冲区
+ * @size: 字节数
+ *
+ * 数据只写入缓存并标记为脏，由回写线程或者同步操作写回磁盘
+ * @return: 成功返回0，失败返回-1
+ */
+int bcache_write(int solt, int handle, sector_t sector, void *buffer, size_t size)
+{
+    unsigned char *buf = buffer;
+    bcache_block_t *blk;
+    unsigned long count = size / BCACHE_BLOCK_SIZE;
+    unsigned long i;
+    int retval;
+    mutex_lock(&bcache_mutex);
+    if (size % BCACHE_BLOCK_SIZE) {
+        /* 不是整扇区的写入直接写磁盘，写入前后都丢弃重叠的缓存块，
+           写入期间其它任务读入缓存的旧数据也会被丢弃 */
+        count = DIV_ROUND_UP(size, BCACHE_BLOCK_SIZE);
+        bcache_drop_range(solt, sector, count);
+        mutex_unlock(&bcache_mutex);
+        retval = device_write(handle, buffer, size, sector);
+        mutex_lock(&bcache_mutex);
+        bcache_drop_range(solt, sector, count);
+        mutex_unlock(&bcache_mutex);
+        return retval < 0 ? -1 : 0;
+    }
+    i = 0;
+    while (i < count) {
+        blk = bcache_lookup(solt, sector + i);
+        if (blk && blk->busy) { /* 正在读入或者回写，等完成后再修改 */
+            bcache_wait_io();
+            continue;
+        }
+        if (blk) {
+            list_move(&blk->lru_list, &bcache_lru_list);
+        } else {
+            blk = bcache_alloc();
+            if (!blk) {
+                if (!bcache_busy_nr) {  /* 回写失败，无法腾出缓存块 */
+                    mutex_unlock(&bcache_mutex);
+                    return -1;
+                }
+                bcache_wait_io();
+                continue;
+            }
+            if (bcache_lookup(solt, sector + i)) {
+                bcache_free(blk);
+                continue;
+            }
+            bcache_insert(blk, solt, handle, sector + i);
+        }
+        memcpy(blk->data, buf + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+        bcache_mark_dirty(blk);
+        i++;
+    }
+    if (bcache_state.bs_dirty > BCACHE_DIRTY_MAX)
+        __bcache_sync(-1);
+    mutex_unlock(&bcache_mutex);
+    return 0;
+}
+
+/**
+ * bcache_prefetch - 把扇区预读到缓存中
+ * @solt: 磁盘插槽
+ * @handle: 设备句柄
+ * @sector: 起始扇区
+ * @count: 扇区数
+ *
+ * 已经缓存的扇区会被跳过，连续未缓存的扇区合并成一次磁盘读取
+ * @return: 成功返回0，失败返回-1
+ */
+int bcache_prefetch(int solt, int handle, sector_t sector, unsigned long count)
+{
+    unsigned char *buf;
+    unsigned long i, n;
+    int retval = 0;
+    if (count > BCACHE_PREFETCH_MAX)
+        count = BCACHE_PREFETCH_MAX;
+    buf = mem_alloc(count * BCACHE_BLOCK_SIZE);
+    if (!buf)
+        return -1;
+    mutex_lock(&bcache_mutex);
+    i = 0;
+    while (i < count) {
+        if (bcache_lookup(solt, sector + i)) {
+            i++;
+            continue;
+        }
+        n = 1;
+        while (i + n < count && !bcache_lookup(solt, sector + i + n))
+            n++;
+        n = bcache_reserve(solt, handle, sector + i, n);
+        if (!n) {
+            if (bcache_lookup(solt, sector + i))
+                continue;
+            break;  /* 缓存块都在进行I/O，放弃预读 */
+        }
+        mutex_unlock(&bcache_mutex);
+        retval = device_read(handle, buf, n * BCACHE_BLOCK_SIZE, sector + i);
+        mutex_lock(&bcache_mutex);
+        bcache_fill(solt, sector + i, n, buf, retval >= 0);
+        if (retval < 0)
+            break;
+        i += n;
+    }
+    mutex_unlock(&bcache_mutex);
+    mem_free(buf);
+    return retval < 0 ? -1 : 0;
+}
+
+/**
+ * bcache_prefetch_async - 异步预读扇区到缓存中
+ * @solt: 磁盘插槽
+ * @handle: 设备句柄
+ * @sector: 起始扇区
+ * @count: 扇区数
+ *
+ * 只把请求放到预读队列中，由预读线程读取，调用者不等待磁盘I/O。
+ * 队列满时丢弃请求，预读失败不影响正常读取
+ * @return: 成功返回0，失败返回-1
+ */
+int bcache_prefetch_async(int solt, int handle, sector_t sector, unsigned long count)
+{
+    bcache_ra_req_t *req;
+    int i;
+    mutex_lock(&bcache_mutex);
+    /* 已经在队列中的请求不再重复添加 */
+    for (i = bcache_ra_head; i != bcache_ra_tail; i = (i + 1) % BCACHE_RA_QUEUE_NR) {
+        req = &bcache_ra_queue[i];
+        if (req->solt == solt && req->sector == sector) {
+            req->count = max(req->count, count);
+            mutex_unlock(&bcache_mutex);
+            return 0;
+        }
+    }
+    if ((bcache_ra_tail + 1) % BCACHE_RA_QUEUE_NR == bcache_ra_head) {
+        mutex_unlock(&bcache_mutex);
+        return -1;
+    }
+    req = &bcache_ra_queue[bcache_ra_tail];
+    req->solt = solt;
+    req->handle = handle;
+    req->sector = sector;
+    req->count = count;
+    bcache_ra_tail = (bcache_ra_tail + 1) % BCACHE_RA_QUEUE_NR;
+    wait_queue_wakeup(&bcache_ra_wait);
+    mutex_unlock(&bcache_mutex);
+    return 0;
+}
+
+/**
+ * bcache_sync - 回写磁盘的脏块
+ * @solt: 磁盘插槽，小于0表示所有磁盘
+ *
+ * @return: 成功返回0，失败返回-1
+ */
+int bcache_sync(int solt)
+{
+    mutex_lock(&bcache_mutex);
+    int retval = __bcache_sync(solt);
+    mutex_unlock(&bcache_mutex);
+    return retval;
+}
+
+/**
+ * bcache_invalidate - 释放磁盘的所有缓存块
+ * @solt: 磁盘插槽
+ *
+ * 在磁盘关闭前调用，调用前需要先回写
+ */
+void bcache_invalidate(int solt)
+{
+    bcache_block_t *blk, *next;
+    mutex_lock(&bcache_mutex);
+repeat:
+    list_for_each_owner_safe (blk, next, &bcache_lru_list, lru_list) {
+        if (blk->solt != solt)
+            continue;
+        if (blk->busy) {
+            bcache_wait_io();
+            goto repeat;
+        }
+        bcache_release(blk);
+    }
+    mutex_unlock(&bcache_mutex);
+}
+
+void bcache_get_state(bstate_t *state)
+{
+    mutex_lock(&bcache_mutex);
+    *state = bcache_state;
+    mutex_unlock(&bcache_mutex);
+}
+
+int sys_bstate(bstate_t *bs)
+{
+    if (!bs)
+        return -EINVAL;
+    bstate_t tbs;
+    bcache_get_state(&tbs);
+    if (mem_copy_to_user(bs, &tbs, sizeof(bstate_t)) < 0)
+        return -EFAULT;
+    return 0;
+}
+
+/* 回写线程，周期性地把脏块写回磁盘 */
+static void bcache_flush_thread(void *arg)
+{
+    while (1) {
+        task_sleep_by_ticks(BCACHE_FLUSH_INTERVAL);
+        if (bcache_state.bs_dirty > 0)
+            bcache_sync(-1);
+    }
+}
+
+/* 预读线程，处理异步预读队列中的请求 */
+static void bcache_readahead_thread(void *arg)
+{
+    bcache_ra_req_t req;
+    while (1) {
+        mutex_lock(&bcache_mutex);
+        while (bcache_ra_head == bcache_ra_tail) {
+            wait_queue_add(&bcache_ra_wait, task_current);
+            mutex_unlock(&bcache_mutex);
+            task_block(TASK_BLOCKED);
+            mutex_lock(&bcache_mutex);
+        }
+        req = bcache_ra_queue[bcache_ra_head];
+        bcache_ra_head = (bcache_ra_head + 1) % BCACHE_RA_QUEUE_NR;
+        mutex_unlock(&bcache_mutex);
+        bcache_prefetch(req.solt, req.handle, req.sector, req.count);
+    }
+}
+
+int bcache_init()
+{
+    int i;
+    bcache_blocks = mem_alloc(sizeof(bcache_block_t) * BCACHE_BLOCK_NR);
+    if (!bcache_blocks)
+        return -1;
+    unsigned char *data = mem_alloc(BCACHE_BLOCK_SIZE * BCACHE_BLOCK_NR);
+    if (!data) {
+        mem_free(bcache_blocks);
+        return -1;
+    }
+    for (i = 0; i < BCACHE_HASH_NR; i++)
+        list_init(&bcache_hash_table[i]);
+    for (i = 0; i < BCACHE_BLOCK_NR; i++) {
+        bcache_block_t *blk = &bcache_blocks[i];
+        blk->solt = -1;
+        blk->handle = -1;
+        blk->sector = 0;
+        blk->valid = 0;
+        blk->dirty = 0;
+        blk->busy = 0;
+        blk->data = data + i * BCACHE_BLOCK_SIZE;
+        list_init(&blk->hash_list);
+        list_init(&blk->dirty_list);
+        list_add_tail(&blk->lru_list, &bcache_free_list);
+    }
+    bcache_busy_nr = 0;
+    bcache_ra_head = bcache_ra_tail = 0;
+    memset(&bcache_state, 0, sizeof(bstate_t));
+    bcache_state.bs_blocks = BCACHE_BLOCK_NR;
+    if (!task_create("bcache", TASK_PRIO_LEVEL_NORMAL, bcache_flush_thread, NULL)) {
+        keprint(PRINT_ERR "[bcache]: create flush thread failed!\n");
+        return -1;
+    }
+    if (!task_create("bcache-ra", TASK_PRIO_LEVEL_NORMAL, bcache_readahead_thread, NULL)) {
+        keprint(PRINT_ERR "[bcache]: create readahead thread failed!\n");
+        return -1;
+    }
+    return 0;
+}
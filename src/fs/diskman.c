@@ -1,5 +1,6 @@
 #include <xbook/list.h>
 #include <xbook/diskman.h>
+#include <xbook/bcache.h>
 #include <xbook/memalloc.h>
 #include <xbook/path.h>
 #include <string.h>
@@ -131,6 +132,9 @@ static int disk_manager_close(int solt)
     list_for_each_owner (disk, &disk_list_head, list) {
         if (disk->solt == solt) {
             if (atomic_get(&disk->ref) == 1) {
+                /* 关闭前回写并释放该磁盘的缓存块 */
+                bcache_sync(solt);
+                bcache_invalidate(solt);
                 if (device_close(disk->handle) != 0) {
                     mutex_unlock(&disk_manager_mutex);
                     return -1;
@@ -161,7 +165,7 @@ static int disk_manager_read(int solt, off_t off, void *buffer, size_t size)
 {
     if (IS_BAD_SOLT(solt))
         return -1;
-    if (device_read(SOLT_TO_HANDLE(solt), buffer, size, off) < 0)
+    if (bcache_read(solt, SOLT_TO_HANDLE(solt), off, buffer, size) < 0)
         return -1;
     return 0;
 }
@@ -170,11 +174,25 @@ static int disk_manager_write(int solt, off_t off, void *buffer, size_t size)
 {
     if (IS_BAD_SOLT(solt))
         return -1;
-    if (device_write(SOLT_TO_HANDLE(solt), buffer, size, off) < 0)
+    if (bcache_write(solt, SOLT_TO_HANDLE(solt), off, buffer, size) < 0)
         return -1;
     return 0;
 }
 
+static int disk_manager_readahead(int solt, off_t off, size_t count)
+{
+    if (IS_BAD_SOLT(solt))
+        return -1;
+    return bcache_prefetch_async(solt, SOLT_TO_HANDLE(solt), off, count);
+}
+
+static int disk_manager_sync(int solt)
+{
+    if (IS_BAD_SOLT(solt))
+        return -1;
+    return bcache_sync(solt);
+}
+
 static int disk_manager_ioctl(int solt, unsigned int cmd, unsigned long arg)
 {
     if (IS_BAD_SOLT(solt))
@@ -195,10 +213,14 @@ int disk_manager_init()
         disk_solt_cache[i] = -1;
 
     disk_info_print();
+    if (bcache_init() < 0)
+        return -1;
     diskman.open = disk_manager_open;
     diskman.close = disk_manager_close;
     diskman.read = disk_manager_read;
     diskman.write = disk_manager_write;
     diskman.ioctl = disk_manager_ioctl;
+    diskman.sync = disk_manager_sync;
+    diskman.readahead = disk_manager_readahead;
     return 0;
 }
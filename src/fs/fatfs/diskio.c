@@ -125,8 +125,8 @@ DRESULT disk_ioctl (
     DRESULT res;
     switch(cmd)
     {
-    case CTRL_SYNC:
-        res = RES_OK;
+    case CTRL_SYNC:   /* 回写块缓存中的脏块 */
+        res = diskman.sync(fatfs_drv_map[pdrv]) < 0 ? RES_ERROR : RES_OK;
         break;     
     case GET_SECTOR_SIZE:
         *(WORD*)buff = 512; res = RES_OK;
@@ -3930,7 +3930,18 @@ FRESULT f_read (
 			cc = btr / SS(fs);					/* When remaining bytes >= sector size, */
 			if (cc > 0) {						/* Read maximum contiguous sectors directly */
 				if (csect + cc > fs->csize) {	/* Clip at cluster boundary */
+					UINT rest = cc - (fs->csize - csect);
 					cc = fs->csize - csect;
+					while (rest > 0) {			/* Merge physically contiguous clusters into one transfer */
+						clst = get_fat(&fp->obj, fp->clust);
+						if (clst != fp->clust + 1) break;
+						fp->clust = clst;
+						if (rest > fs->csize) {
+							cc += fs->csize; rest -= fs->csize;
+						} else {
+							cc += rest; rest = 0;
+						}
+					}
 				}
 				if (disk_read(fs->pdrv, rbuff, sect, cc) != RES_OK) ABORT(fs, FR_DISK_ERR);
 #if !FF_FS_READONLY && FF_FS_MINIMIZE <= 2		/* Replace one of the read sectors with cached data if it contains a dirty sector */
@@ -5,11 +5,15 @@
 #include <xbook/path.h>
 #include "../fatfs/ff.h"
 #include <xbook/diskman.h>
+#include <xbook/bcache.h>
 #include <xbook/memalloc.h>
 #include <xbook/walltime.h>
 #include <xbook/memspace.h>
+#include <xbook/pagecache.h>
 #include <xbook/safety.h>
 #include <const.h>
+#include <math.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <errno.h>
@@ -42,6 +46,10 @@ typedef struct {
 
 fatfs_extention_t fatfs_extention;
 
+/* 页缓存以(卷号，起始簇号)识别文件，起始簇在文件被删除或者清空之前不会改变 */
+#define FATFS_FILE_DEV(path)    PATH_TO_PDRV((path)[0])
+#define FATFS_FILE_INO(fil)     ((fil)->obj.sclust)
+
 int fatfs_drv_map[FF_VOLUMES] = {
     0,1,2,3,4,5,6,7,8,9
 };
@@ -225,6 +233,7 @@ static int fsal_fatfs_unmount(char *origin_path, char *path, unsigned long flags
             dbgprint("%s: %s: remove path %s failed!\n", FS_MODEL_NAME,__func__, p);
             return -1;
         }
+        page_cache_invalidate_dev(pdrv);
     } else {
         /* 删除抽象路径 */
         char *p = origin_path;
@@ -288,6 +297,16 @@ static int fatfs_is_director(char *path, DIR *dir)
     return 0;
 }
 
+/* 文件被删除或者清空时起始簇会被释放，丢弃文件的页缓存 */
+static void fatfs_drop_page_cache(char *path)
+{
+    FIL fil;
+    if (f_open(&fil, path, FA_OPEN_EXISTING | FA_READ) != FR_OK)
+        return;
+    page_cache_invalidate(FATFS_FILE_DEV(path), FATFS_FILE_INO(&fil), 1);
+    f_close(&fil);
+}
+
 static int fsal_fatfs_open(void *path, int flags)
 {
     fsal_file_t *fp = fsal_file_alloc();
@@ -338,6 +357,8 @@ static int fsal_fatfs_open(void *path, int flags)
         extension->dir_path = extension->path;  /* open as director */
     } else {
         FRESULT fres;
+        if (mode & FA_CREATE_ALWAYS)
+            fatfs_drop_page_cache(path);
         fres = f_open((FIL *)&extension->file, p, mode);
         if (fres != FR_OK) {
             /* 当作为文件打开失败时，就尝试作为目录打开 */
@@ -385,10 +406,43 @@ static int fsal_fatfs_close(int idx)
     return 0;
 }
 
+/* 顺序预读窗口的范围(扇区) */
+#define FATFS_RA_MIN    8
+#define FATFS_RA_MAX    BCACHE_PREFETCH_MAX
+
 /**
- * The data of multiple sectors read once may not be read correctly. In this case,
- *  the data is read in units of 1 sector
+ * 顺序读取时把文件后面的扇区预读到块缓存，随机访问时关闭预读。
+ * 预读请求交给块缓存的预读线程，读取不等待预读的磁盘I/O。
+ * 预读假设文件后面的数据在物理上是连续的，不连续时只会浪费一次读取。
  */
+static void fsal_fatfs_readahead(fsal_file_t *fp, FIL *fil, FSIZE_t start)
+{
+    FATFS *fs = fil->obj.fs;
+    FSIZE_t pos = f_tell(fil);
+    if (start != fp->ra_next) {     /* 非顺序访问 */
+        fp->ra_next = pos;
+        fp->ra_window = 0;
+        fp->ra_end = 0;
+        return;
+    }
+    fp->ra_next = pos;
+    if (pos == 0 || pos >= f_size(fil) || fil->clust < 2)
+        return;
+    /* 预读的数据还剩一半以上时不需要再次预读 */
+    if (pos + (fp->ra_window * SECTOR_SIZE) / 2 < fp->ra_end)
+        return;
+    fp->ra_window = fp->ra_window ? min(fp->ra_window * 2, FATFS_RA_MAX) : FATFS_RA_MIN;
+    unsigned long count = DIV_ROUND_UP(f_size(fil) - pos, SECTOR_SIZE);
+    if (count > fp->ra_window)
+        count = fp->ra_window;
+    /* 上一次读取的最后一个扇区之后的扇区 */
+    LBA_t sect = fs->database + (LBA_t)fs->csize * (fil->clust - 2) +
+            (((pos - 1) / SECTOR_SIZE) & (fs->csize - 1)) + 1;
+    if (diskman.readahead(fatfs_drv_map[fs->pdrv], sect, count) < 0)
+        return;
+    fp->ra_end = pos + count * SECTOR_SIZE;
+}
+
 static int fsal_fatfs_read(int idx, void *buf, size_t size)
 {
     if (FSAL_BAD_FILE_IDX(idx))
@@ -397,30 +451,18 @@ static int fsal_fatfs_read(int idx, void *buf, size_t size)
     if (FSAL_BAD_FILE(fp))
         return -1;
     
+    FIL *fil = (FIL *)fp->extension;
     FRESULT fr;
-    UINT br;
-    UINT readbytes = 0;
-    
-    // read 512 bytes each time
-    UINT chunk;
-    uint8_t *p = (uint8_t *) buf;
-    chunk =  size % (SECTOR_SIZE); // read mini block
-    while (size > 0) {
-        br = 0;
-        fr = f_read((FIL *)fp->extension, p, chunk, &br);
-        if (fr != FR_OK && !readbytes) { // first time read get error
-            errprint("fatfs: f_read: err code %d\n", fr);
-            return -1;
-        } else  if (fr != FR_OK ) { // next time read over
-            errprint("fatfs: f_read: err code %d, rd=%d br=%d\n", fr, readbytes, br);
-            return readbytes + br;
-        }
-        p += chunk;
-        size -= chunk;
-        chunk =  (SECTOR_SIZE ); // read 512 bytes block
-        readbytes += br;
+    UINT br = 0;
+    FSIZE_t start = f_tell(fil);
+    /* 整扇区的部分由FatFs按连续的簇直接读取到缓冲区，头尾不足一个扇区的部分经过文件缓冲区 */
+    fr = f_read(fil, buf, size, &br);
+    if (fr != FR_OK) {
+        errprint("fatfs: f_read: err code %d, br=%d\n", fr, br);
+        return br > 0 ? br : -1;
     }
-    return readbytes;
+    fsal_fatfs_readahead(fp, fil, start);
+    return br;
 }
 
 static int fsal_fatfs_write(int idx, void *buf, size_t size)
@@ -430,11 +472,16 @@ static int fsal_fatfs_write(int idx, void *buf, size_t size)
     fsal_file_t *fp = FSAL_IDX2FILE(idx);
     if (FSAL_BAD_FILE(fp)) 
         return -1;
+    fatfs_file_extention_t *extension = (fatfs_file_extention_t *) fp->extension;
+    FIL *fil = &extension->file;
+    FSIZE_t start = f_tell(fil);
     FRESULT fr;
     UINT bw;
-    fr = f_write((FIL *)fp->extension, buf, size, &bw);
+    fr = f_write(fil, buf, size, &bw);
     if (fr != FR_OK)
         return -1;
+    if (bw > 0)
+        page_cache_update(FATFS_FILE_DEV(extension->path), FATFS_FILE_INO(fil), start, buf, bw);
     return bw;
 }
 
@@ -565,6 +612,7 @@ static int fsal_fatfs_unlink(char *path)
 {
     FRESULT res;
     //dbgprintln("[fs] fatfs: unlink %s", path);
+    fatfs_drop_page_cache(path);
     res = f_unlink(path);
     if (res != FR_OK) {
         return -1;
@@ -592,6 +640,8 @@ static int fsal_fatfs_ftruncate(int idx, off_t offset)
     
     off_t old = f_tell((FIL *)fp->extension);
 
+    fatfs_file_extention_t *extension = (fatfs_file_extention_t *) fp->extension;
+    DWORD sclust = FATFS_FILE_INO(&extension->file);
     FRESULT fres;
     fres = f_lseek((FIL *)fp->extension, offset);
     if (fres != FR_OK) {
@@ -602,6 +652,8 @@ static int fsal_fatfs_ftruncate(int idx, off_t offset)
         f_lseek((FIL *)fp->extension, old);
         return -1;
     }
+    /* 截断后文件末尾之后的数据不再有效，清空文件时起始簇被释放 */
+    page_cache_invalidate(FATFS_FILE_DEV(extension->path), sclust, !offset);
     return 0;
 }
 
@@ -613,10 +665,14 @@ static int fsal_fatfs_fsync(int idx)
     if (FSAL_BAD_FILE(fp))   
         return -1;
     FRESULT fres;
-    fres = f_sync((FIL *)fp->extension);
+    FIL *fil = (FIL *)fp->extension;
+    fres = f_sync(fil);
     if (fres != FR_OK) {
         return -1;
     }
+    /* 文件未修改时f_sync不会同步磁盘，需要主动回写块缓存 */
+    if (diskman.sync(fatfs_drv_map[fil->obj.fs->pdrv]) < 0)
+        return -1;
     return 0;
 }
 
@@ -721,7 +777,7 @@ static int fsal_fatfs_fstat(int idx, void *buf)
     else
         mode |= S_IFREG;
     stat->st_dev = pdrv;
-    stat->st_ino = 0;
+    stat->st_ino = extension->dir_path == NULL ? FATFS_FILE_INO(&extension->file) : 0;
     stat->st_mode = mode;
     stat->st_size = finfo.fsize;
     stat->st_nlink = 1;         // 1 link for this file
@@ -876,6 +932,31 @@ static int fsal_fatfs_access(const char *path, int mode)
     return -1;
 }
 
+/**
+ * 映射文件，文件的数据经过页缓存，偏移必须按页对齐。
+ * 共享映射写入的数据在msync或者munmap时回写到文件，私有映射写入时复制。
+ */
+static void *fsal_fatfs_mmap(int idx, void *addr, size_t length, int prot, int flags, off_t offset)
+{
+    if (FSAL_BAD_FILE_IDX(idx))
+        return NULL;
+    fsal_file_t *fp = FSAL_IDX2FILE(idx);
+    if (FSAL_BAD_FILE(fp))
+        return NULL;
+    fatfs_file_extention_t *extension = (fatfs_file_extention_t *) fp->extension;
+    if (extension->dir_path != NULL || !length || (offset & ~PAGE_MASK))
+        return NULL;
+    unsigned long mflags = flags & MEM_SPACE_MAP_FIXED;
+    if (flags & MEM_SPACE_MAP_SHARED)
+        mflags |= MEM_SPACE_MAP_FILE_SHARED;
+    prot = (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) | PROT_USER;
+    void *ret = mem_space_mmap_file((unsigned long) addr, length, prot, mflags, idx,
+        (mflags & MEM_SPACE_MAP_FIXED) ? (unsigned long) addr : 0, offset, PAGE_ALIGN(length));
+    if (ret == (void *) -1)
+        return NULL;
+    return ret;
+}
+
 /* fatfs 支持的文件系统类型 */
 static char *fatfs_sub_table[] = {
     "fat12",
@@ -921,6 +1002,7 @@ fsal_t fatfs_fsal = {
     .fcntl      =fsal_fatfs_fcntl,
     .fstat      =fsal_fatfs_fstat,
     .access     =fsal_fatfs_access,
+    .mmap       =fsal_fatfs_mmap,
     .extention  = (void *)&fatfs_extention,
 };
 
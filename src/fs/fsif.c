@@ -211,8 +211,23 @@ void *__sys_mmap(void *addr, size_t length, int prot, int flags, int fd, off_t o
     return ffd->fsal->mmap(ffd->handle, addr, length, prot, flags, offset);
 }
 
+/**
+ * 匿名映射只保留地址空间，物理页在第一次访问时分配
+ */
+static void *sys_mmap_anonymous(void *addr, size_t length, int prot, int flags)
+{
+    prot = (prot & (PROT_READ | PROT_WRITE | PROT_EXEC)) | PROT_USER;
+    flags &= MEM_SPACE_MAP_FIXED;
+    void *ret = mem_space_mmap((unsigned long) addr, 0, length, prot, flags);
+    if (ret == (void *) -1)
+        return NULL;
+    return ret;
+}
+
 void *sys_mmap(mmap_args_t *args)
 {
+    if (args->flags & MEM_SPACE_MAP_ANONYMOUS)
+        return sys_mmap_anonymous(args->addr, args->length, args->prot, args->flags);
     return __sys_mmap(args->addr, args->length, args->prot, args->flags, args->fd, args->offset);
 }
 
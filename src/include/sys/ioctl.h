@@ -62,6 +62,16 @@
 #define NETIO_SETMAC        DEVCTL_CODE('n', 2)
 #define NETIO_SETFLGS       DEVCTL_CODE('n', 3)
 #define NETIO_GETFLGS       DEVCTL_CODE('n', 4)
+#define NETIO_GETSTAT       DEVCTL_CODE('n', 5) /* get irq/poll stat */
+
+/* 网卡中断和轮询的统计 */
+typedef struct _netdev_stat {
+    unsigned long irqs;         /* 网卡中断次数 */
+    unsigned long polls;        /* 轮询次数 */
+    unsigned long packets;      /* 轮询中收到的数据包 */
+    unsigned long drops;        /* 没有缓冲区或者队列满丢弃的数据包 */
+    unsigned long squeezed;     /* 总预算用完还有设备没有处理完的次数 */
+} netdev_stat_t;
 
 /* sockets */
 #define SIOCGIFCONF         DEVCTL_CODE('s', 1)
@@ -8,6 +8,8 @@
 #define CLOCK_PROCESS_CPUTIME_ID  3 /* 本进程运行时间*/
 #define CLOCK_THREAD_CPUTIME_ID   4 /*本线程运行时间*/
 
+#define TIMER_ABSTIME             1 /* clock_nanosleep的时间是绝对时间 */
+
 struct timeval {
     long tv_sec;         /* seconds */
     long tv_usec;        /* and microseconds */
@@ -35,6 +37,7 @@ struct tms {
 
 int sys_gettimeofday(struct timeval *tv, struct timezone *tz);
 int sys_clock_gettime(clockid_t clockid, struct timespec *ts);
+int sys_clock_nanosleep(clockid_t clockid, int flags, struct timespec *req, struct timespec *rem);
 unsigned long timeval_to_systicks(struct timeval *tv);
 void systicks_to_timeval(unsigned long ticks, struct timeval *tv);
 unsigned long timespec_to_systicks(struct timespec *ts);
@@ -1,21 +1,18 @@
 #ifndef _XBOOK_ALARM_H
 #define _XBOOK_ALARM_H
 
-/* 闹钟结构 */
+#include "timer.h"
+
+/* 闹钟结构，超时后给进程发送SIGALRM */
 typedef struct alarm_struct {
-    char flags;              /* 有效标志 */
-    unsigned long ticks;    /* ticks计数 */
-    unsigned long second;   /* 秒数 */
+    timer_t timer;
 } alarm_t;
 
 static inline void alarm_init(alarm_t *alarm)
 {
-    alarm->flags = 0;
-    alarm->ticks = 0;
-    alarm->second = 0;
+    timer_init(&alarm->timer, 0, NULL, NULL);
 }
 
 unsigned long sys_alarm(unsigned long second);
-void alarm_update_ticks();
 
 #endif   /* _XBOOK_ALARM_H */
@@ -0,0 +1,53 @@
+#ifndef _XBOOK_BCACHE_H
+#define _XBOOK_BCACHE_H
+
+#include <xbook/list.h>
+#include <types.h>
+#include <const.h>
+
+/* 块缓存：位于diskman和磁盘驱动之间，以扇区为单位缓存磁盘数据 */
+#define BCACHE_BLOCK_SIZE       SECTOR_SIZE
+#define BCACHE_BLOCK_NR         1024    /* 缓存块数量，共512KB */
+#define BCACHE_HASH_NR          256     /* 哈希桶数量，必须是2的幂 */
+#define BCACHE_FLUSH_MAX        32      /* 回写时一次合并的最大扇区数 */
+#define BCACHE_DIRTY_MAX        (BCACHE_BLOCK_NR / 2)   /* 脏块超过该值时立即回写 */
+#define BCACHE_FLUSH_INTERVAL   (HZ * 5)    /* 回写线程的回写周期 */
+#define BCACHE_PREFETCH_MAX     128     /* 一次预读的最大扇区数 */
+#define BCACHE_RA_QUEUE_NR      16      /* 异步预读队列的长度 */
+#define BCACHE_STREAM_MIN       (BCACHE_BLOCK_NR / 4)   /* 超过该扇区数的读取不进入缓存 */
+
+typedef struct {
+    list_t hash_list;       /* 哈希链表 */
+    list_t lru_list;        /* LRU链表，链表头为最近使用 */
+    list_t dirty_list;      /* 脏块链表 */
+    int solt;               /* 所属磁盘插槽 */
+    int handle;             /* 设备句柄 */
+    sector_t sector;        /* 扇区号 */
+    char valid;             /* 是否已经缓存了数据，预留的块读入完成前为0 */
+    char dirty;             /* 是否需要回写 */
+    char busy;              /* 正在读入或者回写 */
+    unsigned char *data;    /* 数据缓冲区 */
+} bcache_block_t;
+
+/* 块缓存状态 */
+typedef struct {
+    unsigned long bs_blocks;    /* 缓存块总数 */
+    unsigned long bs_used;      /* 已经使用的缓存块数 */
+    unsigned long bs_dirty;     /* 脏块数 */
+    unsigned long bs_hits;      /* 命中次数 */
+    unsigned long bs_misses;    /* 未命中次数 */
+    unsigned long bs_writebacks;    /* 回写的扇区数 */
+} bstate_t;
+
+int bcache_init();
+int bcache_read(int solt, int handle, sector_t sector, void *buffer, size_t size);
+int bcache_write(int solt, int handle, sector_t sector, void *buffer, size_t size);
+int bcache_sync(int solt);
+int bcache_prefetch(int solt, int handle, sector_t sector, unsigned long count);
+int bcache_prefetch_async(int solt, int handle, sector_t sector, unsigned long count);
+void bcache_invalidate(int solt);
+void bcache_get_state(bstate_t *state);
+
+int sys_bstate(bstate_t *bs);
+
+#endif   /* _XBOOK_BCACHE_H */
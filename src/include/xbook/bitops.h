@@ -96,4 +96,15 @@ static inline unsigned long test_and_set_bit(int nr, unsigned long *addr)
    return old;  
 }
 
+/**
+ * find_highest_bit - 查找最高的置1位
+ * @word: 要查找的值，不能为0
+ * 
+ * 返回最高置1位的位置(0-31)，会被编译成一条位扫描指令
+ */
+static inline int find_highest_bit(unsigned long word)
+{
+   return 31 - __builtin_clz(word);
+}
+
 #endif   /* _XBOOK_BITOPS_H */
@@ -29,5 +29,6 @@ void clock_msleep(unsigned long msecond);
 clock_t sys_get_ticks();
 clock_t clock_delay_by_ticks(clock_t ticks);
 void mdelay(time_t msec);
+void clock_delay_calibrate(unsigned long cycles_per_tick);
 
 #endif  /* _XBOOK_CLOCK_H */
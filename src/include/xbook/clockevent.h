@@ -0,0 +1,69 @@
+#ifndef _XBOOK_CLOCKEVENT_H
+#define _XBOOK_CLOCKEVENT_H
+
+#include <xbook/list.h>
+#include <xbook/clock.h>
+#include <types.h>
+
+/* 每个时钟节拍的微秒数 */
+#define US_PER_TICKS        (1000000 / HZ)
+
+/* 时钟事件设备的特性 */
+#define CLOCK_EVT_FEAT_PERIODIC     0x01    /* 可以周期性地产生中断 */
+#define CLOCK_EVT_FEAT_ONESHOT      0x02    /* 可以在指定的计数后产生一次中断 */
+
+enum clock_event_mode {
+    CLOCK_EVT_MODE_UNUSED = 0,
+    CLOCK_EVT_MODE_PERIODIC,
+    CLOCK_EVT_MODE_ONESHOT,
+};
+
+/**
+ * 时钟事件设备：给启动cpu产生时钟中断，时间都用设备自己的计数值表示。
+ * elapsed返回周期模式下本周期已经经过的计数，或者单次模式下编程后经过的计数，
+ * 单次模式下超时后也要能继续计数，这样才能准确地补上停掉的节拍。
+ */
+typedef struct clock_event_device {
+    char *name;
+    int features;
+    int rating;                         /* 有多个设备时使用评分最高的 */
+    unsigned long counts_per_tick;      /* 一个节拍的计数值 */
+    unsigned long min_counts;           /* 单次模式的最小和最大计数值 */
+    unsigned long max_counts;
+    void (*set_periodic)(struct clock_event_device *dev);
+    void (*set_oneshot)(struct clock_event_device *dev, unsigned long counts);
+    unsigned long (*elapsed)(struct clock_event_device *dev);
+} clock_event_device_t;
+
+struct hrtimer;
+typedef void (*hrtimer_callback_t) (struct hrtimer *, void *);
+
+/* 高精度定时器，超时点是开机后的微秒数，回调在时钟中断中关中断执行 */
+typedef struct hrtimer {
+    list_t list;
+    unsigned long long expires;
+    void *arg;
+    hrtimer_callback_t callback;
+} hrtimer_t;
+
+int clock_event_register(clock_event_device_t *dev);
+void clock_event_handle(void);
+unsigned long long clock_event_now_us(void);
+unsigned long clock_event_subtick_us(void);
+
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
+void tick_nohz_irq_enter(void);
+void tick_nohz_kick(void);
+
+void hrtimer_init(hrtimer_t *timer, hrtimer_callback_t callback, void *arg);
+void hrtimer_start(hrtimer_t *timer, unsigned long usec);
+int hrtimer_cancel(hrtimer_t *timer);
+int hrtimer_available(void);
+
+static inline int hrtimer_active(hrtimer_t *timer)
+{
+    return !list_empty(&timer->list);
+}
+
+#endif   /* _XBOOK_CLOCKEVENT_H */
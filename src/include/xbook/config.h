@@ -11,6 +11,11 @@
 /* config large alloc size in memcache */
 #define CONFIG_LARGE_ALLOCS
 
+/* 多处理器支持，没有MADT或者只有一个cpu时和单处理器一样运行
+ * 应用处理器的启动代码和内核锁的入口还没有在qemu -smp下验证过，默认关闭，
+ * 打开后用make run QEMU_SMP=4启动并运行tests smp */
+/* #define CONFIG_SMP */
+
 /* auto select timezone */
 /* #define CONFIG_TIMEZONE_AUTO */
 
@@ -23,6 +23,8 @@ typedef struct {
     int (*read)(int , off_t , void *, size_t );
     int (*write)(int , off_t , void *, size_t );
     int (*ioctl)(int , unsigned int , unsigned long );
+    int (*sync)(int);
+    int (*readahead)(int , off_t , size_t );    /* 异步预读扇区到块缓存 */
 } disk_manager_t;
 
 extern disk_manager_t diskman;
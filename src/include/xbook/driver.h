@@ -6,6 +6,7 @@
 #include "spinlock.h"
 #include "mutexlock.h"
 #include "waitqueue.h"
+#include "fiforing.h"
 #include <arch/atomic.h>
 #include <sys/res.h>
 #include <sys/input.h>
@@ -24,6 +25,7 @@
 #define IO_PENDING             (1 << 1)    /* 未决 */
 #define IO_NOWAIT              (1 << 2)    /* 不需要等待 */
 #define IO_KERNEL              (1 << 3)    /* 内核IO */
+#define IO_CANCELED            (1 << 4)    /* 请求被取消 */
 
 #define IO_STATUS_MASK(status) ((status) & 0xffff)
 #define IO_ERRNO(err)          (((err) & 0xffff) << 16)             
@@ -47,6 +49,10 @@
         ((unsigned int) ((((type) & 0xffff) << 16) | ((cmd) & 0xffff)))
 #endif
 
+/* 系统保留命令中带有该位的只能在内核中使用，参数是内核指针 */
+#define DEVCTL_KERNEL           0x4000
+#define DEVCTL_IS_KERNEL(code)  (((code) & 0xc000) == DEVCTL_KERNEL)
+
 /* io请求函数表 */
 enum _io_request_function {
     IOREQ_OPEN,                     /* 设备打开派遣索引 */
@@ -83,6 +89,10 @@ enum _io_request_flags {
     IOREQ_DEVCTL_OPERATION      = (1 << 4),
     IOREQ_MMAP_OPERATION        = (1 << 5),
     IOREQ_BUFFERED_IO           = (1 << 6),
+    IOREQ_ASYNC                 = (1 << 7),     /* 异步请求 */
+    IOREQ_CANCELED              = (1 << 8),     /* 请求已经被取消 */
+    IOREQ_DISPATCHING           = (1 << 9),     /* 异步请求正在派遣中 */
+    IOREQ_DONE                  = (1 << 10),    /* 异步请求的完成处理已经结束，等待者可以释放请求 */
     IOREQ_COMPLETION            = (1 << 31),    /* 完成请求 */
 };
 
@@ -91,6 +101,7 @@ enum _device_object_flags {
     DO_BUFFERED_IO              = (1 << 0),     /* 缓冲区IO */
     DO_DIRECT_IO                = (1 << 1),     /* 直接内存IO */
     DO_DISPENSE                 = (1 << 2),     /* 分发位，保留 */
+    DO_ASYNC_IO                 = (1 << 3),     /* 驱动自己处理并发，框架不加设备锁 */
 };
 
 typedef struct _driver_extension 
@@ -130,6 +141,13 @@ typedef struct _io_status_block {
     unsigned long infomation;           /* io结果信息 */
 } io_status_block_t;
 
+struct _io_request;
+
+/* 异步请求完成回调，可能在中断上下文中被调用 */
+typedef void (*io_completion_t)(struct _io_request *ioreq, void *context);
+/* 取消请求的例程，由驱动在请求挂起时设置 */
+typedef void (*io_cancel_t)(struct _device_object *device, struct _io_request *ioreq);
+
 /* 输入输出请求 */
 typedef struct _io_request 
 {
@@ -141,26 +159,22 @@ typedef struct _io_request
     struct _device_object *devobj;      /* 设备对象 */
     io_parame_t parame;                 /* 参数 */
     io_status_block_t io_status;        /* 状态块 */
-    
+    /* 异步请求 */
+    list_t pending_list;                /* 在设备未决队列中的链表 */
+    io_completion_t completion;         /* 完成回调 */
+    void *context;                      /* 完成回调的参数 */
+    io_cancel_t cancel_routine;         /* 取消例程 */
+    wait_queue_t wait_queue;            /* 等待请求完成的任务 */
 } io_request_t;
 
-#define DEVICE_QUEUE_ENTRY_NR 12
-
-/* 设备队列管理 */
+/* 设备队列管理：预先分配好的固定大小槽的环形队列。
+生产者（中断或者轮询）只有一个，放入时不加锁也不分配内存，读者之间用锁互斥 */
 typedef struct _device_queue {
-    list_t list_head;   /* 队列列表 */
-    spinlock_t lock;    /* 维护队列的锁 */
-    wait_queue_t wait_queue;    /* 等待队列 */
-    char entry_count;           /* 队列项数[0-DEVICE_QUEUE_ENTRY_NR] */
+    fifo_ring_t ring;           /* 槽环 */
+    spinlock_t lock;            /* 读者之间互斥的锁 */
+    wait_queue_t wait_queue;    /* 等待数据的读者 */
 } device_queue_t;
 
-/* 设备队列项 */
-typedef struct _device_queue_entry {
-    list_t list;                        /* 链表 */
-    unsigned char *buf;                 /* 缓冲区 */
-    int length;                         /* 数据长度 */
-} device_queue_entry_t;
-
 /* 设备可分发设备（网卡）可以被DEVICE_QUEUE_NR个进程同时打开使用 */
 #define DEVICE_QUEUE_NR 12
 
@@ -181,9 +195,13 @@ typedef struct _device_object
         spinlock_t spinlock;            /* 设备自旋锁 */
         mutexlock_t mutexlock;          /* 设备互斥锁 */
     } lock;
+    list_t pending_list;                /* 未完成的异步请求 */
+    spinlock_t pending_lock;            /* 保护未决队列 */
     unsigned long reserved;             /* 预留 */
 } device_object_t;
 
+extern device_object_t *device_handle_table[DEVICE_HANDLE_NR];
+
 /* 派遣函数定义 */ 
 typedef iostatus_t (*driver_dispatch_t)(device_object_t *device, io_request_t *ioreq);
 /* 派遣函数定义 */ 
@@ -241,27 +259,52 @@ int driver_object_delete(driver_object_t *driver);
 
 device_object_t *io_search_device_by_name(char *name);
 
+io_request_t *io_build_async_request(
+    unsigned long function,
+    device_object_t *devobj,
+    void *buffer,
+    unsigned long length,
+    unsigned long offset,
+    io_completion_t completion,
+    void *context
+);
+
 io_request_t *io_request_alloc();
+void io_request_free(io_request_t *ioreq);
 
 iostatus_t io_call_dirver(device_object_t *device, io_request_t *ioreq);
 
 void io_complete_request(io_request_t *ioreq);
 
-void io_device_queue_init(device_queue_t *queue);
+iostatus_t io_wait_request(io_request_t *ioreq);
+int io_cancel_request(io_request_t *ioreq);
+int io_set_cancel_routine(io_request_t *ioreq, io_cancel_t routine);
+void io_cancel_device_requests(device_object_t *devobj);
+
+int io_device_queue_init(
+    device_queue_t *queue,
+    void *slots,
+    unsigned int slot_size,
+    unsigned int slot_nr
+);
 
 iostatus_t io_device_queue_append(
     device_queue_t *queue, 
-    unsigned char *buf,
-    int len
+    void *slot
 );
 
 int io_device_queue_pickup(
     device_queue_t *queue,
-    unsigned char *buf,
-    int buflen,
+    void *slots,
+    int nr,
     int flags
 );
 
+static inline unsigned int io_device_queue_drops(device_queue_t *queue)
+{
+    return queue->ring.drops;
+}
+
 #define DISKOFF_MAX  (~0UL)
 
 handle_t device_open(char *devname, unsigned int flags);
@@ -285,16 +328,16 @@ int sys_scandev(devent_t *de, device_type_t type, devent_t *out);
 /* 事件缓冲区大小，事件个数 */
 #define EVBUF_SIZE        64
 
-/* 输入事件缓冲区 */
+/* 输入事件缓冲区，事件在中断中放入 */
 typedef struct _input_even_buf {
     input_event_t evbuf[EVBUF_SIZE];       /* 事件输入缓冲区 */
-    int head, tail;                        /* 输入输出时的指针 */
-    spinlock_t lock;                    /* 自旋锁来保护写入和读取操作 */
+    device_queue_t queue;                  /* 事件队列 */
 } input_even_buf_t;
 
 int input_even_init(input_even_buf_t *evbuf);
 int input_even_put(input_even_buf_t *evbuf, input_event_t *even);
 int input_even_get(input_even_buf_t *evbuf, input_event_t *even);
+int input_even_read(input_even_buf_t *evbuf, input_event_t *evens, int nr, int flags);
 
 void drivers_print();
 void drivers_print_mini();
@@ -302,5 +345,6 @@ void drivers_print_mini();
 #define DEVFS_PATH  "/devfs"
 /* 导出devfs */
 extern fsal_t devfs_fsal;
+handle_t devfs_file_to_handle(int idx);
 
 #endif   /* _XBOOK_DRIVER_H */
@@ -0,0 +1,40 @@
+#ifndef _XBOOK_FIFO_RING_H
+#define _XBOOK_FIFO_RING_H
+
+#include <stddef.h>
+
+/**
+ * 固定大小槽的环形队列，和fifo_buf一样用不断累加的in/out做下标。
+ * 只有一个生产者和一个消费者时不需要加锁：in只由生产者修改，out只由消费者修改。
+ * 有多个消费者时，消费者之间需要自己互斥。
+ */
+typedef struct fifo_ring {
+    unsigned char *buffer;      /* 槽数组，共size * slot_size字节 */
+    unsigned int slot_size;     /* 每个槽的字节数 */
+    unsigned int size;          /* 槽的个数，必须是2的n次幂 */
+    unsigned int in;            /* 下一个写入的位置 */
+    unsigned int out;           /* 下一个读取的位置 */
+    unsigned int drops;         /* 队列满时丢弃的个数 */
+} fifo_ring_t;
+
+int fifo_ring_init(fifo_ring_t *ring, void *buffer,
+        unsigned int slot_size, unsigned int size);
+int fifo_ring_put(fifo_ring_t *ring, const void *slot);
+unsigned int fifo_ring_get(fifo_ring_t *ring, void *slots, unsigned int nr);
+
+static inline unsigned int fifo_ring_len(fifo_ring_t *ring)
+{
+    return *(volatile unsigned int *) &ring->in - *(volatile unsigned int *) &ring->out;
+}
+
+static inline int fifo_ring_empty(fifo_ring_t *ring)
+{
+    return !fifo_ring_len(ring);
+}
+
+static inline int fifo_ring_full(fifo_ring_t *ring)
+{
+    return fifo_ring_len(ring) >= ring->size;
+}
+
+#endif   /* _XBOOK_FIFO_RING_H */
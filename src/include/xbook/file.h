@@ -22,6 +22,10 @@ typedef struct {
     char flags;             /* 文件标志 */
     fsal_t *fsal;           /* 文件系统抽象 */
     void *extension;
+    /* 顺序预读状态 */
+    off_t ra_next;          /* 顺序访问时下一次读取的位置 */
+    unsigned long ra_window;    /* 预读窗口(扇区) */
+    unsigned long ra_end;   /* 已经预读到的位置 */
 } fsal_file_t;
 
 extern fsal_file_t *fsal_file_table;
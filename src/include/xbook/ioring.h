@@ -0,0 +1,66 @@
+#ifndef _XBOOK_IORING_H
+#define _XBOOK_IORING_H
+
+#include <xbook/driver.h>
+#include <xbook/spinlock.h>
+#include <xbook/waitqueue.h>
+#include <xbook/list.h>
+#include <xbook/task.h>
+#include <types.h>
+#include <stddef.h>
+
+/* 用户态异步IO：进程通过提交环提交设备请求，从完成环中收割结果 */
+#define IORING_ENTRY_NR     64      /* 每个任务最多同时存在的请求数，必须是2的幂 */
+#define IORING_BUF_MAX      (64 * 1024) /* 单个请求的最大长度 */
+
+/* 请求操作码 */
+enum {
+    IOCB_CMD_READ = 0,
+    IOCB_CMD_WRITE,
+};
+
+/* 提交的请求 */
+typedef struct {
+    int fd;                     /* 设备文件描述符 */
+    int opcode;                 /* 操作码 */
+    void *buf;                  /* 用户缓冲区 */
+    size_t length;              /* 长度 */
+    off_t offset;               /* 设备偏移，磁盘设备是扇区号 */
+    unsigned long user_data;    /* 原样返回给完成事件 */
+} iocb_t;
+
+/* 完成事件 */
+typedef struct {
+    unsigned long user_data;    /* 提交时的user_data */
+    long result;                /* 成功返回传输的字节数，失败返回负的错误码 */
+} ioevent_t;
+
+struct io_context;
+
+/* 内核中的请求，数据先放在内核缓冲区，收割时才复制到用户空间 */
+typedef struct {
+    list_t list;                /* 未完成链表 */
+    struct io_context *ctx;     /* 所属的上下文 */
+    io_request_t *ioreq;        /* 驱动请求 */
+    iocb_t iocb;                /* 用户请求 */
+    void *kbuf;                 /* 内核缓冲区 */
+    long result;                /* 完成结果 */
+} ioring_req_t;
+
+typedef struct io_context {
+    list_t list;                /* 任务退出后在回收链表上 */
+    spinlock_t lock;
+    list_t inflight_list;       /* 已经提交还没有完成的请求 */
+    int inflight;
+    ioring_req_t *ring[IORING_ENTRY_NR];  /* 完成环 */
+    unsigned int head, tail;    /* 完成时写入head，收割时读取tail */
+    wait_queue_t wait_queue;    /* 等待完成事件的任务 */
+    char dead;                  /* 任务已经退出，等请求完成后释放 */
+} io_context_t;
+
+void io_context_exit(task_t *task);
+
+int sys_io_submit(iocb_t *iocbs, int nr);
+int sys_io_getevents(ioevent_t *events, int min_nr, int nr);
+
+#endif   /* _XBOOK_IORING_H */
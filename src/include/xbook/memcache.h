@@ -7,37 +7,40 @@
 #include <xbook/bitmap.h>
 #include <xbook/list.h>
 #include <xbook/mutexlock.h>
+#include <arch/cpu.h>
 #include <const.h>
 
 /*
-当内存对象大小小于1024时，储存在一个页中。
+当内存对象大小小于1024时，group和对象储存在一个页中，对象按照自身大小对齐。
 +-----------+
 | group     | 
-| bitmap    |
 | objects   |
 +-----------+
-当内存对象大于1024时，对象和纪律信息分开存放。记录信息存放在一个页中，
+当内存对象大于等于1024时，对象和记录信息分开存放。group从最小的缓存中分配，
 对象存放在其他页中。
 +-----------+
 | group     | 
-| bitmap    |
 +-----------+
 | objects   |
 +-----------+
+空闲对象的开头存放下一个空闲对象的指针，组成group的空闲链表，分配和释放都不需要扫描。
 */
 
-/* 最大的mem的对象的大小 */
+/* 最小的对象大小是2^5，最大的对象大小是2^MEM_CACHE_MAX_SHIFT */
+#define MEM_CACHE_MIN_SHIFT     5
 #ifdef CONFIG_LARGE_ALLOCS 
-	#define MAX_MEM_CACHE_SIZE (2*1024*1024)
+	#define MEM_CACHE_MAX_SHIFT     21
 #else
-	#define MAX_MEM_CACHE_SIZE (128*1024)
+	#define MEM_CACHE_MAX_SHIFT     17
 #endif
+#define MAX_MEM_CACHE_SIZE      (1UL << MEM_CACHE_MAX_SHIFT)
+#define MAX_MEM_CACHE_NR        (MEM_CACHE_MAX_SHIFT - MEM_CACHE_MIN_SHIFT + 1)
 
 #define MAX_MEM_OBJECT_SIZE     (24 * MB)
 
 typedef struct mem_group {
     list_t list;           // 指向cache中的某个链表（full, partial, free）
-    bitmap_t map;          // 管理对象分配状态的位图
+    void *free_list;             // 空闲对象链表
     unsigned char *objects;     // 指向对象群的指针
     unsigned long using_count;    // 正在使用中的对象数量
     unsigned long free_count;     // 空闲的对象数量
@@ -48,29 +51,35 @@ typedef struct mem_group {
 
 #define MEM_CACHE_NAME_LEN 24
 
+/* 每个cpu的对象弹匣，关中断后只由本cpu访问，分配和释放的快速路径不需要互斥锁 */
+#define MEM_MAGAZINE_SIZE       16
+#define MEM_MAGAZINE_BYTES      (64 * 1024)    /* 一个弹匣最多缓存的字节数 */
+
+typedef struct {
+    unsigned long count;
+    unsigned long allocs;       /* 统计：本cpu分配和释放的次数，以及命中弹匣的次数 */
+    unsigned long frees;
+    unsigned long hits;
+    void *objects[MEM_MAGAZINE_SIZE];
+} mem_magazine_t;
+
 typedef struct mem_cache {
     list_t full_groups;      // group对象都被使用了，就放在这个链表
     list_t partial_groups;   // group对象一部分被使用了，就放在这个链表
     list_t free_groups;      // group对象都未被使用了，就放在这个链表
+    list_t list;             // 所有缓存的链表，用来统计
 
     unsigned long object_size;    // group中每个对象的大小
     flags_t flags;              // cache的标志位
     unsigned long object_count;  // 每个group中有多少个对象
+    unsigned long group_count;   // group的数量
+    unsigned long using_count;   // 从group中取出的对象数量，包括弹匣中的对象
+    unsigned long magazine_limit;   // 弹匣的容量，对象越大容量越小
     mutexlock_t mutex;
     char name[MEM_CACHE_NAME_LEN];     // cache的名字
+    mem_magazine_t magazines[CPU_NR_MAX];
 } mem_cache_t;
 
-typedef struct cache_size {
-    unsigned long cache_size;         // 描述cache的大小
-    mem_cache_t *mem_cache;      // 指向对应cache的指针
-} cache_size_t;
-
-typedef struct {
-    list_t list;    /* 链表 */
-    size_t size;    /* 内存大小 */
-    void *addr;     /* 虚拟地址 */
-} large_mem_object_t;
-
 int mem_caches_init();
 
 void *mem_alloc(size_t size);
@@ -83,7 +92,10 @@ void *mem_alloc_align(size_t size, int align);
 #define mem_free_align(ptr) mem_free(ptr)
 
 int mem_cache_init(mem_cache_t *cache, char *name, size_t size, flags_t flags);
+mem_cache_t *mem_cache_create(char *name, size_t size, flags_t flags);
 void *mem_cache_alloc_object(mem_cache_t *cache);
 void mem_cache_free_object(mem_cache_t *cache, void *object);
+void mem_caches_dump();
+void mem_cache_bench();
 
 #endif   /* _XBOOK_MEMCACHE_H */
@@ -13,6 +13,13 @@
 #define MEM_SPACE_MAP_HEAP        0x40       /* 映射成堆，会动态变化 */
 #define MEM_SPACE_MAP_SHARED      0x80       /* 映射成共享内存 */
 #define MEM_SPACE_MAP_REMAP       0x100      /* 强制重写映射 */
+#define MEM_SPACE_MAP_ANONYMOUS   0x200      /* 匿名映射，只在mmap调用中使用，不保存到空间 */
+#define MEM_SPACE_MAP_FILE_SHARED 0x400      /* 共享的文件映射，写入的页回写到文件 */
+
+/* msync的标志 */
+#define MEM_SPACE_SYNC_ASYNC      0x01
+#define MEM_SPACE_SYNC_INVALIDATE 0x02
+#define MEM_SPACE_SYNC_SYNC       0x04
 
 #define MAX_MEM_SPACE_STACK_SIZE  (16 * MB)
 #define MEM_SPACE_STACK_SIZE_DEFAULT  (PAGE_SIZE * 4)
@@ -23,13 +30,24 @@
 
 #define MAX_MEM_SPACE_MAP_SIZE    (256 * MB)
 
+struct page_cache;
+
 typedef struct mem_space {
     unsigned long start;        /* 空间开始地址 */
     unsigned long end;          /* 空间结束地址 */
     unsigned long page_prot;    /* 空间保护 */
     unsigned long flags;        /* 空间的标志 */
     vmm_t *vmm;                 /* 空间对应的虚拟内存管理 */
-    struct mem_space *next;     /* 所有空间构成单向链表 */
+    struct mem_space *next;     /* 所有空间构成单向链表，按地址排序 */
+    struct mem_space *parent;   /* 区间树（AVL树）的节点，用于按地址查找空间 */
+    struct mem_space *left;
+    struct mem_space *right;
+    int height;
+    int file;                   /* 映射的文件（内核文件表句柄），-1表示匿名映射 */
+    unsigned long file_vaddr;   /* 文件数据在空间中的起始虚拟地址 */
+    unsigned long file_offset;  /* 文件数据在文件中的偏移 */
+    unsigned long file_size;    /* 文件数据的大小，超出的部分（bss）填0 */
+    struct page_cache *pcache;  /* 文件的页缓存，没有时每个进程单独读取文件 */
 } mem_space_t;
 
 typedef struct {
@@ -41,11 +59,18 @@ typedef struct {
     off_t offset;
 } mmap_args_t;
 
-#define mem_space_alloc() mem_alloc(sizeof(mem_space_t))
-#define mem_space_free    mem_free
+extern mem_cache_t *mem_space_cache;
+
+#define mem_space_alloc() mem_cache_alloc_object(mem_space_cache)
+void mem_space_cache_init();
+void mem_space_free(mem_space_t *space);
 
 void mem_space_dump(vmm_t *vmm);
 void mem_space_insert(vmm_t *vmm, mem_space_t *space);
+void mem_space_link(vmm_t *vmm, mem_space_t *space, mem_space_t *prev);
+void mem_space_remove(vmm_t *vmm, mem_space_t *space, mem_space_t *prev);
+mem_space_t *mem_space_find(vmm_t *vmm, unsigned long addr);
+mem_space_t *mem_space_find_prev(vmm_t *vmm, unsigned long addr, mem_space_t **prev);
 int do_mem_space_unmap(vmm_t *vmm, unsigned long addr, unsigned long len);
 int do_mem_space_map(vmm_t *vmm, unsigned long addr, unsigned long paddr, 
     unsigned long len, unsigned long prot, unsigned long flags);
@@ -58,6 +83,18 @@ unsigned long mem_space_get_unmaped(vmm_t *vmm, unsigned len);
 void *mem_space_mmap_viraddr(uint32_t addr, uint32_t vaddr,
         uint32_t len, uint32_t prot, uint32_t flags);
 
+int mem_space_set_file(mem_space_t *space, int file, unsigned long vaddr,
+    unsigned long offset, unsigned long size);
+int do_mem_space_map_file(vmm_t *vmm, unsigned long addr, unsigned long len,
+    unsigned long prot, unsigned long flags, int file, unsigned long vaddr,
+    unsigned long offset, unsigned long size);
+void *mem_space_mmap_file(uint32_t addr, uint32_t len, uint32_t prot, uint32_t flags,
+    int file, uint32_t vaddr, uint32_t offset, uint32_t size);
+int mem_space_fill_page(mem_space_t *space, unsigned long addr);
+int mem_space_read_file(int file, unsigned long offset, void *buf, unsigned long len);
+int mem_space_sync(mem_space_t *space, unsigned long start, unsigned long end);
+int sys_msync(void *addr, size_t len, int flags);
+
 #define sys_munmap  mem_space_unmmap
 
 static inline void mem_space_init(mem_space_t *space, unsigned long start,
@@ -69,39 +106,15 @@ static inline void mem_space_init(mem_space_t *space, unsigned long start,
     space->flags = flags;
     space->vmm = NULL;
     space->next = NULL;
-}
-
-static inline void mem_space_remove(vmm_t *vmm, mem_space_t *space, mem_space_t *prev)
-{
-    if (prev)
-        prev->next = space->next;
-    else
-        vmm->mem_space_head = space->next;    
-    mem_space_free(space);
-}
-
-static inline mem_space_t *mem_space_find(vmm_t *vmm, unsigned long addr)
-{
-    mem_space_t *space = vmm->mem_space_head;
-    while (space != NULL) {
-        if (addr < space->end)
-            return space;
-        space = space->next;
-    }
-    return NULL;
-}
-
-static inline mem_space_t *mem_space_find_prev(vmm_t *vmm, unsigned long addr, mem_space_t **prev)
-{
-    *prev = NULL;    /* prev save prev space ptr, set NULL first */
-    mem_space_t *space = vmm->mem_space_head;
-    while (space != NULL) {
-        if (addr < space->end)
-            return space;
-        *prev = space;   /* save prev */
-        space = space->next;
-    }
-    return NULL;
+    space->parent = NULL;
+    space->left = NULL;
+    space->right = NULL;
+    space->height = 1;
+    space->file = -1;
+    space->file_vaddr = 0;
+    space->file_offset = 0;
+    space->file_size = 0;
+    space->pcache = NULL;
 }
 
 static inline mem_space_t *mem_space_find_intersection(vmm_t *vmm,
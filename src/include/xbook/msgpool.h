@@ -14,7 +14,8 @@ typedef struct {
     uint8_t *tail;      /* message tail */
     uint8_t *msgbuf;    /* message buf */
     mutexlock_t mutex;  /* message mutex */
-    wait_queue_t waiters;   /* message waiters */
+    wait_queue_t waiters;   /* waiters for a message */
+    wait_queue_t putters;   /* waiters for a free slot */
 } msgpool_t;
 
 typedef void (*msgpool_get_func_t)(msgpool_t *, void *);
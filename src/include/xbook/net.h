@@ -7,6 +7,22 @@
 
 void init_net(void);
 
+/**
+ * 大块收发时的分块缓冲区。
+ * 协议栈在用户态的服务中时使用授权缓冲区，服务直接读写缓冲区，只需要和用户空间复制一次。
+ */
+#ifdef CONFIG_NETREMOTE
+#define NET_CHUNK_SIZE          LPC_GRANT_SIZE
+#define net_chunk_alloc()       lpc_grant_get()
+#define net_chunk_free(buf)     lpc_grant_put(buf)
+#else
+#include <xbook/fsal.h>
+#include <xbook/memalloc.h>
+#define NET_CHUNK_SIZE          FSIF_RW_CHUNK_SIZE
+#define net_chunk_alloc()       mem_alloc(FSIF_RW_CHUNK_SIZE)
+#define net_chunk_free(buf)     mem_free(buf)
+#endif
+
 #include <xbook/driver.h>
 #include <xbook/list.h>
 #include <types.h>
@@ -0,0 +1,81 @@
+#ifndef _XBOOK_NETBUF_H
+#define _XBOOK_NETBUF_H
+
+#include <xbook/spinlock.h>
+#include <xbook/waitqueue.h>
+#include <xbook/driver.h>
+#include <xbook/list.h>
+#include <types.h>
+#include <stddef.h>
+
+/* 网络包缓冲池：网卡直接把数据包DMA到池中的缓冲区，再把缓冲区交给协议栈，不需要复制 */
+#define NETBUF_SIZE         2048    /* 每个缓冲区的大小，一个页刚好放两个，不会跨页 */
+#define NETBUF_HEADROOM     64      /* 缓冲区前面留给协议栈的空间，存放pbuf结构，协议栈可以在数据前面添加头部 */
+#define NETBUF_DATA_SIZE    (NETBUF_SIZE - NETBUF_HEADROOM) /* 网卡可以DMA的最大长度，大于最大的以太网帧 */
+#define NETBUF_NR           256     /* 缓冲区数量，共512KB */
+#define NETBUF_QUEUE_MAX    (NETBUF_NR / 4) /* 接收队列的最大长度，超过后丢弃新的数据包，必须是2的n次幂 */
+#define NETBUF_SG_MAX       8       /* 一个发送请求最多的分段数 */
+
+/* 内核内部使用的网卡控制码，参数是内核指针，devfs不会转发给驱动 */
+#define NETIO_RECVBUF       DEVCTL_CODE('n', DEVCTL_KERNEL | 1) /* 取走一个接收到的缓冲区 */
+#define NETIO_SENDSG        DEVCTL_CODE('n', DEVCTL_KERNEL | 2) /* 分散/聚集发送 */
+
+typedef struct netbuf {
+    list_t list;                /* 空闲链表 */
+    unsigned char *head;        /* 缓冲区的起始地址，后面是NETBUF_HEADROOM字节的保留空间 */
+    unsigned char *data;        /* 数据区，网卡从这里开始DMA */
+    unsigned short length;      /* 有效数据长度 */
+    unsigned short index;       /* 在缓冲池中的序号 */
+} netbuf_t;
+
+/* 接收队列，队列中是缓冲区的指针。网卡的接收轮询是唯一的生产者，读者取出 */
+typedef struct {
+    netbuf_t *slots[NETBUF_QUEUE_MAX];
+    device_queue_t queue;
+} netbuf_queue_t;
+
+typedef struct {
+    void *addr;                 /* 内核线性地址，物理上连续 */
+    size_t len;
+} netbuf_seg_t;
+
+/**
+ * 分散/聚集发送请求。
+ * 驱动接受请求后由驱动持有，发送完成（或者已经复制走数据）后调用done归还给调用者，
+ * done可能在中断中调用，也可能在NETIO_SENDSG返回前调用。
+ * 驱动拒绝请求时不会调用done。
+ */
+typedef struct netbuf_sg {
+    int count;
+    size_t total;               /* 所有分段的总长度 */
+    netbuf_seg_t seg[NETBUF_SG_MAX];
+    void (*done)(struct netbuf_sg *sg);
+    void *priv;                 /* 调用者的私有数据 */
+} netbuf_sg_t;
+
+int netbuf_init();
+netbuf_t *netbuf_alloc();
+void netbuf_free(netbuf_t *nb);
+int netbuf_free_count();
+
+void netbuf_queue_init(netbuf_queue_t *queue);
+int netbuf_queue_put(netbuf_queue_t *queue, netbuf_t *nb);
+netbuf_t *netbuf_queue_get(netbuf_queue_t *queue, int flags);
+int netbuf_queue_get_batch(netbuf_queue_t *queue, netbuf_t **nbs, int nr, int flags);
+int netbuf_queue_read(netbuf_queue_t *queue, void *buf, size_t buflen, int flags);
+void netbuf_queue_flush(netbuf_queue_t *queue);
+
+int netbuf_sg_copy(netbuf_sg_t *sg, void *buf, size_t buflen);
+
+static inline int netbuf_queue_count(netbuf_queue_t *queue)
+{
+    return fifo_ring_len(&queue->queue.ring);
+}
+
+static inline void netbuf_sg_complete(netbuf_sg_t *sg)
+{
+    if (sg->done)
+        sg->done(sg);
+}
+
+#endif   /* _XBOOK_NETBUF_H */
@@ -0,0 +1,50 @@
+#ifndef _XBOOK_NETPOLL_H
+#define _XBOOK_NETPOLL_H
+
+#include <xbook/list.h>
+#include <sys/ioctl.h>
+#include <types.h>
+#include <stddef.h>
+
+/**
+ * 网卡接收的中断/轮询混合模式：
+ * 收到中断后驱动关闭网卡中断并调度轮询，轮询在NET_RX软中断中进行，
+ * 每次最多处理预算个数据包，接收环空了才重新打开网卡中断。
+ * 数据包很多时网卡不再产生中断，避免一直处于中断中而不能调度任务。
+ */
+#define NETPOLL_WEIGHT      64      /* 每个设备每次轮询的默认预算 */
+#define NETPOLL_BUDGET      300     /* 一次软中断中所有设备的总预算 */
+
+/* 轮询状态 */
+#define NETPOLL_SCHED       0x01    /* 已经在轮询链表上或者正在轮询 */
+#define NETPOLL_DISABLED    0x02    /* 设备已经关闭，不再调度 */
+
+typedef struct netpoll {
+    list_t list;                /* 轮询链表 */
+    /* 轮询函数，返回处理的数据包数，小于budget表示已经处理完 */
+    int (*poll)(struct netpoll *np, int budget);
+    int weight;
+    unsigned long state;
+    void *data;                 /* 驱动的私有数据 */
+    netdev_stat_t stat;         /* 中断和轮询的统计 */
+} netpoll_t;
+
+void netpoll_init(netpoll_t *np, int (*poll)(netpoll_t *, int), int weight, void *data);
+void netpoll_schedule(netpoll_t *np);
+void netpoll_complete(netpoll_t *np);
+void netpoll_enable(netpoll_t *np);
+void netpoll_disable(netpoll_t *np);
+void netpoll_subsystem_init();
+
+/* 驱动在自己的中断中调用，用来统计中断次数 */
+static inline void netpoll_stat_irq(netpoll_t *np)
+{
+    np->stat.irqs++;
+}
+
+static inline void netpoll_drop(netpoll_t *np)
+{
+    np->stat.drops++;
+}
+
+#endif   /* _XBOOK_NETPOLL_H */
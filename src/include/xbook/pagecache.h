@@ -0,0 +1,44 @@
+#ifndef _XBOOK_PAGECACHE_H
+#define _XBOOK_PAGECACHE_H
+
+#include <xbook/list.h>
+#include <types.h>
+
+/* 没有映射的文件最多保留的页缓存数，超出时释放最早不用的 */
+#define PAGE_CACHE_IDLE_MAX     16
+
+/**
+ * 文件的页缓存：按（设备，索引节点）识别同一个文件，
+ * 映射同一个文件的进程共享缓存中的物理页，干净的页只需要读取一次。
+ */
+typedef struct page_cache {
+    list_t list;                /* 在哈希链表上，没有引用时同时在空闲链表上 */
+    list_t idle_list;
+    list_t page_list;           /* 缓存的页 */
+    dev_t dev;
+    ino_t ino;
+    int reference;              /* 映射这个文件的空间数 */
+    int pages;                  /* 缓存的页数 */
+    char detached;              /* 文件已经删除或者截断，不能再被查找到 */
+} page_cache_t;
+
+/* 缓存中的一页，物理页由缓存持有一个引用 */
+typedef struct cache_page {
+    list_t list;                /* 在所属缓存的页链表上 */
+    list_t hash_list;           /* 在页哈希链表上 */
+    page_cache_t *cache;
+    unsigned long index;        /* 页在文件中的序号 */
+    unsigned long paddr;
+} cache_page_t;
+
+page_cache_t *page_cache_get(int file);
+void page_cache_hold(page_cache_t *cache);
+void page_cache_put(page_cache_t *cache);
+unsigned long page_cache_find_page(page_cache_t *cache, int file, unsigned long index);
+void page_cache_update(dev_t dev, ino_t ino, off_t offset, void *buf, size_t len);
+void page_cache_invalidate(dev_t dev, ino_t ino, int detach);
+void page_cache_invalidate_dev(dev_t dev);
+int page_cache_shrink(int count, int flags);
+void page_cache_init(void);
+
+#endif   /* _XBOOK_PAGECACHE_H */
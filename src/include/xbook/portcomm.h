@@ -11,8 +11,6 @@
 
 #define PORT_MSG_NR 8
 
-#define PORT_COMM_RETRY_GET_CNT  10
-
 #define BAD_PORT_COMM(port) ((port) >= PORT_COMM_NR)
 
 /* 知名端口号 */
@@ -74,6 +72,7 @@ int sys_port_comm_receive(int port, port_msg_t *msg);
 int sys_port_comm_reply(int port, port_msg_t *msg);
 
 void port_comm_init();
+port_comm_t *port_comm_find(uint32_t port);
 
 void port_msg_reset(port_msg_t *msg);
 void port_msg_copy_header(port_msg_t *src, port_msg_t *dest);
@@ -3,11 +3,13 @@
 
 #include <sys/pthread.h>
 #include <arch/atomic.h>
+#include <xbook/list.h>
 
 #define PTHREAD_MAX_NR      32
 
 typedef struct pthread_desc {
     atomic_t thread_count;
+    list_t thread_list;         /* 线程组中所有的线程 */
 } pthread_desc_t;
 
 void pthread_desc_init(pthread_desc_t *pthread);
@@ -0,0 +1,26 @@
+#ifndef _XBOOK_RECLAIM_H
+#define _XBOOK_RECLAIM_H
+
+#include <xbook/list.h>
+
+#define MEM_RECLAIM_BLOCK       0x01    /* 可以等待缓存的互斥锁，只有回收线程使用 */
+#define MEM_RECLAIM_BATCH       32      /* 直接回收时至少回收的页数，分配连续的页需要多回收一些 */
+
+/**
+ * 可以回收内存的缓存，在初始化时注册，按注册的顺序回收，代价小的缓存先注册。
+ * shrink最多回收count页，每个缓存内部先回收最久没有使用的，返回释放的页数。
+ * 没有MEM_RECLAIM_BLOCK时可能在关中断或者持有其它锁的时候调用，拿不到锁就直接返回0。
+ */
+typedef struct mem_shrinker {
+    list_t list;
+    char *name;
+    int (*shrink)(int count, int flags);
+} mem_shrinker_t;
+
+void mem_shrinker_register(mem_shrinker_t *shrinker);
+int mem_reclaim(int count, int flags);
+int mem_reclaim_direct(int count);
+void mem_reclaim_wakeup(void);
+int mem_reclaim_init(void);
+
+#endif   /* _XBOOK_RECLAIM_H */
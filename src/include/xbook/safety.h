@@ -9,4 +9,8 @@ int safety_check_range(void *src, unsigned long nbytes);
 int mem_copy_from_user(void *dest, void *src, unsigned long nbytes);
 int mem_copy_to_user(void *dest, void *src, unsigned long nbytes);
 int mem_copy_from_user_str(char *dest, char *src, unsigned long maxn);
+
+unsigned long copy_from_user(void *to, const void *from, unsigned long n);
+unsigned long copy_to_user(void *to, const void *from, unsigned long n);
+long strncpy_from_user(char *dst, const char *src, long count);
 #endif /* _XBOOK_SAFETY_H */
@@ -4,7 +4,9 @@
 
 #include "task.h"
 #include <xbook/list.h>
+#include <xbook/bitops.h>
 #include <assert.h>
+#include <arch/cpu.h>
 #include "debug.h"
 #include "schedule.h"
 
@@ -17,12 +19,21 @@ enum sched_priority_level {
     TASK_PRIO_LEVEL_MAX
 };
 
-#define TASK_PRIORITY_LOW       0
-#define TASK_PRIORITY_HIGH      2
-#define TASK_PRIORITY_REALTIME  3
+/* 优先级，数值越大越优先，不能超过就绪位图的位数 */
+#define TASK_PRIORITY_IDLE      0
+#define TASK_PRIORITY_LOW       8
+#define TASK_PRIORITY_NORMAL    16
+#define TASK_PRIORITY_HIGH      24
+#define TASK_PRIORITY_REALTIME  31
 #define TASK_PRIORITY_MAX       TASK_PRIORITY_REALTIME
 #define TASK_PRIORITY_MAX_NR    (TASK_PRIORITY_MAX + 1)
 
+/* 非实时任务的动态优先级最多比静态优先级高这么多 */
+#define TASK_PRIORITY_BOOST_MAX 7
+
+/* 每隔多少个时钟节拍做一次负载均衡 */
+#define SCHED_BALANCE_TICKS     20
+
 typedef struct {
     spinlock_t lock;
     list_t list;
@@ -35,9 +46,10 @@ typedef struct {
     cpuid_t cpuid;          /* 调度单元的cpuid */
     uint32_t flags;
     uint32_t tasknr;
-    uint32_t dynamic_priority;      /* 当前调度单元的动态优先级 */
+    uint32_t priority_bitmap;       /* 就绪位图，第n位表示优先级为n的队列非空 */
     task_t *idle;           /* 当前调度单元的idle任务 */
     task_t *cur;            /* 当前调度单元的执行中的任务 */
+    uint32_t balance_ticks; /* 距离下一次负载均衡的时钟节拍 */
     sched_queue_t priority_queue[TASK_PRIORITY_MAX_NR];  /* 优先级队列 */
 } sched_unit_t;
 
@@ -51,61 +63,57 @@ typedef struct _scheduler {
 extern scheduler_t scheduler;
 
 void schedule();
+void schedule_to(task_t *next);
 void schedule_init();
+void init_sched_unit(sched_unit_t *su, cpuid_t cpuid, unsigned long flags);
+void sched_tick();
+void sched_balance(sched_unit_t *su);
+void sched_notify_unit(sched_unit_t *su);
 
 uint8_t sched_calc_base_priority(uint32_t level);
 uint8_t sched_calc_new_priority(task_t *task, char adjustment);
 
+/* 当前cpu的调度单元和当前任务都保存在cpu私有数据区中 */
 static inline sched_unit_t *sched_get_cur_unit()
 {
-    sched_unit_t *su = NULL;
-    cpuid_t cpuid = cpu_get_my_id();
-    int i;
-    for (i = 0; i < scheduler.cpunr; i++) {
-        su = &scheduler.sched_unit_table[i];
-        if (su->cpuid == cpuid) {
-            return su;
-        }
-    }
-    if (unlikely(su == NULL))
-        panic("[schdule]: get unit null!");
-    return NULL;
+    return (sched_unit_t *) cpu_local_read(CPU_LOCAL_SCHED);
+}
+
+static inline sched_unit_t *sched_get_unit(cpuid_t cpu)
+{
+    return &scheduler.sched_unit_table[cpu];
 }
 
-static inline int sched_queue_has_task(sched_unit_t *su, task_t *task)
+static inline void sched_set_cur_task(sched_unit_t *su, task_t *task)
 {
-    sched_queue_t *queue = &su->priority_queue[su->dynamic_priority];
-    return list_find(&task->list, &queue->list);
+    su->cur = task;
+    cpu_local_write(CPU_LOCAL_CURRENT, task);
 }
 
 static inline void sched_queue_add_tail(sched_unit_t *su, task_t *task)
 {    
     sched_queue_t *queue = su->priority_queue + task->priority;
-    assert(!list_find(&task->list, &queue->list));
     list_add_tail(&task->list, &queue->list);
+    task->cpuid = su->cpuid;
     queue->length++;
     su->tasknr++;
     scheduler.tasknr++;
-    if (task->priority > su->dynamic_priority) {
-        su->dynamic_priority = task->priority;
-    }
+    su->priority_bitmap |= (1UL << task->priority);
 }
 
 static inline void sched_queue_add_head(sched_unit_t *su, task_t *task)
 {
     sched_queue_t *queue = su->priority_queue + task->priority;
-    assert(!list_find(&task->list, &queue->list));
-    list_add_tail(&task->list, &queue->list);
+    list_add(&task->list, &queue->list);
+    task->cpuid = su->cpuid;
     queue->length++;
     su->tasknr++;
     scheduler.tasknr++;    
-    if (task->priority > su->dynamic_priority) {
-        su->dynamic_priority = task->priority;
-    }
+    su->priority_bitmap |= (1UL << task->priority);
 }
 
 void sched_print_queue(sched_unit_t *su);
 
-#define task_current    sched_get_cur_unit()->cur
+#define task_current    ((task_t *) cpu_local_read(CPU_LOCAL_CURRENT))
 
 #endif   /* _XBOOK_SCHEDULE_H */
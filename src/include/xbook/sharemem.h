@@ -14,6 +14,10 @@
 
 
 #define SHARE_MEM_PRIVATE       0x01    /* 映射的虚拟地址在本进程中已经存在 */
+#define SHARE_MEM_KERNEL        0x02    /* 物理页由内核创建和使用，不会被释放 */
+
+/* 检查当前任务能否映射内核的共享内存，可以时返回0 */
+typedef int (*share_mem_access_t)(int shmid);
 
 /* 共享内存结构 */
 typedef struct share_mem {
@@ -22,6 +26,7 @@ typedef struct share_mem {
     unsigned long npages;       /* 物理页数量 */
     unsigned int flags;         /* 标志 */
     atomic_t links;        /* 使用这段共享内存被映射的次数 */
+    share_mem_access_t access;  /* 内核的共享内存由创建者决定哪些任务可以映射 */
     char name[SHARE_MEM_NAME_LEN];      /* 名字 */
 } share_mem_t;
 
@@ -30,6 +35,7 @@ int share_mem_free(share_mem_t *shm);
 
 int share_mem_get(char *name, unsigned long size, unsigned long flags);
 int share_mem_put(int shmid);
+int share_mem_create_kernel(char *name, unsigned long size, void **kaddr, share_mem_access_t access);
 
 void *share_mem_map(int shmid, void *shmaddr, int shmflg);
 int share_mem_unmap(const void *shmaddr, int shmflg);
@@ -0,0 +1,39 @@
+#ifndef _XBOOK_SMP_H
+#define _XBOOK_SMP_H
+
+#include <types.h>
+#include <xbook/config.h>
+
+/*
+ * 多处理器支持
+ * 内核使用一把可以递归获取的大锁保护，任何cpu从用户态或者idle进入内核时获取，
+ * 返回用户态或者回到idle时释放。任务切换时锁保持不变，只交换嵌套深度。
+ */
+
+/* 核间中断类型 */
+enum ipi_type {
+    IPI_RESCHED = 0,    /* 目标cpu有新的就绪任务 */
+    IPI_TLB,            /* 目标cpu需要刷新TLB */
+};
+
+/* 刷新整个TLB */
+#define TLB_SHOOTDOWN_ALL   ((unsigned long) -1)
+
+struct vmm;
+
+void kernel_lock();
+void kernel_unlock();
+int kernel_lock_switch(int depth);
+
+void smp_init();
+void smp_ap_start(cpuid_t cpu);
+void smp_send_reschedule(cpuid_t cpu);
+void smp_reschedule_interrupt();
+void smp_tlb_interrupt();
+void smp_tlb_shootdown(struct vmm *vmm, unsigned long addr);
+
+/* 体系结构相关的部分 */
+int smp_boot_cpus();
+void smp_send_ipi(cpuid_t cpu, int ipi);
+
+#endif   /* _XBOOK_SMP_H */
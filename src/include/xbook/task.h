@@ -35,6 +35,7 @@ typedef enum {
 #define TASK_KERN_STACK_SIZE    8192
 
 #define USER_INIT_PROC_ID       1
+#define TASK_PID_MAX            0x7fffffff  /* pid_t能表示的最大pid，用完后回绕 */
 
 #define TASK_TIMESLICE_MIN  1
 #define TASK_TIMESLICE_MAX  100
@@ -65,7 +66,8 @@ typedef struct {
     unsigned char *kstack;              /* kernel stack, must be first member */
     task_state_t state;
     spinlock_t lock;                    /* 操作task成员时需要进行上锁 */
-    cpuid_t cpuid;
+    cpuid_t cpuid;                      /* 所在调度单元的cpu */
+    int lock_depth;                     /* 切换出去时持有的内核锁深度 */
     pid_t pid;                          /* process id */
     pid_t parent_pid;
     pid_t tgid;                         /* 线程组id：线程属于哪个进程，和pid一样，就说明是主线程，不然就是子线程 */
@@ -83,6 +85,10 @@ typedef struct {
     struct vmm *vmm;                    
     list_t list;                        /* 处于所在队列的链表，就绪队列，阻塞队列等 */
     list_t global_list;                 /* 全局任务队列，用来查找所有存在的任务 */
+    list_t pid_list;                    /* pid散列表的冲突链表 */
+    list_t child_list;                  /* 子任务链表头，parent_pid指向自己的任务都在这里 */
+    list_t sibling_list;                /* 在父任务的子任务链表中 */
+    list_t thread_list;                 /* 在线程组的链表中，只有用户多线程时使用 */
     exception_manager_t exception_manager;         
     timer_t sleep_timer;               
     fpu_t fpu;
@@ -94,11 +100,16 @@ typedef struct {
     void *exit_hook_arg;
     lpc_port_table_t port_table;
     port_comm_t *port_comm;
+    struct io_context *io_context;      /* 异步IO上下文，第一次提交时创建 */
     struct tms times;
     unsigned int stack_magic;
 } task_t;
 
 extern list_t task_global_list;
+
+/* pid散列表的大小，必须是2的n次幂 */
+#define TASK_PID_HASH_NR    256
+#define TASK_PID_HASH(pid)  ((pid) & (TASK_PID_HASH_NR - 1))
 extern volatile int task_init_done;
 
 #define TASK_GET_TRAP_FRAME(task) \
@@ -140,14 +151,17 @@ extern volatile int task_init_done;
 void tasks_init();
 
 void task_init(task_t *task, char *name, uint8_t prio_level);
+task_t *task_alloc();
 void task_free(task_t *task);
 void task_dump(task_t *task);
 
 task_t *task_create(char *name, uint8_t prio_level, task_func_t *func, void *arg);
+task_t *task_create_idle(cpuid_t cpu);
 void task_exit(int status);
 
 task_t *task_find_by_pid(pid_t pid);
 void task_add_to_global_list(task_t *task);
+void task_set_parent(task_t *task, pid_t parent_pid);
 void task_activate_when_sched(task_t *task);
 
 void task_block(task_state_t state);
@@ -182,7 +196,9 @@ pid_t task_take_pid();
 void task_rollback_pid();
 void tasks_print();
 void task_start_user();
+void kern_do_idle(void *arg);
 unsigned long task_sleep_by_ticks(clock_t ticks);
+unsigned long task_sleep_by_usec(unsigned long usec);
 int task_count_children(task_t *parent);
 int task_do_cancel(task_t *task);
 pid_t task_get_pid(task_t *task);
@@ -0,0 +1,17 @@
+#ifndef _XBOOK_TIMEPAGE_H
+#define _XBOOK_TIMEPAGE_H
+
+#include <xbook/vmm.h>
+#include <sys/timepage.h>
+#include <sys/time.h>
+
+/* 时间页映射在用户空间的最后一页，栈顶之上 */
+#define TIMEPAGE_USER_ADDR  USER_STACK_TOP
+
+void timepage_init(void);
+void timepage_update(void);
+int timepage_map(void);
+unsigned long timepage_user_addr(void);
+int timepage_gettime(clockid_t clockid, struct timespec *ts);
+
+#endif   /* _XBOOK_TIMEPAGE_H */
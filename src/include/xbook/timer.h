@@ -58,6 +58,7 @@ void timer_del_period(timer_t *timer);
 timer_t *timer_find(unsigned long id);
 
 void timer_update_ticks();
+clock_t timer_next_expiry();
 long sys_usleep(struct timeval *inv, struct timeval *outv);
 
 int timers_init();
@@ -23,6 +23,7 @@ unsigned long vir_addr_alloc(size_t size);
 unsigned long vir_addr_free(unsigned long vaddr, size_t size);
 
 void *memio_remap(unsigned long paddr, size_t size);
+void *memio_remap_wc(unsigned long paddr, size_t size);
 int memio_unmap(void *vaddr);
 
 void vir_mem_init();
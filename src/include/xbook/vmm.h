@@ -12,6 +12,7 @@
 typedef struct vmm {
     void *page_storage;                     /* 虚拟内存管理的结构 */                   
     void *mem_space_head;                     /* 虚拟空间头,设置成空类型，使用时转换类型 */
+    void *mem_space_root;                     /* 虚拟空间区间树的根，用于快速查找 */
     char **envp;    /* 环境变量指针 */     
     char **argv;    /* 参数变量 */
     char *argbuf;   /* 参数的缓冲区首地址 */
@@ -27,8 +28,13 @@ typedef struct {
     unsigned long ms_total;    /* 物理内存总大小 */
     unsigned long ms_free;     /* 物理内存空闲大小 */
     unsigned long ms_used;     /* 物理内存已使用大小 */
+    unsigned long ms_largest;  /* 最大的连续空闲物理内存 */
+    unsigned long ms_frag;     /* 碎片化的空闲内存百分比 */
 } mstate_t;
 
+/* 获取内存状态时的标志 */
+#define MSTATE_CACHES   0x01    /* 同时把内存缓存的统计打印到内核日志 */
+
 void vmm_init(vmm_t *vmm);
 int vmm_exit(vmm_t *vmm);
 void vmm_free(vmm_t *vmm);
@@ -43,6 +49,6 @@ void vmm_active(vmm_t *vmm);
 int vmm_build_argbug(vmm_t *vmm, char **argv, char **envp);
 void vmm_debuild_argbuf(vmm_t *vmm);
 
-int sys_mstate(mstate_t *ms);
+int sys_mstate(mstate_t *ms, int flags);
 
 #endif  /* _XBOOK_VMM_H */
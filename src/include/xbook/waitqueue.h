@@ -21,6 +21,7 @@ void wait_queue_remove(wait_queue_t *wait_queue, void *task_ptr);
 void wait_queue_wakeup(wait_queue_t *wait_queue);
 void wait_queue_wakeup_all(wait_queue_t *wait_queue);
 void wait_queue_sleepon(wait_queue_t *wait_queue);
+void *wait_queue_first(wait_queue_t *wait_queue);
 
 static inline void wait_queue_init(wait_queue_t *wait_queue)
 {
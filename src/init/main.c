@@ -4,6 +4,9 @@
 #include <xbook/softirq.h>
 #include <xbook/clock.h>
 #include <xbook/virmem.h>
+#include <xbook/memspace.h>
+#include <xbook/pagecache.h>
+#include <xbook/reclaim.h>
 #include <xbook/task.h>
 #include <xbook/schedule.h>
 #include <xbook/sharemem.h>
@@ -15,11 +18,15 @@
 #include <xbook/walltime.h>
 #include <xbook/fs.h>
 #include <xbook/timer.h>
+#include <xbook/timepage.h>
 #include <xbook/initcall.h>
 #include <xbook/mutexqueue.h>
 #include <xbook/account.h>
 #include <xbook/portcomm.h>
 #include <xbook/disk.h>
+#include <xbook/smp.h>
+#include <xbook/netbuf.h>
+#include <xbook/netpoll.h>
 #ifdef CONFIG_NET
 #include <xbook/net.h>
 #endif
@@ -33,6 +40,8 @@ int kernel_main(void)
     keprint(PRINT_INFO "welcome to xbook kernel.\n");
     mem_caches_init();
     vir_mem_init();
+    mem_space_cache_init();
+    page_cache_init();
     irq_description_init();
     softirq_init();
     syscall_init();
@@ -47,7 +56,15 @@ int kernel_main(void)
     timers_init();
     walltime_init();
     interrupt_enable();
+    timepage_init();
+    mem_reclaim_init();
+#ifdef CONFIG_MEMCACHE_BENCH
+    mem_cache_bench();
+#endif
+    smp_init();
     driver_framewrok_init();
+    netbuf_init();
+    netpoll_subsystem_init();
     disk_init();
     initcalls_exec();
 #ifdef CONFIG_DEVICE_TEST
@@ -4,6 +4,11 @@
 #include <stdlib.h>
 #include <xbook/memalloc.h>
 #include <xbook/portcomm.h>
+#include <xbook/sharemem.h>
+#include <xbook/semaphore.h>
+#include <xbook/spinlock.h>
+#include <xbook/task.h>
+#include <xbook/schedule.h>
 
 lpc_parcel_t lpc_parcel_get()
 {
@@ -23,11 +28,135 @@ int lpc_parcel_put(lpc_parcel_t parcel)
     return -1;
 }
 
+/* 授权缓冲区，第一次使用时才创建共享内存 */
+typedef struct {
+    int shmid;
+    uint8_t *buf;           /* 内核中的线性地址 */
+    char used;
+    int port;               /* 调用时借给了哪个端口，只有这个端口的服务端可以映射 */
+} lpc_grant_t;
+
+static lpc_grant_t lpc_grant_table[LPC_GRANT_NR];
+DEFINE_SEMAPHORE(lpc_grant_sem, LPC_GRANT_NR);
+DEFINE_SPIN_LOCK_UNLOCKED(lpc_grant_lock);
+
+/**
+ * 检查当前任务能否映射授权缓冲区：只有正在使用这个缓冲区的调用所发往的端口的服务端才可以，
+ * 其它进程即使知道共享内存的id也不能读写正在传递的数据
+ */
+static int lpc_grant_access(int shmid)
+{
+    port_comm_t *port_comm = task_current->port_comm;
+    int i;
+    if (!port_comm)
+        return -1;
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        lpc_grant_t *grant = &lpc_grant_table[i];
+        if (grant->buf && grant->shmid == shmid) {
+            if (grant->used && grant->port >= 0 && port_comm_find(grant->port) == port_comm)
+                return 0;
+            return -1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * 获取一个授权缓冲区，大小是LPC_GRANT_SIZE，没有空闲的缓冲区时等待。
+ * 写入序列时，缓冲区中的数据只传递位置，服务端映射后直接读写。
+ */
+void *lpc_grant_get()
+{
+    lpc_grant_t *grant = NULL;
+    unsigned long iflags;
+    int i;
+    semaphore_down(&lpc_grant_sem);
+    spin_lock_irqsave(&lpc_grant_lock, iflags);
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        if (!lpc_grant_table[i].used) {
+            grant = &lpc_grant_table[i];
+            grant->used = 1;
+            grant->port = -1;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&lpc_grant_lock, iflags);
+    if (!grant->buf) {
+        char name[SHARE_MEM_NAME_LEN];
+        sprintf(name, "lpc-grant%d", i);
+        grant->shmid = share_mem_create_kernel(name, LPC_GRANT_SIZE, (void **) &grant->buf,
+            lpc_grant_access);
+        if (grant->shmid < 0) {
+            errprint("lpc: create grant %d failed!\n", i);
+            grant->buf = NULL;
+            grant->used = 0;
+            semaphore_up(&lpc_grant_sem);
+            return NULL;
+        }
+    }
+    return grant->buf;
+}
+
+void lpc_grant_put(void *buf)
+{
+    int i;
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        if (lpc_grant_table[i].used && lpc_grant_table[i].buf == buf) {
+            lpc_grant_table[i].port = -1;
+            lpc_grant_table[i].used = 0;
+            semaphore_up(&lpc_grant_sem);
+            return;
+        }
+    }
+}
+
+/* buf在授权缓冲区中时返回0，并且生成授权序列的参数值 */
+static int lpc_grant_lookup(void *buf, size_t len, uint32_t *arg)
+{
+    uint8_t *p = buf;
+    int i;
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        lpc_grant_t *grant = &lpc_grant_table[i];
+        if (grant->buf && p >= grant->buf && p + len <= grant->buf + LPC_GRANT_SIZE) {
+            *arg = LPC_GRANT_ARG(grant->shmid, p - grant->buf);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void *lpc_grant_addr(uint32_t arg)
+{
+    int i;
+    for (i = 0; i < LPC_GRANT_NR; i++) {
+        lpc_grant_t *grant = &lpc_grant_table[i];
+        if (grant->buf && grant->shmid == LPC_GRANT_SHMID(arg))
+            return grant->buf + LPC_GRANT_OFFSET(arg);
+    }
+    return NULL;
+}
+
 static uint16_t lpc_parcel_get_arg_type(lpc_parcel_t parcel, uint16_t index)
 {
     return parcel->header.argtype[index];
 }
 
+/* 把参数中的授权缓冲区借给port的服务端，允许它映射 */
+static void lpc_grant_lend(lpc_parcel_t parcel, uint32_t port)
+{
+    int i, j;
+    for (i = 0; i < LPC_PARCEL_ARG_NR; i++) {
+        if (!(parcel->header.argused & (1 << i)) ||
+            lpc_parcel_get_arg_type(parcel, i) != LPC_PARCEL_ARG_GRANT)
+            continue;
+        for (j = 0; j < LPC_GRANT_NR; j++) {
+            lpc_grant_t *grant = &lpc_grant_table[j];
+            if (grant->used && grant->shmid == LPC_GRANT_SHMID(parcel->header.args[i]))
+                grant->port = port;
+        }
+    }
+}
+
 static int lpc_parcel_alloc_arg_solt(lpc_parcel_t parcel)
 {
     if (!parcel)
@@ -48,7 +177,10 @@ static int lpc_parcel_find_arg_solt(lpc_parcel_t parcel, uint16_t type)
         return -1;
     int i; for (i = 0; i < LPC_PARCEL_ARG_NR; i++) {
         if ((parcel->header.argused & (1 << i))) {
-            if (lpc_parcel_get_arg_type(parcel, i) == type && 
+            uint16_t argtype = lpc_parcel_get_arg_type(parcel, i);
+            /* 授权的序列也是序列，保持参数的顺序 */
+            if ((argtype == type || (type == LPC_PARCEL_ARG_SEQUENCE &&
+                argtype == LPC_PARCEL_ARG_GRANT)) && 
                 parcel->header.arglen[i] > 0) {
                 break;
             }
@@ -60,6 +192,14 @@ static int lpc_parcel_find_arg_solt(lpc_parcel_t parcel, uint16_t type)
     return i;
 }
 
+/* 序列参数的数据地址，授权的序列在共享内存中 */
+static void *lpc_parcel_arg_buf(lpc_parcel_t parcel, uint16_t index)
+{
+    if (lpc_parcel_get_arg_type(parcel, index) == LPC_PARCEL_ARG_GRANT)
+        return lpc_grant_addr(parcel->header.args[index]);
+    return (void *) &parcel->data[parcel->header.args[index]];
+}
+
 static void lpc_parcel_set_arg(lpc_parcel_t parcel, uint16_t index,
         uint32_t data, uint16_t len, uint16_t type)
 {
@@ -85,6 +225,9 @@ void lpc_parcel_dump_args(lpc_parcel_t parcel)
             printf("arg%d: ", i);
             switch (lpc_parcel_get_arg_type(parcel, i))
             {
+            case LPC_PARCEL_ARG_GRANT:
+                printf("grant[%d] %x\n", parcel->header.arglen[i], parcel->header.args[i]);
+                break;
             case LPC_PARCEL_ARG_SEQUENCE:
                 {
                     printf("seq[%d] ", parcel->header.arglen[i]);
@@ -130,6 +273,12 @@ int lpc_parcel_write_sequence(lpc_parcel_t parcel, void *buf, size_t len)
     int i = lpc_parcel_alloc_arg_solt(parcel);
     if (i < 0)
         return -1;
+    uint32_t grant;
+    /* 数据已经在授权缓冲区中，只传递位置，不复制 */
+    if (buf && !lpc_grant_lookup(buf, len, &grant)) {
+        lpc_parcel_set_arg(parcel, i, grant, len, LPC_PARCEL_ARG_GRANT);
+        return 0;
+    }
     int size = parcel->header.size + len + 1;
     if (size >= LPC_PARCEL_BUF_SIZE)
         return -1; // no mem_free space
@@ -241,11 +390,14 @@ int lpc_parcel_read_sequence(lpc_parcel_t parcel, void *buf, size_t *len)
     int i = lpc_parcel_find_arg_solt(parcel, LPC_PARCEL_ARG_SEQUENCE);
     if (i < 0) 
         return -1;
+    void *src = lpc_parcel_arg_buf(parcel, i);
+    if (!src)
+        return -1;
     if (len) {
         *len = parcel->header.arglen[i];
     }
-    if (buf) {  
-        memcpy(buf, (void *) &parcel->data[parcel->header.args[i]], parcel->header.arglen[i]);
+    if (buf && buf != src) {    /* 服务端直接写到了授权缓冲区时不用复制 */
+        memcpy(buf, src, parcel->header.arglen[i]);
     }
     lpc_parcel_clear_arg(parcel, i);
     return 0;
@@ -256,8 +408,11 @@ int lpc_parcel_read_sequence_buf(lpc_parcel_t parcel, void **buf, size_t *len)
     int i = lpc_parcel_find_arg_solt(parcel, LPC_PARCEL_ARG_SEQUENCE);
     if (i < 0) 
         return -1;
+    void *src = lpc_parcel_arg_buf(parcel, i);
+    if (!src)
+        return -1;
     if (buf) {
-        *buf = (void *) &parcel->data[parcel->header.args[i]];
+        *buf = src;
     }
     if (len) {
         *len = parcel->header.arglen[i];
@@ -387,6 +542,7 @@ int lpc_call(uint32_t port, uint32_t code, lpc_parcel_t data, lpc_parcel_t reply
     }
     port_msg_reset(msg);
     data->code = code;
+    lpc_grant_lend(data, port);
     int msglen = sizeof(_lpc_parcel_t) + data->header.size;
     memcpy(msg->data, data, msglen);
     // 计算请求头大小
@@ -2,6 +2,7 @@
 #include <xbook/task.h>
 #include <xbook/schedule.h>
 #include <xbook/process.h>
+#include <arch/interrupt.h>
 #include <errno.h>
 #include <assert.h>
 #include <string.h>
@@ -146,6 +147,34 @@ static void msgpool_get_callback(msgpool_t *pool, void *buf)
     memcpy(buf, pool->tail, min(mhead->size, pool->msgsz));   /* copy data */
 }
 
+/**
+ * 从消息池中等待一个消息，没有消息时在消息池上睡眠，不再轮询。
+ * handoff是刚刚被唤醒的对端任务，睡眠时直接切换过去，不经过调度器的选择，
+ * 请求和应答就像同步调用一样在客户端和服务端之间来回传递。
+ */
+static int port_comm_wait_msg(msgpool_t *pool, port_msg_t *msg, task_t *handoff)
+{
+    task_t *cur = task_current;
+    unsigned long iflags;
+    while (msgpool_try_get(pool, msg, msgpool_get_callback) < 0) {
+        // 如果有异常产生，则返回中断错误号
+        if (exception_cause_exit(&cur->exception_manager))
+            return -EINTR;
+        interrupt_save_and_disable(iflags);
+        wait_queue_add(&pool->waiters, cur);
+        if (!msgpool_empty(pool)) { /* 加入等待队列前消息已经到达 */
+            wait_queue_remove(&pool->waiters, cur);
+            interrupt_restore_state(iflags);
+            continue;
+        }
+        cur->state = TASK_BLOCKED;
+        schedule_to(handoff);
+        handoff = NULL;
+        interrupt_restore_state(iflags);
+    }
+    return 0;
+}
+
 /**
  * 如果端口已经绑定，则直接返回错误
  * 当port为正的时候，查找端口地址，如果端口已经存在着返回错误，不然就分配一个新端口。
@@ -325,7 +354,7 @@ int sys_port_comm_unbind(int port)
  * 如果端口值错误就直接返回错误
  * 首先验证端口，失败就返回错误
  * 如果是发送给自己的就返回错误
- * 生成一个消息id并发送到消息池。
+ * 生成一个消息id并发送到消息池，唤醒等待的服务端并直接切换过去。
  * 接着就从自己的消息池里面等待消息，如果消息id错误，则返回错误
  */
 int sys_port_comm_request(uint32_t port, port_msg_t *msg)
@@ -354,24 +383,17 @@ int sys_port_comm_request(uint32_t port, port_msg_t *msg)
     uint32_t msgid = port_comm_generate_msg_id();
     msg->header.id = msgid;
     msg->header.port = myport_comm->my_port;
+    /* 放入消息时会唤醒第一个等待的服务端 */
+    task_t *server = wait_queue_first(&port_comm->msgpool->waiters);
     /* 往端口发出请求 */
     if (msgpool_put(port_comm->msgpool, msg, msg->header.size) < 0) {
         errprint("port request: msg put to %d failed!\n", port);
         return -EPERM;
     }
-    /* 尝试获取消息，如果获取无果，就yield来降低cpu占用 */
-    int try_count = 0;
-    while (msgpool_try_get(myport_comm->msgpool, msg, msgpool_get_callback) < 0){
-        // 如果有异常产生，则返回中断错误号
-        if (exception_cause_exit(&task_current->exception_manager)) {
-            noteprint("port_comm receive: port %d interrupt by exception!\n", myport_comm->my_port);
-            return -EINTR;
-        }
-        try_count++;
-        if (try_count > PORT_COMM_RETRY_GET_CNT) {
-            task_yield();
-            try_count = 0;
-        }
+    /* 等待应答，阻塞时把cpu直接交给服务端 */
+    if (port_comm_wait_msg(myport_comm->msgpool, msg, server) < 0) {
+        noteprint("port_comm receive: port %d interrupt by exception!\n", myport_comm->my_port);
+        return -EINTR;
     }
     /* 对消息进行验证，看是否存在丢失 */
     if (msg->header.id != msgid) {
@@ -397,19 +419,10 @@ int sys_port_comm_receive(int port, port_msg_t *msg)
     }
     if (!port_comm->msgpool)
         return -EPERM;
-    int try_count = 0;
-    /* 尝试获取消息，如果获取无果，就yield来降低cpu占用 */
-    while (msgpool_try_get(port_comm->msgpool, msg, msgpool_get_callback) < 0){
-        // 如果有异常产生，则返回中断错误号
-        if (exception_cause_exit(&task_current->exception_manager)) {
-            noteprint("port_comm receive: port %d interrupt by exception!\n", port);
-            return -EINTR;
-        }
-        try_count++;
-        if (try_count > PORT_COMM_RETRY_GET_CNT) {
-            task_yield();
-            try_count = 0;
-        }
+    /* 没有请求时在端口的消息池上睡眠 */
+    if (port_comm_wait_msg(port_comm->msgpool, msg, NULL) < 0) {
+        noteprint("port_comm receive: port %d interrupt by exception!\n", port);
+        return -EINTR;
     }
     return 0;
 }
@@ -418,7 +431,7 @@ int sys_port_comm_receive(int port, port_msg_t *msg)
  * 应答一个消息。
  * 首先会验证自己的端口，失败则返回错误
  * 接着从消息中获取要应答的端口，如果端口没有找到或者无消息池则返回错误。
- * 最后把消息放入客户端的消息池。
+ * 最后把消息放入客户端的消息池，并把cpu直接交给等待应答的客户端。
  */
 int sys_port_comm_reply(int port, port_msg_t *msg)
 {
@@ -438,7 +451,13 @@ int sys_port_comm_reply(int port, port_msg_t *msg)
         return -EPERM;
     if (!client_port->msgpool)
         return -EPERM;
-    return msgpool_put(client_port->msgpool, msg, msg->header.size);
+    task_t *client = wait_queue_first(&client_port->msgpool->waiters);
+    if (msgpool_put(client_port->msgpool, msg, msg->header.size) < 0)
+        return -EPERM;
+    /* 服务端仍然是就绪的，排到队尾，下次接收请求时再运行 */
+    if (client)
+        schedule_to(client);
+    return 0;
 }
 
 void port_comm_thread(void *arg)
@@ -14,13 +14,14 @@
 share_mem_t *share_mem_table;
 DEFINE_SEMAPHORE(share_mem_mutex, 1);
 
+/* 内核的共享内存不能通过名字找到 */
 static share_mem_t *share_mem_find_by_name(char *name)
 {
     share_mem_t *shm;
     int i;
     for (i = 0; i < MAX_SHARE_MEM_NR; i++) {
         shm = &share_mem_table[i];
-        if (shm->name[0] != '\0') {
+        if (shm->name[0] != '\0' && !(shm->flags & SHARE_MEM_KERNEL)) {
             if (!strcmp(shm->name, name)) {
                 return shm;
             }
@@ -71,6 +72,7 @@ share_mem_t *share_mem_alloc(char *name, unsigned long size)
             shm->npages = size / PAGE_SIZE;
             shm->page_addr = 0;
             shm->flags = 0;
+            shm->access = NULL;
             memcpy(shm->name, name, SHARE_MEM_NAME_LEN);
             shm->name[SHARE_MEM_NAME_LEN - 1] = '\0';
             return shm;
@@ -126,6 +128,37 @@ err:
     return retval;
 }
 
+/**
+ * 创建一段由内核使用的共享内存，物理页在创建时分配，内核通过线性地址kaddr访问，
+ * 用户进程映射后和内核访问的是同一段物理页。
+ * 它不在名字表中，用户进程只能通过id映射，并且要通过access的检查，access为NULL时不能映射。
+ * @return: 成功返回共享区域id，失败返回-1
+ */
+int share_mem_create_kernel(char *name, unsigned long size, void **kaddr, share_mem_access_t access)
+{
+    if (!name || !size || PAGE_ALIGN(size) >= MAX_SHARE_MEM_SIZE)
+        return -1;
+    int retval = -1;
+    share_mem_t *shm;
+    semaphore_down(&share_mem_mutex);
+    shm = share_mem_alloc(name, size);
+    if (shm == NULL)
+        goto err;
+    /* 普通内存区的页在内核中有线性映射 */
+    shm->page_addr = page_alloc_normal(shm->npages);
+    if (!shm->page_addr) {
+        share_mem_free(shm);
+        goto err;
+    }
+    shm->flags |= SHARE_MEM_KERNEL;
+    shm->access = access;
+    *kaddr = kern_phy_addr2vir_addr(shm->page_addr);
+    retval = shm->id;
+err:
+    semaphore_up(&share_mem_mutex);
+    return retval;
+}
+
 /**
  * @shmaddr: 共享内存的地址
  *          若该参数为NULL，则在进程空间自动选择一个闲的地址来映射，
@@ -145,6 +178,10 @@ void *share_mem_map(int shmid, void *shmaddr, int shmflg)
         errprint("shm %d not fouded!" endl, shmid);
         return (void *) -1;
     }   
+    if ((shm->flags & SHARE_MEM_KERNEL) && (!shm->access || shm->access(shm->id) < 0)) {
+        errprint("shm %d: map kernel share memory denied!" endl, shmid);
+        return (void *) -1;
+    }
     task_t *cur = task_current;
     unsigned long addr;
     unsigned long len = shm->npages * PAGE_SIZE;
@@ -230,7 +267,7 @@ int share_mem_put(int shmid)
     semaphore_down(&share_mem_mutex);
     shm = share_mem_find_by_id(shmid);
     if (shm) {  
-        if (atomic_get(&shm->links) <= 0) {
+        if (atomic_get(&shm->links) <= 0 && !(shm->flags & SHARE_MEM_KERNEL)) {
             share_mem_free(shm);
         } 
         semaphore_up(&share_mem_mutex);
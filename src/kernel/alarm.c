@@ -3,37 +3,35 @@
 #include <xbook/clock.h>
 #include <xbook/debug.h>
 
-unsigned long sys_alarm(unsigned long second)
+static void alarm_timeout_handler(timer_t *timer_self, void *arg)
 {
-    task_t *cur = task_current;
-    unsigned long old_second = cur->alarm.second;
-    if (second == 0) {
-        cur->alarm.flags = 0;
-    } else {
-        cur->alarm.flags = 1;
-        cur->alarm.second = second;
-        cur->alarm.ticks = HZ;
-    }
-    return old_second;
+    exception_send((pid_t) arg, EXP_CODE_ALRM);
 }
 
-void alarm_update_ticks()
+/**
+ * 闹钟用一个普通的定时器实现，不需要每个节拍都扫描所有任务。
+ * 返回上一个闹钟剩余的秒数。
+ */
+unsigned long sys_alarm(unsigned long second)
 {
-    task_t *task;
+    task_t *cur = task_current;
+    timer_t *timer = &cur->alarm.timer;
+    unsigned long old_second = 0;
     unsigned long flags;
     interrupt_save_and_disable(flags);
-    list_for_each_owner (task, &task_global_list, global_list) {
-        if (task->alarm.flags) {
-            task->alarm.ticks--;
-            if (!task->alarm.ticks) {
-                task->alarm.second--;
-                task->alarm.ticks = HZ;
-                if (!task->alarm.second) {
-                    exception_send(task->pid, EXP_CODE_ALRM);
-                    task->alarm.flags = 0;
-                }
-            }
-        }
+    if (timer_alive(timer)) {
+        if (time_after(timer->timeout, timer_ticks))
+            old_second = (timer->timeout - timer_ticks + HZ - 1) / HZ;
+        else
+            old_second = 1;
+        timer_del(timer);
+    }
+    if (second > 0) {
+        timer_modify(timer, second * HZ);
+        timer_set_arg(timer, (void *) cur->pid);
+        timer_set_handler(timer, alarm_timeout_handler);
+        timer_add(timer);
     }
     interrupt_restore_state(flags);
+    return old_second;
 }
\ No newline at end of file
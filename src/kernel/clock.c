@@ -7,39 +7,35 @@
 #include <xbook/task.h>
 #include <xbook/schedule.h>
 #include <xbook/timer.h>
+#include <xbook/clockevent.h>
 #include <xbook/hardirq.h>
 #include <xbook/walltime.h>
+#include <xbook/timepage.h>
 
 volatile clock_t systicks;
 volatile clock_t timer_ticks;
+static clock_t walltime_ticks;  /* 上一次更新墙上时间的节拍 */
+static unsigned long delay_cycles_per_msec;  /* 每毫秒的TSC计数，没有校准时为0 */
 
 static void timer_softirq_handler(softirq_action_t *action)
 {
-    if (systicks % HZ == 0) {  /* 1s更新一次 */
+    /* 1s更新一次，停止节拍后一次可能补上多个节拍 */
+    while (systicks - walltime_ticks >= HZ) {
+        walltime_ticks += HZ;
         walltime_update_second();
     }
+    timepage_update();
     timer_update_ticks();
-    alarm_update_ticks();
 }
 
 static void sched_softirq_handler(softirq_action_t *action)
 {
-    task_t *current = task_current;
-    assert(current->stack_magic == TASK_STACK_MAGIC);
-    current->elapsed_ticks++;
-	if (current->ticks <= 0) {
-		schedule();
-	} else {
-		current->ticks--;
-	}
+    sched_tick();
 }
 
 static int clock_handler(irqno_t irq, void *data)
 {
-	systicks++;
-    timer_ticks++;
-	softirq_active(TIMER_SOFTIRQ);
-	softirq_active(SCHED_SOFTIRQ);
+    clock_event_handle();
     return 0;
 }
 
@@ -56,8 +52,30 @@ clock_t clock_delay_by_ticks(clock_t ticks)
     return ticks;
 }
 
+/**
+ * 设置忙等使用的TSC速率，在校准TSC后调用
+ */
+void clock_delay_calibrate(unsigned long cycles_per_tick)
+{
+    delay_cycles_per_msec = cycles_per_tick * MS_PER_TICKS;
+}
+
+/**
+ * 忙等msec毫秒，期间一直持有内核锁，驱动的复位和探测序列不会被其它cpu打断。
+ * 校准后按TSC计数，不依赖启动cpu的时钟中断，应用处理器上也能返回；
+ * 校准之前只有启动cpu在运行，按节拍等待。
+ */
 void mdelay(time_t msec)
 {
+    if (delay_cycles_per_msec) {
+        unsigned long long start;
+        while (msec-- > 0) {
+            start = clock_cycles_read();
+            while (clock_cycles_read() - start < delay_cycles_per_msec)
+                cpu_pause();
+        }
+        return;
+    }
     clock_t ticks = MSEC_TO_TICKS(msec);
     if (!ticks)
         ticks = 1;
@@ -69,7 +87,7 @@ void mdelay(time_t msec)
 
 void clock_init()
 {
-    timer_ticks = systicks = 0;
+    walltime_ticks = timer_ticks = systicks = 0;
     clock_hardware_init();
 	softirq_build(TIMER_SOFTIRQ, timer_softirq_handler);
 	softirq_build(SCHED_SOFTIRQ, sched_softirq_handler);
@@ -0,0 +1,336 @@
+#include <xbook/clockevent.h>
+#include <xbook/timer.h>
+#include <xbook/softirq.h>
+#include <xbook/debug.h>
+#include <arch/interrupt.h>
+#include <arch/cpu.h>
+#include <stddef.h>
+
+/**
+ * 时钟事件：启动cpu的时钟节拍由评分最高的时钟事件设备产生。
+ * 平时使用周期模式，有高精度定时器或者idle停止节拍时切换到单次模式，
+ * 单次模式下每次中断都根据设备经过的计数补上节拍，不满一个节拍的计数留到下一次。
+ */
+static clock_event_device_t *clock_event = NULL;
+static int clock_event_mode = CLOCK_EVT_MODE_UNUSED;
+static unsigned long clock_event_residue;       /* 还不满一个节拍的计数 */
+static unsigned long clock_event_accounted;     /* 本周期或者本次编程后已经记入的计数 */
+static unsigned long long clock_event_ticks;    /* 64位的节拍数，不会回绕 */
+static unsigned long long clock_event_last_us;  /* 保证读到的时间不会倒退 */
+static int tick_stopped = 0;                    /* idle时停止了节拍 */
+
+/* 按照超时点排序，只用于不到一个节拍的短延时，数量很少 */
+static LIST_HEAD(hrtimer_list);
+
+static unsigned long clock_event_counts_to_us(unsigned long counts)
+{
+    unsigned long cpt = clock_event->counts_per_tick;
+    return (counts / cpt) * US_PER_TICKS + (counts % cpt) * US_PER_TICKS / cpt;
+}
+
+static unsigned long clock_event_us_to_counts(unsigned long usec)
+{
+    unsigned long cpt = clock_event->counts_per_tick;
+    return (usec / US_PER_TICKS) * cpt + (usec % US_PER_TICKS) * cpt / US_PER_TICKS;
+}
+
+static void clock_event_do_ticks(unsigned long ticks)
+{
+    systicks += ticks;
+    timer_ticks += ticks;
+    clock_event_ticks += ticks;
+    softirq_active(TIMER_SOFTIRQ);
+    softirq_active(SCHED_SOFTIRQ);
+}
+
+/* 把满一个节拍的计数转换成节拍 */
+static void clock_event_normalize(void)
+{
+    unsigned long cpt = clock_event->counts_per_tick;
+    if (clock_event_residue >= cpt) {
+        unsigned long ticks = clock_event_residue / cpt;
+        clock_event_residue -= ticks * cpt;
+        clock_event_do_ticks(ticks);
+    }
+}
+
+/* 把设备已经经过还没有记入的计数记入节拍 */
+static void clock_event_account(void)
+{
+    unsigned long elapsed = clock_event->elapsed(clock_event);
+    if (elapsed > clock_event_accounted) {
+        clock_event_residue += elapsed - clock_event_accounted;
+        clock_event_accounted = elapsed;
+    }
+    clock_event_normalize();
+}
+
+/**
+ * 单次模式下编程下一次中断：正常时是下一个节拍，停止节拍时是下一个定时器，
+ * 高精度定时器更早超时时用它的超时点
+ */
+static void clock_event_program(void)
+{
+    clock_event_device_t *dev = clock_event;
+    unsigned long cpt = dev->counts_per_tick;
+    unsigned long counts = cpt - clock_event_residue;
+    if (tick_stopped) {
+        long delta = (long) (timer_next_expiry() - timer_ticks);
+        long max_ticks = dev->max_counts / cpt;
+        if (delta > max_ticks)
+            delta = max_ticks;
+        if (delta > 1)
+            counts += (delta - 1) * cpt;
+    }
+    if (!list_empty(&hrtimer_list)) {
+        hrtimer_t *timer = list_first_owner(&hrtimer_list, hrtimer_t, list);
+        unsigned long long now = clock_event_now_us();
+        unsigned long hrcounts = 0;
+        if (timer->expires > now) {
+            unsigned long long delta = timer->expires - now;
+            unsigned long max_us = clock_event_counts_to_us(dev->max_counts);
+            hrcounts = clock_event_us_to_counts(delta > max_us ? max_us : (unsigned long) delta);
+        }
+        counts = min(counts, hrcounts);
+    }
+    if (counts < dev->min_counts)
+        counts = dev->min_counts;
+    if (counts > dev->max_counts)
+        counts = dev->max_counts;
+    clock_event_accounted = 0;
+    dev->set_oneshot(dev, counts);
+}
+
+/* 有高精度定时器或者停止了节拍时使用单次模式，否则回到周期模式 */
+static void clock_event_reprogram(void)
+{
+    clock_event_device_t *dev = clock_event;
+    if (!dev || !(dev->features & CLOCK_EVT_FEAT_ONESHOT))
+        return;
+    int oneshot = tick_stopped || !list_empty(&hrtimer_list);
+    if (!oneshot && clock_event_mode == CLOCK_EVT_MODE_PERIODIC)
+        return;
+    clock_event_account();
+    clock_event_accounted = 0;
+    if (oneshot) {
+        clock_event_mode = CLOCK_EVT_MODE_ONESHOT;
+        clock_event_program();
+    } else {
+        clock_event_mode = CLOCK_EVT_MODE_PERIODIC;
+        dev->set_periodic(dev);
+    }
+}
+
+static void hrtimer_run(void)
+{
+    hrtimer_t *timer;
+    if (list_empty(&hrtimer_list))
+        return;
+    unsigned long long now = clock_event_now_us();
+    while (!list_empty(&hrtimer_list)) {
+        timer = list_first_owner(&hrtimer_list, hrtimer_t, list);
+        if (timer->expires > now)
+            break;
+        list_del_init(&timer->list);
+        timer->callback(timer, timer->arg);
+    }
+}
+
+/**
+ * 时钟事件设备的中断处理，在关中断的情况下调用
+ */
+void clock_event_handle(void)
+{
+    if (!clock_event) {
+        clock_event_do_ticks(1);
+        return;
+    }
+    if (clock_event_mode == CLOCK_EVT_MODE_PERIODIC) {
+        /* 一个周期结束，设备已经重新开始计数 */
+        clock_event_residue += clock_event->counts_per_tick -
+            min(clock_event_accounted, clock_event->counts_per_tick);
+        clock_event_accounted = 0;
+        clock_event_normalize();
+    } else {
+        clock_event_account();
+    }
+    hrtimer_run();
+    clock_event_reprogram();
+}
+
+/**
+ * 开机后的微秒数，精度是时钟事件设备的计数
+ */
+unsigned long long clock_event_now_us(void)
+{
+    unsigned long flags;
+    unsigned long long now;
+    interrupt_save_and_disable(flags);
+    if (!clock_event) {
+        now = clock_event_ticks * US_PER_TICKS;
+    } else {
+        unsigned long counts = clock_event_residue;
+        unsigned long elapsed = clock_event->elapsed(clock_event);
+        if (elapsed > clock_event_accounted)
+            counts += elapsed - clock_event_accounted;
+        now = clock_event_ticks * US_PER_TICKS + clock_event_counts_to_us(counts);
+    }
+    if (now < clock_event_last_us)
+        now = clock_event_last_us;
+    else
+        clock_event_last_us = now;
+    interrupt_restore_state(flags);
+    return now;
+}
+
+/**
+ * 当前节拍中已经经过的微秒数，用来给节拍时间补上不满一个节拍的部分
+ */
+unsigned long clock_event_subtick_us(void)
+{
+    unsigned long flags;
+    unsigned long usec = 0;
+    interrupt_save_and_disable(flags);
+    if (clock_event) {
+        unsigned long counts = clock_event_residue;
+        unsigned long elapsed = clock_event->elapsed(clock_event);
+        if (elapsed > clock_event_accounted)
+            counts += elapsed - clock_event_accounted;
+        usec = clock_event_counts_to_us(counts);
+        if (usec >= US_PER_TICKS)
+            usec = US_PER_TICKS - 1;
+    }
+    interrupt_restore_state(flags);
+    return usec;
+}
+
+/**
+ * idle进入睡眠前调用，没有马上要到期的定时器时停止节拍，需要关中断。
+ * 节拍由启动cpu维护，所以只在启动cpu上停止。
+ */
+void tick_nohz_idle_enter(void)
+{
+    if (!clock_event || !(clock_event->features & CLOCK_EVT_FEAT_ONESHOT))
+        return;
+    if (cpu_get_my_id() != 0 || tick_stopped)
+        return;
+    if (!time_after(timer_next_expiry(), timer_ticks + 1))
+        return;
+    tick_stopped = 1;
+    clock_event_reprogram();
+}
+
+/* idle被唤醒后补上停止期间的节拍，恢复节拍 */
+void tick_nohz_idle_exit(void)
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (tick_stopped) {
+        tick_stopped = 0;
+        clock_event_reprogram();
+    }
+    interrupt_restore_state(flags);
+}
+
+/* 停止节拍时进入中断，先补上节拍，中断处理中看到的是正确的时间 */
+void tick_nohz_irq_enter(void)
+{
+    if (tick_stopped)
+        clock_event_account();
+}
+
+/* 停止节拍期间添加了更早的定时器，重新编程 */
+void tick_nohz_kick(void)
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (tick_stopped) {
+        clock_event_account();
+        clock_event_program();
+    }
+    interrupt_restore_state(flags);
+}
+
+void hrtimer_init(hrtimer_t *timer, hrtimer_callback_t callback, void *arg)
+{
+    list_init(&timer->list);
+    timer->expires = 0;
+    timer->callback = callback;
+    timer->arg = arg;
+}
+
+/**
+ * 启动高精度定时器，usec微秒后超时。
+ * 设备不支持单次模式时在下一个节拍检查，精度就是一个节拍。
+ */
+void hrtimer_start(hrtimer_t *timer, unsigned long usec)
+{
+    hrtimer_t *tmp;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (!list_empty(&timer->list))
+        list_del_init(&timer->list);
+    timer->expires = clock_event_now_us() + usec;
+    list_for_each_owner (tmp, &hrtimer_list, list) {
+        if (timer->expires < tmp->expires)
+            break;
+    }
+    list_add_before(&timer->list, &tmp->list);
+    if (list_first_owner(&hrtimer_list, hrtimer_t, list) == timer) {
+        if (clock_event_mode == CLOCK_EVT_MODE_ONESHOT) {
+            clock_event_account();
+            clock_event_program();
+        } else {
+            clock_event_reprogram();
+        }
+    }
+    interrupt_restore_state(flags);
+}
+
+/* 取消高精度定时器，定时器已经超时返回-1 */
+int hrtimer_cancel(hrtimer_t *timer)
+{
+    int retval = -1;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (!list_empty(&timer->list)) {
+        list_del_init(&timer->list);
+        retval = 0;
+    }
+    interrupt_restore_state(flags);
+    return retval;
+}
+
+/* 时钟事件设备支持单次模式时，高精度定时器才能比一个节拍更精确 */
+int hrtimer_available(void)
+{
+    return clock_event && (clock_event->features & CLOCK_EVT_FEAT_ONESHOT);
+}
+
+/**
+ * 注册时钟事件设备，评分更高的设备替换当前设备，从周期模式开始
+ */
+int clock_event_register(clock_event_device_t *dev)
+{
+    if (!dev || !dev->counts_per_tick || !(dev->features & CLOCK_EVT_FEAT_PERIODIC))
+        return -1;
+    if (dev->counts_per_tick * US_PER_TICKS / US_PER_TICKS != dev->counts_per_tick)
+        return -1;  /* 计数和微秒转换时不能溢出 */
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (clock_event && clock_event->rating >= dev->rating) {
+        interrupt_restore_state(flags);
+        return -1;
+    }
+    if (clock_event)
+        clock_event_account();
+    clock_event = dev;
+    clock_event_mode = CLOCK_EVT_MODE_PERIODIC;
+    clock_event_accounted = 0;
+    clock_event_residue = 0;
+    dev->set_periodic(dev);
+    interrupt_restore_state(flags);
+    keprint(PRINT_INFO "[clock] event device %s, %d counts per tick%s\n", dev->name,
+        dev->counts_per_tick, (dev->features & CLOCK_EVT_FEAT_ONESHOT) ? ", oneshot" : "");
+    return 0;
+}
@@ -2,6 +2,7 @@
 #include <xbook/task.h>
 #include <xbook/clock.h>
 #include <xbook/driver.h>
+#include <xbook/timepage.h>
 #include <errno.h>
 #include <stddef.h>
 
@@ -38,6 +39,8 @@ long sys_sysconf(int name)
         return 6;
     case _SC_VERSION:   /* posix version */
         return 199009L;
+    case _SC_TIMEPAGE:
+        return timepage_user_addr();
     default:
         break;
     }
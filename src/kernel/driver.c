@@ -44,6 +44,9 @@ DEFINE_SPIN_LOCK_UNLOCKED(driver_lock);
 /* 设备文件系统创建时间和日期 */
 static uint16_t devfs_create_time = 0, devfs_create_date = 0;
 
+static void io_unlock_device(device_object_t *devobj);
+static void io_end_async_dispatch(io_request_t *ioreq, iostatus_t status);
+
 static iostatus_t default_device_dispatch(device_object_t *device, io_request_t *ioreq)
 {
     ioreq->io_status.infomation = 0;
@@ -242,12 +245,15 @@ int driver_object_delete(driver_object_t *driver)
     return status;
 }
 
-void io_device_queue_init(device_queue_t *queue)
+/**
+ * 初始化设备队列，slots是slot_nr个slot_size大小的槽，slot_nr必须是2的n次幂
+ */
+int io_device_queue_init(device_queue_t *queue, void *slots,
+    unsigned int slot_size, unsigned int slot_nr)
 {
     spinlock_init(&queue->lock);
-    list_init(&queue->list_head);
     wait_queue_init(&queue->wait_queue);
-    queue->entry_count = 0;
+    return fifo_ring_init(&queue->ring, slots, slot_size, slot_nr);
 }
 
 device_object_t *io_iterative_search_device_by_type(device_object_t *devptr, device_type_t type)
@@ -357,6 +363,8 @@ iostatus_t io_create_device(
     devobj->driver = driver;
     spinlock_init(&devobj->lock.spinlock);    /* 初始化设备锁-自旋锁 */
     mutexlock_init(&devobj->lock.mutexlock);  /* 初始化设备锁-互斥锁 */
+    list_init(&devobj->pending_list);
+    spinlock_init(&devobj->pending_lock);
     spin_lock(&driver->device_lock);
     assert(!list_find(&devobj->list, &driver->device_list));
     list_add_tail(&devobj->list, &driver->device_list);
@@ -391,9 +399,12 @@ void io_delete_device(
     mem_free(devobj);
 }
 
+/* 每次IO都要分配请求，使用专用的缓存 */
+static mem_cache_t *io_request_cache;
+
 io_request_t *io_request_alloc()
 {
-    io_request_t *ioreq = mem_alloc(sizeof(io_request_t));
+    io_request_t *ioreq = mem_cache_alloc_object(io_request_cache);
     if (ioreq)
         memset(ioreq, 0, sizeof(io_request_t));
     return ioreq;
@@ -401,6 +412,13 @@ io_request_t *io_request_alloc()
 
 void io_request_free(io_request_t *ioreq)
 {
+    /* 异步请求可能在中断中完成，缓冲区在这里才释放 */
+    if (ioreq->flags & IOREQ_ASYNC) {
+        if (ioreq->system_buffer)
+            mem_free(ioreq->system_buffer);
+        if (ioreq->mdl_address)
+            mdl_free(ioreq->mdl_address);
+    }
     mem_free(ioreq);    
 }
 
@@ -410,6 +428,19 @@ iostatus_t io_call_dirver(device_object_t *device, io_request_t *ioreq)
 
     driver_dispatch_t func = NULL;
 
+    if (ioreq->flags & IOREQ_ASYNC) {
+        /* 异步请求在完成前都挂在设备的未决队列上，用于取消 */
+        unsigned long irqflags;
+        spin_lock_irqsave(&device->pending_lock, irqflags);
+        ioreq->flags |= IOREQ_DISPATCHING;
+        list_add_tail(&ioreq->pending_list, &device->pending_list);
+        spin_unlock_irqrestore(&device->pending_lock, irqflags);
+    }
+
+    /* 驱动自己处理并发时，不需要设备锁 */
+    if (device->flags & DO_ASYNC_IO)
+        goto dispatch;
+
     /* 根据设备类型选择不同的锁 */
     switch (device->type)
     {
@@ -431,7 +462,7 @@ iostatus_t io_call_dirver(device_object_t *device, io_request_t *ioreq)
     default:
         break;
     }
-
+dispatch:
     if (ioreq->flags & IOREQ_OPEN_OPERATION) {
         func = device->driver->dispatch_function[IOREQ_OPEN];
     } else if (ioreq->flags & IOREQ_CLOSE_OPERATION) {
@@ -447,6 +478,8 @@ iostatus_t io_call_dirver(device_object_t *device, io_request_t *ioreq)
     }
     if (func) 
         status = func(device, ioreq);
+    if (ioreq->flags & IOREQ_ASYNC)
+        io_end_async_dispatch(ioreq, func ? status : IO_FAILED);
     return status;
 }
 
@@ -565,14 +598,213 @@ io_request_t *io_build_sync_request(
     return ioreq;
 }
 
+/**
+ * 创建一个异步请求，buffer必须是内核内存，请求完成时在任意上下文中调用completion，
+ * 没有completion时可以用io_wait_request等待完成，之后由调用者释放请求
+ */
+io_request_t *io_build_async_request(
+    unsigned long function,
+    device_object_t *devobj,
+    void *buffer,
+    unsigned long length,
+    unsigned long offset,
+    io_completion_t completion,
+    void *context
+){
+    io_request_t *ioreq = io_build_sync_request(function, devobj, buffer, length, offset, NULL);
+    if (ioreq == NULL)
+        return NULL;
+    ioreq->flags |= IOREQ_ASYNC;
+    list_init(&ioreq->pending_list);
+    ioreq->completion = completion;
+    ioreq->context = context;
+    ioreq->cancel_routine = NULL;
+    wait_queue_init(&ioreq->wait_queue);
+    return ioreq;
+}
+
+/**
+ * 异步请求的完成处理。回调和等待者都可能释放请求，
+ * 唤醒和回调之后都不能再访问请求
+ */
+static void io_async_request_done(io_request_t *ioreq)
+{
+    io_completion_t completion = ioreq->completion;
+    void *context = ioreq->context;
+    wait_queue_t *wait_queue = &ioreq->wait_queue;
+    task_t *task, *next;
+    unsigned long irqflags;
+    if (completion) {
+        completion(ioreq, context);
+        return;
+    }
+    /* 等待者在等待队列的锁中检查IOREQ_DONE，解锁后请求就可能被释放 */
+    spin_lock_irqsave(&wait_queue->lock, irqflags);
+    ioreq->flags |= IOREQ_DONE;
+    list_for_each_owner_safe (task, next, &wait_queue->wait_list, list) {
+        list_del(&task->list);
+        TASK_LEAVE_WAITLIST(task);
+        task_wakeup(task);
+    }
+    spin_unlock_irqrestore(&wait_queue->lock, irqflags);
+}
+
+/* 异步请求完成，可能在中断上下文中 */
+static void io_complete_async_request(io_request_t *ioreq)
+{
+    device_object_t *devobj = ioreq->devobj;
+    unsigned long irqflags;
+    int dispatching;
+
+    if (ioreq->flags & IOREQ_BUFFERED_IO) {
+        /* 异步请求的缓冲区都在内核中，可以直接复制 */
+        if ((ioreq->flags & IOREQ_READ_OPERATION) &&
+            IO_STATUS_MASK(ioreq->io_status.status) == IO_SUCCESS)
+            memcpy(ioreq->user_buffer, ioreq->system_buffer, ioreq->io_status.infomation);
+    }
+    spin_lock_irqsave(&devobj->pending_lock, irqflags);
+    list_del_init(&ioreq->pending_list);
+    ioreq->cancel_routine = NULL;
+    ioreq->flags |= IOREQ_COMPLETION;
+    dispatching = ioreq->flags & IOREQ_DISPATCHING;
+    spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+    /* 在派遣函数中就完成了，回调推迟到派遣返回后再调用，避免派遣时请求被释放 */
+    if (!dispatching)
+        io_async_request_done(ioreq);
+}
+
+/**
+ * 派遣函数返回后，处理同步完成的请求，没有挂起也没有完成的请求由框架完成。
+ * 设备锁由派遣的任务持有，也在这里释放，请求可能在中断中完成，不能在完成时释放
+ */
+static void io_end_async_dispatch(io_request_t *ioreq, iostatus_t status)
+{
+    device_object_t *devobj = ioreq->devobj;
+    unsigned long irqflags;
+    int done;
+    if (!(devobj->flags & DO_ASYNC_IO))
+        io_unlock_device(devobj);
+    spin_lock_irqsave(&devobj->pending_lock, irqflags);
+    ioreq->flags &= ~IOREQ_DISPATCHING;
+    done = ioreq->flags & IOREQ_COMPLETION;
+    spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+    if (done) {
+        io_async_request_done(ioreq);
+    } else if (!(status & IO_PENDING)) {
+        ioreq->io_status.status = status;
+        io_complete_request(ioreq);
+    }
+}
+
 void io_complete_request(io_request_t *ioreq)
 {
     if (ioreq->io_status.status == IO_FAILED)
         ioreq->io_status.infomation = -1;
     
+    if (ioreq->flags & IOREQ_ASYNC) {
+        /* 设备锁在派遣返回后由派遣的任务释放 */
+        io_complete_async_request(ioreq);
+        return;
+    }
     ioreq->flags |= IOREQ_COMPLETION;
+    if (ioreq->devobj->flags & DO_ASYNC_IO)
+        return;
+    io_unlock_device(ioreq->devobj);
+}
+
+/* 等待没有完成回调的异步请求完成，返回请求状态 */
+iostatus_t io_wait_request(io_request_t *ioreq)
+{
+    wait_queue_t *wait_queue = &ioreq->wait_queue;
+    unsigned long flags;
+    while (1) {
+        /* 完成处理在等待队列的锁中设置IOREQ_DONE，之后不会再访问请求 */
+        spin_lock_irqsave(&wait_queue->lock, flags);
+        if (ioreq->flags & IOREQ_DONE) {
+            spin_unlock_irqrestore(&wait_queue->lock, flags);
+            break;
+        }
+        list_add_tail(&task_current->list, &wait_queue->wait_list);
+        TASK_ENTER_WAITLIST(task_current);
+        spin_unlock(&wait_queue->lock);
+        task_block(TASK_BLOCKED);
+        interrupt_restore_state(flags);
+    }
+    return ioreq->io_status.status;
+}
+
+/**
+ * 驱动挂起异步请求前设置取消例程
+ * @return: 请求已经被取消时返回-1，驱动需要以IO_CANCELED完成请求
+ */
+int io_set_cancel_routine(io_request_t *ioreq, io_cancel_t routine)
+{
+    device_object_t *devobj = ioreq->devobj;
+    unsigned long irqflags;
+    spin_lock_irqsave(&devobj->pending_lock, irqflags);
+    if (ioreq->flags & IOREQ_CANCELED) {
+        spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+        return -1;
+    }
+    ioreq->cancel_routine = routine;
+    spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+    return 0;
+}
+
+/**
+ * 取消异步请求，驱动的取消例程负责以IO_CANCELED完成请求
+ * @return: 成功调用取消例程返回0，请求已经完成或者无法取消返回-1
+ */
+int io_cancel_request(io_request_t *ioreq)
+{
+    device_object_t *devobj = ioreq->devobj;
+    io_cancel_t routine;
+    unsigned long irqflags;
+    spin_lock_irqsave(&devobj->pending_lock, irqflags);
+    if (ioreq->flags & IOREQ_COMPLETION) {
+        spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+        return -1;
+    }
+    ioreq->flags |= IOREQ_CANCELED;
+    routine = ioreq->cancel_routine;
+    ioreq->cancel_routine = NULL;
+    spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+    if (!routine)   /* 请求正在被硬件处理，等待它自然完成 */
+        return -1;
+    routine(devobj, ioreq);
+    return 0;
+}
+
+/* 取消设备上所有可以取消的异步请求 */
+void io_cancel_device_requests(device_object_t *devobj)
+{
+    io_request_t *ioreq;
+    io_cancel_t routine;
+    unsigned long irqflags;
+    spin_lock_irqsave(&devobj->pending_lock, irqflags);
+    while (1) {
+        routine = NULL;
+        list_for_each_owner (ioreq, &devobj->pending_list, pending_list) {
+            if (ioreq->cancel_routine) {
+                ioreq->flags |= IOREQ_CANCELED;
+                routine = ioreq->cancel_routine;
+                ioreq->cancel_routine = NULL;
+                break;
+            }
+        }
+        if (!routine)
+            break;
+        spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+        routine(devobj, ioreq);
+        spin_lock_irqsave(&devobj->pending_lock, irqflags);
+    }
+    spin_unlock_irqrestore(&devobj->pending_lock, irqflags);
+}
+
+static void io_unlock_device(device_object_t *devobj)
+{
     /* 根据设备类型选择不同的锁 */
-    switch (ioreq->devobj->type)
+    switch (devobj->type)
     {
     case DEVICE_TYPE_SERIAL_PORT:
     case DEVICE_TYPE_SCREEN:
@@ -582,12 +814,12 @@ void io_complete_request(io_request_t *ioreq)
     case DEVICE_TYPE_BEEP:
     case DEVICE_TYPE_VIEW:
     case DEVICE_TYPE_SOUND:
-        spin_unlock(&ioreq->devobj->lock.spinlock);
+        spin_unlock(&devobj->lock.spinlock);
         break;
     case DEVICE_TYPE_DISK:
     case DEVICE_TYPE_NETWORK:
     case DEVICE_TYPE_PHYSIC_NETCARD:
-        mutex_unlock(&ioreq->devobj->lock.mutexlock);
+        mutex_unlock(&devobj->lock.mutexlock);
         break;
     default:
         break;
@@ -605,68 +837,43 @@ static int io_complete_check(io_request_t *ioreq, iostatus_t status)
     return -1;
 }
 
-void io_device_queue_cleanup(device_queue_t *queue)
-{
-    device_queue_entry_t *entry, *next;
-    unsigned long irqflags;
-    spin_lock_irqsave(&queue->lock, irqflags);
-    list_for_each_owner_safe (entry, next, &queue->list_head, list) {
-        list_del(&entry->list);
-        mem_free(entry);
-    }
-    spin_unlock_irqrestore(&queue->lock, irqflags);
-}
-
-iostatus_t io_device_queue_append(device_queue_t *queue, unsigned char *buf, int len)
+/**
+ * 放入一个槽，只能由设备唯一的生产者调用（中断或者轮询），不加锁也不分配内存。
+ * 队列满时丢弃，返回IO_FAILED。
+ */
+iostatus_t io_device_queue_append(device_queue_t *queue, void *slot)
 {
-    unsigned long irqflags;
-    spin_lock_irqsave(&queue->lock, irqflags);
-    if (queue->entry_count > DEVICE_QUEUE_ENTRY_NR) { /* 超过队列项数，就先丢弃数据包 */
-        spin_unlock_irqrestore(&queue->lock, irqflags);
-        return IO_FAILED;
-    }
-    device_queue_entry_t *entry = mem_alloc(sizeof(device_queue_entry_t) + len);
-    if (entry == NULL) {
-        spin_unlock_irqrestore(&queue->lock, irqflags);
+    if (fifo_ring_put(&queue->ring, slot) < 0)
         return IO_FAILED;
-    }
-    list_add_tail(&entry->list, &queue->list_head);
-    queue->entry_count++;
-    entry->buf = (unsigned char *) (entry + 1);
-    entry->length = len;
-    memcpy(entry->buf, buf, len);
-    spin_unlock_irqrestore(&queue->lock, irqflags);
     wait_queue_wakeup(&queue->wait_queue);
     return IO_SUCCESS;
 }
 
-int io_device_queue_pickup(device_queue_t *queue, unsigned char *buf, int buflen, int flags)
+/**
+ * 批量取出最多nr个槽，返回取出的个数。
+ * 没有IO_NOWAIT标志时至少等到一个槽，否则队列为空时返回-1。
+ */
+int io_device_queue_pickup(device_queue_t *queue, void *slots, int nr, int flags)
 {
     unsigned long irqflags;
+    int count;
+    if (nr <= 0)
+        return -1;
     spin_lock_irqsave(&queue->lock, irqflags);
-    if (!queue->entry_count) {  /* 没有数据包 */
+    while (fifo_ring_empty(&queue->ring)) {  /* 唤醒后可能已经被别的读者取走 */
         if (flags & IO_NOWAIT) {    /* 不进行等待 */
             spin_unlock_irqrestore(&queue->lock, irqflags);
             return -1;    
         }
+        /* 生产者不拿读者的锁，检查和阻塞之间要一直关着中断，避免丢失唤醒 */
         wait_queue_add(&queue->wait_queue, task_current);
-        spin_unlock_irqrestore(&queue->lock, irqflags);
+        spin_unlock(&queue->lock);
         task_block(TASK_BLOCKED);
-        spin_lock_irqsave(&queue->lock, irqflags);   
-    }
-    device_queue_entry_t *entry;
-    entry = list_first_owner(&queue->list_head, device_queue_entry_t, list);
-    list_del(&entry->list);
-    queue->entry_count--;
-    int len = MIN(entry->length, buflen);
-    memcpy(buf, entry->buf, len);
-    mem_free(entry);
+        spin_lock(&queue->lock);
+    }
+    count = fifo_ring_get(&queue->ring, slots, nr);
     spin_unlock_irqrestore(&queue->lock, irqflags);
-#if DEBUG_LOCLA == 1
-    keprint(PRINT_DEBUG "io_device_queue_get: pid=%d len=%d.\n",
-        queue->wait_queue.task->pid, len);
-#endif            
-    return len;
+    return count;
 }
 
 iostatus_t io_device_increase_reference(device_object_t *devobj)
@@ -811,8 +1018,11 @@ void *device_mmap(handle_t handle, size_t length, int flags)
             // dbgprint("device memmap paddr=%x, len=%x\n", ioreq->io_status.infomation, length);
 
             if (flags & IO_KERNEL) {
-                // 设备映射到内核地址中
-                mapaddr = memio_remap(ioreq->io_status.infomation, length);
+                // 设备映射到内核地址中，显存使用写合并
+                if (devobj->type == DEVICE_TYPE_VIDEO)
+                    mapaddr = memio_remap_wc(ioreq->io_status.infomation, length);
+                else
+                    mapaddr = memio_remap(ioreq->io_status.infomation, length);
             } else {
                 switch (devobj->type) {
                 case DEVICE_TYPE_VIEW:
@@ -1076,35 +1286,32 @@ int device_probe_unused(const char *name, char *buf, size_t buflen)
 
 int input_even_init(input_even_buf_t *evbuf)
 {
-    spinlock_init(&evbuf->lock);
-    evbuf->head = evbuf->tail = 0;
     memset(evbuf->evbuf, 0, sizeof(input_event_t) * EVBUF_SIZE);
-    return 0;
+    return io_device_queue_init(&evbuf->queue, evbuf->evbuf,
+        sizeof(input_event_t), EVBUF_SIZE);
 }
 
-
+/* 在输入设备的中断中调用，缓冲区满时丢弃新的事件 */
 int input_even_put(input_even_buf_t *evbuf, input_event_t *even)
 {
-    unsigned long flags;
-    spin_lock_irqsave(&evbuf->lock, flags);
-    evbuf->evbuf[evbuf->head++] = *even;
-    evbuf->head &= EVBUF_SIZE - 1;
-    spin_unlock_irqrestore(&evbuf->lock, flags);
+    if (io_device_queue_append(&evbuf->queue, even) != IO_SUCCESS)
+        return -1;
     return 0;
 }
 
+/* 不等待地取出一个事件 */
 int input_even_get(input_even_buf_t *evbuf, input_event_t *even)
 {
-    unsigned long flags;
-    spin_lock_irqsave(&evbuf->lock, flags);
-    if (evbuf->head == evbuf->tail) {
-        spin_unlock_irqrestore(&evbuf->lock, flags);
-        return -1;    
-    }
-    *even = evbuf->evbuf[evbuf->tail++];
-    evbuf->tail &= EVBUF_SIZE - 1;
-    spin_unlock_irqrestore(&evbuf->lock, flags);
-    return 0;
+    return io_device_queue_pickup(&evbuf->queue, even, 1, IO_NOWAIT) == 1 ? 0 : -1;
+}
+
+/**
+ * 一次读取最多nr个事件，返回读取的个数。
+ * 没有IO_NOWAIT标志时至少等到一个事件，否则没有事件时返回-1。
+ */
+int input_even_read(input_even_buf_t *evbuf, input_event_t *evens, int nr, int flags)
+{
+    return io_device_queue_pickup(&evbuf->queue, evens, nr, flags);
 }
 
 /**
@@ -1152,6 +1359,18 @@ static int devif_open(void *pathname, int flags)
     return FSAL_FILE2IDX(fp);
 }
 
+/* 把devfs的文件索引转换成设备句柄，不是设备文件返回-1 */
+handle_t devfs_file_to_handle(int idx)
+{
+    if (FSAL_BAD_FILE_IDX(idx))
+        return -1;
+    fsal_file_t *fp = FSAL_IDX2FILE(idx);
+    if (FSAL_BAD_FILE(fp) || fp->fsal != &devfs_fsal)
+        return -1;
+    devfs_file_extention_t *ext = (devfs_file_extention_t *) fp->extension;
+    return ext->handle;
+}
+
 static int devif_close(int handle)
 {
     if (FSAL_BAD_FILE_IDX(handle))
@@ -1222,6 +1441,8 @@ static int devif_ioctl(int idx, int cmd, void *arg)
     fsal_file_t *fp = FSAL_IDX2FILE(idx);
     if (FSAL_BAD_FILE(fp)) 
         return -1;
+    if (DEVCTL_IS_KERNEL(cmd))
+        return -EPERM;
     devfs_file_extention_t *ext = (devfs_file_extention_t *) fp->extension;
     return device_devctl(ext->handle, cmd, (unsigned long) arg);
 }
@@ -1515,6 +1736,9 @@ void driver_framewrok_init()
     for (i = 0; i < DEVICE_HANDLE_NR; i++) {
         device_handle_table[i] = NULL;
     }
+    io_request_cache = mem_cache_create("io request", sizeof(io_request_t), 0);
+    if (!io_request_cache)
+        panic("driver framework: create io request cache failed!\n");
 
     /* devfs */
     memset(&devfs_fsal, 0, sizeof(fsal_t));
@@ -1,5 +1,6 @@
 #include <xbook/hardirq.h>
 #include <xbook/memalloc.h>
+#include <xbook/clockevent.h>
 #include <stddef.h>
 #include <types.h>
 
@@ -134,6 +135,7 @@ int irq_handle(irqno_t irq, trap_frame_t *frame)
     irq_description_t *irq_desc = irq_description_get(irq);
     if (!irq_desc) 
         return -1;
+    tick_nohz_irq_enter();
     irq_action_t *action = irq_desc->action;
     while (action)
     {
@@ -0,0 +1,273 @@
+#include <xbook/ioring.h>
+#include <xbook/driver.h>
+#include <xbook/memcache.h>
+#include <xbook/schedule.h>
+#include <xbook/safety.h>
+#include <xbook/debug.h>
+#include <xbook/fd.h>
+#include <arch/interrupt.h>
+#include <string.h>
+#include <errno.h>
+
+/* 任务已经退出但是还有请求未完成的上下文，在进程上下文中回收 */
+static LIST_HEAD(io_context_dead_list);
+DEFINE_SPIN_LOCK_UNLOCKED(io_context_dead_lock);
+
+static void ioring_req_free(ioring_req_t *req)
+{
+    if (req->ioreq)
+        io_request_free(req->ioreq);
+    if (req->kbuf)
+        mem_free(req->kbuf);
+    mem_free(req);
+}
+
+/* 取出一个完成的请求，需要持有上下文的锁 */
+static ioring_req_t *io_context_pop(io_context_t *ctx)
+{
+    if (ctx->tail == ctx->head)
+        return NULL;
+    return ctx->ring[ctx->tail++ & (IORING_ENTRY_NR - 1)];
+}
+
+/* 释放已经退出的任务留下的上下文，不能在中断中调用 */
+static void io_context_reap_dead()
+{
+    LIST_HEAD(reap_list);
+    io_context_t *ctx, *next;
+    ioring_req_t *req;
+    unsigned long irqflags;
+    int busy;
+    /* 先摘到本地链表，释放内存时不需要持有回收链表的锁 */
+    spin_lock_irqsave(&io_context_dead_lock, irqflags);
+    list_for_each_owner_safe (ctx, next, &io_context_dead_list, list)
+        list_move_tail(&ctx->list, &reap_list);
+    spin_unlock_irqrestore(&io_context_dead_lock, irqflags);
+
+    list_for_each_owner_safe (ctx, next, &reap_list, list) {
+        spin_lock_irqsave(&ctx->lock, irqflags);
+        while ((req = io_context_pop(ctx)) != NULL) {
+            spin_unlock_irqrestore(&ctx->lock, irqflags);
+            ioring_req_free(req);
+            spin_lock_irqsave(&ctx->lock, irqflags);
+        }
+        busy = ctx->inflight;
+        spin_unlock_irqrestore(&ctx->lock, irqflags);
+        list_del(&ctx->list);
+        if (busy) {     /* 还有请求在硬件中，下次再回收 */
+            spin_lock_irqsave(&io_context_dead_lock, irqflags);
+            list_add_tail(&ctx->list, &io_context_dead_list);
+            spin_unlock_irqrestore(&io_context_dead_lock, irqflags);
+        } else {
+            mem_free(ctx);
+        }
+    }
+}
+
+static io_context_t *io_context_get(task_t *task)
+{
+    if (task->io_context)
+        return task->io_context;
+    io_context_t *ctx = mem_alloc(sizeof(io_context_t));
+    if (!ctx)
+        return NULL;
+    memset(ctx, 0, sizeof(io_context_t));
+    list_init(&ctx->list);
+    spinlock_init(&ctx->lock);
+    list_init(&ctx->inflight_list);
+    wait_queue_init(&ctx->wait_queue);
+    task->io_context = ctx;
+    return ctx;
+}
+
+/* 驱动请求完成回调，可能在中断上下文中 */
+static void ioring_complete(io_request_t *ioreq, void *context)
+{
+    ioring_req_t *req = (ioring_req_t *) context;
+    io_context_t *ctx = req->ctx;
+    unsigned long irqflags;
+    if (IO_STATUS_MASK(ioreq->io_status.status) == IO_SUCCESS)
+        req->result = ioreq->io_status.infomation;
+    else if (ioreq->io_status.status & IO_CANCELED)
+        req->result = -ECANCELED;
+    else if (IO_ERRNO_MASK(ioreq->io_status.status))
+        req->result = -IO_ERRNO_MASK(ioreq->io_status.status);
+    else
+        req->result = -EIO;
+
+    spin_lock_irqsave(&ctx->lock, irqflags);
+    list_del(&req->list);
+    ctx->inflight--;
+    /* 提交前已经保证了完成环有空位 */
+    ctx->ring[ctx->head++ & (IORING_ENTRY_NR - 1)] = req;
+    /* 解锁后退出的任务就可能回收上下文，检查和唤醒都要在锁中完成 */
+    if (!ctx->dead)
+        wait_queue_wakeup_all(&ctx->wait_queue);
+    spin_unlock_irqrestore(&ctx->lock, irqflags);
+}
+
+static int ioring_submit_one(io_context_t *ctx, iocb_t *iocb)
+{
+    unsigned long function;
+    if (iocb->opcode == IOCB_CMD_READ)
+        function = IOREQ_READ;
+    else if (iocb->opcode == IOCB_CMD_WRITE)
+        function = IOREQ_WRITE;
+    else
+        return -EINVAL;
+    if (!iocb->buf || !iocb->length || iocb->length > IORING_BUF_MAX)
+        return -EINVAL;
+    file_fd_t *ffd = fd_local_to_file(iocb->fd);
+    if (FILE_FD_IS_BAD(ffd))
+        return -EBADF;
+    handle_t handle = devfs_file_to_handle(ffd->handle);
+    if (IS_BAD_DEVICE_HANDLE(handle))   /* 只支持设备文件 */
+        return -ENODEV;
+    device_object_t *devobj = GET_DEVICE_BY_HANDLE(handle);
+    if (!devobj)
+        return -ENODEV;
+
+    ioring_req_t *req = mem_alloc(sizeof(ioring_req_t));
+    if (!req)
+        return -ENOMEM;
+    memset(req, 0, sizeof(ioring_req_t));
+    req->ctx = ctx;
+    req->iocb = *iocb;
+    req->kbuf = mem_alloc(iocb->length);
+    if (!req->kbuf) {
+        mem_free(req);
+        return -ENOMEM;
+    }
+    if (function == IOREQ_WRITE) {
+        if (mem_copy_from_user(req->kbuf, iocb->buf, iocb->length) < 0) {
+            ioring_req_free(req);
+            return -EFAULT;
+        }
+    } else {
+        /* 提前检查用户缓冲区，收割时才复制 */
+        if (safety_check_range(iocb->buf, iocb->length) < 0) {
+            ioring_req_free(req);
+            return -EFAULT;
+        }
+    }
+    req->ioreq = io_build_async_request(function, devobj, req->kbuf, iocb->length,
+        iocb->offset, ioring_complete, req);
+    if (!req->ioreq) {
+        ioring_req_free(req);
+        return -ENOMEM;
+    }
+    unsigned long irqflags;
+    spin_lock_irqsave(&ctx->lock, irqflags);
+    list_add_tail(&req->list, &ctx->inflight_list);
+    ctx->inflight++;
+    spin_unlock_irqrestore(&ctx->lock, irqflags);
+    /* 同步完成的请求也通过回调进入完成环 */
+    io_call_dirver(devobj, req->ioreq);
+    return 0;
+}
+
+/**
+ * 提交一组请求，返回成功提交的个数。
+ * 未完成和未收割的请求总数不超过IORING_ENTRY_NR，超出时返回已经提交的个数。
+ */
+int sys_io_submit(iocb_t *iocbs, int nr)
+{
+    if (!iocbs || nr <= 0)
+        return -EINVAL;
+    io_context_reap_dead();
+    io_context_t *ctx = io_context_get(task_current);
+    if (!ctx)
+        return -ENOMEM;
+    iocb_t iocb;
+    unsigned long irqflags;
+    int i, err;
+    for (i = 0; i < nr; i++) {
+        spin_lock_irqsave(&ctx->lock, irqflags);
+        int used = ctx->inflight + (ctx->head - ctx->tail);
+        spin_unlock_irqrestore(&ctx->lock, irqflags);
+        if (used >= IORING_ENTRY_NR)
+            break;
+        if (mem_copy_from_user(&iocb, &iocbs[i], sizeof(iocb_t)) < 0) {
+            err = -EFAULT;
+            goto out;
+        }
+        if ((err = ioring_submit_one(ctx, &iocb)) < 0)
+            goto out;
+    }
+    return i;
+out:
+    return i > 0 ? i : err;
+}
+
+/**
+ * 收割完成事件，至少等到min_nr个事件（或者没有未完成的请求），最多返回nr个
+ */
+int sys_io_getevents(ioevent_t *events, int min_nr, int nr)
+{
+    if (!events || nr <= 0 || min_nr < 0 || min_nr > nr)
+        return -EINVAL;
+    io_context_t *ctx = task_current->io_context;
+    if (!ctx)
+        return 0;
+    ioring_req_t *req;
+    ioevent_t event;
+    unsigned long irqflags;
+    int count = 0;
+    while (count < nr) {
+        spin_lock_irqsave(&ctx->lock, irqflags);
+        req = io_context_pop(ctx);
+        if (!req) {
+            if (count >= min_nr || !ctx->inflight) {
+                spin_unlock_irqrestore(&ctx->lock, irqflags);
+                break;
+            }
+            wait_queue_add(&ctx->wait_queue, task_current);
+            spin_unlock(&ctx->lock);
+            task_block(TASK_BLOCKED);
+            interrupt_restore_state(irqflags);
+            if (exception_cause_exit_when_wait(&task_current->exception_manager))
+                break;
+            continue;
+        }
+        spin_unlock_irqrestore(&ctx->lock, irqflags);
+        event.user_data = req->iocb.user_data;
+        event.result = req->result;
+        if (req->result > 0 && req->iocb.opcode == IOCB_CMD_READ) {
+            if (mem_copy_to_user(req->iocb.buf, req->kbuf, req->result) < 0)
+                event.result = -EFAULT;
+        }
+        ioring_req_free(req);
+        if (mem_copy_to_user(&events[count], &event, sizeof(ioevent_t)) < 0)
+            return count > 0 ? count : -EFAULT;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * 任务退出或者执行新程序时释放异步IO上下文。
+ * 可以取消的请求立即取消，正在被硬件处理的请求完成后再回收。
+ */
+void io_context_exit(task_t *task)
+{
+    io_context_t *ctx = task->io_context;
+    if (!ctx)
+        return;
+    task->io_context = NULL;
+    io_request_t *inflight[IORING_ENTRY_NR];
+    ioring_req_t *req;
+    unsigned long irqflags;
+    int i, n = 0;
+    spin_lock_irqsave(&ctx->lock, irqflags);
+    ctx->dead = 1;
+    list_for_each_owner (req, &ctx->inflight_list, list)
+        inflight[n++] = req->ioreq;
+    spin_unlock_irqrestore(&ctx->lock, irqflags);
+    /* 上下文加入回收链表前，完成的请求不会被释放，可以安全地取消 */
+    for (i = 0; i < n; i++)
+        io_cancel_request(inflight[i]);
+    spin_lock_irqsave(&io_context_dead_lock, irqflags);
+    list_add_tail(&ctx->list, &io_context_dead_list);
+    spin_unlock_irqrestore(&io_context_dead_lock, irqflags);
+    io_context_reap_dead();
+}
@@ -0,0 +1,152 @@
+#include <xbook/netbuf.h>
+#include <xbook/memalloc.h>
+#include <xbook/debug.h>
+#include <xbook/schedule.h>
+#include <string.h>
+
+static netbuf_t *netbuf_table;
+static LIST_HEAD(netbuf_free_list);
+static int netbuf_free_nr;
+DEFINE_SPIN_LOCK_UNLOCKED(netbuf_lock);
+
+/**
+ * 从缓冲池中分配一个缓冲区，可以在中断中调用
+ */
+netbuf_t *netbuf_alloc()
+{
+    netbuf_t *nb = NULL;
+    unsigned long irqflags;
+    spin_lock_irqsave(&netbuf_lock, irqflags);
+    if (!list_empty(&netbuf_free_list)) {
+        nb = list_first_owner(&netbuf_free_list, netbuf_t, list);
+        list_del_init(&nb->list);
+        netbuf_free_nr--;
+    }
+    spin_unlock_irqrestore(&netbuf_lock, irqflags);
+    if (nb)
+        nb->length = 0;
+    return nb;
+}
+
+/**
+ * 把缓冲区归还给缓冲池，可以在中断中调用
+ */
+void netbuf_free(netbuf_t *nb)
+{
+    unsigned long irqflags;
+    spin_lock_irqsave(&netbuf_lock, irqflags);
+    list_add(&nb->list, &netbuf_free_list);  /* 刚释放的缓冲区还在缓存中，优先使用 */
+    netbuf_free_nr++;
+    spin_unlock_irqrestore(&netbuf_lock, irqflags);
+}
+
+int netbuf_free_count()
+{
+    return netbuf_free_nr;
+}
+
+void netbuf_queue_init(netbuf_queue_t *queue)
+{
+    io_device_queue_init(&queue->queue, queue->slots, sizeof(netbuf_t *), NETBUF_QUEUE_MAX);
+}
+
+/**
+ * 把接收到的缓冲区放入队列，只能由网卡的接收轮询调用。
+ * 队列满时返回-1，由调用者处理缓冲区。
+ */
+int netbuf_queue_put(netbuf_queue_t *queue, netbuf_t *nb)
+{
+    if (io_device_queue_append(&queue->queue, &nb) != IO_SUCCESS)
+        return -1;
+    return 0;
+}
+
+/**
+ * 从队列中取出一个缓冲区，缓冲区由调用者释放。
+ * 没有IO_NOWAIT标志时阻塞到有数据包为止。
+ */
+netbuf_t *netbuf_queue_get(netbuf_queue_t *queue, int flags)
+{
+    netbuf_t *nb;
+    if (io_device_queue_pickup(&queue->queue, &nb, 1, flags) != 1)
+        return NULL;
+    return nb;
+}
+
+/**
+ * 一次取出最多nr个缓冲区，返回取出的个数，没有数据包并且是IO_NOWAIT时返回-1
+ */
+int netbuf_queue_get_batch(netbuf_queue_t *queue, netbuf_t **nbs, int nr, int flags)
+{
+    return io_device_queue_pickup(&queue->queue, nbs, nr, flags);
+}
+
+/**
+ * 取出一个数据包复制到buf中并释放缓冲区，用于普通的读请求
+ */
+int netbuf_queue_read(netbuf_queue_t *queue, void *buf, size_t buflen, int flags)
+{
+    netbuf_t *nb = netbuf_queue_get(queue, flags);
+    if (!nb)
+        return -1;
+    int len = min(nb->length, buflen);
+    memcpy(buf, nb->data, len);
+    netbuf_free(nb);
+    return len;
+}
+
+/**
+ * 释放队列中所有的缓冲区，关闭设备时调用
+ */
+void netbuf_queue_flush(netbuf_queue_t *queue)
+{
+    netbuf_t *nbs[16];
+    int i, n;
+    while ((n = netbuf_queue_get_batch(queue, nbs, 16, IO_NOWAIT)) > 0) {
+        for (i = 0; i < n; i++)
+            netbuf_free(nbs[i]);
+    }
+}
+
+/**
+ * 把发送请求的所有分段复制到连续的缓冲区中，用于不支持分散/聚集的网卡。
+ * 返回复制的长度，缓冲区不够时返回-1。
+ */
+int netbuf_sg_copy(netbuf_sg_t *sg, void *buf, size_t buflen)
+{
+    unsigned char *p = buf;
+    int i;
+    if (sg->total > buflen)
+        return -1;
+    for (i = 0; i < sg->count; i++) {
+        memcpy(p, sg->seg[i].addr, sg->seg[i].len);
+        p += sg->seg[i].len;
+    }
+    return sg->total;
+}
+
+int netbuf_init()
+{
+    int i;
+    netbuf_table = mem_alloc(sizeof(netbuf_t) * NETBUF_NR);
+    if (!netbuf_table)
+        return -1;
+    /* 缓冲区按照NETBUF_SIZE对齐，保证不跨页，DMA时物理地址连续 */
+    unsigned char *data = mem_alloc_align(NETBUF_SIZE * NETBUF_NR, NETBUF_SIZE);
+    if (!data) {
+        mem_free(netbuf_table);
+        netbuf_table = NULL;
+        return -1;
+    }
+    for (i = 0; i < NETBUF_NR; i++) {
+        netbuf_t *nb = &netbuf_table[i];
+        nb->head = data + i * NETBUF_SIZE;
+        nb->data = nb->head + NETBUF_HEADROOM;
+        nb->length = 0;
+        nb->index = i;
+        list_add_tail(&nb->list, &netbuf_free_list);
+    }
+    netbuf_free_nr = NETBUF_NR;
+    keprint(PRINT_INFO "[netbuf] %d buffers at %x\n", NETBUF_NR, data);
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <xbook/netpoll.h>
+#include <xbook/softirq.h>
+#include <xbook/spinlock.h>
+#include <xbook/debug.h>
+#include <string.h>
+
+/* 等待轮询的设备，大内核锁保证同一时刻只有一个处理器在执行软中断 */
+static LIST_HEAD(netpoll_list);
+DEFINE_SPIN_LOCK_UNLOCKED(netpoll_lock);
+
+void netpoll_init(netpoll_t *np, int (*poll)(netpoll_t *, int), int weight, void *data)
+{
+    list_init(&np->list);
+    np->poll = poll;
+    np->weight = weight > 0 ? weight : NETPOLL_WEIGHT;
+    np->state = NETPOLL_DISABLED;
+    np->data = data;
+    memset(&np->stat, 0, sizeof(netdev_stat_t));
+}
+
+/**
+ * 把设备加入轮询链表，在网卡中断中调用，调用前驱动已经关闭了网卡中断。
+ * 已经在链表上或者设备关闭时什么也不做。
+ */
+void netpoll_schedule(netpoll_t *np)
+{
+    unsigned long irqflags;
+    spin_lock_irqsave(&netpoll_lock, irqflags);
+    if (!(np->state & (NETPOLL_SCHED | NETPOLL_DISABLED))) {
+        np->state |= NETPOLL_SCHED;
+        list_add_tail(&np->list, &netpoll_list);
+        softirq_active(NET_RX_SOFTIRQ);
+    }
+    spin_unlock_irqrestore(&netpoll_lock, irqflags);
+}
+
+/**
+ * 轮询函数处理完接收环后调用，必须在重新打开网卡中断之前调用，
+ * 否则打开中断后立即到来的中断会因为还在轮询中而被忽略。
+ */
+void netpoll_complete(netpoll_t *np)
+{
+    unsigned long irqflags;
+    spin_lock_irqsave(&netpoll_lock, irqflags);
+    np->state &= ~NETPOLL_SCHED;
+    spin_unlock_irqrestore(&netpoll_lock, irqflags);
+}
+
+/* 打开设备时调用，在打开网卡中断之前 */
+void netpoll_enable(netpoll_t *np)
+{
+    unsigned long irqflags;
+    spin_lock_irqsave(&netpoll_lock, irqflags);
+    np->state &= ~(NETPOLL_DISABLED | NETPOLL_SCHED);
+    spin_unlock_irqrestore(&netpoll_lock, irqflags);
+}
+
+/**
+ * 关闭设备时调用，在关闭网卡中断之后。
+ * 软中断嵌套在中断中执行，任务上下文调用时不会有正在进行的轮询，
+ * 只需要从链表上摘下来。
+ */
+void netpoll_disable(netpoll_t *np)
+{
+    unsigned long irqflags;
+    spin_lock_irqsave(&netpoll_lock, irqflags);
+    np->state |= NETPOLL_DISABLED;
+    if (np->state & NETPOLL_SCHED) {
+        list_del_init(&np->list);
+        np->state &= ~NETPOLL_SCHED;
+    }
+    spin_unlock_irqrestore(&netpoll_lock, irqflags);
+}
+
+/**
+ * NET_RX软中断：轮流调用链表上设备的轮询函数。
+ * 用完预算还没有处理完的设备放回链表尾部，等下一次软中断继续，
+ * 期间网卡中断一直是关闭的。
+ */
+static void netpoll_action(softirq_action_t *action)
+{
+    int budget = NETPOLL_BUDGET;
+    unsigned long irqflags;
+    netpoll_t *np;
+    int quota, work;
+
+    spin_lock_irqsave(&netpoll_lock, irqflags);
+    while (!list_empty(&netpoll_list)) {
+        if (budget <= 0) {
+            /* 总预算用完，让出处理器，剩下的设备下一次软中断再处理 */
+            np = list_first_owner(&netpoll_list, netpoll_t, list);
+            np->stat.squeezed++;
+            softirq_active(NET_RX_SOFTIRQ);
+            break;
+        }
+        np = list_first_owner(&netpoll_list, netpoll_t, list);
+        list_del_init(&np->list);
+        spin_unlock_irqrestore(&netpoll_lock, irqflags);
+
+        quota = min(np->weight, budget);
+        work = np->poll(np, quota);
+        np->stat.polls++;
+        np->stat.packets += work;
+        budget -= work;
+
+        spin_lock_irqsave(&netpoll_lock, irqflags);
+        /* 用完了自己的预算，说明还有数据包，继续轮询 */
+        if (work >= quota && (np->state & NETPOLL_SCHED) &&
+            !(np->state & NETPOLL_DISABLED))
+            list_add_tail(&np->list, &netpoll_list);
+    }
+    spin_unlock_irqrestore(&netpoll_lock, irqflags);
+}
+
+void netpoll_subsystem_init()
+{
+    softirq_build(NET_RX_SOFTIRQ, netpoll_action);
+}
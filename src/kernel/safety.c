@@ -2,26 +2,78 @@
 #include <xbook/kernel.h>
 #include <xbook/schedule.h>
 #include <arch/page.h>
+#include <arch/uaccess.h>
 #include <string.h>
+#include <errno.h>
 
+/* 检查用户地址范围，长度很大时不能因为回绕而越过检查 */
 int safety_check_range(void *src, unsigned long nbytes)
 {
     unsigned long addr;
     addr = (unsigned long) src;
-    if (task_current->vmm && !((addr >= USER_VMM_BASE_ADDR) && (addr + nbytes < USER_VMM_TOP_ADDR))) {
+    if (task_current->vmm && !((addr >= USER_VMM_BASE_ADDR) && (addr < USER_VMM_TOP_ADDR) &&
+        (nbytes < USER_VMM_TOP_ADDR - addr))) {
         return -1;
     }
     return 0;
 }
 
+/**
+ * copy_from_user - 从用户空间复制数据
+ * 
+ * 不预先遍历页表，直接复制，没有映射的页由页故障按需映射。
+ * 地址无效时页故障处理通过异常表跳转到修复代码，复制提前结束，
+ * 没有复制的部分填0。返回没有复制的字节数，成功返回0。
+ */
+unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    unsigned long left = n;
+    if (safety_check_range((void *) from, n) == 0)
+        left = __copy_user(to, from, n);
+    if (left)
+        memset((unsigned char *) to + (n - left), 0, left);
+    return left;
+}
+
+/* 复制数据到用户空间，返回没有复制的字节数，成功返回0 */
+unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    if (safety_check_range(to, n) < 0)
+        return n;
+    return __copy_user(to, from, n);
+}
+
+/**
+ * strncpy_from_user - 从用户空间复制字符串，最多count个字节
+ * 
+ * 返回字符串的长度，没有遇到结束符时返回count，地址无效返回-EFAULT
+ */
+long strncpy_from_user(char *dst, const char *src, long count)
+{
+    unsigned long addr = (unsigned long) src;
+    if (count <= 0)
+        return 0;
+    if (task_current->vmm) {
+        if (addr < USER_VMM_BASE_ADDR || addr >= USER_VMM_TOP_ADDR)
+            return -EFAULT;
+        if ((unsigned long) count > USER_VMM_TOP_ADDR - addr)  /* 不能读到内核空间 */
+            count = USER_VMM_TOP_ADDR - addr;
+    }
+    return __strncpy_from_user(dst, src, count);
+}
+
+/**
+ * dest为NULL时只检查用户缓冲区，调用者会直接访问用户缓冲区（例如文件系统读写），
+ * 这时仍然预先映射缓冲区的页，避免在文件系统中因为缺页而重入。
+ */
 int mem_copy_from_user(void *dest, void *src, unsigned long nbytes)
 {
     if (safety_check_range(src, nbytes) < 0)
         return -1;
-    if (!page_readable((unsigned long) src, nbytes))
+    if (!dest)
+        return page_readable((unsigned long) src, nbytes) ? 0 : -1;
+    if (src && copy_from_user(dest, src, nbytes))
         return -1;
-    if (dest && src)
-        memcpy(dest, src, nbytes);
     return 0;
 }
 
@@ -29,26 +81,26 @@ int mem_copy_to_user(void *dest, void *src, unsigned long nbytes)
 {
     if (safety_check_range(dest, nbytes) < 0)
         return -1;
-    if (!page_writable((unsigned long) dest, nbytes))
-        return -1;  
-    if (dest && src)
-        memcpy(dest, src, nbytes);
+    if (!src)
+        return page_writable((unsigned long) dest, nbytes) ? 0 : -1;
+    if (dest && copy_to_user(dest, src, nbytes))
+        return -1;
     return 0;
 }
 
 /**
- * 从用户态复制一个字符串
+ * 从用户态复制一个字符串，最多maxn个字节，结果总是以0结尾
  * 成功返回字符串长度，失败返回-1
  */
 int mem_copy_from_user_str(char *dest, char *src, unsigned long maxn)
 {
-    if (safety_check_range(src, maxn) < 0)
+    if (!dest || !src || !maxn)
         return -1;
-    if (!page_readable((unsigned long) src, maxn))
+    long len = strncpy_from_user(dest, src, maxn);
+    if (len < 0)
         return -1;
-    int err = -1;
-    if (dest && src) {
-        strncpy(dest, src, maxn);
-    }
-    return err;
+    if ((unsigned long) len >= maxn)
+        len = maxn - 1;
+    dest[len] = '\0';
+    return len;
 }
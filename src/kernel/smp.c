@@ -0,0 +1,155 @@
+#include <xbook/smp.h>
+#include <xbook/schedule.h>
+#include <xbook/task.h>
+#include <xbook/debug.h>
+#include <arch/interrupt.h>
+#include <arch/memory.h>
+#include <arch/cpu.h>
+
+#ifdef CONFIG_SMP
+
+typedef struct {
+    volatile int locked;
+    volatile cpuid_t owner;     /* 持有锁的cpu，没有被持有时为-1 */
+    int depth;                  /* 嵌套深度 */
+} kernel_lock_t;
+
+/* 启动cpu从一开始就持有内核锁，直到第一次进入idle */
+static kernel_lock_t big_kernel_lock = {1, 0, 1};
+
+/* 需要刷新TLB的cpu，由发起者设置，目标cpu刷新后清除 */
+static volatile char tlb_shootdown_pending[CPU_NR_MAX];
+static volatile unsigned long tlb_shootdown_addr;
+
+void kernel_lock()
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    cpuid_t cpu = cpu_get_my_id();
+    if (big_kernel_lock.owner == cpu) {
+        big_kernel_lock.depth++;
+    } else {
+        while (xchg(&big_kernel_lock.locked, 1)) {
+            /* 等锁的时候也要响应TLB刷新，持有锁的cpu可能正在等待 */
+            while (big_kernel_lock.locked) {
+                smp_tlb_interrupt();
+                cpu_pause();
+            }
+        }
+        big_kernel_lock.owner = cpu;
+        big_kernel_lock.depth = 1;
+    }
+    interrupt_restore_state(flags);
+}
+
+void kernel_unlock()
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    if (big_kernel_lock.owner != cpu_get_my_id() || big_kernel_lock.depth <= 0)
+        panic("kernel_unlock: cpu %d not own the kernel lock!\n", cpu_get_my_id());
+    if (!--big_kernel_lock.depth) {
+        big_kernel_lock.owner = -1;
+        barrier();
+        big_kernel_lock.locked = 0;
+    }
+    interrupt_restore_state(flags);
+}
+
+/* 任务切换时交换嵌套深度，返回切换前的深度 */
+int kernel_lock_switch(int depth)
+{
+    int old = big_kernel_lock.depth;
+    big_kernel_lock.depth = depth;
+    return old;
+}
+
+void smp_send_reschedule(cpuid_t cpu)
+{
+    if (cpu != cpu_get_my_id())
+        smp_send_ipi(cpu, IPI_RESCHED);
+}
+
+/* 其它cpu给当前cpu加入了就绪任务，idle时立即调度 */
+void smp_reschedule_interrupt()
+{
+    sched_unit_t *su = sched_get_cur_unit();
+    if (su->cur == su->idle && su->tasknr)
+        schedule();
+}
+
+void smp_tlb_interrupt()
+{
+    cpuid_t cpu = cpu_get_my_id();
+    if (!tlb_shootdown_pending[cpu])
+        return;
+    if (tlb_shootdown_addr == TLB_SHOOTDOWN_ALL)
+        tlb_flush();
+    else
+        tlb_flush_one(tlb_shootdown_addr);
+    tlb_shootdown_pending[cpu] = 0;
+}
+
+/**
+ * 页表修改后通知其它cpu刷新TLB，需要持有内核锁，所以同时只有一个发起者
+ * @vmm: 修改的地址空间，为NULL表示内核地址空间，需要通知所有cpu
+ * @addr: 修改的地址，TLB_SHOOTDOWN_ALL表示刷新整个TLB
+ */
+void smp_tlb_shootdown(struct vmm *vmm, unsigned long addr)
+{
+    if (scheduler.cpunr <= 1)
+        return;
+    cpuid_t cpu, self = cpu_get_my_id();
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    tlb_shootdown_addr = addr;
+    for (cpu = 0; cpu < scheduler.cpunr; cpu++) {
+        if (cpu == self)
+            continue;
+        /* 切换任务时会重新加载页目录，只需要通知正在使用这个地址空间的cpu */
+        if (vmm && scheduler.sched_unit_table[cpu].cur->vmm != vmm)
+            continue;
+        tlb_shootdown_pending[cpu] = 1;
+        smp_send_ipi(cpu, IPI_TLB);
+    }
+    for (cpu = 0; cpu < scheduler.cpunr; cpu++) {
+        while (tlb_shootdown_pending[cpu])
+            cpu_pause();
+    }
+    interrupt_restore_state(flags);
+}
+
+/**
+ * 应用处理器完成体系结构相关的初始化后调用，加入调度后进入idle循环
+ */
+void smp_ap_start(cpuid_t cpu)
+{
+    kernel_lock();
+    /* 启动时临时映射的低端内存已经被启动cpu撤销，丢掉残留的TLB */
+    tlb_flush();
+    cpu_attach(cpu);
+    scheduler.cpunr++;
+    keprint(PRINT_INFO "[smp] cpu %d online\n", cpu);
+    interrupt_enable();
+    kern_do_idle(NULL);
+}
+
+void smp_init()
+{
+    int cpus = smp_boot_cpus();
+    keprint(PRINT_INFO "[smp] %d cpu(s) booted\n", cpus);
+}
+
+#else
+
+void kernel_lock() {}
+void kernel_unlock() {}
+int kernel_lock_switch(int depth) { return depth; }
+void smp_send_reschedule(cpuid_t cpu) {}
+void smp_reschedule_interrupt() {}
+void smp_tlb_interrupt() {}
+void smp_tlb_shootdown(struct vmm *vmm, unsigned long addr) {}
+void smp_ap_start(cpuid_t cpu) {}
+void smp_init() {}
+
+#endif  /* CONFIG_SMP */
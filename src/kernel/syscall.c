@@ -16,6 +16,8 @@
 #include <xbook/schedule.h>
 #include <xbook/fifo.h>
 #include <xbook/sockcall.h>
+#include <xbook/bcache.h>
+#include <xbook/ioring.h>
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <dirent.h>
@@ -153,6 +155,11 @@ void syscall_init()
     syscalls[SYS_REBOOT] = sys_reboot;
     syscalls[SYS_SHUTDOWN] = sys_shutdown;
     syscalls[SYS_SELECT] = sys_select;
+    syscalls[SYS_BSTATE] = sys_bstate;
+    syscalls[SYS_IOSUBMIT] = sys_io_submit;
+    syscalls[SYS_IOGETEVENTS] = sys_io_getevents;
+    syscalls[SYS_CLOCK_NANOSLEEP] = sys_clock_nanosleep;
+    syscalls[SYS_MSYNC] = sys_msync;
     
 }
 
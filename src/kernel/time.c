@@ -4,13 +4,20 @@
 #include <xbook/clock.h>
 #include <xbook/schedule.h>
 #include <xbook/safety.h>
+#include <xbook/clockevent.h>
+#include <xbook/timepage.h>
+#include <errno.h>
+
+static int clock_get_timespec(clockid_t clockid, struct timespec *ts);
 
 int sys_gettimeofday(struct timeval *tv, struct timezone *tz)
 {
     if (tv) {
         struct timeval tmp_tv;
-        tmp_tv.tv_sec = walltime_make_timestamp(&walltime);
-        tmp_tv.tv_usec = ((systicks % HZ) * MS_PER_TICKS) * 1000;
+        struct timespec ts;
+        clock_get_timespec(CLOCK_REALTIME, &ts);
+        tmp_tv.tv_sec = ts.tv_sec;
+        tmp_tv.tv_usec = ts.tv_nsec / 1000;
         if (mem_copy_to_user(tv, &tmp_tv, sizeof(struct timeval)) < 0)
             return -1;
     }
@@ -24,35 +31,113 @@ int sys_gettimeofday(struct timeval *tv, struct timezone *tz)
     return 0;
 }
 
-int sys_clock_gettime(clockid_t clockid, struct timespec *ts)
+/* 节拍内的纳秒数，加上时钟事件设备在当前节拍中经过的时间 */
+static long clock_get_nsec(clock_t ticks, unsigned long subtick)
 {
-    if (!ts)
-        return -1; 
-    struct timespec tmp_ts;
+    return ((ticks % HZ) * MS_PER_TICKS) * 1000000 + subtick * 1000;
+}
+
+static int clock_get_timespec(clockid_t clockid, struct timespec *ts)
+{
+    unsigned long flags;
+    unsigned long subtick;
+    clock_t ticks;
+    /* 有TSC时从时间页读取，和用户态直接读到的时间一致 */
+    if ((clockid == CLOCK_REALTIME || clockid == CLOCK_MONOTONIC) &&
+        !timepage_gettime(clockid, ts))
+        return 0;
     switch (clockid)
     {
     case CLOCK_REALTIME:        /* 系统统当前时间，从1970年1.1日算起 */
-        tmp_ts.tv_sec = walltime_make_timestamp(&walltime);
-        tmp_ts.tv_nsec = ((systicks % HZ) * MS_PER_TICKS) * 1000000;
+        interrupt_save_and_disable(flags);
+        ticks = systicks;
+        subtick = clock_event_subtick_us();
+        ts->tv_sec = walltime_make_timestamp(&walltime);
+        interrupt_restore_state(flags);
+        ts->tv_nsec = clock_get_nsec(ticks, subtick);
         break;
     case CLOCK_MONOTONIC:       /*系统的启动时间，不能被设置*/
-        tmp_ts.tv_sec = (systicks / HZ);
-        tmp_ts.tv_nsec = ((systicks % HZ) * MS_PER_TICKS) * 1000000;
+        interrupt_save_and_disable(flags);
+        ticks = systicks;
+        subtick = clock_event_subtick_us();
+        interrupt_restore_state(flags);
+        ts->tv_sec = (ticks / HZ);
+        ts->tv_nsec = clock_get_nsec(ticks, subtick);
         break;
     case CLOCK_PROCESS_CPUTIME_ID:  /* 本进程运行时间*/
-        tmp_ts.tv_sec = task_current->elapsed_ticks / HZ;
-        tmp_ts.tv_nsec = ((task_current->elapsed_ticks % HZ) * MS_PER_TICKS) * 1000000;
+        ts->tv_sec = task_current->elapsed_ticks / HZ;
+        ts->tv_nsec = ((task_current->elapsed_ticks % HZ) * MS_PER_TICKS) * 1000000;
         break;
     case CLOCK_THREAD_CPUTIME_ID:   /*本线程运行时间*/
-        tmp_ts.tv_sec = task_current->elapsed_ticks / HZ;
-        tmp_ts.tv_nsec = ((task_current->elapsed_ticks % HZ) * MS_PER_TICKS) * 1000000;
+        ts->tv_sec = task_current->elapsed_ticks / HZ;
+        ts->tv_nsec = ((task_current->elapsed_ticks % HZ) * MS_PER_TICKS) * 1000000;
         break;
     default:
         return -1;
     }
+    return 0;
+}
+
+int sys_clock_gettime(clockid_t clockid, struct timespec *ts)
+{
+    if (!ts)
+        return -1; 
+    struct timespec tmp_ts;
+    if (clock_get_timespec(clockid, &tmp_ts) < 0)
+        return -1;
     return mem_copy_to_user(ts, &tmp_ts, sizeof(struct timespec));
 }
 
+/* 小于这个秒数时按照微秒休眠，不会溢出 */
+#define NANOSLEEP_USEC_MAX_SEC  2000
+
+/**
+ * 按照指定的时钟休眠，flags有TIMER_ABSTIME时req是绝对时间。
+ * 不到两个节拍的休眠使用高精度定时器。
+ * 被打断时返回-EINTR，相对时间时把剩余的时间写入rem。
+ */
+int sys_clock_nanosleep(clockid_t clockid, int flags, struct timespec *req, struct timespec *rem)
+{
+    struct timespec ts, now, left;
+    TASK_CHECK_THREAD_CANCELATION_POTINT(task_current);
+    if (!req)
+        return -EINVAL;
+    if (clockid != CLOCK_REALTIME && clockid != CLOCK_MONOTONIC)
+        return -EINVAL;
+    if (mem_copy_from_user(&ts, req, sizeof(struct timespec)) < 0)
+        return -EFAULT;
+    if (ts.tv_sec < 0 || ts.tv_nsec < 0 || ts.tv_nsec >= 1000000000L)
+        return -EINVAL;
+    if (flags & TIMER_ABSTIME) {
+        clock_get_timespec(clockid, &now);
+        ts.tv_sec -= now.tv_sec;
+        ts.tv_nsec -= now.tv_nsec;
+        if (ts.tv_nsec < 0) {
+            ts.tv_nsec += 1000000000L;
+            ts.tv_sec--;
+        }
+        if (ts.tv_sec < 0)  /* 已经过了 */
+            return 0;
+    }
+    if (ts.tv_sec < NANOSLEEP_USEC_MAX_SEC) {
+        unsigned long usec = ts.tv_sec * 1000000L + (ts.tv_nsec + 999) / 1000;
+        usec = task_sleep_by_usec(usec);
+        left.tv_sec = usec / 1000000L;
+        left.tv_nsec = (usec % 1000000L) * 1000;
+    } else {
+        /* 不满一个节拍的部分向上取整 */
+        unsigned long ticks = timespec_to_systicks(&ts) + 1;
+        systicks_to_timespec(task_sleep_by_ticks(ticks), &left);
+    }
+    if (!left.tv_sec && !left.tv_nsec)
+        return 0;
+    if (rem && !(flags & TIMER_ABSTIME)) {
+        if (mem_copy_to_user(rem, &left, sizeof(struct timespec)) < 0)
+            return -EFAULT;
+    }
+    return -EINTR;
+}
+
 #define MAX_SYSTICKS_VALUE  ((~0UL >> 1) -1)
 
 unsigned long timeval_to_systicks(struct timeval *tv)
@@ -108,12 +193,13 @@ clock_t sys_times(struct tms *buf)
         /* 统计子进程的时间 */
         clock_t cutime = 0, cstime = 0;
         task_t *child;
-        list_for_each_owner (child, &task_global_list, list) {
-            if (child->parent_pid == cur->pid) {
-                cstime += child->syscall_ticks;
-                cutime += child->elapsed_ticks;
-            }
+        unsigned long flags;
+        interrupt_save_and_disable(flags);
+        list_for_each_owner (child, &cur->child_list, sibling_list) {
+            cstime += child->syscall_ticks;
+            cutime += child->elapsed_ticks;
         }
+        interrupt_restore_state(flags);
         buf->tms_cstime = cstime;
         buf->tms_cutime = cutime;
         keprint("%d %d %d %d\n", buf->tms_stime, buf->tms_utime, buf->tms_cstime, buf->tms_cutime);
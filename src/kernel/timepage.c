@@ -0,0 +1,188 @@
+#include <xbook/timepage.h>
+#include <xbook/clock.h>
+#include <xbook/walltime.h>
+#include <xbook/memspace.h>
+#include <xbook/debug.h>
+#include <arch/interrupt.h>
+#include <arch/page.h>
+#include <arch/memory.h>
+#include <arch/time.h>
+#include <string.h>
+
+/**
+ * 时间页：用TSC作为时钟源，每个节拍在时钟软中断中把TSC和时间写入时间页，
+ * 两次更新之间的时间由TSC的差值换算，精度是纳秒。
+ * 时间页只读映射到每个进程，用户态可以不进入内核读取时间。
+ */
+#define TIMEPAGE_CALIBRATE_TICKS    50  /* 校准TSC的节拍数 */
+#define NSEC_PER_SEC                1000000000UL
+#define NSEC_PER_TICKS              (NSEC_PER_SEC / HZ)
+
+static timepage_t *timepage = NULL;
+static unsigned long timepage_paddr;
+
+/* 64位除以32位，内核没有libgcc，只在初始化时用一次，逐位相除 */
+static unsigned long long timepage_div(unsigned long long n, unsigned long base)
+{
+    unsigned long long quot = 0, rem = 0;
+    int i;
+    for (i = 63; i >= 0; i--) {
+        rem = (rem << 1) | ((n >> i) & 1);
+        quot <<= 1;
+        if (rem >= base) {
+            rem -= base;
+            quot |= 1;
+        }
+    }
+    return quot;
+}
+
+/**
+ * 用时钟节拍校准TSC，返回一个节拍的TSC计数，需要开中断。
+ * 在启动其它cpu之前调用，持有内核锁等待节拍不会挡住别人。
+ */
+static unsigned long timepage_calibrate(void)
+{
+    unsigned long long begin, cycles;
+    clock_t start = systicks;
+    while (systicks == start)   /* 从节拍的边界开始 */
+        cpu_pause();
+    start = systicks;
+    begin = clock_cycles_read();
+    while (systicks - start < TIMEPAGE_CALIBRATE_TICKS)
+        cpu_pause();
+    cycles = clock_cycles_read() - begin;
+    if (cycles >> 32)
+        return 0;
+    return (unsigned long) cycles / TIMEPAGE_CALIBRATE_TICKS;
+}
+
+/**
+ * 把上一次更新以来的TSC计入时间页，在启动cpu的时钟软中断中调用。
+ * 墙上时间和TSC计算的时间相差超过1秒时重新同步。
+ */
+void timepage_update(void)
+{
+    unsigned long flags;
+    unsigned long long now, delta;
+    if (!timepage)
+        return;
+    interrupt_save_and_disable(flags);
+    now = clock_cycles_read();
+    delta = now - timepage->cycles;
+    if (delta >> 32)
+        delta = 0xffffffffUL;
+    timepage->seq++;
+    barrier();
+    timepage->snsec += delta * timepage->mult;
+    while (timepage->snsec >= ((unsigned long long) NSEC_PER_SEC << timepage->shift)) {
+        timepage->snsec -= (unsigned long long) NSEC_PER_SEC << timepage->shift;
+        timepage->mono_sec++;
+    }
+    timepage->cycles = now;
+    long real = walltime_make_timestamp(&walltime);
+    long diff = real - (timepage->mono_sec + timepage->real_offset);
+    if (diff > 1 || diff < -1)
+        timepage->real_offset = real - timepage->mono_sec;
+    barrier();
+    timepage->seq++;
+    interrupt_restore_state(flags);
+}
+
+/**
+ * 从时间页读取时间，和用户态的算法一样，保证两边读到的时间一致。
+ * 没有TSC时返回-1，由调用者使用节拍时间。
+ */
+int timepage_gettime(clockid_t clockid, struct timespec *ts)
+{
+    unsigned long seq;
+    unsigned long long delta, nsec;
+    long sec;
+    if (!timepage)
+        return -1;
+    do {
+        seq = timepage->seq;
+        barrier();
+        delta = clock_cycles_read() - timepage->cycles;
+        if (delta >> 32)    /* 更新停了太久，不会发生 */
+            delta = 0xffffffffUL;
+        nsec = (timepage->snsec + delta * timepage->mult) >> timepage->shift;
+        sec = timepage->mono_sec;
+        if (clockid == CLOCK_REALTIME)
+            sec += timepage->real_offset;
+        barrier();
+    } while ((seq & 1) || seq != timepage->seq);
+    while (nsec >= NSEC_PER_SEC) {
+        nsec -= NSEC_PER_SEC;
+        sec++;
+    }
+    ts->tv_sec = sec;
+    ts->tv_nsec = (long) nsec;
+    return 0;
+}
+
+/**
+ * 把时间页只读映射到当前进程的用户空间，执行新程序时调用
+ */
+int timepage_map(void)
+{
+    if (!timepage)
+        return 0;
+    if (mem_space_mmap(TIMEPAGE_USER_ADDR, timepage_paddr, PAGE_SIZE, PROT_USER | PROT_READ,
+        MEM_SPACE_MAP_FIXED | MEM_SPACE_MAP_SHARED) == ((void *)-1)) {
+        keprint(PRINT_ERR "timepage_map: map failed!\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* 时间页的用户地址，没有时间页时是0 */
+unsigned long timepage_user_addr(void)
+{
+    return timepage ? TIMEPAGE_USER_ADDR : 0;
+}
+
+/**
+ * 校准TSC并且建立时间页，在开中断之后，启动其它cpu之前调用。
+ * 选择最大的shift让mult尽量精确，mult不超过31位，换算时64位的乘积和累加不会溢出。
+ */
+void timepage_init(void)
+{
+    unsigned long cycles_per_tick;
+    unsigned long long mult = 0;
+    unsigned long shift;
+    if (!clock_cycles_probe()) {
+        keprint(PRINT_INFO "[timepage] no tsc, use ticks\n");
+        return;
+    }
+    cycles_per_tick = timepage_calibrate();
+    if (!cycles_per_tick) {
+        keprint(PRINT_WARING "[timepage] calibrate tsc failed!\n");
+        return;
+    }
+    clock_delay_calibrate(cycles_per_tick);
+    for (shift = 32; shift > 0; shift--) {
+        mult = timepage_div((unsigned long long) NSEC_PER_TICKS << shift, cycles_per_tick);
+        if (!(mult >> 31))
+            break;
+    }
+    if (!shift || !mult)
+        return;
+    timepage_paddr = page_alloc_normal(1);
+    if (!timepage_paddr) {
+        keprint(PRINT_ERR "[timepage] alloc page failed!\n");
+        return;
+    }
+    timepage_t *tp = kern_phy_addr2vir_addr(timepage_paddr);
+    memset(tp, 0, PAGE_SIZE);
+    tp->mult = (unsigned long) mult;
+    tp->shift = shift;
+    tp->cycles = clock_cycles_read();
+    tp->mono_sec = systicks / HZ;
+    tp->snsec = (unsigned long long) ((systicks % HZ) * NSEC_PER_TICKS) << shift;
+    tp->real_offset = walltime_make_timestamp(&walltime) - tp->mono_sec;
+    tp->flags = TIMEPAGE_TSC;
+    timepage = tp;
+    keprint(PRINT_INFO "[timepage] tsc %d cycles per tick, mult %x shift %d\n",
+        cycles_per_tick, tp->mult, shift);
+}
@@ -3,33 +3,72 @@
 #include <sys/walltime.h>
 #include <xbook/task.h>
 #include <xbook/clock.h>
+#include <xbook/clockevent.h>
 #include <xbook/safety.h>
 #include <errno.h>
 #include <string.h>
 #include <arch/interrupt.h>
 #include <arch/time.h>
 
-/* 10day = 10 * 60 * 60 * 24 * HZ */
-#define TIMER_IDLE_TIMEOUT  (864000 * HZ)
+/**
+ * 分层时间轮：第一层有256个槽，每个槽是一个节拍，后面4层各有64个槽，
+ * 每个槽是上一层转一圈的时间。添加和删除定时器都只需要操作一个链表，
+ * 第一层转完一圈时才把上一层对应槽里的定时器重新分配到下面的层。
+ */
+#define TVR_BITS    8
+#define TVN_BITS    6
+#define TVR_SIZE    (1 << TVR_BITS)
+#define TVN_SIZE    (1 << TVN_BITS)
+#define TVR_MASK    (TVR_SIZE - 1)
+#define TVN_MASK    (TVN_SIZE - 1)
+#define TVN_NR      4
+
+typedef struct {
+    clock_t timer_jiffies;          /* 下一个要处理的节拍 */
+    list_t tv1[TVR_SIZE];
+    list_t tvn[TVN_NR][TVN_SIZE];
+} timer_base_t;
 
-LIST_HEAD(timer_list_head);
+static timer_base_t timer_base;
 unsigned long timer_id_next = 1; /* 从1开始，0是无效的id */
-static clock_t minim_timeout_val = 0;
-static timer_t timer_idle;
 
-/* idle定时器超时
- * 重新调整所有定时器的值，所有值都减去timer_ticks（idle除外）
- */
-static void timer_idle_handler(timer_t *timer_self, void *arg)
-{
-    clock_t dt = timer_idle.timeout;
-    timer_ticks -= dt;
-    timer_t *tmp;
-    list_for_each_owner (tmp, &timer_list_head, list) {
-        if (tmp != &timer_idle)
-            tmp->timeout -= dt;
+/* 定时器在第n层的槽号 */
+#define TVN_INDEX(expires, n) (((expires) >> (TVR_BITS + (n) * TVN_BITS)) & TVN_MASK)
+
+/* 根据超时点把定时器放到对应层的槽中，需要关中断 */
+static void timer_wheel_add(timer_t *timer)
+{
+    clock_t expires = timer->timeout;
+    clock_t idx = expires - timer_base.timer_jiffies;
+    list_t *vec;
+    if ((long) idx < 0) {   /* 已经超时的放到马上要处理的槽 */
+        vec = &timer_base.tv1[timer_base.timer_jiffies & TVR_MASK];
+    } else if (idx < TVR_SIZE) {
+        vec = &timer_base.tv1[expires & TVR_MASK];
+    } else if (idx < 1UL << (TVR_BITS + TVN_BITS)) {
+        vec = &timer_base.tvn[0][TVN_INDEX(expires, 0)];
+    } else if (idx < 1UL << (TVR_BITS + 2 * TVN_BITS)) {
+        vec = &timer_base.tvn[1][TVN_INDEX(expires, 1)];
+    } else if (idx < 1UL << (TVR_BITS + 3 * TVN_BITS)) {
+        vec = &timer_base.tvn[2][TVN_INDEX(expires, 2)];
+    } else {
+        vec = &timer_base.tvn[3][TVN_INDEX(expires, 3)];
     }
-    timer_add(&timer_idle);
+    list_add_tail(&timer->list, vec);
+}
+
+/* 把第n层的一个槽里的定时器重新分配到下面的层，返回槽号 */
+static int timer_cascade(int n, int index)
+{
+    LIST_HEAD(work_list);
+    timer_t *timer, *next;
+    list_t *vec = &timer_base.tvn[n][index];
+    if (!list_empty(vec)) {
+        list_replace_init(vec, &work_list);
+        list_for_each_owner_safe (timer, next, &work_list, list)
+            timer_wheel_add(timer);
+    }
+    return index;
 }
 
 void timer_init(
@@ -53,25 +92,9 @@ void timer_add(timer_t *timer)
     interrupt_save_and_disable(flags);
     if (!timer->id)
         timer->id = timer_id_next++;
-    assert(!list_find(&timer->list, &timer_list_head));
-    if (list_empty(&timer_list_head)) {    
-        list_add_tail(&timer->list, &timer_list_head);
-        minim_timeout_val = timer->timeout;
-    } else {
-        timer_t *first = list_first_owner(&timer_list_head, timer_t, list);
-        if (timer->timeout < first->timeout) {
-            list_add(&timer->list, &timer_list_head);
-            minim_timeout_val = timer->timeout;
-        } else {
-            timer_t *tmp;
-            list_for_each_owner (tmp, &timer_list_head, list) {
-                if (timer->timeout >= tmp->timeout) {
-                    list_add_after(&timer->list, &tmp->list);
-                    break;
-                }
-            }
-        }
-    }
+    assert(list_empty(&timer->list));
+    timer_wheel_add(timer);
+    tick_nohz_kick();   /* 启动cpu停止了节拍时按照新的定时器重新编程 */
     interrupt_restore_state(flags);
 }
 
@@ -79,40 +102,59 @@ void timer_del(timer_t *timer)
 {
     unsigned long flags;
     interrupt_save_and_disable(flags);
-    assert(list_find(&timer->list, &timer_list_head));
-    list_del(&timer->list);
+    assert(!list_empty(&timer->list));
+    list_del_init(&timer->list);
     interrupt_restore_state(flags);
 }
 
+/* 定时器在时间轮上就是活动的，删除和超时的时候都会重新初始化链表 */
 int timer_alive(timer_t *timer)
 {
     int alive = 0; 
     unsigned long flags;
     interrupt_save_and_disable(flags);
-    if (list_find(&timer->list, &timer_list_head))
+    if (!list_empty(&timer->list))
         alive = 1;
     interrupt_restore_state(flags);
     return alive;
 }
 
+/* 修改超时值，定时器在时间轮上时需要换到新的槽 */
 void timer_modify(timer_t *timer, unsigned long timeout)
 {
     unsigned long flags;
     interrupt_save_and_disable(flags);
     timer->timeout = timer_ticks + timeout;
+    if (!list_empty(&timer->list)) {
+        list_del_init(&timer->list);
+        timer_wheel_add(timer);
+        tick_nohz_kick();
+    }
     interrupt_restore_state(flags);
 }
 
+static timer_t *timer_find_in(list_t *vec, unsigned long id)
+{
+    timer_t *timer;
+    list_for_each_owner (timer, vec, list) {
+        if (timer->id == id)
+            return timer;
+    }
+    return NULL;
+}
+
+/* 按照id查找需要遍历所有的槽，只在很少调用的地方使用 */
 timer_t *timer_find(unsigned long id)
 {
-    timer_t *timer, *tmr_find = NULL;
+    timer_t *tmr_find = NULL;
     unsigned long flags;
+    int i, n;
     interrupt_save_and_disable(flags);
-    list_for_each_owner (timer, &timer_list_head, list) {
-        if (timer->id == id) {
-            tmr_find = timer;
-            break;
-        }
+    for (i = 0; i < TVR_SIZE && !tmr_find; i++)
+        tmr_find = timer_find_in(&timer_base.tv1[i], id);
+    for (n = 0; n < TVN_NR && !tmr_find; n++) {
+        for (i = 0; i < TVN_SIZE && !tmr_find; i++)
+            tmr_find = timer_find_in(&timer_base.tvn[n][i], id);
     }
     interrupt_restore_state(flags);
     return tmr_find;
@@ -122,9 +164,11 @@ int timer_cancel(timer_t *timer)
 {
     int retval = -1;
     if (timer) {
-        if (timer_alive(timer)) {
-            timer_del(timer);
-        }
+        unsigned long flags;
+        interrupt_save_and_disable(flags);
+        if (!list_empty(&timer->list))
+            list_del_init(&timer->list);
+        interrupt_restore_state(flags);
         retval = 0;
     }
     return retval;
@@ -142,43 +186,58 @@ void timer_del_period(timer_t *timer)
 
 static void timer_do_action(timer_t *timer)
 {
-    if (!(timer->flags & TIMER_PERIOD))
-    {
-        /* 不是周期定时才删除定时器 */
-        list_del(&timer->list);
-    }
-    else
-    {
-        /* 不删除定时器，并更新定时器超时值 */
+    list_del_init(&timer->list);
+    if (timer->flags & TIMER_PERIOD) {
+        /* 周期定时器更新超时值后重新加入时间轮 */
         timer->timeout = timer_ticks + timer->timeval;
+        timer_wheel_add(timer);
     }
     timer->callback(timer, timer->arg);
 }
 
+/**
+ * 处理到当前节拍为止的所有槽。
+ * 第一层转完一圈时，才把上一层下一个槽的定时器分散下来。
+ */
 void timer_update_ticks()
 {
-    timer_t *timer, *next;
+    LIST_HEAD(work_list);
+    timer_t *timer;
     unsigned long flags;
     interrupt_save_and_disable(flags);
-    if (timer_ticks < minim_timeout_val) { // no timer timeout
-        interrupt_restore_state(flags);
-        return;
-    }
-    list_for_each_owner_safe (timer, next, &timer_list_head, list) {
-        if (timer->timeout > timer_ticks) {
-            break;
+    while (time_after_eq(timer_ticks, timer_base.timer_jiffies)) {
+        int index = timer_base.timer_jiffies & TVR_MASK;
+        if (!index &&
+            !timer_cascade(0, TVN_INDEX(timer_base.timer_jiffies, 0)) &&
+            !timer_cascade(1, TVN_INDEX(timer_base.timer_jiffies, 1)) &&
+            !timer_cascade(2, TVN_INDEX(timer_base.timer_jiffies, 2)))
+            timer_cascade(3, TVN_INDEX(timer_base.timer_jiffies, 3));
+        timer_base.timer_jiffies++;
+        if (!list_empty(&timer_base.tv1[index]))
+            list_replace_init(&timer_base.tv1[index], &work_list);
+        /* 每次只取一个，回调中可以删除其它的定时器 */
+        while (!list_empty(&work_list)) {
+            timer = list_first_owner(&work_list, timer_t, list);
+            timer_do_action(timer);
         }
-        timer_do_action(timer); // time out
     }
+    interrupt_restore_state(flags);
+}
 
-    /* 寻找超时最小的定时器超时值 */
-    list_for_each_owner (timer, &timer_list_head, list) {
-        if (timer->timeout > timer_ticks) {
-            break;
-        }
+/**
+ * 下一个定时器超时的节拍，需要关中断。
+ * 只查找第一层，上面几层的定时器要等到下一次重新分配，所以最晚返回下一次重新分配的节拍，
+ * 用来停止节拍时足够了。
+ */
+clock_t timer_next_expiry()
+{
+    clock_t jiffies = timer_base.timer_jiffies;
+    int index = jiffies & TVR_MASK, i;
+    for (i = index; i < TVR_SIZE; i++) {
+        if (!list_empty(&timer_base.tv1[i]))
+            return jiffies + (i - index);
     }
-    minim_timeout_val = timer->timeout;
-    interrupt_restore_state(flags);
+    return jiffies + (TVR_SIZE - index);
 }
 
 long sys_usleep(struct timeval *inv, struct timeval *outv)
@@ -191,9 +250,18 @@ long sys_usleep(struct timeval *inv, struct timeval *outv)
         return -EFAULT;
     if (tv.tv_usec >= 1000000 || tv.tv_sec < 0 || tv.tv_usec < 0)
         return -EINVAL;
-    /* 如果小于2毫秒就用延时的方式 */
-    if (tv.tv_usec < 2000L && tv.tv_sec == 0) {
-        udelay(tv.tv_usec);
+    /* 不到两个节拍时用高精度定时器休眠，没有高精度定时器就用延时的方式 */
+    if (tv.tv_usec < 2 * US_PER_TICKS && tv.tv_sec == 0) {
+        if (!hrtimer_available()) {
+            udelay(tv.tv_usec);
+            return 0;
+        }
+        tv.tv_usec = task_sleep_by_usec(tv.tv_usec);
+        if (tv.tv_usec > 0) {
+            if (outv && mem_copy_to_user(outv, &tv, sizeof(struct timeval)) < 0)
+                return -EFAULT;
+            return -EINTR;
+        }
         return 0;
     }
     ticks = timeval_to_systicks(&tv);
@@ -211,7 +279,13 @@ long sys_usleep(struct timeval *inv, struct timeval *outv)
 
 int timers_init()
 {
-    timer_init(&timer_idle, TIMER_IDLE_TIMEOUT, NULL, timer_idle_handler);
-    timer_add(&timer_idle);
+    int i, n;
+    timer_base.timer_jiffies = timer_ticks;
+    for (i = 0; i < TVR_SIZE; i++)
+        list_init(&timer_base.tv1[i]);
+    for (n = 0; n < TVN_NR; n++) {
+        for (i = 0; i < TVN_SIZE; i++)
+            list_init(&timer_base.tvn[n][i]);
+    }
     return 0;
-}
\ No newline at end of file
+}
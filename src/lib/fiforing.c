@@ -0,0 +1,62 @@
+#include <xbook/fiforing.h>
+#include <arch/memory.h>
+#include <math.h>
+#include <string.h>
+
+int fifo_ring_init(fifo_ring_t *ring, void *buffer,
+        unsigned int slot_size, unsigned int size)
+{
+    /* 槽的个数必须是2的n次幂 */
+    if (!buffer || !slot_size || !is_power_of_2(size))
+        return -1;
+    ring->buffer = buffer;
+    ring->slot_size = slot_size;
+    ring->size = size;
+    ring->in = ring->out = 0;
+    ring->drops = 0;
+    return 0;
+}
+
+/**
+ * 放入一个槽，只能由生产者调用。队列满时丢弃并返回-1。
+ */
+int fifo_ring_put(fifo_ring_t *ring, const void *slot)
+{
+    unsigned int in = ring->in;
+    if (in - *(volatile unsigned int *) &ring->out >= ring->size) {
+        ring->drops++;
+        return -1;
+    }
+    /* 先读取out，再写入槽 */
+    mb();
+    memcpy(ring->buffer + (in & (ring->size - 1)) * ring->slot_size,
+        slot, ring->slot_size);
+    /* 槽写好以后才更新in，消费者看到in时数据已经完整 */
+    wmb();
+    ring->in = in + 1;
+    return 0;
+}
+
+/**
+ * 批量取出最多nr个槽，只能由消费者调用，返回取出的个数
+ */
+unsigned int fifo_ring_get(fifo_ring_t *ring, void *slots, unsigned int nr)
+{
+    unsigned int out = ring->out;
+    unsigned int len, l;
+    len = MIN(nr, *(volatile unsigned int *) &ring->in - out);
+    if (!len)
+        return 0;
+    /* 先读取in，再读取槽 */
+    rmb();
+    /* 先复制到数组末尾，剩下的从数组开头复制 */
+    l = MIN(len, ring->size - (out & (ring->size - 1)));
+    memcpy(slots, ring->buffer + (out & (ring->size - 1)) * ring->slot_size,
+        l * ring->slot_size);
+    memcpy((unsigned char *) slots + l * ring->slot_size, ring->buffer,
+        (len - l) * ring->slot_size);
+    /* 槽读完以后才更新out，生产者才能覆盖 */
+    mb();
+    ring->out = out + len;
+    return len;
+}
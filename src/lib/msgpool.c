@@ -1,8 +1,21 @@
 #include <xbook/msgpool.h>
 #include <xbook/memalloc.h>
 #include <xbook/schedule.h>
+#include <arch/interrupt.h>
 #include <string.h>
 
+/* 在等待队列上睡眠，加入队列后才释放互斥锁，关中断保证不会错过唤醒 */
+static void msgpool_sleep(msgpool_t *pool, wait_queue_t *wait_queue)
+{
+    unsigned long iflags;
+    interrupt_save_and_disable(iflags);
+    wait_queue_add(wait_queue, task_current);
+    mutex_unlock(&pool->mutex);
+    task_block(TASK_BLOCKED);
+    interrupt_restore_state(iflags);
+    mutex_lock(&pool->mutex);
+}
+
 msgpool_t *msgpool_create(size_t msgsz, size_t msgcount)
 {
     if (!msgsz || !msgcount)
@@ -19,6 +32,7 @@ msgpool_t *msgpool_create(size_t msgsz, size_t msgcount)
     memset(pool->msgbuf, 0, msgcount * msgsz);
     mutexlock_init(&pool->mutex);
     wait_queue_init(&pool->waiters);
+    wait_queue_init(&pool->putters);
     pool->tail = pool->head = pool->msgbuf;
     return pool;
 }
@@ -30,6 +44,9 @@ int msgpool_destroy(msgpool_t *pool)
     if (wait_queue_length(&pool->waiters) > 0) {
         wait_queue_wakeup_all(&pool->waiters);
     }
+    if (wait_queue_length(&pool->putters) > 0) {
+        wait_queue_wakeup_all(&pool->putters);
+    }
     pool->msgmaxcnt = 0;
     pool->msgcount     = 0;
     pool->msgsz     = 0;
@@ -45,11 +62,8 @@ int msgpool_put(msgpool_t *pool, void *buf, size_t size)
         return -1;
         
     mutex_lock(&pool->mutex);
-    if (msgpool_full(pool)) {
-        mutex_unlock(&pool->mutex);
-        task_yield();
-        mutex_lock(&pool->mutex);
-    }
+    while (msgpool_full(pool))  /* 等待接收者取走消息 */
+        msgpool_sleep(pool, &pool->putters);
     memcpy(pool->head, buf, min(pool->msgsz, size));   /* copy data */
     pool->head += pool->msgsz;
     /* fix out of boundary */
@@ -91,11 +105,8 @@ int msgpool_get(msgpool_t *pool, void *buf, msgpool_get_func_t callback)
     if (!pool)
         return -1;
     mutex_lock(&pool->mutex);
-    while (msgpool_empty(pool)) {
-        mutex_unlock(&pool->mutex);
-        task_yield();
-        mutex_lock(&pool->mutex);
-    }
+    while (msgpool_empty(pool)) /* 等待发送者放入消息 */
+        msgpool_sleep(pool, &pool->waiters);
     if (buf) { /* 有buf才复制 */
         if (callback) {
             callback(pool, buf);
@@ -108,8 +119,8 @@ int msgpool_get(msgpool_t *pool, void *buf, msgpool_get_func_t callback)
     if (pool->tail >= pool->msgbuf + pool->msgmaxcnt * pool->msgsz)
         pool->tail = pool->msgbuf;
     pool->msgcount--;
-    if (wait_queue_length(&pool->waiters) > 0)
-        wait_queue_wakeup(&pool->waiters);     /* wake up */    
+    if (wait_queue_length(&pool->putters) > 0)
+        wait_queue_wakeup(&pool->putters);     /* wake up */    
 
     mutex_unlock(&pool->mutex);
     return 0;
@@ -136,8 +147,8 @@ int msgpool_try_get(msgpool_t *pool, void *buf, msgpool_get_func_t callback)
     if (pool->tail >= pool->msgbuf + pool->msgmaxcnt * pool->msgsz)
         pool->tail = pool->msgbuf;
     pool->msgcount--;
-    if (wait_queue_length(&pool->waiters) > 0)
-        wait_queue_wakeup(&pool->waiters);     /* wake up */    
+    if (wait_queue_length(&pool->putters) > 0)
+        wait_queue_wakeup(&pool->putters);     /* wake up */    
 
     mutex_unlock(&pool->mutex);
     return 0;
@@ -56,9 +56,12 @@
 #include "netif/ppp_oe.h"
 
 #include <string.h>
+#include <errno.h>
 #include <sys/ioctl.h>
 #include <xbook/driver.h>
 #include <xbook/net.h>
+#include <xbook/netbuf.h>
+#include <xbook/spinlock.h>
 #include <xbook/debug.h>
 
 /* Define those to better describe your network interface. */
@@ -80,8 +83,84 @@ struct ethernetif {
   struct eth_addr *ethaddr;
   /* Add whatever per-interface state that is needed here. */
   int netsolt;      /* netcard solt */
+  int zerocopy;     /* 网卡支持直接交换缓冲区 */
 };
 
+/**
+ * 接收：网卡的DMA缓冲区包装成自定义pbuf，协议栈释放pbuf时把缓冲区还给缓冲池。
+ * pbuf结构放在缓冲区数据前面的保留空间中，类型是PBUF_POOL，
+ * pbuf_header可以把payload向前移动到pbuf结构之后，ICMP回应和端口不可达都需要移回IP头部。
+ * PBUF_REF不能向前移动，PBUF_RAM在pbuf_realloc时会被mem_trim，都不能使用。
+ */
+struct eth_rx_pbuf {
+  struct pbuf_custom pc;
+  netbuf_t *nb;
+};
+
+/* 发送：pbuf链的每个分段直接交给网卡，发送完成后再释放pbuf */
+#define ETH_TX_SLOT_NR 64
+
+struct eth_tx_slot {
+  netbuf_sg_t sg;
+  struct pbuf *p;
+  struct eth_tx_slot *next;
+};
+
+static struct eth_tx_slot eth_tx_slots[ETH_TX_SLOT_NR];
+static struct eth_tx_slot *eth_tx_free;   /* 空闲的槽，只在发送路径中使用 */
+static struct eth_tx_slot *eth_tx_done;   /* 发送完成的槽，可能在中断中加入 */
+DEFINE_SPIN_LOCK_UNLOCKED(eth_tx_lock);
+
+static void eth_rx_pbuf_free(struct pbuf *p)
+{
+  struct eth_rx_pbuf *rp = (struct eth_rx_pbuf *)p;
+  netbuf_free(rp->nb);
+}
+
+/* 网卡发送完成的回调，可能在中断中，pbuf_free不能在这里调用 */
+static void eth_tx_complete(netbuf_sg_t *sg)
+{
+  struct eth_tx_slot *slot = sg->priv;
+  unsigned long flags;
+  spin_lock_irqsave(&eth_tx_lock, flags);
+  slot->next = eth_tx_done;
+  eth_tx_done = slot;
+  spin_unlock_irqrestore(&eth_tx_lock, flags);
+}
+
+/* 在发送路径中释放已经发送完成的pbuf */
+static void eth_tx_reap(void)
+{
+  struct eth_tx_slot *slot, *next;
+  unsigned long flags;
+  spin_lock_irqsave(&eth_tx_lock, flags);
+  slot = eth_tx_done;
+  eth_tx_done = NULL;
+  spin_unlock_irqrestore(&eth_tx_lock, flags);
+  while (slot != NULL) {
+    next = slot->next;
+    pbuf_free(slot->p);
+    slot->p = NULL;
+    slot->next = eth_tx_free;
+    eth_tx_free = slot;
+    slot = next;
+  }
+}
+
+static void eth_tx_slots_init(void)
+{
+  int i;
+  eth_tx_free = NULL;
+  eth_tx_done = NULL;
+  for (i = 0; i < ETH_TX_SLOT_NR; i++) {
+    eth_tx_slots[i].sg.done = eth_tx_complete;
+    eth_tx_slots[i].sg.priv = &eth_tx_slots[i];
+    eth_tx_slots[i].p = NULL;
+    eth_tx_slots[i].next = eth_tx_free;
+    eth_tx_free = &eth_tx_slots[i];
+  }
+}
+
 /* Forward declarations. */
 //static void ethernetif_input(struct netif *netif);
 
@@ -116,6 +195,10 @@ low_level_init(struct netif *netif)
     int flags = DEV_NOWAIT;
     drv_netcard.ioctl(ethernetif->netsolt, NETIO_SETFLGS, &flags);
 
+    /* 先假设网卡支持零复制，不支持时收发路径会退回到复制方式 */
+    ethernetif->zerocopy = 1;
+    eth_tx_slots_init();
+
   /* set MAC hardware address length */
   netif->hwaddr_len = ETHARP_HWADDR_LEN;
 
@@ -157,11 +240,48 @@ low_level_output(struct netif *netif, struct pbuf *p)
 {
   struct ethernetif *ethernetif = netif->state;
   struct pbuf *q;
+  struct eth_tx_slot *slot;
   err_t retval = ERR_OK;
     int len;
 #if ETH_PAD_SIZE
   pbuf_header(p, -ETH_PAD_SIZE); /* drop the padding word */
 #endif
+  eth_tx_reap();
+
+  /* 分段不多并且有空闲的槽时，把pbuf链的分段直接交给网卡发送 */
+  if (ethernetif->zerocopy && eth_tx_free != NULL && pbuf_clen(p) <= NETBUF_SG_MAX) {
+    slot = eth_tx_free;
+    slot->sg.count = 0;
+    slot->sg.total = 0;
+    for (q = p; q != NULL; q = q->next) {
+      if (!q->len)
+        continue;
+      slot->sg.seg[slot->sg.count].addr = q->payload;
+      slot->sg.seg[slot->sg.count].len = q->len;
+      slot->sg.count++;
+      slot->sg.total += q->len;
+    }
+    /* 网卡持有pbuf直到发送完成 */
+    pbuf_ref(p);
+    slot->p = p;
+    eth_tx_free = slot->next;
+    len = drv_netcard.ioctl(ethernetif->netsolt, NETIO_SENDSG, &slot->sg);
+    if (len == 0) {
+#if ETH_PAD_SIZE
+      pbuf_header(p, ETH_PAD_SIZE); /* reclaim the padding word */
+#endif
+      LINK_STATS_INC(link.xmit);
+      return ERR_OK;
+    }
+    /* 网卡拒绝了请求，不会调用完成回调，改用复制发送 */
+    slot->p = NULL;
+    slot->next = eth_tx_free;
+    eth_tx_free = slot;
+    pbuf_free(p);
+    if (len == -EPERM)  /* 驱动不支持 */
+      ethernetif->zerocopy = 0;
+  }
+
   unsigned int templen = 0;
   for(q = p; q != NULL; q = q->next) {
     /* Send the data from the pbuf to the interface, one pbuf at a
@@ -207,8 +327,35 @@ low_level_input(struct netif *netif)
 {
   struct ethernetif *ethernetif = netif->state;
   struct pbuf *p, *q;
+  struct eth_rx_pbuf *rp;
+  netbuf_t *nb;
   int recvlen;
   unsigned int i = 0;
+
+  /* 直接取走网卡的接收缓冲区，包装成pbuf，不复制数据 */
+  if (ethernetif->zerocopy) {
+    recvlen = drv_netcard.ioctl(ethernetif->netsolt, NETIO_RECVBUF, &nb);
+    if (recvlen == 0) {
+      LWIP_ASSERT("eth_rx_pbuf fits in netbuf headroom",
+        sizeof(struct eth_rx_pbuf) <= NETBUF_HEADROOM);
+      rp = (struct eth_rx_pbuf *)nb->head;
+      rp->nb = nb;
+      rp->pc.custom_free_function = eth_rx_pbuf_free;
+      p = pbuf_alloced_custom(PBUF_RAW, nb->length, PBUF_POOL, &rp->pc, nb->data, NETBUF_DATA_SIZE);
+      if (p == NULL) {
+        netbuf_free(nb);
+        LINK_STATS_INC(link.memerr);
+        LINK_STATS_INC(link.drop);
+        return NULL;
+      }
+      LINK_STATS_INC(link.recv);
+      return p;
+    }
+    if (recvlen == -EAGAIN) /* 没有数据包 */
+      return NULL;
+    ethernetif->zerocopy = 0;   /* 驱动不支持，改用复制接收 */
+  }
+
   recvlen = drv_netcard.read(ethernetif->netsolt, eth_recv_buf, ETH_MTU);
   if (recvlen < 0)
     return 0;
@@ -142,8 +142,9 @@ static int netcard_ioctl(int solt, unsigned int cmd, void *arg)
 {
     if (IS_BAD_SOLT(solt))
         return -1;
-    if (device_devctl(SOLT_TO_HANDLE(solt), cmd, (unsigned long) arg) < 0)
-        return -1;
+    int err = device_devctl(SOLT_TO_HANDLE(solt), cmd, (unsigned long) arg);
+    if (err < 0)
+        return err;     /* 返回驱动设置的错误码 */
     return 0;
 }
 
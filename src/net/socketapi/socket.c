@@ -163,7 +163,6 @@ static int do_read(int sock, void *buf, size_t len)
     if (!parcel) {
         return -ENOMEM;
     }
-    memset(buf, 0, len);
     lpc_parcel_write_int(parcel, sock); 
     lpc_parcel_write_sequence(parcel, buf, len); // 写入缓冲区，预留位置
     if (lpc_call(LPC_ID_NET, NETCALL_read, parcel, parcel) < 0) {
@@ -184,13 +183,13 @@ static int do_read(int sock, void *buf, size_t len)
 
 static int read_large(int sock, void *buffer, size_t nbytes)
 {
-    char *_mbuf = mem_alloc(FSIF_RW_CHUNK_SIZE);
+    char *_mbuf = net_chunk_alloc();
     if (_mbuf == NULL) {
         return -ENOMEM;
     }
     int total = 0;
     char *p = (char *)buffer;
-    size_t chunk = nbytes % FSIF_RW_CHUNK_SIZE;
+    size_t chunk = min(nbytes, NET_CHUNK_SIZE);
     while (nbytes > 0) {
         int rd = do_read(sock, _mbuf, chunk);
         if (rd < 0) {
@@ -198,7 +197,7 @@ static int read_large(int sock, void *buffer, size_t nbytes)
             total = -EIO;
             break;
         }
-        if (mem_copy_to_user(p, _mbuf, chunk) < 0) {
+        if (mem_copy_to_user(p, _mbuf, rd) < 0) {
             errprint("[net] read_large: copy buf %p to user failed!\n", p);
             total = -EINVAL;
             break;
@@ -207,9 +206,11 @@ static int read_large(int sock, void *buffer, size_t nbytes)
         p += chunk;
         total += rd;
         nbytes -= chunk;
-        chunk = FSIF_RW_CHUNK_SIZE;
+        if (rd < chunk)   /* 没有更多的数据了 */
+            break;
+        chunk = min(nbytes, NET_CHUNK_SIZE);
     }
-    mem_free(_mbuf);
+    net_chunk_free(_mbuf);
     return total;
 }
 
@@ -267,13 +268,13 @@ static int do_write(int sock, const void *buf, size_t len)
 
 static int write_large(int sock, void *buffer, size_t nbytes)
 {
-    char *_mbuf = mem_alloc(FSIF_RW_CHUNK_SIZE);
+    char *_mbuf = net_chunk_alloc();
     if (_mbuf == NULL) {
         return -ENOMEM;
     }
     int total = 0;
     char *p = (char *)buffer;
-    size_t chunk = nbytes % FSIF_RW_CHUNK_SIZE;
+    size_t chunk = min(nbytes, NET_CHUNK_SIZE);
     while (nbytes > 0) {
         if (mem_copy_from_user(_mbuf, p, chunk) < 0) {
             errprint("[net] write_large: copy buf %p from user failed!\n", p);
@@ -289,9 +290,9 @@ static int write_large(int sock, void *buffer, size_t nbytes)
         p += chunk;
         total += wr;
         nbytes -= chunk;
-        chunk = FSIF_RW_CHUNK_SIZE;
+        chunk = min(nbytes, NET_CHUNK_SIZE);
     }
-    mem_free(_mbuf);
+    net_chunk_free(_mbuf);
     return total;
 }
 
@@ -19,7 +19,6 @@ static int do_recv(int sock, void *buf, int len, int flags)
     if (!parcel) {
         return -1;
     }
-    memset(buf, 0, len);
     lpc_parcel_write_int(parcel, sock); 
     lpc_parcel_write_sequence(parcel, buf, len); // 写入缓冲区，预留位置
     lpc_parcel_write_int(parcel, flags);
@@ -41,13 +40,13 @@ static int do_recv(int sock, void *buf, int len, int flags)
 
 static int recv_large(int sock, void *buf, int len, int flags)
 {
-    char *_mbuf = mem_alloc(FSIF_RW_CHUNK_SIZE);
+    char *_mbuf = net_chunk_alloc();
     if (_mbuf == NULL) {
         return -ENOMEM;
     }
     int total = 0;
     char *p = (char *)buf;
-    size_t chunk = len % FSIF_RW_CHUNK_SIZE;
+    size_t chunk = min(len, NET_CHUNK_SIZE);
     while (len > 0) {
         int rd = do_recv(sock, _mbuf, chunk, flags);
         if (rd < 0) {
@@ -55,7 +54,7 @@ static int recv_large(int sock, void *buf, int len, int flags)
             total = -EIO;
             break;
         }
-        if (mem_copy_to_user(p, _mbuf, chunk) < 0) {
+        if (mem_copy_to_user(p, _mbuf, rd) < 0) {
             errprint("[net] recv_large: copy buf %p to user failed!", p);
             total = -EINVAL;
             break;
@@ -64,9 +63,11 @@ static int recv_large(int sock, void *buf, int len, int flags)
         p += chunk;
         total += rd;
         len -= chunk;
-        chunk = FSIF_RW_CHUNK_SIZE;
+        if (rd < chunk)   /* 没有更多的数据了 */
+            break;
+        chunk = min(len, NET_CHUNK_SIZE);
     }
-    mem_free(_mbuf);
+    net_chunk_free(_mbuf);
     return total;
 }
 
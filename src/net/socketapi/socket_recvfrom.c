@@ -20,7 +20,6 @@ static int do_recvfrom(int sock, void *buf, int len, unsigned int flags,
     if (!parcel) {
         return -1;
     }
-    memset(buf, 0, len);
     lpc_parcel_write_int(parcel, sock); 
     lpc_parcel_write_sequence(parcel, buf, len); // 写入缓冲区，预留位置
     lpc_parcel_write_int(parcel, flags);
@@ -44,13 +43,13 @@ static int do_recvfrom(int sock, void *buf, int len, unsigned int flags,
 static int recvfrom_large(int sock, void *buf, int len, int flags,
     struct sockaddr *from, socklen_t *fromlen)
 {
-    char *_mbuf = mem_alloc(FSIF_RW_CHUNK_SIZE);
+    char *_mbuf = net_chunk_alloc();
     if (_mbuf == NULL) {
         return -ENOMEM;
     }
     int total = 0;
     char *p = (char *)buf;
-    size_t chunk = len % FSIF_RW_CHUNK_SIZE;
+    size_t chunk = min(len, NET_CHUNK_SIZE);
     while (len > 0) {
         int rd = do_recvfrom(sock, _mbuf, chunk, flags, from, fromlen);
         if (rd < 0) {
@@ -58,7 +57,7 @@ static int recvfrom_large(int sock, void *buf, int len, int flags,
             total = -EIO;
             break;
         }
-        if (mem_copy_to_user(p, _mbuf, chunk) < 0) {
+        if (mem_copy_to_user(p, _mbuf, rd) < 0) {
             errprint("[net] recvfrom_large: copy buf %p to user failed!", p);
             total = -EINVAL;
             break;
@@ -67,9 +66,11 @@ static int recvfrom_large(int sock, void *buf, int len, int flags,
         p += chunk;
         total += rd;
         len -= chunk;
-        chunk = FSIF_RW_CHUNK_SIZE;
+        if (rd < chunk)   /* 没有更多的数据了 */
+            break;
+        chunk = min(len, NET_CHUNK_SIZE);
     }
-    mem_free(_mbuf);
+    net_chunk_free(_mbuf);
     return total;
 }
 
@@ -37,13 +37,13 @@ static int do_send(int sock, const void *buf, int len, int flags)
 
 static int send_large(int sock, const void *buf, int len, int flags)
 {
-    char *_mbuf = mem_alloc(FSIF_RW_CHUNK_SIZE);
+    char *_mbuf = net_chunk_alloc();
     if (_mbuf == NULL) {
         return -ENOMEM;
     }
     int total = 0;
     char *p = (char *)buf;
-    size_t chunk = len % FSIF_RW_CHUNK_SIZE;
+    size_t chunk = min(len, NET_CHUNK_SIZE);
     while (len > 0) {
         if (mem_copy_from_user(_mbuf, p, chunk) < 0) {
             errprint("[net] send_large: copy buf %p from user failed!", p);
@@ -60,9 +60,9 @@ static int send_large(int sock, const void *buf, int len, int flags)
         p += chunk;
         total += wr;
         len -= chunk;
-        chunk = FSIF_RW_CHUNK_SIZE;
+        chunk = min(len, NET_CHUNK_SIZE);
     }
-    mem_free(_mbuf);
+    net_chunk_free(_mbuf);
     return total;
 }
 
@@ -12,16 +12,15 @@
 #include <xbook/dir.h>
 #include <xbook/fsal.h>
 #include <xbook/fd.h>
+#include <xbook/timepage.h>
 
 
 
 /**
  * exec使用新的镜像以及堆栈替换原有的内容。
- * 注意，加载代码和数据的过程中，不会释放掉已经映射的内容，
- * 只是把虚拟内存空间结构释放掉。
- * 内存映射也是安全映射，即如果虚拟地址没有映射才映射，已经映射就不映射。
- * 只有在退出进程的时候才释放所有资源。这样也在一定程度上提高了效率，
- * 但是占用的内存变大，是空间换取时间的做法。
+ * 注意，加载代码和数据之前，会解除旧镜像的映射（栈除外）并释放虚拟内存空间结构。
+ * fork之后的页是写时复制共享的，解除映射可以把页归还给父进程，
+ * 避免新镜像写入这些页时还要复制一次。
  * 
  * 如果在线程中执行exec，那么线程会全部关闭，并把当前进程用新进程镜像替换。
  */
@@ -89,7 +88,8 @@ static int do_execute(const char *pathname, char *name, const char *argv[], cons
 
     char tmp_name[MAX_TASK_NAMELEN] = {0};
     strcpy(tmp_name, name);
-    vmm_unmap_the_mapping_space(cur->vmm);
+    /* 解除旧镜像的映射，归还写时复制共享的页，避免新镜像写入时再复制 */
+    vmm_unmap_space(cur->vmm);
     vmm_release_space(cur->vmm);
     if (proc_load_image(cur->vmm, &elf_header, fd) < 0) {
         keprint(PRINT_ERR "sys_exec_file: load_image failed!\n");
@@ -101,6 +101,8 @@ static int do_execute(const char *pathname, char *name, const char *argv[], cons
     if(process_frame_init(cur, frame, new_argv, new_envp) < 0){
         goto free_loaded_image;
     }
+    if (timepage_map() < 0)
+        goto free_loaded_image;
     if (cur->vmm->argbuf) {
         vmm_debuild_argbuf(cur->vmm);
     } else {
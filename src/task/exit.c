@@ -8,11 +8,9 @@
 
 static void adopt_children_to_init(task_t *parent)
 {
-    task_t *child;
-    list_for_each_owner (child, &task_global_list, global_list) {
-        if (child->parent_pid == parent->pid) {
-            child->parent_pid = USER_INIT_PROC_ID;
-        }
+    task_t *child, *next;
+    list_for_each_owner_safe (child, next, &parent->child_list, sibling_list) {
+        task_set_parent(child, USER_INIT_PROC_ID);
     }
 }
 
@@ -29,8 +29,17 @@ static int copy_struct_and_kstack(task_t *child, task_t *parent)
     child->pgid = parent->pgid;     /* 和父进程在同一个组 */
     list_init(&child->list);
     list_init(&child->global_list);
+    list_init(&child->pid_list);
+    list_init(&child->child_list);
+    list_init(&child->sibling_list);
+    list_init(&child->thread_list);
+    /* 定时器链表是父进程的，闹钟也不会被子进程继承 */
+    timer_init(&child->sleep_timer, 0, NULL, NULL);
+    alarm_init(&child->alarm);
     child->kstack = (unsigned char *)((unsigned char *)child + TASK_KERN_STACK_SIZE - sizeof(trap_frame_t));
     child->port_comm = NULL;
+    child->io_context = NULL;
+    child->lock_depth = 1;  /* 从interrupt_exit返回用户态时释放内核锁 */
     return 0;
 }
 
@@ -59,8 +68,8 @@ static int copy_vm(task_t *child, task_t *parent)
         return -1;
     }
     if (vmm_copy_mapping(child, parent) < 0) {
-        vmm_release_space(child->vmm);
-        vmm_free(child->vmm);
+        /* 已经共享的页需要解除映射，归还引用 */
+        vmm_exit_when_fork_failed(child->vmm, parent->vmm);
         child->vmm = NULL;
         return -1;
     }
@@ -121,7 +130,7 @@ int sys_fork()
     task_t *parent = task_current;
     unsigned long flags;
     interrupt_save_and_disable(flags);
-    task_t *child = mem_alloc(TASK_KERN_STACK_SIZE);
+    task_t *child = task_alloc();
     if (child == NULL) {
         keprint(PRINT_ERR "sys_fork: mem_alloc for child task failed!\n");
         return -1;
@@ -14,12 +14,17 @@
 #include <sys/pthread.h>
 #include <xbook/safety.h>
 #include <xbook/fd.h>
+#include <xbook/ioring.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <errno.h>
 
 #define DEBUG_PROCESS 0
 
+/**
+ * 建立程序段的文件映射，数据在访问时才从文件中读取（按需分页），
+ * 超出文件大小的部分（bss）在访问时填0。
+ */
 static int proc_load_segment(int fd, unsigned long offset, unsigned long file_sz,
     unsigned long mem_sz, unsigned long vaddr)
 {
@@ -32,15 +37,10 @@ static int proc_load_segment(int fd, unsigned long offset, unsigned long file_sz
     } else {
         occupy_pages = 1;
     }
-    void *retaddr = mem_space_mmap(vaddr_page, 0, occupy_pages * PAGE_SIZE, 
-            PROT_USER | PROT_WRITE, MEM_SPACE_MAP_FIXED);
+    void *retaddr = mem_space_mmap_file(vaddr_page, occupy_pages * PAGE_SIZE, 
+            PROT_USER | PROT_WRITE, MEM_SPACE_MAP_FIXED, fd, vaddr, offset, file_sz);
     if (retaddr == ((void *)-1)) {
-        keprint(PRINT_ERR "proc_load_segment: mem_space_mmap failed!\n");
-        return -1;
-    }
-    kfile_lseek(fd, offset, SEEK_SET);
-    if (kfile_read(fd, (void *)vaddr, file_sz) != file_sz) {
-        keprint(PRINT_ERR "proc_load_segment: read file failed!\n");
+        keprint(PRINT_ERR "proc_load_segment: mem_space_mmap_file failed!\n");
         return -1;
     }
     return 0;
@@ -68,11 +68,6 @@ int proc_load_image(vmm_t *vmm, struct Elf32_Ehdr *elf_header, int fd)
                     prog_header.p_filesz, prog_header.p_memsz, prog_header.p_vaddr)) {
                 return -1;
             }
-            /* 如果内存大小比文件大小大，就要清0 */
-            if (prog_header.p_memsz > prog_header.p_filesz) {
-                memset((void *)(prog_header.p_vaddr + prog_header.p_filesz), 0,
-                    prog_header.p_memsz - prog_header.p_filesz);    
-            }
             prog_end = prog_header.p_vaddr + prog_header.p_memsz;
             
             if (prog_header.p_flags == ELF32_PHDR_CODE) {
@@ -200,6 +195,7 @@ int proc_pthread_init(task_t *task)
     if (task->pthread == NULL)
         return -1;
     pthread_desc_init(task->pthread);
+    list_add_tail(&task->thread_list, &task->pthread->thread_list);
     return 0;
 }
 
@@ -207,6 +203,7 @@ int proc_pthread_exit(task_t *task)
 {
     if (!task->pthread)
         return -1; 
+    list_del_init(&task->thread_list);
     pthread_desc_exit(task->pthread);
     task->pthread = NULL;
     return 0;
@@ -214,6 +211,7 @@ int proc_pthread_exit(task_t *task)
 
 int proc_release(task_t *task)
 {
+    io_context_exit(task);
     proc_vmm_exit(task);
     fs_fd_exit(task);
     proc_pthread_exit(task);
@@ -225,8 +223,13 @@ int proc_release(task_t *task)
 
 void proc_exec_init(task_t *task)
 {
+    io_context_exit(task);
     proc_map_space_init(task);
-    pthread_desc_init(task->pthread);
+    if (task->pthread) {    /* 新程序只有当前线程 */
+        pthread_desc_init(task->pthread);
+        list_init(&task->thread_list);
+        list_add_tail(&task->thread_list, &task->pthread->thread_list);
+    }
     fs_fd_reinit(task);
     exception_manager_exit(&task->exception_manager);
     exception_manager_init(&task->exception_manager);
@@ -260,19 +263,17 @@ int proc_deal_zombie_child(task_t *parent)
     int zombies = 0;
     int zombie = -1;
     task_t *child, *next;
-    list_for_each_owner_safe (child, next, &task_global_list, global_list) {
-        if (child->parent_pid == parent->pid) {
-            if (child->state == TASK_ZOMBIE) {
-                if (zombie == -1) {
-                    zombie = child->pid;
-                }
-                if (TASK_IS_SINGAL_THREAD(child)) {
-                    proc_destroy(child, 0);
-                } else {
-                    proc_destroy(child, 1);
-                }
-                zombies++;
+    list_for_each_owner_safe (child, next, &parent->child_list, sibling_list) {
+        if (child->state == TASK_ZOMBIE) {
+            if (zombie == -1) {
+                zombie = child->pid;
+            }
+            if (TASK_IS_SINGAL_THREAD(child)) {
+                proc_destroy(child, 0);
+            } else {
+                proc_destroy(child, 1);
             }
+            zombies++;
         }
     }
     return zombie; /* 如果没有僵尸进程就返回-1，有则返回第一个僵尸进程的pid */
@@ -286,22 +287,21 @@ void proc_close_one_thread(task_t *thread)
     if (thread->state != TASK_HANGING && thread->state != TASK_ZOMBIE) {
         task_do_cancel(thread);
     }
+    io_context_exit(thread);
     proc_destroy(thread, 1);
 }
 
 void proc_close_other_threads(task_t *thread)
 {
     task_t *borther, *next;
-    list_for_each_owner_safe (borther, next, &task_global_list, global_list) {
-        if (TASK_IN_SAME_THREAD_GROUP(thread, borther)) {
-            if (thread->pid != borther->pid) {
-                proc_close_one_thread(borther);
-            }
+    if (!thread->pthread)   /* 没有创建过线程 */
+        return;
+    list_for_each_owner_safe (borther, next, &thread->pthread->thread_list, thread_list) {
+        if (thread->pid != borther->pid) {
+            proc_close_one_thread(borther);
         }
     }
-    if (thread->pthread) {
-        atomic_set(&thread->pthread->thread_count, 0);
-    }
+    atomic_set(&thread->pthread->thread_count, 0);
 }
 
 void proc_entry(void* arg)
@@ -327,7 +327,7 @@ task_t *process_create(char **argv, char **envp, uint32_t flags)
 {
     if (!argv || !argv[0])
         return NULL;
-    task_t *task = (task_t *) mem_alloc(TASK_KERN_STACK_SIZE);
+    task_t *task = task_alloc();
     if (!task)
         return NULL;
     task_t *parent = task_current;
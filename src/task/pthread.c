@@ -2,6 +2,7 @@
 #include <xbook/process.h>
 #include <xbook/pthread.h>
 #include <xbook/safety.h>
+#include <xbook/ioring.h>
 #include <arch/interrupt.h>
 #include <arch/task.h>
 #include <errno.h>
@@ -10,6 +11,7 @@ void pthread_desc_init(pthread_desc_t *pthread)
 {
     if (pthread != NULL) {
         atomic_set(&pthread->thread_count, 1);
+        list_init(&pthread->thread_list);
     }
 }
 
@@ -27,16 +29,12 @@ void pthread_entry(void *arg)
 
 int wait_one_hangging_thread(task_t *parent, pid_t pid, int *status)
 {
-    task_t *child, *next;
-    list_for_each_owner_safe (child, next, &task_global_list, global_list) {
-        if (child->pid == pid) {
-            if (child->state == TASK_HANGING) {
-                if (status != NULL)
-                    *status = child->exit_status;
-                proc_destroy(child, 1);
-                return pid;
-            }
-        }
+    task_t *child = task_find_by_pid(pid);
+    if (child && child->state == TASK_HANGING) {
+        if (status != NULL)
+            *status = child->exit_status;
+        proc_destroy(child, 1);
+        return pid;
     }
     return -1;
 }
@@ -49,7 +47,7 @@ task_t *pthread_start(task_func_t *func, void *arg,
         if (proc_pthread_init(parent))
             return NULL;
     }
-    task_t *task = (task_t *) mem_alloc(TASK_KERN_STACK_SIZE);
+    task_t *task = task_alloc();
     if (!task)
         return NULL;
     task_init(task, "pthread", TASK_PRIO_LEVEL_NORMAL);
@@ -84,6 +82,7 @@ task_t *pthread_start(task_func_t *func, void *arg,
         return NULL;
     }
     task_add_to_global_list(task);
+    list_add_tail(&task->thread_list, &task->pthread->thread_list);
     sched_queue_add_tail(sched_get_cur_unit(), task);
     interrupt_restore_state(flags);
     return task;
@@ -121,6 +120,7 @@ void pthread_exit(void *status)
     }
     cur->exit_status = (int)status;
     task_do_cancel(cur);
+    io_context_exit(cur);
     task_exit_hook(cur);
 
     if (cur->flags & THREAD_FLAG_DETACH) {
@@ -133,7 +133,7 @@ void pthread_exit(void *status)
                 }
             }
         }
-        cur->parent_pid = USER_INIT_PROC_ID;
+        task_set_parent(cur, USER_INIT_PROC_ID);
     }
     task_t *parent = task_find_by_pid(cur->parent_pid); 
     if (parent) {
@@ -183,14 +183,8 @@ int pthread_join(pthread_t thread, void **thread_return)
     task_t *waiter = task_current;
     unsigned long flags;
     interrupt_save_and_disable(flags);
-    task_t *task, *find = NULL;
-    list_for_each_owner (task, &task_global_list, global_list) {
-        if (task->pid == thread && task->state != TASK_ZOMBIE) {
-            find = task;
-            break;
-        }
-    }
-    if (find == NULL) {
+    task_t *find = task_find_by_pid(thread);
+    if (find == NULL || find->state == TASK_ZOMBIE) {
         interrupt_restore_state(flags);
         return -1;
     }
@@ -204,7 +198,7 @@ int pthread_join(pthread_t thread, void **thread_return)
     }
 
     find->flags |= THREAD_FLAG_JOINED;
-    find->parent_pid = waiter->pid;
+    task_set_parent(find, waiter->pid);
     waiter->flags |= THREAD_FLAG_JOINING;
     int status;
     pid_t pid;
@@ -3,6 +3,7 @@
 #include <xbook/clock.h>
 #include <assert.h>
 #include <xbook/debug.h>
+#include <xbook/smp.h>
 #include <arch/interrupt.h>
 #include <arch/task.h>
 
@@ -10,12 +11,13 @@
 
 scheduler_t scheduler;
 
-const uint8_t sched_priority_levels[TASK_PRIO_LEVEL_MAX] = {1, 0, 1, 2, 3};
+const uint8_t sched_priority_levels[TASK_PRIO_LEVEL_MAX] = {
+    TASK_PRIORITY_NORMAL, TASK_PRIORITY_LOW, TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_HIGH, TASK_PRIORITY_REALTIME};
 
 /*
-TODO：优化动态优先级：当一个优先级高的线程长期获得优运行时，可以适当调低优先级。
-当一个低先级高的线程长期没获得运行时，可以适当调提高优先级。
-当前采取的是高优先级执行固定时间后就降低，不太好，没体现优先级的优势。
+动态优先级：任务被唤醒时提升优先级，每用完一个时间片降低一级，直到回到静态优先级。
+实时任务的优先级不变。
 */
 uint8_t sched_calc_base_priority(uint32_t level)
 {
@@ -29,9 +31,12 @@ uint8_t sched_calc_new_priority(task_t *task, char adjustment)
     char priority = task->priority;
     assert((priority <= TASK_PRIORITY_REALTIME));
     if ((priority < TASK_PRIORITY_REALTIME)) {
+        char limit = task->static_priority + TASK_PRIORITY_BOOST_MAX;
+        if (limit >= TASK_PRIORITY_REALTIME)
+            limit = TASK_PRIORITY_REALTIME - 1;
         priority = priority + adjustment;
-        if (priority >= TASK_PRIORITY_REALTIME)
-            priority = TASK_PRIORITY_REALTIME - 1;
+        if (priority > limit)
+            priority = limit;
         if (priority < task->static_priority)
             priority = task->static_priority;
     }
@@ -41,13 +46,11 @@ uint8_t sched_calc_new_priority(task_t *task, char adjustment)
 static task_t *sched_queue_fetch_first(sched_unit_t *su)
 {
     task_t *task;
-    /* 总是选择优先级比较高的队列 */
-    while (!su->priority_queue[su->dynamic_priority].length) {
-        --su->dynamic_priority;
-    }
-    sched_queue_t *queue = &su->priority_queue[su->dynamic_priority];
+    /* 就绪位图中最高的置位就是优先级最高的非空队列，idle任务保证位图不为空 */
+    sched_queue_t *queue = &su->priority_queue[find_highest_bit(su->priority_bitmap)];
     task = list_first_owner(&queue->list, task_t, list);
-    --queue->length;
+    if (!--queue->length)
+        su->priority_bitmap &= ~(1UL << queue->priority);
     --su->tasknr;
     list_del_init(&task->list);
     return task;
@@ -62,11 +65,8 @@ task_t *get_next_task(sched_unit_t *su)
         task->state = TASK_READY;
     case TASK_READY:
         // Non-real-time tasks are dynamically prioritized    
-        if (task->priority < TASK_PRIORITY_REALTIME && task->priority > TASK_PRIORITY_LOW) {
+        if (task->priority < TASK_PRIORITY_REALTIME && task->priority > task->static_priority) {
             task->priority--;
-            if ((task->priority <= TASK_PRIORITY_LOW)) {
-                task->priority = task->static_priority;
-            }
         }
         sched_queue_add_tail(su, task);
     default:
@@ -80,7 +80,7 @@ task_t *get_next_task(sched_unit_t *su)
 static void sched_set_next_task(sched_unit_t *su, task_t *next)
 {
     fpu_save(&su->cur->fpu);
-    su->cur = next;
+    sched_set_cur_task(su, next);
     task_activate_when_sched(su->cur);
     fpu_restore(&next->fpu);
 }
@@ -96,10 +96,114 @@ void schedule()
     dbgprint("sched: switch from %d to %d\n", cur->pid, next->pid);
     #endif
     sched_set_next_task(su, next);
+    /* 内核锁跟着cpu走，只交换两个任务各自的嵌套深度 */
+    cur->lock_depth = kernel_lock_switch(next->lock_depth);
     thread_switch_to_next(cur, next);
     interrupt_restore_state(flags);
 }
 
+/**
+ * 时钟节拍到来时调用，统计当前任务的运行时间，时间片用完后调度
+ */
+void sched_tick()
+{
+    sched_unit_t *su = sched_get_cur_unit();
+    task_t *current = su->cur;
+    assert(current->stack_magic == TASK_STACK_MAGIC);
+    if (scheduler.cpunr > 1 && ++su->balance_ticks >= SCHED_BALANCE_TICKS) {
+        su->balance_ticks = 0;
+        sched_balance(su);
+    }
+    current->elapsed_ticks++;
+    if (current->ticks <= 0) {
+        schedule();
+    } else {
+        current->ticks--;
+    }
+}
+
+/* 把就绪任务从调度单元中摘下来，和sched_queue_fetch_first一样维护就绪位图 */
+static void sched_queue_del(sched_unit_t *su, task_t *task)
+{
+    sched_queue_t *queue = su->priority_queue + task->priority;
+    list_del_init(&task->list);
+    if (!--queue->length)
+        su->priority_bitmap &= ~(1UL << queue->priority);
+    --su->tasknr;
+}
+
+/**
+ * 直接切换到next，不经过就绪位图的选择，用于同步IPC的直接交接。
+ * 当前任务的状态由调用者设置：还是运行状态时放到就绪队列尾部，阻塞状态时直接睡眠。
+ * next不是本调度单元的就绪任务时，退化成schedule。
+ */
+void schedule_to(task_t *next)
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    sched_unit_t *su = sched_get_cur_unit();
+    task_t *cur = su->cur;
+    if (!next || next == cur || next->state != TASK_READY || next->cpuid != su->cpuid) {
+        schedule();
+        interrupt_restore_state(flags);
+        return;
+    }
+    sched_queue_del(su, next);
+    if (cur->state == TASK_RUNNING) {
+        cur->state = TASK_READY;
+        sched_queue_add_tail(su, cur);
+    }
+    #if DEBUG_SCHED == 1
+    dbgprint("sched: handoff from %d to %d\n", cur->pid, next->pid);
+    #endif
+    sched_set_next_task(su, next);
+    cur->lock_depth = kernel_lock_switch(next->lock_depth);
+    thread_switch_to_next(cur, next);
+    interrupt_restore_state(flags);
+}
+
+/**
+ * 负载均衡：从就绪任务最多的调度单元拉一个任务到su
+ * 只有相差超过一个任务时才迁移，避免任务在cpu之间来回移动
+ */
+void sched_balance(sched_unit_t *su)
+{
+    sched_unit_t *busiest = NULL, *unit;
+    int i;
+    for (i = 0; i < scheduler.cpunr; i++) {
+        unit = &scheduler.sched_unit_table[i];
+        if (unit == su)
+            continue;
+        if (!busiest || unit->tasknr > busiest->tasknr)
+            busiest = unit;
+    }
+    if (!busiest || busiest->tasknr <= su->tasknr + 1)
+        return;
+    /* 从优先级最高的非空队列的队尾取，idle任务不能迁移 */
+    uint32_t bitmap = busiest->priority_bitmap & ~(1UL << TASK_PRIORITY_IDLE);
+    if (!bitmap)
+        return;
+    sched_queue_t *queue = &busiest->priority_queue[find_highest_bit(bitmap)];
+    task_t *task = list_last_owner(&queue->list, task_t, list);
+    if (task == busiest->idle)
+        return;
+    sched_queue_del(busiest, task);
+    sched_queue_add_tail(su, task);
+    scheduler.tasknr--; /* 只是迁移，任务总数不变 */
+    #if DEBUG_SCHED == 1
+    dbgprint("sched: migrate task %d from cpu %d to cpu %d\n", task->pid, busiest->cpuid, su->cpuid);
+    #endif
+}
+
+/**
+ * 向其它cpu的调度单元加入就绪任务后调用，如果它正在空闲就发送核间中断让它调度
+ */
+void sched_notify_unit(sched_unit_t *su)
+{
+    if (su->cpuid != cpu_get_my_id() && su->cur == su->idle)
+        smp_send_reschedule(su->cpuid);
+}
+
 void sched_print_queue(sched_unit_t *su)
 {
     if (su == NULL) {
@@ -131,9 +235,10 @@ void init_sched_unit(sched_unit_t *su, cpuid_t cpuid, unsigned long flags)
     su->flags = flags;
     su->cur = NULL;
     su->idle = NULL;
+    su->balance_ticks = 0;
     spinlock_init(&su->lock);
     su->tasknr = 0;
-    su->dynamic_priority = 0;
+    su->priority_bitmap = 0;
     sched_queue_t *queue;
     int i;
     for (i = 0; i < TASK_PRIORITY_MAX_NR; i++) {
@@ -155,4 +260,6 @@ void schedule_init()
     for (i = 0; i < scheduler.cpunr; i++) {
         init_sched_unit(&scheduler.sched_unit_table[i], cpu_list[i], 0);
     }
+    /* 启动cpu的调度单元 */
+    cpu_local_write(CPU_LOCAL_SCHED, &scheduler.sched_unit_table[0]);
 }
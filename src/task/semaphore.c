@@ -35,7 +35,9 @@ void __semaphore_up(semaphore_t *sema)
         list_del(&waiter->list);
         TASK_LEAVE_WAITLIST(waiter);
         waiter->state = TASK_READY;
-        sched_queue_add_head(sched_get_cur_unit(), waiter);
+        sched_unit_t *su = sched_get_unit(waiter->cpuid);
+        sched_queue_add_head(su, waiter);
+        sched_notify_unit(su);
     }
     mutex_unlock(&sema->lock);
 }
@@ -1,6 +1,7 @@
 #include <xbook/task.h>
 #include <xbook/timer.h>
 #include <xbook/clock.h>
+#include <xbook/clockevent.h>
 #include <xbook/schedule.h>
 
 static void task_sleep_timeout_handler(timer_t *timer_self, void *arg)
@@ -24,8 +25,10 @@ unsigned long task_sleep_by_ticks(clock_t ticks)
     unsigned long flags;
     interrupt_save_and_disable(flags);
     long delta_ticks = 0;
-    if (timer->timeout > timer_ticks) {
-        delta_ticks = timer->timeout - timer_ticks;
+    /* 被提前唤醒时定时器还在时间轮上 */
+    if (timer_alive(timer)) {
+        if (time_after(timer->timeout, timer_ticks))
+            delta_ticks = timer->timeout - timer_ticks;
         timer_del(timer);
         //keprint("sleep intrrupted!\n");
     }
@@ -33,6 +36,42 @@ unsigned long task_sleep_by_ticks(clock_t ticks)
     return delta_ticks;
 }
 
+static void task_sleep_hrtimer_handler(hrtimer_t *timer_self, void *arg)
+{
+    task_wakeup((task_t *) arg);
+}
+
+/**
+ * 以微秒为单位休眠，返回被打断时剩余的微秒数。
+ * 不到两个节拍并且有高精度定时器时用高精度定时器，否则向上取整成节拍。
+ */
+unsigned long task_sleep_by_usec(unsigned long usec)
+{
+    if (!usec)
+        return 0;
+    if (usec >= 2 * US_PER_TICKS || !hrtimer_available()) {
+        clock_t ticks = usec / US_PER_TICKS + (usec % US_PER_TICKS ? 1 : 0);
+        return task_sleep_by_ticks(ticks) * US_PER_TICKS;
+    }
+    task_t *cur = task_current;
+    hrtimer_t timer;
+    unsigned long left = 0;
+    unsigned long flags;
+    hrtimer_init(&timer, task_sleep_hrtimer_handler, cur);
+    /* 关中断阻塞，定时器不会在阻塞前超时 */
+    interrupt_save_and_disable(flags);
+    hrtimer_start(&timer, usec);
+    task_block(TASK_BLOCKED);
+    if (hrtimer_active(&timer)) {
+        unsigned long long now = clock_event_now_us();
+        if (timer.expires > now)
+            left = timer.expires - now;
+        hrtimer_cancel(&timer);
+    }
+    interrupt_restore_state(flags);
+    return left;
+}
+
 unsigned long sys_sleep(unsigned long second)
 {
     TASK_CHECK_THREAD_CANCELATION_POTINT(task_current);
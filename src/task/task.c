@@ -23,17 +23,33 @@
 #include <xbook/safety.h>
 #include <xbook/kernel.h>
 #include <xbook/fd.h>
+#include <xbook/smp.h>
+#include <xbook/clockevent.h>
 #include <math.h>
+#include <stdio.h>
 #include <errno.h>
 
 static pid_t task_next_pid;
 LIST_HEAD(task_global_list);
+/* 按照pid散列，查找任务时只需要遍历一个冲突链表 */
+static list_t task_pid_hash[TASK_PID_HASH_NR];
+/* 任务结构和内核栈在一起，从专用的缓存分配，对象按照栈的大小对齐 */
+static mem_cache_t *task_cache;
 /* task init done flags, for early interrupt. */
 volatile int task_init_done = 0;
 
 pid_t task_take_pid()
 {
-    return task_next_pid++;
+    pid_t pid;
+    /* pid用完后回绕，跳过还在使用的pid */
+    do {
+        pid = task_next_pid;
+        if (task_next_pid >= TASK_PID_MAX)
+            task_next_pid = USER_INIT_PROC_ID + 1;
+        else
+            task_next_pid++;
+    } while (task_init_done && task_find_by_pid(pid));
+    return pid;
 }
 
 void task_rollback_pid()
@@ -47,6 +63,8 @@ void task_init(task_t *task, char *name, uint8_t prio_level)
     strcpy(task->name, name);
     task->state = TASK_READY;
     spinlock_init(&task->lock);
+    task->cpuid = cpu_get_my_id();
+    task->lock_depth = 1;   /* 第一次运行时持有内核锁，返回用户态时释放 */
     task->static_priority = sched_calc_base_priority(prio_level);
     task->priority = task->static_priority;
     //task->timeslice = TASK_TIMESLICE_BASE + (task->priority / 10);
@@ -63,6 +81,10 @@ void task_init(task_t *task, char *name, uint8_t prio_level)
     // set kernel stack as the top of task mem struct
     task->kstack = (unsigned char *)(((unsigned long )task) + TASK_KERN_STACK_SIZE);
     task->flags = 0;
+    list_init(&task->pid_list);
+    list_init(&task->child_list);
+    list_init(&task->sibling_list);
+    list_init(&task->thread_list);
     fpu_init(&task->fpu, 0);
     timer_init(&task->sleep_timer, 0, NULL, NULL);
     alarm_init(&task->alarm);
@@ -73,19 +95,57 @@ void task_init(task_t *task, char *name, uint8_t prio_level)
     task->exit_hook = NULL;
     task->exit_hook_arg = NULL;
     task->port_comm = NULL;
+    task->io_context = NULL;
     task->stack_magic = TASK_STACK_MAGIC;
 }
 
+/**
+ * 分配任务结构和内核栈，用mem_free释放
+ */
+task_t *task_alloc()
+{
+    return mem_cache_alloc_object(task_cache);
+}
+
+/**
+ * 释放任务结构，需要关中断。还没有被回收的子任务交给INIT进程收养
+ */
 void task_free(task_t *task)
 {
+    task_t *child, *next;
+    list_for_each_owner_safe (child, next, &task->child_list, sibling_list) {
+        task_set_parent(child, USER_INIT_PROC_ID);
+    }
+    list_del_init(&task->sibling_list);
+    list_del_init(&task->thread_list);
+    list_del(&task->pid_list);
     list_del(&task->global_list);
     mem_free(task);
 }
 
+/**
+ * 把任务加入全局链表和pid散列表，有父任务时加入父任务的子任务链表，需要关中断
+ */
 void task_add_to_global_list(task_t *task)
 {
     assert(!list_find(&task->global_list, &task_global_list));
     list_add_tail(&task->global_list, &task_global_list);
+    list_add(&task->pid_list, &task_pid_hash[TASK_PID_HASH(task->pid)]);
+    task_t *parent = task_find_by_pid(task->parent_pid);
+    if (parent && parent != task)
+        list_add_tail(&task->sibling_list, &parent->child_list);
+}
+
+/**
+ * 修改任务的父任务，同时移动到新父任务的子任务链表，需要关中断
+ */
+void task_set_parent(task_t *task, pid_t parent_pid)
+{
+    list_del_init(&task->sibling_list);
+    task->parent_pid = parent_pid;
+    task_t *parent = task_find_by_pid(parent_pid);
+    if (parent && parent != task)
+        list_add_tail(&task->sibling_list, &parent->child_list);
 }
 
 void task_set_timeslice(task_t *task, uint32_t timeslice)
@@ -106,8 +166,10 @@ task_t *task_find_by_pid(pid_t pid)
 {
     task_t *task;
     unsigned long flags;
+    if (pid < 0)
+        return NULL;
     interrupt_save_and_disable(flags);
-    list_for_each_owner(task, &task_global_list, global_list) {
+    list_for_each_owner(task, &task_pid_hash[TASK_PID_HASH(pid)], pid_list) {
         if (task->pid == pid) {
             interrupt_restore_state(flags);
             return task;
@@ -136,7 +198,7 @@ int task_is_child(pid_t pid, pid_t child_pid)
  */
 task_t *task_create(char *name, uint8_t prio_level, task_func_t *func, void *arg)
 {
-    task_t *task = (task_t *) mem_alloc(TASK_KERN_STACK_SIZE);
+    task_t *task = task_alloc();
     if (!task)
         return NULL;
     task_init(task, name, prio_level);
@@ -155,6 +217,35 @@ task_t *task_create(char *name, uint8_t prio_level, task_func_t *func, void *arg
     return task;
 }
 
+/**
+ * task_create_idle - 创建应用处理器的idle任务
+ * @cpu: 所在的cpu
+ * 
+ * idle任务不放入就绪队列，应用处理器启动后直接在它的栈上运行
+ */
+task_t *task_create_idle(cpuid_t cpu)
+{
+    task_t *task = task_alloc();
+    if (!task)
+        return NULL;
+    char name[MAX_TASK_NAMELEN];
+    sprintf(name, "idle%d", cpu);
+    task_init(task, name, TASK_PRIO_LEVEL_REALTIME);
+    task->static_priority = task->priority = TASK_PRIORITY_IDLE;
+    task->flags |= THREAD_FLAG_KERNEL;
+    task->state = TASK_RUNNING;
+    task->cpuid = cpu;
+    sched_unit_t *su = sched_get_unit(cpu);
+    init_sched_unit(su, cpu, 0);
+    su->idle = task;
+    su->cur = task;
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    task_add_to_global_list(task);
+    interrupt_restore_state(flags);
+    return task;
+}
+
 void task_exit(int status)
 {
     unsigned long flags;
@@ -168,7 +259,7 @@ void task_exit(int status)
     cur->exit_status = status;
     task_do_cancel(cur);
     task_exit_hook(cur);
-    cur->parent_pid = USER_INIT_PROC_ID;
+    task_set_parent(cur, USER_INIT_PROC_ID);
     task_t *parent = task_find_by_pid(cur->parent_pid); 
     if (parent) {
         if (parent->state == TASK_WAITING) {
@@ -219,14 +310,12 @@ void task_unblock(task_t *task)
         panic("task_unblock: task name=%s pid=%d state=%d\n", task->name, task->pid, task->state);
     }
     if (task->state != TASK_READY) {
-        sched_unit_t *su = sched_get_cur_unit();
-        assert(!sched_queue_has_task(su, task));
-        if (sched_queue_has_task(su, task)) {
-            panic("task_unblock: task has already in ready list!\n");
-        }
+        /* 回到原来的调度单元，cpu空闲时通知它调度 */
+        sched_unit_t *su = sched_get_unit(task->cpuid);
         task->state = TASK_READY;
         task->priority = sched_calc_new_priority(task, 1);
         sched_queue_add_head(su, task);
+        sched_notify_unit(su);
     }
     interrupt_restore_state(flags);
 }
@@ -244,8 +333,8 @@ int task_count_children(task_t *parent)
 {
     int children = 0;
     task_t *child;
-    list_for_each_owner (child, &task_global_list, global_list) {
-        if (child->parent_pid == parent->pid && TASK_IS_SINGAL_THREAD(child)) {
+    list_for_each_owner (child, &parent->child_list, sibling_list) {
+        if (TASK_IS_SINGAL_THREAD(child)) {
             children++;
         }
     }
@@ -255,6 +344,7 @@ int task_count_children(task_t *parent)
 int task_do_cancel(task_t *task)
 {
     timer_cancel(&task->sleep_timer);
+    timer_cancel(&task->alarm.timer);
     return 0;
 }
 
@@ -273,7 +363,7 @@ static void task_init_boot_idle(sched_unit_t *su)
     su->idle->state = TASK_RUNNING;
     task_add_to_global_list(su->idle);
     
-    su->cur = su->idle;
+    sched_set_cur_task(su, su->idle);
 }
 
 pid_t task_get_pid(task_t *task)
@@ -428,8 +518,22 @@ void task_dump(task_t *task)
 
 void kern_do_idle(void *arg)
 {
+    sched_unit_t *su = sched_get_cur_unit();
     while (1) {
-        cpu_idle();
+        /* 启动cpu没有马上到期的定时器时停止节拍，被中断唤醒后再恢复 */
+        interrupt_disable();
+        if (!su->tasknr)
+            tick_nohz_idle_enter();
+        /* 空闲时不持有内核锁，其它cpu才能进入内核 */
+        kernel_unlock();
+        if (!su->tasknr)
+            cpu_safe_sleep();
+        else
+            interrupt_enable();
+        kernel_lock();
+        tick_nohz_idle_exit();
+        if (!su->tasknr)
+            sched_balance(su);
         schedule();
     }
 }
@@ -451,7 +555,7 @@ void task_start_user()
     sched_unit_t *su = sched_get_cur_unit();
 	unsigned long flags;
     interrupt_save_and_disable(flags);
-    su->idle->static_priority = su->idle->priority = TASK_PRIORITY_LOW;
+    su->idle->static_priority = su->idle->priority = TASK_PRIORITY_IDLE;
     interrupt_restore_state(flags);
     schedule();
     interrupt_enable();
@@ -460,6 +564,12 @@ void task_start_user()
 
 void tasks_init()
 {
+    int i;
+    for (i = 0; i < TASK_PID_HASH_NR; i++)
+        list_init(&task_pid_hash[i]);
+    task_cache = mem_cache_create("task", TASK_KERN_STACK_SIZE, 0);
+    if (!task_cache)
+        panic("tasks_init: create task cache failed!\n");
     task_next_pid = 0;
     sched_unit_t *su = sched_get_cur_unit();
     task_init_boot_idle(su);
@@ -36,6 +36,16 @@ void wait_queue_remove(wait_queue_t *wait_queue, void *task_ptr)
     spin_unlock_irqrestore(&wait_queue->lock, flags);
 }
 
+/* 返回wait_queue_wakeup会唤醒的任务，不会把它从队列中取下 */
+void *wait_queue_first(wait_queue_t *wait_queue)
+{
+    unsigned long flags;
+    spin_lock_irqsave(&wait_queue->lock, flags);
+    task_t *task = list_first_owner_or_null(&wait_queue->wait_list, task_t, list);
+    spin_unlock_irqrestore(&wait_queue->lock, flags);
+    return task;
+}
+
 void wait_queue_wakeup(wait_queue_t *wait_queue)
 {
     unsigned long flags;
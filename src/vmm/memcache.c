@@ -8,58 +8,26 @@
 #include <arch/page.h>
 #include <arch/interrupt.h>
 #include <arch/phymem.h>
+#include <arch/cpu.h>
 #include <xbook/config.h>
 #include <xbook/memcache.h>
 #include <xbook/debug.h>
+#include <xbook/bitops.h>
+#include <xbook/clockevent.h>
+#include <xbook/reclaim.h>
 #include <string.h>
 #include <math.h>
 #include <string.h>
-#include <xbook/bitmap.h>
 #include <xbook/vmm.h>
 
-static cache_size_t cache_size[] = {
-	#if PAGE_SIZE == 4096
-	{32, NULL},
-	#endif
-	{64, NULL},
-	{128, NULL},
-	{256, NULL},
-	{512, NULL},
-	{1024, NULL},
-	{2048, NULL},
-	{4096, NULL},
-	{8*1024, NULL},
-	{16*1024, NULL},
-	{32*1024, NULL},
-	{64*1024, NULL},
-	{128*1024, NULL},	
-	/* 配置大内存的分配 */
-	#ifdef CONFIG_LARGE_ALLOCS
-	{256*1024, NULL},
-	{512*1024, NULL},
-	{1024*1024, NULL},
-	{2*1024*1024, NULL},
-	#endif
-	{0, NULL},
-};
-
-#if PAGE_SIZE == 4096
-	#ifdef CONFIG_LARGE_ALLOCS 
-		#define MAX_MEM_CACHE_NR 17
-	#else
-		#define MAX_MEM_CACHE_NR 13
-	#endif
-#else
-	#ifdef CONFIG_LARGE_ALLOCS 
-		#define MAX_MEM_CACHE_NR 16
-	#else
-		#define MAX_MEM_CACHE_NR 12
-	#endif
-#endif
-
+/* 通用缓存，第i个缓存的对象大小是2^(i+MEM_CACHE_MIN_SHIFT) */
 mem_cache_t mem_caches[MAX_MEM_CACHE_NR];
-LIST_HEAD(large_mem_object_list);
-DEFINE_MUTEX_LOCK(large_mem_mutex);
+/* 所有的缓存，包括按类型创建的缓存 */
+LIST_HEAD(mem_cache_list);
+DEFINE_MUTEX_LOCK(mem_cache_list_mutex);
+
+/* 大于1024的对象的group从最小的缓存中分配 */
+#define mem_group_cache (&mem_caches[0])
 
 void mem_cache_dump(mem_cache_t *cache)
 {
@@ -72,11 +40,19 @@ void mem_cache_dump(mem_cache_t *cache)
 void mem_group_dump(mem_group_t *group)
 {
 	keprint("----Mem Group----\n");
-	keprint("map bits %x len %d\n", group->map.bits, group->map.byte_length);
+	keprint("free list %x\n", group->free_list);
 	keprint("objects %x flags %x list %x\n", group->objects, group->flags, group->list);
 	keprint("using %d free %x\n", group->using_count, group->free_count);
 }
 
+/* 大小对应的通用缓存的序号，用一条位扫描指令计算 */
+static inline int mem_cache_index(size_t size)
+{
+	if (size <= (1UL << MEM_CACHE_MIN_SHIFT))
+		return 0;
+	return find_highest_bit(size - 1) + 1 - MEM_CACHE_MIN_SHIFT;
+}
+
 int mem_cache_init(mem_cache_t *cache, char *name, size_t size, flags_t flags)
 {
 	if (!size)
@@ -85,10 +61,15 @@ int mem_cache_init(mem_cache_t *cache, char *name, size_t size, flags_t flags)
 	list_init(&cache->partial_groups);
 	list_init(&cache->free_groups);
 
+	/* 空闲对象中要存放链表指针 */
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	size = ALIGN_WITH(size, sizeof(void *));
 	if (size < 1024) {
+		/* 对象按照自身大小对齐，2的n次幂的对象天然对齐 */
 		unsigned int group_size = ALIGN_WITH(SIZEOF_MEM_GROUP, 8);
-		unsigned int left_size = PAGE_SIZE - group_size - 16;
-		cache->object_count = left_size / size;;
+		unsigned int offset = (size & (size - 1)) ? group_size : ALIGN_WITH(group_size, size);
+		cache->object_count = (PAGE_SIZE - offset) / size;
 	} else if (size <= 128 * 1024) {
 		cache->object_count = (1 * MB) / size;
 	} else if (size <= 4 * 1024 * 1024) {
@@ -100,12 +81,34 @@ int mem_cache_init(mem_cache_t *cache, char *name, size_t size, flags_t flags)
 
 	cache->object_size = size;
 	cache->flags = flags;
+	cache->group_count = 0;
+	cache->using_count = 0;
+	cache->magazine_limit = min(MEM_MAGAZINE_SIZE, MEM_MAGAZINE_BYTES / size);
+	memset(cache->magazines, 0, sizeof(cache->magazines));
 	memset(cache->name, 0, MEM_CACHE_NAME_LEN);
-	strcpy(cache->name, name);
+	strncpy(cache->name, name, MEM_CACHE_NAME_LEN - 1);
     mutexlock_init(&cache->mutex);
+    mutex_lock(&mem_cache_list_mutex);
+    list_add_tail(&cache->list, &mem_cache_list);
+    mutex_unlock(&mem_cache_list_mutex);
 	return 0;
 }
 
+/**
+ * 创建一个按类型使用的缓存，用于频繁分配的结构体，对象也可以用mem_free释放
+ */
+mem_cache_t *mem_cache_create(char *name, size_t size, flags_t flags)
+{
+	mem_cache_t *cache = mem_alloc(sizeof(mem_cache_t));
+	if (!cache)
+		return NULL;
+	if (mem_cache_init(cache, name, size, flags)) {
+		mem_free(cache);
+		return NULL;
+	}
+	return cache;
+}
+
 static void *mem_cache_page_alloc(unsigned long count)
 {
 	unsigned long page = page_alloc_normal(count);
@@ -125,37 +128,51 @@ static int mem_cache_page_free(void *address)
 	return 0;
 }
 
+/* 标记页属于哪个缓存的哪个group，释放对象时直接找到group */
+static void mem_cache_mark_pages(void *address, unsigned long pages, mem_cache_t *cache, mem_group_t *group)
+{
+	mem_node_t *node;
+	unsigned long i;
+	for (i = 0; i < pages; i++) {
+		node = phy_addr_to_mem_node(kern_vir_addr2phy_addr((unsigned char *) address + i * PAGE_SIZE));
+		CHECK_MEM_NODE(node);
+		MEM_NODE_MARK_CHACHE_GROUP(node, cache, group);
+	}
+}
+
+static inline unsigned long mem_group_pages(mem_cache_t *cache)
+{
+	return DIV_ROUND_UP(cache->object_count * cache->object_size, PAGE_SIZE);
+}
+
 static int mem_group_init(
     mem_cache_t *cache,
 	mem_group_t *group,
 	flags_t flags)
 {
-	list_add(&group->list, &cache->free_groups);
-	unsigned char *map = (unsigned char *)(group + 1);
-	group->map.byte_length = DIV_ROUND_UP(cache->object_count, 8);
-	group->map.bits = (unsigned char *)map;	
-	bitmap_init(&group->map);
-	mem_node_t *node; 
 	if (cache->object_size < 1024) {
-		group->objects = map + 16;
-		node = phy_addr_to_mem_node(kern_vir_addr2phy_addr(group));
-		CHECK_MEM_NODE(node);
-		MEM_NODE_MARK_CHACHE_GROUP(node, cache, group);
+		unsigned int group_size = ALIGN_WITH(SIZEOF_MEM_GROUP, 8);
+		if (!(cache->object_size & (cache->object_size - 1)))
+			group_size = ALIGN_WITH(group_size, cache->object_size);
+		group->objects = (unsigned char *) group + group_size;
+		mem_cache_mark_pages(group, 1, cache, group);
 	} else {
-		unsigned int pages = DIV_ROUND_UP(cache->object_count * cache->object_size, PAGE_SIZE); 
-		group->objects = mem_cache_page_alloc(pages);
+		group->objects = mem_cache_page_alloc(mem_group_pages(cache));
 		if (group->objects == NULL) {
 			keprint(PRINT_ERR "alloc page for mem objects failed\n");
 			return -1;
 		}
-		int i;
-		for (i = 0; i < pages; i++) {
-			node = phy_addr_to_mem_node(kern_vir_addr2phy_addr(group->objects + i * PAGE_SIZE));
-			CHECK_MEM_NODE(node);
-			MEM_NODE_MARK_CHACHE_GROUP(node, cache, group);
-		}
+		mem_cache_mark_pages(group->objects, mem_group_pages(cache), cache, group);
 	}
-
+	/* 把所有对象串成空闲链表 */
+	unsigned long i;
+	void **object = (void **) group->objects;
+	for (i = 0; i < cache->object_count - 1; i++) {
+		*object = (unsigned char *) object + cache->object_size;
+		object = *object;
+	}
+	*object = NULL;
+	group->free_list = group->objects;
 	group->using_count = 0;
 	group->free_count = cache->object_count;
 	group->flags =  flags;
@@ -165,7 +182,10 @@ static int mem_group_init(
 static int mem_group_create(mem_cache_t *cache, flags_t flags)
 {
 	mem_group_t *group;
-	group = mem_cache_page_alloc(1);
+	if (cache->object_size < 1024)
+		group = mem_cache_page_alloc(1);
+	else
+		group = mem_cache_alloc_object(mem_group_cache);
 	if (group == NULL) {
 		keprint(PRINT_ERR "alloc page for mem group failed!\n");
 		return -1;
@@ -174,40 +194,43 @@ static int mem_group_create(mem_cache_t *cache, flags_t flags)
 		keprint(PRINT_ERR "init mem group failed!\n");
 		goto free_group;
 	}
+    mutex_lock(&cache->mutex);
+	list_add(&group->list, &cache->free_groups);
+	cache->group_count++;
+    mutex_unlock(&cache->mutex);
 	return 0;
 free_group:
-	mem_cache_page_free(group);
+	if (cache->object_size < 1024)
+		mem_cache_page_free(group);
+	else
+		mem_cache_free_object(mem_group_cache, group);
 	return -1;
 }
 
 static int mem_caches_build()
 {
-	cache_size_t *cachesz = cache_size;
-	mem_cache_t *mem_cache = &mem_caches[0];
-	while (cachesz->cache_size) {
-		if (mem_cache_init(mem_cache, "mem cache", cachesz->cache_size, 0)) {
+	int i;
+	for (i = 0; i < MAX_MEM_CACHE_NR; i++) {
+		if (mem_cache_init(&mem_caches[i], "mem cache", 1UL << (i + MEM_CACHE_MIN_SHIFT), 0)) {
 			keprint("create mem cache failed!\n");
 			return -1;
 		}
-		cachesz->mem_cache = mem_cache;
-		mem_cache++;
-		cachesz++;
 	}
 	return 0;
 }
 
+/* 从group的空闲链表中取出一个对象，需要持有缓存的互斥锁 */
 static void *mem_cache_do_alloc(mem_cache_t *cache, mem_group_t *group)
 {
-	void *object;
-	int idx = bitmap_scan(&group->map, 1);
-	if (idx == -1) {
-		keprint(PRINT_EMERG "bitmap scan failed!\n");
+	void **object = group->free_list;
+	if (object == NULL) {
+		keprint(PRINT_EMERG "group free list empty!\n");
 		return NULL;
 	}
-	bitmap_set(&group->map, idx, 1);
-	object = group->objects + idx * cache->object_size;
+	group->free_list = *object;
 	group->using_count++;
 	group->free_count--;
+	cache->using_count++;
 	if (group->free_count == 0) {
 		list_del(&group->list);
 		list_add_tail(&group->list, &cache->full_groups);
@@ -215,35 +238,141 @@ static void *mem_cache_do_alloc(mem_cache_t *cache, mem_group_t *group)
 	return object;
 }
 
-void *mem_cache_alloc_object(mem_cache_t *cache)
+/* 从部分使用或者空闲的group中取出一个对象，没有时返回NULL，需要持有缓存的互斥锁 */
+static void *mem_cache_take_object(mem_cache_t *cache)
 {
-	void *object;
-	mem_group_t *group;
 	list_t *partialList, *node;
-retry_alloc_object:
-    mutex_lock(&cache->mutex);
 	partialList = &cache->partial_groups;
 	node = partialList->next;
 	if (list_empty(partialList)) {
 		list_t *freeList;
 		freeList = &cache->free_groups;
 		if (list_empty(freeList)) {
-			goto new_group;
+			return NULL;
 		}
 		node = freeList->next;
 		list_del(node);
 		list_add_tail(node, partialList);
 	}
-	group = list_owner(node, mem_group_t, list);
-	object = mem_cache_do_alloc(cache, group);
+	return mem_cache_do_alloc(cache, list_owner(node, mem_group_t, list));
+}
+
+/* 把对象放回所属group的空闲链表，需要持有缓存的互斥锁 */
+static void mem_cache_put_object(mem_cache_t *cache, void *object)
+{
+	mem_group_t *group;
+	mem_node_t *node = phy_addr_to_mem_node(kern_vir_addr2phy_addr(object));
+
+	CHECK_MEM_NODE(node);
+	group = MEM_NODE_GET_GROUP(node);
+	if (group == NULL)
+		panic(PRINT_EMERG "group get from page bad!\n");
+	unsigned long offset = ((unsigned char *)object) - group->objects;
+	if (offset >= cache->object_count * cache->object_size || offset % cache->object_size)
+		panic(PRINT_EMERG "object %x not in group %x!\n", object, group);
+	*(void **) object = group->free_list;
+	group->free_list = object;
+	int unsing = group->using_count;
+	group->using_count--;
+	group->free_count++;
+	cache->using_count--;
+
+	if (!group->using_count) {
+		list_del(&group->list);
+		list_add_tail(&group->list, &cache->free_groups);
+	} else if (unsing == cache->object_count) {
+		list_del(&group->list);
+		list_add_tail(&group->list, &cache->partial_groups);
+	}
+}
+
+/**
+ * 弹匣空了，从group中取出一个对象返回，再取出半个弹匣的对象放入当前cpu的弹匣
+ */
+static void *mem_cache_alloc_slow(mem_cache_t *cache)
+{
+	void *object;
+	void *batch[MEM_MAGAZINE_SIZE];
+	unsigned long i, count = 0, want = (cache->magazine_limit + 1) / 2;
+	unsigned long flags;
+retry_alloc_object:
+    mutex_lock(&cache->mutex);
+	object = mem_cache_take_object(cache);
+	if (object == NULL) {
+	    mutex_unlock(&cache->mutex);
+		if (mem_group_create(cache, 0))
+			return NULL;
+		goto retry_alloc_object;
+	}
+	while (count < want) {
+		if ((batch[count] = mem_cache_take_object(cache)) == NULL)
+			break;
+		count++;
+	}
+	/* 取的时候可能睡眠过，换了cpu或者弹匣已经被其它任务填充，放不下的还回去 */
+	interrupt_save_and_disable(flags);
+	mem_magazine_t *mag = &cache->magazines[cpu_get_my_id()];
+	mag->allocs++;
+	while (count && mag->count < cache->magazine_limit)
+		mag->objects[mag->count++] = batch[--count];
+	interrupt_restore_state(flags);
+	for (i = 0; i < count; i++)
+		mem_cache_put_object(cache, batch[i]);
     mutex_unlock(&cache->mutex);
 	return object;
-new_group:
+}
+
+void *mem_cache_alloc_object(mem_cache_t *cache)
+{
+	void *object;
+	unsigned long flags;
+	interrupt_save_and_disable(flags);
+	mem_magazine_t *mag = &cache->magazines[cpu_get_my_id()];
+	if (mag->count) {
+		object = mag->objects[--mag->count];
+		mag->allocs++;
+		mag->hits++;
+		interrupt_restore_state(flags);
+		return object;
+	}
+	interrupt_restore_state(flags);
+	return mem_cache_alloc_slow(cache);
+}
+
+/**
+ * 弹匣满了，把对象和半个弹匣的对象还给group
+ */
+static void mem_cache_free_slow(mem_cache_t *cache, void *object)
+{
+	void *batch[MEM_MAGAZINE_SIZE];
+	unsigned long i, count = 0;
+	unsigned long flags;
+    mutex_lock(&cache->mutex);
+	interrupt_save_and_disable(flags);
+	mem_magazine_t *mag = &cache->magazines[cpu_get_my_id()];
+	mag->frees++;
+	while (mag->count > cache->magazine_limit / 2)
+		batch[count++] = mag->objects[--mag->count];
+	interrupt_restore_state(flags);
+	mem_cache_put_object(cache, object);
+	for (i = 0; i < count; i++)
+		mem_cache_put_object(cache, batch[i]);
     mutex_unlock(&cache->mutex);
-	if (mem_group_create(cache, 0))
-		return NULL;
-	goto retry_alloc_object;
-	return NULL;
+}
+
+void mem_cache_free_object(mem_cache_t *cache, void *object)
+{
+	unsigned long flags;
+	interrupt_save_and_disable(flags);
+	mem_magazine_t *mag = &cache->magazines[cpu_get_my_id()];
+	if (mag->count < cache->magazine_limit) {
+		mag->objects[mag->count++] = object;
+		mag->frees++;
+		interrupt_restore_state(flags);
+		return;
+	}
+	interrupt_restore_state(flags);
+	mem_cache_free_slow(cache, object);
 }
 
 void *mem_alloc(size_t size)
@@ -251,39 +380,31 @@ void *mem_alloc(size_t size)
 	if (size > MAX_MEM_CACHE_SIZE) {
         if (size > MAX_MEM_OBJECT_SIZE)
             return NULL;
-        /* 使用首适配分配法 */
-        large_mem_object_t *obj = mem_alloc(sizeof(large_mem_object_t));
-        if (obj == NULL)
-            return NULL;
-        obj->size = size;
-        obj->addr = mem_cache_page_alloc(DIV_ROUND_UP(size, PAGE_SIZE));
-        if (obj->addr == NULL) {
-            mem_free(obj);
+        /* 大对象直接分配页，页没有缓存的标记，释放时直接归还 */
+        void *addr = mem_cache_page_alloc(DIV_ROUND_UP(size, PAGE_SIZE));
+        if (addr == NULL)
             return NULL;
-        }
-        mutex_lock(&large_mem_mutex);
-        list_add(&obj->list, &large_mem_object_list);
-        mutex_unlock(&large_mem_mutex);
-        //keprint(PRINT_DEBUG "[memcache]: alloc large mem object %x\n", obj->addr);
-		return obj->addr;
+        mem_cache_mark_pages(addr, 1, NULL, NULL);
+		return addr;
 	}
-	cache_size_t *cachesz = &cache_size[0];
-	while (cachesz->cache_size) {
-		if (cachesz->cache_size >= size)
-			break;
-		cachesz++;
-	}
-    void *p = mem_cache_alloc_object(cachesz->mem_cache);
-    return p;
+    return mem_cache_alloc_object(&mem_caches[mem_cache_index(size)]);
 }
 
+/**
+ * 分配对齐的内存，通用缓存的对象按照自身大小对齐，
+ * 所以分配不小于对齐值的对象就可以了
+ */
 void *mem_alloc_align(size_t size, int align)
 {
-	void *p = mem_alloc(size);
+	void *p = mem_alloc(max(size, (size_t) align));
     if (p == NULL)
         return p;
-    void *q = (void *)((unsigned long)p & (~(align - 1)));
-    return q;
+    if ((unsigned long) p & (align - 1)) {
+        keprint(PRINT_ERR "mem_alloc_align: %x not aligned to %x!\n", p, align);
+        mem_free(p);
+        return NULL;
+    }
+    return p;
 }
 
 void *mem_zalloc(size_t size)
@@ -315,39 +436,6 @@ void *mem_realloc(void *ptr, size_t size)
     return ret;
 }
 
-static void mem_cache_do_free(mem_cache_t *cache, void *object)
-{
-	mem_group_t *group;
-	mem_node_t *node = phy_addr_to_mem_node(kern_vir_addr2phy_addr(object));
-
-	CHECK_MEM_NODE(node);
-	group = MEM_NODE_GET_GROUP(node);
-	if (group == NULL) 
-		panic(PRINT_EMERG "group get from page bad!\n");
-	int index = (((unsigned char *)object) - group->objects)/cache->object_size; 
-	if (index < 0 || index > group->map.byte_length*8)
-		panic(PRINT_EMERG "map index bad range!\n");
-    mutex_lock(&cache->mutex);
-	bitmap_set(&group->map, index, 0);
-	int unsing = group->using_count;
-	group->using_count--;
-	group->free_count++;
-	
-	if (!group->using_count) {
-		list_del(&group->list);
-		list_add_tail(&group->list, &cache->free_groups);
-	} else if (unsing == cache->object_count) {
-		list_del(&group->list);
-		list_add_tail(&group->list, &cache->partial_groups);
-	}
-    mutex_unlock(&cache->mutex);
-}
-
-void mem_cache_free_object(mem_cache_t *cache, void *object)
-{
-	mem_cache_do_free(cache, object);
-}
-
 void mem_free(void *object)
 {
 	if (!object)
@@ -357,20 +445,12 @@ void mem_free(void *object)
 	CHECK_MEM_NODE(node);
 	cache = MEM_NODE_GET_CACHE(node);
     if (cache == NULL) {
-        /* 采用首适配释放 */
-        mutex_lock(&large_mem_mutex);
-        large_mem_object_t *obj;
-        list_for_each_owner (obj, &large_mem_object_list, list) {
-            if (obj->addr == object) {
-                list_del(&obj->list);
-                mem_cache_page_free(obj->addr);
-                mem_free(obj);
-                mutex_unlock(&large_mem_mutex);
-                // keprint(PRINT_DEBUG "[memcache]: free large mem object %x\n", object);
-                return;
-            }
+        /* 大对象，直接归还页 */
+        if ((unsigned long) object & (PAGE_SIZE - 1)) {
+            keprint(PRINT_ERR "mem_free: bad large object %x!\n", object);
+            return;
         }
-        mutex_unlock(&large_mem_mutex);
+        mem_cache_page_free(object);
         return;
     }
 	mem_cache_free_object(cache, (void *)object);
@@ -379,22 +459,45 @@ void mem_free(void *object)
 static int group_destory(mem_cache_t *cache, mem_group_t *group)
 {
 	list_del(&group->list);
+	cache->group_count--;
 	if (cache->object_size < 1024) {
+		mem_cache_mark_pages(group, 1, NULL, NULL);
 		if (mem_cache_page_free(group))
 			return -1;
 	} else {
+		mem_cache_mark_pages(group->objects, mem_group_pages(cache), NULL, NULL);
 		if (mem_cache_page_free(group->objects))
 			return -1;
-		if (mem_cache_page_free(group))
-			return -1;
+		mem_cache_free_object(mem_group_cache, group);
 	}
 	return 0;
 }
 
+/**
+ * 把所有cpu弹匣中的对象还给group，需要持有缓存的互斥锁。
+ * 其它cpu的弹匣只在它持有内核锁时访问，当前cpu持有内核锁，不会同时访问。
+ */
+static void mem_cache_drain(mem_cache_t *cache)
+{
+	int cpu;
+	void *object;
+	unsigned long flags;
+	for (cpu = 0; cpu < CPU_NR_MAX; cpu++) {
+		mem_magazine_t *mag = &cache->magazines[cpu];
+		interrupt_save_and_disable(flags);
+		while (mag->count) {
+			object = mag->objects[--mag->count];
+			mem_cache_put_object(cache, object);
+		}
+		interrupt_restore_state(flags);
+	}
+}
+
 static int mem_cache_do_shrink(mem_cache_t *cache)
 {
 	mem_group_t *group, *next;
 	int ret = 0;
+	mem_cache_drain(cache);
 	list_for_each_owner_safe(group, next, &cache->free_groups, list) {
 		if(!group_destory(cache, group))
 			ret++;
@@ -402,33 +505,128 @@ static int mem_cache_do_shrink(mem_cache_t *cache)
 	return ret;
 }
 
-static int mem_cahce_shrink(mem_cache_t *cache)
+static int mem_cahce_shrink(mem_cache_t *cache, int flags)
 {
 	int ret;
-	if (!cache) 
-		return 0; 
-	unsigned long flags;
-    interrupt_save_and_disable(flags);
+	if (!cache)
+		return 0;
+	if (flags & MEM_RECLAIM_BLOCK)
+		mutex_lock(&cache->mutex);
+	else if (mutex_try_lock(&cache->mutex))
+		return 0;
 	ret = mem_cache_do_shrink(cache);
-    interrupt_restore_state(flags);
+    mutex_unlock(&cache->mutex);
 	return ret * cache->object_count * cache->object_size;
 }
 
-int mem_shrink()
+/* 释放空闲的group，释放够limit字节就停止，返回释放的字节数 */
+static size_t mem_do_shrink(size_t limit, int flags)
 {
 	size_t size = 0;
-	cache_size_t *cachesz = &cache_size[0];
-	while (cachesz->cache_size) {
-		size += mem_cahce_shrink(cachesz->mem_cache);
-		cachesz++;
+	mem_cache_t *cache;
+	/* group的缓存最后收缩，前面释放的group会回到它里面 */
+	list_for_each_owner (cache, &mem_cache_list, list) {
+		if (size >= limit)
+			break;
+		if (cache != mem_group_cache)
+			size += mem_cahce_shrink(cache, flags);
 	}
+	size += mem_cahce_shrink(mem_group_cache, flags);
 	return size;
 }
 
+int mem_shrink()
+{
+	return mem_do_shrink(~0UL, MEM_RECLAIM_BLOCK);
+}
+
+/* 空闲的group不保存数据，释放的代价最小，最先回收 */
+static int mem_cache_reclaim(int count, int flags)
+{
+	return mem_do_shrink(count * PAGE_SIZE, flags) / PAGE_SIZE;
+}
+
+static mem_shrinker_t mem_cache_shrinker = {
+	.name = "mem cache",
+	.shrink = mem_cache_reclaim,
+};
+
+/* 百分比，次数很大时先缩小，避免乘法溢出 */
+static unsigned long mem_cache_percent(unsigned long part, unsigned long total)
+{
+	if (!total)
+		return 0;
+	if (total > 0x1000000)
+		return part / (total / 100);
+	return part * 100 / total;
+}
+
+/**
+ * 打印所有缓存的统计：对象大小，group数量，使用中的对象，弹匣中的对象，分配释放次数和弹匣命中率
+ */
+void mem_caches_dump()
+{
+	mem_cache_t *cache;
+	int cpu;
+	keprint(PRINT_INFO "%-16s %8s %6s %6s %8s %6s %10s %10s %4s\n",
+		"cache", "size", "objs", "groups", "inuse", "magaz", "allocs", "frees", "hit%");
+    mutex_lock(&mem_cache_list_mutex);
+	list_for_each_owner (cache, &mem_cache_list, list) {
+		unsigned long cached = 0, allocs = 0, frees = 0, hits = 0;
+		for (cpu = 0; cpu < CPU_NR_MAX; cpu++) {
+			cached += cache->magazines[cpu].count;
+			allocs += cache->magazines[cpu].allocs;
+			frees += cache->magazines[cpu].frees;
+			hits += cache->magazines[cpu].hits;
+		}
+		if (!cache->group_count && !allocs)
+			continue;
+		keprint(PRINT_INFO "%-16s %8d %6d %6d %8d %6d %10u %10u %4d\n",
+			cache->name, cache->object_size, cache->object_count, cache->group_count,
+			cache->using_count - cached, cached, allocs, frees,
+			mem_cache_percent(hits, allocs));
+	}
+    mutex_unlock(&mem_cache_list_mutex);
+}
+
+#define MEM_CACHE_BENCH_LOOPS   10000
+#define MEM_CACHE_BENCH_BATCH   256
+
+/**
+ * 分配器的微基准：每种大小测热路径（分配后马上释放，命中弹匣）
+ * 和批量路径（连续分配一批再全部释放，要经过group），打印每次操作的纳秒数
+ */
+void mem_cache_bench()
+{
+	static size_t sizes[] = {32, 128, 512, 4096, 8192};
+	static void *objects[MEM_CACHE_BENCH_BATCH];
+	int i, j, k;
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		unsigned long long start = clock_event_now_us();
+		for (j = 0; j < MEM_CACHE_BENCH_LOOPS; j++)
+			mem_free(mem_alloc(sizes[i]));
+		unsigned long hot = clock_event_now_us() - start;
+
+		start = clock_event_now_us();
+		for (j = 0; j < MEM_CACHE_BENCH_LOOPS / MEM_CACHE_BENCH_BATCH; j++) {
+			for (k = 0; k < MEM_CACHE_BENCH_BATCH; k++)
+				objects[k] = mem_alloc(sizes[i]);
+			for (k = 0; k < MEM_CACHE_BENCH_BATCH; k++)
+				mem_free(objects[k]);
+		}
+		unsigned long batch = clock_event_now_us() - start;
+		keprint(PRINT_INFO "[memcache] bench size %d: hot %d ns/pair, batch %d ns/pair\n", sizes[i],
+			hot * 1000 / MEM_CACHE_BENCH_LOOPS,
+			batch * 1000 / (MEM_CACHE_BENCH_LOOPS / MEM_CACHE_BENCH_BATCH * MEM_CACHE_BENCH_BATCH));
+	}
+	mem_caches_dump();
+}
+
 int mem_caches_init()
 {
 	mem_caches_build();
-    infoprint("vmm: user base: %x, size: %x, top: %x, stack top:%x\n", 
+	mem_shrinker_register(&mem_cache_shrinker);
+    infoprint("vmm: user base: %x, size: %x, top: %x, stack top:%x\n",
         USER_VMM_BASE_ADDR, USER_VMM_SIZE, USER_VMM_TOP_ADDR, USER_STACK_TOP);
 	return 0;
 }
@@ -1,10 +1,29 @@
 #include <xbook/memspace.h>
+#include <xbook/pagecache.h>
 #include <xbook/task.h>
 #include <xbook/debug.h>
 #include <xbook/schedule.h>
+#include <xbook/mutexlock.h>
+#include <xbook/fs.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* 文件映射的页在缺页时读取，同一个文件句柄可能被多个进程共享，读取时需要互斥 */
+DEFINE_MUTEX_LOCK(mem_space_file_lock);
 
 // #define DEBUG_MEM_SPACE
 
+/* 映射空间的结构频繁分配和释放，使用专用的缓存 */
+mem_cache_t *mem_space_cache;
+
+void mem_space_cache_init()
+{
+    mem_space_cache = mem_cache_create("mem space", sizeof(mem_space_t), 0);
+    if (!mem_space_cache)
+        panic("mem_space_cache_init: create cache failed!\n");
+}
+
 void mem_space_dump(vmm_t *vmm)
 {
     if (vmm == NULL)
@@ -17,43 +36,380 @@ void mem_space_dump(vmm_t *vmm)
     }
 }
 
-void mem_space_insert(vmm_t *vmm, mem_space_t *space)
+void mem_space_free(mem_space_t *space)
 {
-    mem_space_t *prev = NULL;
-    mem_space_t *p = (mem_space_t *)vmm->mem_space_head;
-    while (p != NULL) {
-        if (space->end <= p->start)
-            break;
-        prev = p;
-        p = p->next;
+    if (space->file >= 0) {
+        kfile_close(space->file);
+        space->file = -1;
     }
-    space->next = p;
-    if (prev)
+    if (space->pcache) {
+        page_cache_put(space->pcache);
+        space->pcache = NULL;
+    }
+    mem_free(space);
+}
+
+/**
+ * mem_space_set_file - 设置空间映射的文件
+ * @file: 内核文件表句柄，空间会持有一个引用
+ * @vaddr: 文件数据在空间中的起始虚拟地址
+ * @offset: 文件数据在文件中的偏移
+ * @size: 文件数据的大小
+ * 
+ * 文件有页缓存时，映射同一个文件的空间共享缓存中的页
+ */
+int mem_space_set_file(mem_space_t *space, int file, unsigned long vaddr,
+    unsigned long offset, unsigned long size)
+{
+    if (fsif.incref(file) < 0)
+        return -1;
+    space->file = file;
+    space->file_vaddr = vaddr;
+    space->file_offset = offset;
+    space->file_size = size;
+    space->pcache = page_cache_get(file);
+    return 0;
+}
+
+/**
+ * mem_space_read_file - 从映射的文件读取数据
+ * 
+ * 同一个文件句柄可能被多个进程共享，定位和读取需要互斥。
+ * 返回读取的字节数，到达文件末尾时可能比len小。
+ */
+int mem_space_read_file(int file, unsigned long offset, void *buf, unsigned long len)
+{
+    int ret = -1;
+    mutex_lock(&mem_space_file_lock);
+    if (kfile_lseek(file, offset, SEEK_SET) >= 0)
+        ret = kfile_read(file, buf, len);
+    mutex_unlock(&mem_space_file_lock);
+    return ret;
+}
+
+static int mem_space_write_file(int file, unsigned long offset, void *buf, unsigned long len)
+{
+    int ret = -1;
+    mutex_lock(&mem_space_file_lock);
+    if (kfile_lseek(file, offset, SEEK_SET) >= 0) {
+        if (kfile_write(file, buf, len) == len)
+            ret = 0;
+    }
+    mutex_unlock(&mem_space_file_lock);
+    return ret;
+}
+
+/**
+ * mem_space_fill_page - 文件映射的空间缺页时，从文件读取一页数据
+ * @addr: 页地址，必须已经映射了可写的物理页
+ * 
+ * 页中不属于文件数据的部分填0
+ */
+int mem_space_fill_page(mem_space_t *space, unsigned long addr)
+{
+    addr &= PAGE_MASK;
+    unsigned long start = max(addr, space->file_vaddr);
+    unsigned long end = min(addr + PAGE_SIZE, space->file_vaddr + space->file_size);
+    if (start >= end) {
+        memset((void *)addr, 0, PAGE_SIZE);
+        return 0;
+    }
+    memset((void *)addr, 0, start - addr);
+    memset((void *)end, 0, addr + PAGE_SIZE - end);
+    if (mem_space_read_file(space->file, space->file_offset + (start - space->file_vaddr),
+        (void *)start, end - start) != end - start)
+        return -1;
+    return 0;
+}
+
+/**
+ * mem_space_sync - 把共享文件映射中写过的页回写到文件
+ * @start: 回写范围的开始地址
+ * @end: 回写范围的结束地址
+ * 
+ * 空间必须属于当前的页目录。处理器写入页时设置脏标志，回写前先清除，
+ * 回写期间再次写入的页下一次还会回写。文件末尾之后的部分不回写，不会改变文件大小。
+ */
+int mem_space_sync(mem_space_t *space, unsigned long start, unsigned long end)
+{
+    if (!(space->flags & MEM_SPACE_MAP_FILE_SHARED) || space->file < 0)
+        return 0;
+    start = max(start & PAGE_MASK, space->start);
+    end = min(end, space->end);
+    unsigned long fsize = fsif.fsize ? fsif.fsize(space->file) : 0;
+    unsigned long offset, len;
+    int ret = 0;
+    for (; start < end; start += PAGE_SIZE) {
+        if (start < space->file_vaddr || start - space->file_vaddr >= space->file_size)
+            continue;
+        if (!page_clear_dirty(start))
+            continue;
+        offset = space->file_offset + (start - space->file_vaddr);
+        if (fsize == (unsigned long) -1 || offset >= fsize)
+            continue;
+        len = min(PAGE_SIZE, fsize - offset);
+        if (mem_space_write_file(space->file, offset, (void *)start, len) < 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+int sys_msync(void *addr, size_t len, int flags)
+{
+    unsigned long start = (unsigned long) addr;
+    unsigned long end = start + PAGE_ALIGN(len);
+    if ((start & ~PAGE_MASK) || end < start)
+        return -EINVAL;
+    mem_space_t *space = mem_space_find(task_current->vmm, start);
+    int ret = 0;
+    while (space != NULL && space->start < end) {
+        if (mem_space_sync(space, start, end) < 0) {
+            ret = -EIO;
+        } else if ((flags & MEM_SPACE_SYNC_SYNC) && (space->flags & MEM_SPACE_MAP_FILE_SHARED)) {
+            if (fsif.fsync && fsif.fsync(space->file) < 0)
+                ret = -EIO;
+        }
+        space = space->next;
+    }
+    return ret;
+}
+
+/**
+ * 空间的区间树：进程的空间互不重叠，按开始地址排序和按结束地址排序是一样的，
+ * 所以用开始地址作为键的平衡二叉树就可以按地址查找区间，不需要再记录子树的最大结束地址。
+ * 空间在树中的位置只由顺序决定，在不改变顺序的情况下可以直接修改空间的开始和结束地址。
+ */
+static inline int mem_space_height(mem_space_t *node)
+{
+    return node ? node->height : 0;
+}
+
+static inline void mem_space_update_height(mem_space_t *node)
+{
+    node->height = max(mem_space_height(node->left), mem_space_height(node->right)) + 1;
+}
+
+static void mem_space_replace_child(vmm_t *vmm, mem_space_t *parent,
+    mem_space_t *old, mem_space_t *new)
+{
+    if (!parent)
+        vmm->mem_space_root = new;
+    else if (parent->left == old)
+        parent->left = new;
+    else
+        parent->right = new;
+    if (new)
+        new->parent = parent;
+}
+
+static mem_space_t *mem_space_rotate_left(vmm_t *vmm, mem_space_t *node)
+{
+    mem_space_t *right = node->right;
+    node->right = right->left;
+    if (right->left)
+        right->left->parent = node;
+    mem_space_replace_child(vmm, node->parent, node, right);
+    right->left = node;
+    node->parent = right;
+    mem_space_update_height(node);
+    mem_space_update_height(right);
+    return right;
+}
+
+static mem_space_t *mem_space_rotate_right(vmm_t *vmm, mem_space_t *node)
+{
+    mem_space_t *left = node->left;
+    node->left = left->right;
+    if (left->right)
+        left->right->parent = node;
+    mem_space_replace_child(vmm, node->parent, node, left);
+    left->right = node;
+    node->parent = left;
+    mem_space_update_height(node);
+    mem_space_update_height(left);
+    return left;
+}
+
+/* 从node开始向上更新高度，高度差超过1时旋转 */
+static void mem_space_rebalance(vmm_t *vmm, mem_space_t *node)
+{
+    int balance;
+    while (node) {
+        mem_space_update_height(node);
+        balance = mem_space_height(node->left) - mem_space_height(node->right);
+        if (balance > 1) {
+            if (mem_space_height(node->left->left) < mem_space_height(node->left->right))
+                mem_space_rotate_left(vmm, node->left);
+            node = mem_space_rotate_right(vmm, node);
+        } else if (balance < -1) {
+            if (mem_space_height(node->right->right) < mem_space_height(node->right->left))
+                mem_space_rotate_right(vmm, node->right);
+            node = mem_space_rotate_left(vmm, node);
+        }
+        node = node->parent;
+    }
+}
+
+static void mem_space_tree_insert(vmm_t *vmm, mem_space_t *space)
+{
+    mem_space_t *parent = NULL;
+    mem_space_t **link = (mem_space_t **) &vmm->mem_space_root;
+    while (*link) {
+        parent = *link;
+        if (space->start < parent->start)
+            link = &parent->left;
+        else
+            link = &parent->right;
+    }
+    space->parent = parent;
+    space->left = space->right = NULL;
+    space->height = 1;
+    *link = space;
+    mem_space_rebalance(vmm, parent);
+}
+
+static void mem_space_tree_erase(vmm_t *vmm, mem_space_t *space)
+{
+    mem_space_t *fixup;
+    if (space->left && space->right) {
+        /* 用后继节点代替被删除的节点 */
+        mem_space_t *next = space->right;
+        while (next->left)
+            next = next->left;
+        if (next->parent != space) {
+            fixup = next->parent;
+            mem_space_replace_child(vmm, next->parent, next, next->right);
+            next->right = space->right;
+            space->right->parent = next;
+        } else {
+            fixup = next;
+        }
+        mem_space_replace_child(vmm, space->parent, space, next);
+        next->left = space->left;
+        space->left->parent = next;
+        next->height = space->height;
+    } else {
+        fixup = space->parent;
+        mem_space_replace_child(vmm, space->parent, space, space->left ? space->left : space->right);
+    }
+    space->parent = space->left = space->right = NULL;
+    mem_space_rebalance(vmm, fixup);
+}
+
+/* 地址顺序上的前一个空间 */
+static mem_space_t *mem_space_tree_prev(vmm_t *vmm, mem_space_t *space)
+{
+    mem_space_t *node;
+    if (!space) {   /* 没有指定空间时返回最后一个空间 */
+        node = vmm->mem_space_root;
+        while (node && node->right)
+            node = node->right;
+        return node;
+    }
+    if (space->left) {
+        node = space->left;
+        while (node->right)
+            node = node->right;
+        return node;
+    }
+    node = space->parent;
+    while (node && space == node->left) {
+        space = node;
+        node = node->parent;
+    }
+    return node;
+}
+
+/**
+ * mem_space_find - 查找第一个结束地址大于addr的空间
+ * 
+ * addr在空间中，或者在返回的空间之前，没有时返回NULL
+ */
+mem_space_t *mem_space_find(vmm_t *vmm, unsigned long addr)
+{
+    mem_space_t *space = NULL;
+    mem_space_t *node = vmm->mem_space_root;
+    while (node) {
+        if (addr < node->end) {
+            space = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return space;
+}
+
+/* 和mem_space_find一样，同时返回前一个空间 */
+mem_space_t *mem_space_find_prev(vmm_t *vmm, unsigned long addr, mem_space_t **prev)
+{
+    mem_space_t *space = mem_space_find(vmm, addr);
+    *prev = mem_space_tree_prev(vmm, space);
+    return space;
+}
+
+/**
+ * mem_space_link - 把空间放到prev之后，prev为NULL时放到最前面
+ * 
+ * 调用者保证空间的地址在prev和它的下一个空间之间
+ */
+void mem_space_link(vmm_t *vmm, mem_space_t *space, mem_space_t *prev)
+{
+    if (prev) {
+        space->next = prev->next;
         prev->next = space;
+    } else {
+        space->next = vmm->mem_space_head;
+        vmm->mem_space_head = space;
+    }
+    space->vmm = vmm;
+    mem_space_tree_insert(vmm, space);
+}
+
+/* 从链表和区间树中删除空间并释放，prev是前一个空间 */
+void mem_space_remove(vmm_t *vmm, mem_space_t *space, mem_space_t *prev)
+{
+    if (prev)
+        prev->next = space->next;
     else
-        vmm->mem_space_head = (void *)space;
+        vmm->mem_space_head = space->next;
+    mem_space_tree_erase(vmm, space);
+    mem_space_free(space);
+}
+
+static inline int mem_space_can_merge(mem_space_t *a, mem_space_t *b)
+{
+    return a->end == b->start && a->file < 0 && b->file < 0 &&
+        a->page_prot == b->page_prot && a->flags == b->flags;
+}
+
+void mem_space_insert(vmm_t *vmm, mem_space_t *space)
+{
+    /* 空间不重叠，第一个结束地址大于开始地址的空间就是后一个空间 */
+    mem_space_t *next = mem_space_find(vmm, space->start);
+    mem_space_t *prev = mem_space_tree_prev(vmm, next);
     space->vmm = vmm;
-    /* 共享内存不进行合并处理 */
-    if (space->flags & MEM_SPACE_MAP_SHARED) {
-        return;
-    }
-    /* merge prev and space */
-    if (prev != NULL && prev->end == space->start) {
-        if (prev->page_prot == space->page_prot && prev->flags == space->flags) {
+    /* 共享内存和文件映射不进行合并处理 */
+    if (!(space->flags & MEM_SPACE_MAP_SHARED) && space->file < 0) {
+        /* merge prev and space */
+        if (prev != NULL && mem_space_can_merge(prev, space)) {
             prev->end = space->end;
-            prev->next = p;
             mem_space_free(space);
-            space = prev;
+            /* merge prev and next */
+            if (next != NULL && mem_space_can_merge(prev, next)) {
+                prev->end = next->end;
+                mem_space_remove(vmm, next, prev);
+            }
+            return;
         }
-    }
-    /* merge space and p */
-    if (p != NULL && space->end == p->start) {
-        if (space->page_prot == p->page_prot && space->flags == p->flags) {
-            space->end = p->end;
-            space->next = p->next;
-            mem_space_free(space);    
+        /* merge space and next */
+        if (next != NULL && mem_space_can_merge(space, next)) {
+            next->start = space->start;
+            mem_space_free(space);
+            return;
         }
     }
+    mem_space_link(vmm, space, prev);
 }
 
 unsigned long mem_space_get_unmaped(vmm_t *vmm, unsigned len)
@@ -119,11 +475,10 @@ int do_mem_space_map(vmm_t *vmm, unsigned long addr, unsigned long paddr,
     }
     mem_space_init(space, addr, addr + len, prot, flags);
     mem_space_insert(vmm, space);
-    /* 如果是共享映射，就映射成共享的地址，需要指定物理地址 */
+    /* 如果是共享映射，就映射成共享的地址，需要指定物理地址。
+    匿名映射只保留地址空间，第一次访问时在缺页中分配清零的物理页 */
     if (flags & MEM_SPACE_MAP_SHARED) {
         page_map_addr_fixed(addr, paddr, len, prot);
-    } else {
-        page_map_addr_safe(addr, len, prot); 
     }
     //keprint(PRINT_ERR "do_mem_space_map: addr %x.\n", addr);
     return addr;
@@ -182,9 +537,62 @@ int do_mem_space_map_viraddr(vmm_t *vmm, unsigned long addr, unsigned long vaddr
             vaddr += PAGE_SIZE;
             vstart += PAGE_SIZE;
         }
+    }
+    return addr;
+}
+
+/**
+ * do_mem_space_map_file - 映射文件数据到空间
+ * 
+ * 只建立空间，不映射物理页，在访问时才通过缺页从文件读取数据。
+ * 这样执行程序时只需要加载实际用到的页。
+ */
+int do_mem_space_map_file(vmm_t *vmm, unsigned long addr, unsigned long len,
+    unsigned long prot, unsigned long flags, int file, unsigned long vaddr,
+    unsigned long offset, unsigned long size)
+{
+    if (vmm == NULL || !prot || file < 0) {
+        keprint(PRINT_ERR "do_mem_space_map_file: failed!\n");
+        return -1;
+    }
+    len = PAGE_ALIGN(len);
+    if (!len) {
+        keprint(PRINT_ERR "do_mem_space_map_file: len is zero!\n");
+        return -1;
+    }
+    if (len > USER_VMM_SIZE || addr > USER_VMM_TOP_ADDR || addr > USER_VMM_TOP_ADDR - len || addr < USER_VMM_BASE_ADDR) {
+        keprint(PRINT_ERR "do_mem_space_map_file: addr %x and len %x out of range!\n", addr, len);
+        return -1;
+    }
+    if (flags & MEM_SPACE_MAP_FIXED) {
+        if (addr & ~PAGE_MASK) {
+            keprint(PRINT_ERR "do_mem_space_map_file: addr %x not page aligined!\n", addr);
+            return -1;
+        }
+        mem_space_t* p = mem_space_find(vmm, addr);
+        if (p != NULL && addr + len > p->start) {
+            keprint(PRINT_ERR "do_mem_space_map_file: this FIXED space had existed!\n");
+            return -1;
+        }
     } else {
-        page_map_addr_safe(addr, len, prot); 
+        addr = mem_space_get_unmaped(vmm, len);
+        if (addr == -1) {
+            keprint(PRINT_ERR "do_mem_space_map_file: get unmaped space failed!\n");
+            return -1;
+        }
+        vaddr += addr;  /* 非固定映射时，vaddr是相对空间开始的偏移 */
+    }
+    mem_space_t *space = mem_space_alloc();
+    if (!space) {
+        keprint(PRINT_ERR "do_mem_space_map_file: mem_alloc for space failed!\n");
+        return -1;    
     }
+    mem_space_init(space, addr, addr + len, prot, flags);
+    if (mem_space_set_file(space, file, vaddr, offset, size) < 0) {
+        mem_space_free(space);
+        return -1;
+    }
+    mem_space_insert(vmm, space);
     return addr;
 }
 
@@ -211,6 +619,7 @@ int do_mem_space_unmap(vmm_t *vmm, unsigned long addr, unsigned long len)
         // noteprint("unmap: addr out of range: addr%x -> [%x-%x]\n", addr, space->start, space->end);
         return 0;
     }
+    mem_space_sync(space, addr, addr + len);
     page_unmap_addr_safe(addr, len, space->flags & MEM_SPACE_MAP_SHARED);
 
     mem_space_t* space_new = mem_space_alloc();
@@ -218,11 +627,17 @@ int do_mem_space_unmap(vmm_t *vmm, unsigned long addr, unsigned long len)
         keprint(PRINT_ERR "do_mem_space_unmap: mem_alloc for space_new failed!\n");
         return -1;
     }
+    *space_new = *space;
+    if (space->file >= 0 && fsif.incref(space->file) < 0) {
+        space_new->file = -1;
+        space_new->pcache = NULL;
+    }
+    if (space_new->pcache)
+        page_cache_hold(space_new->pcache);
     space_new->start = addr + len;
     space_new->end = space->end;
     space->end = addr;
-    space_new->next = space->next;
-    space->next = space_new;
+    mem_space_link(vmm, space_new, space);
     if (space->start == space->end) {
         mem_space_remove(vmm, space, prev);
         space = prev;
@@ -245,6 +660,14 @@ void *mem_space_mmap_viraddr(uint32_t addr, uint32_t vaddr, uint32_t len, uint32
     return (void *)do_mem_space_map_viraddr(current->vmm, addr, vaddr, len, prot, flags);
 }
 
+void *mem_space_mmap_file(uint32_t addr, uint32_t len, uint32_t prot, uint32_t flags,
+    int file, uint32_t vaddr, uint32_t offset, uint32_t size)
+{
+    task_t *current = task_current;
+    return (void *)do_mem_space_map_file(current->vmm, addr, len, prot, flags,
+        file, vaddr, offset, size);
+}
+
 int mem_space_unmmap(uint32_t addr, uint32_t len)
 {
     task_t *current = task_current;
@@ -0,0 +1,363 @@
+#include <xbook/pagecache.h>
+#include <xbook/memspace.h>
+#include <xbook/memalloc.h>
+#include <xbook/mutexlock.h>
+#include <xbook/debug.h>
+#include <xbook/fsal.h>
+#include <xbook/reclaim.h>
+#include <arch/page.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <math.h>
+
+#define PAGE_CACHE_HASH_NR      64      /* 文件的哈希桶数量，必须是2的幂 */
+#define CACHE_PAGE_HASH_NR      512     /* 页的哈希桶数量，必须是2的幂 */
+
+/* 文件以(设备，索引节点)为键，页以(缓存，页序号)为键 */
+static list_t page_cache_hash_table[PAGE_CACHE_HASH_NR];
+static list_t cache_page_hash_table[CACHE_PAGE_HASH_NR];
+static LIST_HEAD(page_cache_idle_list);
+static int page_cache_idle_nr;
+
+/* 读取文件时不持有这个锁，分配内存时也不持有，避免回收内存时重入 */
+DEFINE_MUTEX_LOCK(page_cache_mutex);
+
+#define PAGE_CACHE_HASH(dev, ino) \
+        (((ino) ^ ((ino) >> 6) ^ ((dev) << 4)) & (PAGE_CACHE_HASH_NR - 1))
+
+#define CACHE_PAGE_HASH(cache, index) \
+        ((((unsigned long) (cache) >> 5) + (index)) & (CACHE_PAGE_HASH_NR - 1))
+
+static page_cache_t *page_cache_lookup(dev_t dev, ino_t ino)
+{
+    page_cache_t *cache;
+    list_for_each_owner (cache, &page_cache_hash_table[PAGE_CACHE_HASH(dev, ino)], list) {
+        if (cache->dev == dev && cache->ino == ino)
+            return cache;
+    }
+    return NULL;
+}
+
+static cache_page_t *cache_page_lookup(page_cache_t *cache, unsigned long index)
+{
+    cache_page_t *cpage;
+    list_for_each_owner (cpage, &cache_page_hash_table[CACHE_PAGE_HASH(cache, index)], hash_list) {
+        if (cpage->cache == cache && cpage->index == index)
+            return cpage;
+    }
+    return NULL;
+}
+
+/* 从缓存中删除一页，映射了这一页的进程仍然持有自己的引用 */
+static void cache_page_drop(cache_page_t *cpage)
+{
+    list_del(&cpage->list);
+    list_del(&cpage->hash_list);
+    cpage->cache->pages--;
+    page_free(cpage->paddr);
+    mem_free(cpage);
+}
+
+/* 丢弃缓存的所有页，返回真正释放的页数，还被进程映射的页只是减少引用 */
+static int page_cache_drop_pages(page_cache_t *cache)
+{
+    cache_page_t *cpage, *next;
+    int freed = 0;
+    list_for_each_owner_safe (cpage, next, &cache->page_list, list) {
+        if (page_ref_count(cpage->paddr) <= 1)
+            freed++;
+        cache_page_drop(cpage);
+    }
+    return freed;
+}
+
+/* 释放没有引用的缓存，需要持有锁，返回真正释放的页数 */
+static int page_cache_destroy(page_cache_t *cache)
+{
+    int freed = page_cache_drop_pages(cache);
+    list_del(&cache->list);
+    if (!list_empty(&cache->idle_list)) {
+        list_del(&cache->idle_list);
+        page_cache_idle_nr--;
+    }
+    mem_free(cache);
+    return freed;
+}
+
+/* 文件被删除或者截断后，同样的索引节点可能分配给别的文件，缓存不能再被查找到 */
+static void page_cache_detach(page_cache_t *cache)
+{
+    list_del_init(&cache->list);
+    cache->detached = 1;
+    if (!cache->reference)
+        page_cache_destroy(cache);
+    else
+        page_cache_drop_pages(cache);
+}
+
+/**
+ * page_cache_get - 获取文件的页缓存，并增加引用
+ * @file: 内核文件表句柄
+ *
+ * 文件系统需要在fstat中提供不为0的索引节点号，不然返回NULL，由调用者直接读取文件
+ */
+page_cache_t *page_cache_get(int file)
+{
+    struct stat st;
+    if (!fsif.fstat || fsif.fstat(file, &st) < 0)
+        return NULL;
+    if (!S_ISREG(st.st_mode) || !st.st_ino)
+        return NULL;
+    page_cache_t *new_cache = mem_alloc(sizeof(page_cache_t));
+    if (!new_cache)
+        return NULL;
+    mutex_lock(&page_cache_mutex);
+    page_cache_t *cache = page_cache_lookup(st.st_dev, st.st_ino);
+    if (cache) {
+        if (!list_empty(&cache->idle_list)) {
+            list_del_init(&cache->idle_list);
+            page_cache_idle_nr--;
+        }
+        cache->reference++;
+        mutex_unlock(&page_cache_mutex);
+        mem_free(new_cache);
+        return cache;
+    }
+    cache = new_cache;
+    list_init(&cache->idle_list);
+    list_init(&cache->page_list);
+    cache->dev = st.st_dev;
+    cache->ino = st.st_ino;
+    cache->reference = 1;
+    cache->pages = 0;
+    cache->detached = 0;
+    list_add(&cache->list, &page_cache_hash_table[PAGE_CACHE_HASH(st.st_dev, st.st_ino)]);
+    mutex_unlock(&page_cache_mutex);
+    return cache;
+}
+
+void page_cache_hold(page_cache_t *cache)
+{
+    mutex_lock(&page_cache_mutex);
+    cache->reference++;
+    mutex_unlock(&page_cache_mutex);
+}
+
+/**
+ * page_cache_put - 减少页缓存的引用
+ *
+ * 没有引用的缓存保留在空闲链表上，再次执行同一个程序时不需要读取磁盘，
+ * 空闲的缓存太多时释放最早不用的。
+ */
+void page_cache_put(page_cache_t *cache)
+{
+    mutex_lock(&page_cache_mutex);
+    if (--cache->reference > 0) {
+        mutex_unlock(&page_cache_mutex);
+        return;
+    }
+    if (cache->detached) {
+        page_cache_destroy(cache);
+        mutex_unlock(&page_cache_mutex);
+        return;
+    }
+    list_add(&cache->idle_list, &page_cache_idle_list);
+    page_cache_idle_nr++;
+    if (page_cache_idle_nr > PAGE_CACHE_IDLE_MAX)
+        page_cache_destroy(list_last_owner(&page_cache_idle_list, page_cache_t, idle_list));
+    mutex_unlock(&page_cache_mutex);
+}
+
+/**
+ * page_cache_find_page - 获取文件中的一页
+ * @file: 读取数据使用的内核文件表句柄
+ * @index: 页在文件中的序号
+ *
+ * 页不在缓存中时从文件读取，文件末尾之后的部分填0。
+ * 返回的物理页已经为调用者增加了一个引用，失败返回0。
+ */
+unsigned long page_cache_find_page(page_cache_t *cache, int file, unsigned long index)
+{
+    cache_page_t *cpage, *other;
+    unsigned long paddr;
+    mutex_lock(&page_cache_mutex);
+    cpage = cache_page_lookup(cache, index);
+    if (cpage) {
+        paddr = cpage->paddr;
+        page_ref(paddr);
+        mutex_unlock(&page_cache_mutex);
+        return paddr;
+    }
+    mutex_unlock(&page_cache_mutex);
+
+    cpage = mem_alloc(sizeof(cache_page_t));
+    if (!cpage)
+        return 0;
+    /* 缓存的页在内核中有线性映射，填充和回写时可以直接访问 */
+    paddr = page_alloc_normal(1);
+    if (!paddr) {
+        mem_free(cpage);
+        return 0;
+    }
+    unsigned char *buf = kern_phy_addr2vir_addr(paddr);
+    int count = mem_space_read_file(file, index * PAGE_SIZE, buf, PAGE_SIZE);
+    if (count < 0) {
+        page_free(paddr);
+        mem_free(cpage);
+        return 0;
+    }
+    memset(buf + count, 0, PAGE_SIZE - count);
+
+    mutex_lock(&page_cache_mutex);
+    other = cache_page_lookup(cache, index);
+    if (other) {    /* 读取文件期间其它进程已经填充了这一页 */
+        page_free(paddr);
+        paddr = other->paddr;
+        page_ref(paddr);
+        mutex_unlock(&page_cache_mutex);
+        mem_free(cpage);
+        return paddr;
+    }
+    cpage->cache = cache;
+    cpage->index = index;
+    cpage->paddr = paddr;
+    list_add_tail(&cpage->list, &cache->page_list);
+    list_add(&cpage->hash_list, &cache_page_hash_table[CACHE_PAGE_HASH(cache, index)]);
+    cache->pages++;
+    page_ref(paddr);
+    mutex_unlock(&page_cache_mutex);
+    return paddr;
+}
+
+/**
+ * page_cache_update - 文件系统写入文件后更新缓存中的页
+ * @offset: 写入的位置
+ * @buf: 写入的数据，可以是用户缓冲区
+ *
+ * 缓存和文件始终一致，映射的进程能看到write写入的数据。
+ * 复制数据时不持有锁，用户缓冲区缺页时不会死锁。
+ */
+void page_cache_update(dev_t dev, ino_t ino, off_t offset, void *buf, size_t len)
+{
+    page_cache_t *cache;
+    cache_page_t *cpage;
+    unsigned long paddr, pgoff, chunk;
+    unsigned long end = offset + len;
+    unsigned char *src = buf;
+    if (!ino)
+        return;
+    while (offset < end) {
+        pgoff = offset & ~PAGE_MASK;
+        chunk = min(PAGE_SIZE - pgoff, end - offset);
+        paddr = 0;
+        mutex_lock(&page_cache_mutex);
+        cache = page_cache_lookup(dev, ino);
+        if (!cache || !cache->pages) {
+            mutex_unlock(&page_cache_mutex);
+            return;
+        }
+        cpage = cache_page_lookup(cache, offset >> PAGE_SHIFT);
+        if (cpage) {
+            paddr = cpage->paddr;
+            page_ref(paddr);
+        }
+        mutex_unlock(&page_cache_mutex);
+        if (paddr) {
+            unsigned char *dst = (unsigned char *) kern_phy_addr2vir_addr(paddr) + pgoff;
+            if (dst != src)
+                memcpy(dst, src, chunk);
+            page_free(paddr);
+        }
+        offset += chunk;
+        src += chunk;
+    }
+}
+
+/**
+ * page_cache_invalidate - 文件被截断或者删除时丢弃缓存的页
+ * @detach: 文件的索引节点不再有效，缓存从哈希表中移除
+ *
+ * 已经映射的进程保留原来的页，之后缺页时才从文件读取。
+ */
+void page_cache_invalidate(dev_t dev, ino_t ino, int detach)
+{
+    page_cache_t *cache;
+    if (!ino)
+        return;
+    mutex_lock(&page_cache_mutex);
+    cache = page_cache_lookup(dev, ino);
+    if (cache) {
+        if (detach)
+            page_cache_detach(cache);
+        else
+            page_cache_drop_pages(cache);
+    }
+    mutex_unlock(&page_cache_mutex);
+}
+
+/* 卸载文件系统时丢弃设备上所有文件的缓存 */
+void page_cache_invalidate_dev(dev_t dev)
+{
+    page_cache_t *cache, *next;
+    int i;
+    mutex_lock(&page_cache_mutex);
+    for (i = 0; i < PAGE_CACHE_HASH_NR; i++) {
+        list_for_each_owner_safe (cache, next, &page_cache_hash_table[i], list) {
+            if (cache->dev == dev)
+                page_cache_detach(cache);
+        }
+    }
+    mutex_unlock(&page_cache_mutex);
+}
+
+/**
+ * page_cache_shrink - 内存不足时回收页缓存
+ * @count: 最多回收的页数
+ * @flags: 没有MEM_RECLAIM_BLOCK时拿不到锁就返回
+ *
+ * 先从最早不用的开始释放空闲的缓存，再释放只被缓存引用、没有进程映射的页，
+ * 每个文件的页按缓存的先后顺序释放，返回释放的页数
+ */
+int page_cache_shrink(int count, int flags)
+{
+    page_cache_t *cache;
+    cache_page_t *cpage, *next;
+    int i, freed = 0;
+    if (flags & MEM_RECLAIM_BLOCK)
+        mutex_lock(&page_cache_mutex);
+    else if (mutex_try_lock(&page_cache_mutex))
+        return 0;
+    while (freed < count && !list_empty(&page_cache_idle_list)) {
+        cache = list_last_owner(&page_cache_idle_list, page_cache_t, idle_list);
+        freed += page_cache_destroy(cache);
+    }
+    for (i = 0; i < PAGE_CACHE_HASH_NR && freed < count; i++) {
+        list_for_each_owner (cache, &page_cache_hash_table[i], list) {
+            list_for_each_owner_safe (cpage, next, &cache->page_list, list) {
+                if (freed >= count)
+                    break;
+                if (page_ref_count(cpage->paddr) <= 1) {
+                    cache_page_drop(cpage);
+                    freed++;
+                }
+            }
+        }
+    }
+    mutex_unlock(&page_cache_mutex);
+    return freed;
+}
+
+static mem_shrinker_t page_cache_shrinker = {
+    .name = "page cache",
+    .shrink = page_cache_shrink,
+};
+
+void page_cache_init(void)
+{
+    int i;
+    for (i = 0; i < PAGE_CACHE_HASH_NR; i++)
+        list_init(&page_cache_hash_table[i]);
+    for (i = 0; i < CACHE_PAGE_HASH_NR; i++)
+        list_init(&cache_page_hash_table[i]);
+    mem_shrinker_register(&page_cache_shrinker);
+}
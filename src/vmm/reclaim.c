@@ -0,0 +1,95 @@
+#include <xbook/reclaim.h>
+#include <xbook/waitqueue.h>
+#include <xbook/schedule.h>
+#include <xbook/task.h>
+#include <xbook/clock.h>
+#include <xbook/debug.h>
+#include <arch/interrupt.h>
+#include <arch/phymem.h>
+#include <math.h>
+
+/* 缓存已经没有可以回收的内存时，回收线程过一段时间再检查 */
+#define MEM_RECLAIM_BACKOFF     (HZ / 2)
+
+static LIST_HEAD(mem_shrinker_list);
+static wait_queue_t mem_reclaim_wait = WAIT_QUEUE_INIT(mem_reclaim_wait);
+static volatile int mem_reclaim_pending = 0;
+
+void mem_shrinker_register(mem_shrinker_t *shrinker)
+{
+    unsigned long flags;
+    interrupt_save_and_disable(flags);
+    list_add_tail(&shrinker->list, &mem_shrinker_list);
+    interrupt_restore_state(flags);
+}
+
+/**
+ * mem_reclaim - 从注册的缓存中回收内存
+ * @count: 需要回收的页数
+ * @flags: 回收标志
+ *
+ * 按注册的顺序依次回收，回收够了就停止，返回释放的页数
+ */
+int mem_reclaim(int count, int flags)
+{
+    mem_shrinker_t *shrinker;
+    int freed = 0;
+    list_for_each_owner (shrinker, &mem_shrinker_list, list) {
+        freed += shrinker->shrink(count - freed, flags);
+        if (freed >= count)
+            break;
+    }
+    return freed;
+}
+
+/**
+ * mem_reclaim_direct - 分配失败时直接回收
+ *
+ * 分配物理页的地方可能关了中断或者持有缓存的锁，所以不等待锁。
+ */
+int mem_reclaim_direct(int count)
+{
+    return mem_reclaim(max(count, MEM_RECLAIM_BATCH), 0);
+}
+
+/**
+ * mem_reclaim_wakeup - 空闲页低于低水位时唤醒回收线程
+ *
+ * 只设置标志和唤醒等待队列，可以在任何地方调用
+ */
+void mem_reclaim_wakeup(void)
+{
+    mem_reclaim_pending = 1;
+    wait_queue_wakeup(&mem_reclaim_wait);
+}
+
+/* 回收线程，把空闲页回收到高水位以上 */
+static void mem_reclaim_thread(void *arg)
+{
+    unsigned long flags;
+    unsigned long count;
+    while (1) {
+        /* 关中断检查标志后再阻塞，不会错过唤醒 */
+        interrupt_save_and_disable(flags);
+        if (!mem_reclaim_pending)
+            wait_queue_sleepon(&mem_reclaim_wait);
+        mem_reclaim_pending = 0;
+        interrupt_restore_state(flags);
+
+        while ((count = mem_get_reclaim_page_nr()) > 0) {
+            if (mem_reclaim(count, MEM_RECLAIM_BLOCK) <= 0) {
+                task_sleep_by_ticks(MEM_RECLAIM_BACKOFF);
+                break;
+            }
+        }
+    }
+}
+
+int mem_reclaim_init(void)
+{
+    if (!task_create("kreclaim", TASK_PRIO_LEVEL_NORMAL, mem_reclaim_thread, NULL)) {
+        keprint(PRINT_ERR "[reclaim]: create reclaim thread failed!\n");
+        return -1;
+    }
+    return 0;
+}
@@ -159,7 +159,7 @@ int vir_mem_free(void *ptr)
 	return -1;
 }
 
-void *memio_remap(unsigned long paddr, size_t size)
+static void *memio_do_remap(unsigned long paddr, size_t size, int wc)
 {
     if (!paddr || !size) {
         return NULL;
@@ -180,7 +180,8 @@ void *memio_remap(unsigned long paddr, size_t size)
     unsigned long flags;
     interrupt_save_and_disable(flags);
 	list_add_tail(&area->list, &using_vir_mem_list);
-    if (hal_memio_remap(paddr, vaddr, size)) {
+    int err = wc ? hal_memio_remap_wc(paddr, vaddr, size) : hal_memio_remap(paddr, vaddr, size);
+    if (err) {
         list_del(&area->list);
         mem_free(area);
         vir_addr_free(vaddr, size);
@@ -190,6 +191,17 @@ void *memio_remap(unsigned long paddr, size_t size)
     return (void *)vaddr;    
 }
 
+void *memio_remap(unsigned long paddr, size_t size)
+{
+    return memio_do_remap(paddr, size, 0);
+}
+
+/* map frame buffer with write combining */
+void *memio_remap_wc(unsigned long paddr, size_t size)
+{
+    return memio_do_remap(paddr, size, 1);
+}
+
 int memio_unmap(void *vaddr)
 {
     if (vaddr == NULL) {
@@ -3,9 +3,12 @@
 #include <xbook/vmm.h>
 #include <xbook/debug.h>
 #include <xbook/memspace.h>
+#include <xbook/pagecache.h>
+#include <xbook/memcache.h>
 #include <xbook/sharemem.h>
 #include <xbook/safety.h>
 #include <xbook/process.h>
+#include <xbook/fsal.h>
 #include <string.h>
 #include <errno.h>
 
@@ -16,6 +19,7 @@ void vmm_init(vmm_t *vmm)
         panic(PRINT_EMERG "task_init_vmm: mem_alloc for page_storege failed!\n");
     }
     vmm->mem_space_head = NULL;
+    vmm->mem_space_root = NULL;
     vmm->argv = NULL;
     vmm->envp = NULL;
     vmm->argbuf = NULL;
@@ -33,16 +37,20 @@ void vmm_free(vmm_t *vmm)
     }
 }
 
-int sys_mstate(mstate_t *ms)
+int sys_mstate(mstate_t *ms, int flags)
 {
     if (!ms)
         return -EINVAL;
+    if (flags & MSTATE_CACHES)
+        mem_caches_dump();
     mstate_t tms;
     tms.ms_total = mem_get_total_page_nr() * PAGE_SIZE;
     tms.ms_free = mem_get_free_page_nr() * PAGE_SIZE;
     tms.ms_used = tms.ms_total - tms.ms_free;
     if (tms.ms_used < 0)
         tms.ms_used = 0;
+    tms.ms_frag = mem_get_fragment(&tms.ms_largest);
+    tms.ms_largest *= PAGE_SIZE;
     if (mem_copy_to_user(ms, &tms, sizeof(mstate_t)) < 0) {
         return -EFAULT;
     }
@@ -98,15 +106,18 @@ int vmm_copy_mem_space(vmm_t *child_vmm, vmm_t *parent_vmm)
             return -1;
         }
         *space = *p;
-        space->next = NULL;
+        if (space->file >= 0 && fsif.incref(space->file) < 0) {
+            keprint(PRINT_ERR "copy_vm_mem_space: inc file reference failed!\n");
+            mem_free(space);
+            return -1;
+        }
+        if (space->pcache)
+            page_cache_hold(space->pcache);
         if (space->flags & MEM_SPACE_MAP_SHARED) {
             if (vmm_inc_share_mem(space) < 0)
                 return -1;
         }
-        if (tail == NULL)
-            child_vmm->mem_space_head = space;    
-        else 
-            tail->next = space;
+        mem_space_link(child_vmm, space, tail);
         tail = space;
         p = p->next;
     }
@@ -130,6 +141,7 @@ int vmm_release_space(vmm_t *vmm)
     }
     vmm_debuild_argbuf(vmm);
     vmm->mem_space_head = NULL;
+    vmm->mem_space_root = NULL;
     vmm->code_start = 0;
     vmm->code_end = 0;
     vmm->data_start = 0;
@@ -157,6 +169,7 @@ int vmm_unmap_space(vmm_t *vmm)
             /* FIXME: 在物理机上面执行地址取消映射就会崩溃 */
             // page_unmap_addr(space->start, space->end - space->start, 0);
         } else {
+            mem_space_sync(space, space->start, space->end);
             page_unmap_addr_safe(space->start, space->end - space->start, space->flags & MEM_SPACE_MAP_SHARED);
         }
         space = space->next;